@@ -29,7 +29,9 @@
 
 #include <algorithm>
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 
 #include "analogsnapshot.h"
 
@@ -44,12 +46,15 @@ const int AnalogSnapshot::EnvelopeScaleFactor = 1 << EnvelopeScalePower;
 const float AnalogSnapshot::LogEnvelopeScaleFactor =
 	logf(EnvelopeScaleFactor);
 const uint64_t AnalogSnapshot::EnvelopeDataUnit = 64*1024;	// bytes
+const uint64_t AnalogSnapshot::ParallelEnvelopeSamples = 1024*1024;
 
 AnalogSnapshot::AnalogSnapshot() :
     Snapshot(sizeof(uint16_t), 1, 1)
 {
 	memset(_envelope_levels, 0, sizeof(_envelope_levels));
     _unit_pitch = 0;
+    _transfer_pos = 0;
+    _transfer_synced = false;
 }
 
 AnalogSnapshot::~AnalogSnapshot()
@@ -75,6 +80,10 @@ void AnalogSnapshot::init()
     _ring_sample_count = 0;
     _memory_failed = false;
     _last_ended = true;
+    publish();
+    // transfer regions restart at the head of the ring
+    _transfer_pos = 0;
+    _transfer_synced = _transfer_bufs.empty();
     for (unsigned int i = 0; i < _channel_num; i++) {
         for (unsigned int level = 0; level < ScaleStepCount; level++) {
             _envelope_levels[i][level].length = 0;
@@ -94,10 +103,11 @@ void AnalogSnapshot::clear()
     init();
 }
 
-void AnalogSnapshot::first_payload(const sr_datafeed_analog &analog, uint64_t total_sample_count, GSList *channels)
+bool AnalogSnapshot::init_storage(uint64_t total_sample_count, GSList *channels, int unit_bits)
 {
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
     _total_sample_count = total_sample_count;
-    _unit_bytes = (analog.unit_bits + 7) / 8;
+    _unit_bytes = (unit_bits + 7) / 8;
     assert(_unit_bytes > 0);
     assert(_unit_bytes <= sizeof(uint64_t));
     _channel_num = 0;
@@ -116,6 +126,8 @@ void AnalogSnapshot::first_payload(const sr_datafeed_analog &analog, uint64_t to
     bool isOk = true;
     uint64_t size = _total_sample_count * _channel_num * _unit_bytes + sizeof(uint64_t);
     if (size != _capacity) {
+        // regions handed to the driver must not move under it
+        assert(_transfer_bufs.empty());
         free_data();
         _data = malloc(size);
         if (_data) {
@@ -144,6 +156,18 @@ void AnalogSnapshot::first_payload(const sr_datafeed_analog &analog, uint64_t to
     }
 
     if (isOk) {
+        _capacity = size;
+    } else {
+        free_data();
+        free_envelop();
+        _memory_failed = true;
+    }
+    return isOk;
+}
+
+void AnalogSnapshot::first_payload(const sr_datafeed_analog &analog, uint64_t total_sample_count, GSList *channels)
+{
+    if (init_storage(total_sample_count, channels, analog.unit_bits)) {
         for (const GSList *l = channels; l; l = l->next) {
             sr_channel *const probe = (sr_channel*)l->data;
             assert(probe);
@@ -153,14 +177,9 @@ void AnalogSnapshot::first_payload(const sr_datafeed_analog &analog, uint64_t to
                 _ch_index.push_back(probe->index);
             }
         }
-        _capacity = size;
         _memory_failed = false;
         append_payload(analog);
         _last_ended = false;
-    } else {
-        free_data();
-        free_envelop();
-        _memory_failed = true;
     }
 }
 
@@ -173,26 +192,38 @@ void AnalogSnapshot::append_payload(
 	// Generate the first mip-map from the data
     if (analog.num_samples != 0) // guarantee new samples to compute
         append_payload_to_envelope_levels();
+
+    publish();
 }
 
 void AnalogSnapshot::append_data(void *data, uint64_t samples, uint16_t pitch)
 {
     int bytes_per_sample = _unit_bytes * _channel_num;
+    uint8_t *const dest = (uint8_t*)_data + _ring_sample_count * bytes_per_sample;
+    // payload delivered in a region of our own ring, see alloc_transfer_buffer()
+    const bool in_ring = _data && (uint8_t*)data >= (uint8_t*)_data &&
+                         (uint8_t*)data < (uint8_t*)_data + _capacity;
+    if (in_ring && (data != dest || pitch > 1))
+        _transfer_synced = false;
+
     if (pitch <= 1) {
         if (_sample_count + samples < _total_sample_count)
             _sample_count += samples;
         else
             _sample_count = _total_sample_count;
 
-        if (_ring_sample_count + samples >= _total_sample_count) {
-            memcpy((uint8_t*)_data + _ring_sample_count * bytes_per_sample,
+        if (data == dest && _ring_sample_count + samples <= _total_sample_count) {
+            // already in place, only move the write position
+            _ring_sample_count = (_ring_sample_count + samples) % _total_sample_count;
+        } else if (_ring_sample_count + samples >= _total_sample_count) {
+            memmove(dest,
                 data, (_total_sample_count - _ring_sample_count) * bytes_per_sample);
             data = (uint8_t*)data + (_total_sample_count - _ring_sample_count) * bytes_per_sample;
             _ring_sample_count = (samples + _ring_sample_count - _total_sample_count) % _total_sample_count;
-            memcpy((uint8_t*)_data,
+            memmove((uint8_t*)_data,
                 data, _ring_sample_count * bytes_per_sample);
         } else {
-            memcpy((uint8_t*)_data + _ring_sample_count * bytes_per_sample,
+            memmove(dest,
                 data, samples * bytes_per_sample);
             _ring_sample_count += samples;
         }
@@ -201,7 +232,7 @@ void AnalogSnapshot::append_data(void *data, uint64_t samples, uint16_t pitch)
             if (_unit_pitch == 0) {
                 if (_sample_count < _total_sample_count)
                     _sample_count++;
-                memcpy((uint8_t*)_data + _ring_sample_count * bytes_per_sample,
+                memmove((uint8_t*)_data + _ring_sample_count * bytes_per_sample,
                     data, bytes_per_sample);
                 data = (uint8_t*)data + bytes_per_sample*pitch;
                 _ring_sample_count = (_ring_sample_count + 1) % _total_sample_count;
@@ -259,97 +290,124 @@ void AnalogSnapshot::reallocate_envelope(Envelope &e)
 
 void AnalogSnapshot::append_payload_to_envelope_levels()
 {
-    int i;
-    for (i = 0; i < (int)_channel_num; i++) {
-        Envelope &e0 = _envelope_levels[i][0];
-        uint64_t prev_length;
-        EnvelopeSample *dest_ptr;
+    // channels have envelopes of their own, large payloads (a file
+    // being loaded) have them built side by side
+    const uint64_t new_samples = (_total_sample_count == 0) ? 0 :
+        (_ring_sample_count + _total_sample_count -
+         _envelope_levels[0][0].ring_length * EnvelopeScaleFactor) % _total_sample_count;
+    if (_channel_num > 1 && new_samples >= ParallelEnvelopeSamples) {
+        boost::thread_group pool;
+        for (unsigned int i = 1; i < _channel_num; i++)
+            pool.create_thread(boost::bind(&AnalogSnapshot::append_envelope_levels, this, i));
+        append_envelope_levels(0);
+        pool.join_all();
+    } else {
+        for (unsigned int i = 0; i < _channel_num; i++)
+            append_envelope_levels(i);
+    }
+}
 
-        // Expand the data buffer to fit the new samples
-        e0.length = _sample_count / EnvelopeScaleFactor;
-        prev_length = e0.ring_length;
-        e0.ring_length = _ring_sample_count / EnvelopeScaleFactor;
-
-//        // Break off if there are no new samples to compute
-//    	if (e0.ring_length == prev_length)
-//            continue;
-        if (e0.length == 0)
-            continue;
-
-        //reallocate_envelope(e0);
-
-        dest_ptr = e0.samples + prev_length;
-
-        // Iterate through the samples to populate the first level mipmap
-        const uint64_t src_size = _total_sample_count * _unit_bytes * _channel_num;
-        uint64_t e0_sample_num = (e0.ring_length > prev_length) ? e0.ring_length - prev_length :
-                                                                  e0.ring_length + (_total_sample_count / EnvelopeScaleFactor) - prev_length;
-        uint8_t *src_ptr = (uint8_t*)_data +
-                    (prev_length * EnvelopeScaleFactor * _channel_num + i) * _unit_bytes;
-        for (uint64_t j = 0; j < e0_sample_num; j++) {
-            const uint8_t *end_src_ptr =
-                src_ptr + EnvelopeScaleFactor * _unit_bytes * _channel_num;
-            if (end_src_ptr >= (uint8_t*)_data + src_size)
-                end_src_ptr -= src_size;
-            EnvelopeSample sub_sample;
-            sub_sample.min = *src_ptr;
-            sub_sample.max = *src_ptr;
-            src_ptr += _channel_num * _unit_bytes;
+void AnalogSnapshot::append_envelope_levels(unsigned int i)
+{
+    Envelope &e0 = _envelope_levels[i][0];
+    uint64_t prev_length;
+    EnvelopeSample *dest_ptr;
+
+    // Expand the data buffer to fit the new samples
+    e0.length = _sample_count / EnvelopeScaleFactor;
+    prev_length = e0.ring_length;
+    e0.ring_length = _ring_sample_count / EnvelopeScaleFactor;
+
+//    // Break off if there are no new samples to compute
+//    if (e0.ring_length == prev_length)
+//        return;
+    if (e0.length == 0)
+        return;
+
+    //reallocate_envelope(e0);
+
+    dest_ptr = e0.samples + prev_length;
+
+    // Iterate through the samples to populate the first level mipmap
+    const uint64_t src_size = _total_sample_count * _unit_bytes * _channel_num;
+    uint64_t e0_sample_num = (e0.ring_length > prev_length) ? e0.ring_length - prev_length :
+                                                              e0.ring_length + (_total_sample_count / EnvelopeScaleFactor) - prev_length;
+    const uint64_t stride = _channel_num * _unit_bytes;
+    uint8_t *src_ptr = (uint8_t*)_data +
+                (prev_length * EnvelopeScaleFactor * _channel_num + i) * _unit_bytes;
+    for (uint64_t j = 0; j < e0_sample_num; j++) {
+        EnvelopeSample sub_sample;
+        sub_sample.min = *src_ptr;
+        sub_sample.max = *src_ptr;
+        if (src_ptr + EnvelopeScaleFactor * stride <= (uint8_t*)_data + src_size) {
+            // the whole window is before the end of the ring
+            for (int k = 1; k < EnvelopeScaleFactor; k++) {
+                sub_sample.min = min(sub_sample.min, src_ptr[k * stride]);
+                sub_sample.max = max(sub_sample.max, src_ptr[k * stride]);
+            }
+            src_ptr += EnvelopeScaleFactor * stride;
+            if (src_ptr >= (uint8_t*)_data + src_size)
+                src_ptr -= src_size;
+        } else {
+            const uint8_t *end_src_ptr = src_ptr + EnvelopeScaleFactor * stride - src_size;
+            src_ptr += stride;
+            if (src_ptr >= (uint8_t*)_data + src_size)
+                src_ptr -= src_size;
             while(src_ptr != end_src_ptr) {
                 sub_sample.min = min(sub_sample.min, *src_ptr);
                 sub_sample.max = max(sub_sample.max, *src_ptr);
-                src_ptr += _channel_num * _unit_bytes;
+                src_ptr += stride;
                 if (src_ptr >= (uint8_t*)_data + src_size)
                     src_ptr -= src_size;
             }
-
-            *dest_ptr++ = sub_sample;
-            if (dest_ptr >= e0.samples + e0.count)
-                dest_ptr = e0.samples;
         }
 
-        // Compute higher level mipmaps
-        for (unsigned int level = 1; level < ScaleStepCount; level++)
-        {
-            Envelope &e = _envelope_levels[i][level];
-            const Envelope &el = _envelope_levels[i][level-1];
-
-            // Expand the data buffer to fit the new samples
-            e.length = el.length / EnvelopeScaleFactor;
-            prev_length = e.ring_length;
-            e.ring_length = el.ring_length / EnvelopeScaleFactor;
-
-            // Break off if there are no more samples to computed
-            if (e.ring_length == prev_length)
-                break;
-
-            //reallocate_envelope(e);
-
-            // Subsample the level lower level
-            const EnvelopeSample *src_ptr =
-                el.samples + prev_length * EnvelopeScaleFactor;
-            const EnvelopeSample *const end_dest_ptr = (e.ring_length == e.count) ? e.samples : e.samples + e.ring_length;
-            dest_ptr = (prev_length == e.count) ? e.samples : e.samples + prev_length;
-            while(dest_ptr != end_dest_ptr) {
-                const EnvelopeSample * end_src_ptr =
-                    src_ptr + EnvelopeScaleFactor;
-                if (end_src_ptr >= el.samples + el.count)
-                    end_src_ptr -= el.count;
-
-                EnvelopeSample sub_sample = *src_ptr++;
-                while (src_ptr != end_src_ptr)
-                {
-                    sub_sample.min = min(sub_sample.min, src_ptr->min);
-                    sub_sample.max = max(sub_sample.max, src_ptr->max);
-                    src_ptr++;
-                    if (src_ptr >= el.samples + el.count)
-                        src_ptr = el.samples;
-                }
+        *dest_ptr++ = sub_sample;
+        if (dest_ptr >= e0.samples + e0.count)
+            dest_ptr = e0.samples;
+    }
 
-                *dest_ptr++ = sub_sample;
-                if (dest_ptr >= e.samples + e.count)
-                    dest_ptr = e.samples;
+    // Compute higher level mipmaps
+    for (unsigned int level = 1; level < ScaleStepCount; level++)
+    {
+        Envelope &e = _envelope_levels[i][level];
+        const Envelope &el = _envelope_levels[i][level-1];
+
+        // Expand the data buffer to fit the new samples
+        e.length = el.length / EnvelopeScaleFactor;
+        prev_length = e.ring_length;
+        e.ring_length = el.ring_length / EnvelopeScaleFactor;
+
+        // Break off if there are no more samples to computed
+        if (e.ring_length == prev_length)
+            break;
+
+        //reallocate_envelope(e);
+
+        // Subsample the level lower level
+        const EnvelopeSample *src_ptr =
+            el.samples + prev_length * EnvelopeScaleFactor;
+        const EnvelopeSample *const end_dest_ptr = (e.ring_length == e.count) ? e.samples : e.samples + e.ring_length;
+        dest_ptr = (prev_length == e.count) ? e.samples : e.samples + prev_length;
+        while(dest_ptr != end_dest_ptr) {
+            const EnvelopeSample * end_src_ptr =
+                src_ptr + EnvelopeScaleFactor;
+            if (end_src_ptr >= el.samples + el.count)
+                end_src_ptr -= el.count;
+
+            EnvelopeSample sub_sample = *src_ptr++;
+            while (src_ptr != end_src_ptr)
+            {
+                sub_sample.min = min(sub_sample.min, src_ptr->min);
+                sub_sample.max = max(sub_sample.max, src_ptr->max);
+                src_ptr++;
+                if (src_ptr >= el.samples + el.count)
+                    src_ptr = el.samples;
             }
+
+            *dest_ptr++ = sub_sample;
+            if (dest_ptr >= e.samples + e.count)
+                dest_ptr = e.samples;
         }
     }
 }
@@ -405,5 +463,38 @@ uint64_t AnalogSnapshot::get_block_size(int block_index)
     }
 }
 
+void *AnalogSnapshot::alloc_transfer_buffer(size_t size)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    const uint64_t bytes_per_sample = _unit_bytes * _channel_num;
+    const uint64_t ring_bytes = _total_sample_count * bytes_per_sample;
+
+    // Regions are handed out back to back from the write position and only
+    // over the first lap of the ring, where no committed sample can be hit.
+    // Once a payload misses its place the driver is sent back to copies.
+    if (!_data || !_transfer_synced || bytes_per_sample == 0 ||
+        size % bytes_per_sample != 0 ||
+        _transfer_pos + size > ring_bytes) {
+        _transfer_synced = false;
+        return NULL;
+    }
+
+    uint8_t *const buf = (uint8_t*)_data + _transfer_pos;
+    _transfer_pos += size;
+    _transfer_bufs.push_back(buf);
+    return buf;
+}
+
+bool AnalogSnapshot::release_transfer_buffer(void *buf)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    std::deque<uint8_t *>::iterator i =
+        std::find(_transfer_bufs.begin(), _transfer_bufs.end(), (uint8_t*)buf);
+    if (i == _transfer_bufs.end())
+        return false;
+    _transfer_bufs.erase(i);
+    return true;
+}
+
 } // namespace data
 } // namespace pv
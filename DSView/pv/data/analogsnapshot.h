@@ -28,11 +28,14 @@
 
 #include "snapshot.h"
 
+#include <deque>
 #include <utility>
 #include <vector>
 
 namespace AnalogSnapshotTest {
 class Basic;
+class Interleaved;
+class Wrap;
 }
 
 namespace pv {
@@ -74,6 +77,7 @@ private:
 	static const int EnvelopeScaleFactor;
 	static const float LogEnvelopeScaleFactor;
 	static const uint64_t EnvelopeDataUnit;
+    static const uint64_t ParallelEnvelopeSamples;
 
     static const uint64_t LeafBlockPower = 21;
     static const uint64_t LeafBlockSamples = 1 << LeafBlockPower;
@@ -87,6 +91,9 @@ public:
     void clear();
     void init();
 
+    bool init_storage(uint64_t total_sample_count, GSList *channels,
+                      int unit_bits);
+
     void first_payload(const sr_datafeed_analog &analog,
                        uint64_t total_sample_count, GSList *channels);
 
@@ -105,17 +112,33 @@ public:
     int get_block_num();
     uint64_t get_block_size(int block_index);
 
+    /**
+     * Zero-copy ingest: hand out consecutive regions of the sample ring
+     * as USB transfer buffers, so payloads arrive already in place.
+     * Only the first lap of the ring is handed out; once a capture wraps
+     * around, alloc_transfer_buffer() declines and payloads are copied.
+     */
+    void *alloc_transfer_buffer(size_t size);
+    bool release_transfer_buffer(void *buf);
+
 private:
     void append_data(void *data, uint64_t samples, uint16_t pitch);
     void free_envelop();
 	void reallocate_envelope(Envelope &l);
 	void append_payload_to_envelope_levels();
+    void append_envelope_levels(unsigned int i);
 
 
 
 private:
     struct Envelope _envelope_levels[DS_MAX_ANALOG_PROBES_NUM][ScaleStepCount];
+
+    std::deque<uint8_t *> _transfer_bufs;
+    uint64_t _transfer_pos;
+    bool _transfer_synced;
 	friend class AnalogSnapshotTest::Basic;
+	friend class AnalogSnapshotTest::Interleaved;
+	friend class AnalogSnapshotTest::Wrap;
 };
 
 } // namespace data
@@ -0,0 +1,178 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#include "bitplanes.h"
+
+#include <assert.h>
+#include <string.h>
+
+// BITPLANES_NO_SIMD builds the portable code only, e.g. for the tests
+#ifndef BITPLANES_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BITPLANES_SSE2
+#include <emmintrin.h>
+#endif
+#else
+#undef BITPLANES_AVX2
+#endif
+
+namespace pv {
+namespace data {
+
+/*
+ * The planes of 8 channels, one 64 bit word each, are transposed in
+ * two steps: bytes first, so that each word has the same 8 samples of
+ * all 8 channels, then the bits of these 8x8 matrices.
+ */
+
+#ifdef BITPLANES_SSE2
+static inline __m128i transpose_bits(__m128i x)
+{
+    __m128i t;
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 7)),
+                      _mm_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 7));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 14)),
+                      _mm_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 14));
+    t = _mm_and_si128(_mm_xor_si128(x, _mm_srli_epi64(x, 28)),
+                      _mm_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm_xor_si128(_mm_xor_si128(x, t), _mm_slli_epi64(t, 28));
+    return x;
+}
+
+static inline void transpose_word(const uint64_t *w, uint8_t *dst)
+{
+    const __m128i x01 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&w[0]),
+                                          _mm_loadl_epi64((const __m128i *)&w[1]));
+    const __m128i x23 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&w[2]),
+                                          _mm_loadl_epi64((const __m128i *)&w[3]));
+    const __m128i x45 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&w[4]),
+                                          _mm_loadl_epi64((const __m128i *)&w[5]));
+    const __m128i x67 = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&w[6]),
+                                          _mm_loadl_epi64((const __m128i *)&w[7]));
+    const __m128i y0 = _mm_unpacklo_epi16(x01, x23);
+    const __m128i y1 = _mm_unpackhi_epi16(x01, x23);
+    const __m128i y2 = _mm_unpacklo_epi16(x45, x67);
+    const __m128i y3 = _mm_unpackhi_epi16(x45, x67);
+    _mm_storeu_si128((__m128i *)(dst + 0), transpose_bits(_mm_unpacklo_epi32(y0, y2)));
+    _mm_storeu_si128((__m128i *)(dst + 16), transpose_bits(_mm_unpackhi_epi32(y0, y2)));
+    _mm_storeu_si128((__m128i *)(dst + 32), transpose_bits(_mm_unpacklo_epi32(y1, y3)));
+    _mm_storeu_si128((__m128i *)(dst + 48), transpose_bits(_mm_unpackhi_epi32(y1, y3)));
+}
+#else
+static inline uint64_t transpose_bits(uint64_t x)
+{
+    uint64_t t;
+    t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+    x = x ^ t ^ (t << 7);
+    t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+    x = x ^ t ^ (t << 14);
+    t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+    x = x ^ t ^ (t << 28);
+    return x;
+}
+
+static inline void transpose_word(const uint64_t *w, uint8_t *dst)
+{
+    for (int b = 0; b < 8; b++) {
+        uint64_t m = 0;
+        for (int c = 0; c < 8; c++)
+            m |= ((w[c] >> (8 * b)) & 0xff) << (8 * c);
+        m = transpose_bits(m);
+        for (int s = 0; s < 8; s++)
+            dst[8 * b + s] = m >> (8 * s);
+    }
+}
+#endif
+
+#ifdef BITPLANES_AVX2
+/*
+ * BITPLANES_AVX2 is defined by CMakeLists.txt where bitplanes_avx2.cpp
+ * is built with -mavx2. Two words at a time, used where the CPU has it.
+ */
+void transpose_words_avx2(const uint64_t *w0, const uint64_t *w1, uint8_t *dst);
+#endif
+
+static inline void scatter(const uint8_t *src, uint64_t count,
+                           uint8_t *out, int unitsize)
+{
+    if (unitsize == 1) {
+        memcpy(out, src, count);
+    } else {
+        for (uint64_t s = 0; s < count; s++)
+            out[s * unitsize] = src[s];
+    }
+}
+
+void transpose_planes(const uint64_t *const *planes, const uint8_t *levels,
+                      int channels, uint64_t samples,
+                      uint8_t *out, int unitsize)
+{
+    assert(unitsize > 0 && unitsize <= MaxPlanesUnitSize);
+    assert(channels <= unitsize * 8);
+
+    const uint64_t words = (samples + 63) / 64;
+    uint8_t dst[128];
+    uint64_t w[2][8];
+#ifdef BITPLANES_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    for (int g = 0; g < unitsize; g++) {
+        // constant channels, and the ones past the last, as full words
+        const uint64_t *p[8];
+        for (int c = 0; c < 8; c++) {
+            const int k = g * 8 + c;
+            p[c] = (k < channels) ? planes[k] : NULL;
+            w[0][c] = w[1][c] = (k < channels && p[c] == NULL && levels[k]) ? ~0ULL : 0;
+        }
+
+        uint8_t *const group_out = out + g;
+        uint64_t i = 0;
+#ifdef BITPLANES_AVX2
+        for (; avx2 && i + 2 <= words; i += 2) {
+            for (int c = 0; c < 8; c++) {
+                if (p[c] != NULL) {
+                    w[0][c] = p[c][i];
+                    w[1][c] = p[c][i + 1];
+                }
+            }
+            transpose_words_avx2(w[0], w[1], dst);
+            const uint64_t count = (samples - i * 64 < 128) ? samples - i * 64 : 128;
+            scatter(dst, count, group_out + i * 64 * unitsize, unitsize);
+        }
+#endif
+        for (; i < words; i++) {
+            for (int c = 0; c < 8; c++) {
+                if (p[c] != NULL)
+                    w[0][c] = p[c][i];
+            }
+            transpose_word(w[0], dst);
+            const uint64_t count = (samples - i * 64 < 64) ? samples - i * 64 : 64;
+            scatter(dst, count, group_out + i * 64 * unitsize, unitsize);
+        }
+    }
+}
+
+} // namespace data
+} // namespace pv
@@ -0,0 +1,47 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef DSVIEW_PV_DATA_BITPLANES_H
+#define DSVIEW_PV_DATA_BITPLANES_H
+
+#include <stdint.h>
+
+namespace pv {
+namespace data {
+
+// widest unit of transpose_planes(), in bytes
+const int MaxPlanesUnitSize = 32;
+
+/*
+ * Build samples of unitsize bytes, with bit k from channel k, out of
+ * the bit planes of the channels as LogicSnapshot keeps them: 64
+ * samples per word, the first one in the lowest bit. A NULL plane is
+ * a channel at the constant level levels[k].
+ */
+void transpose_planes(const uint64_t *const *planes, const uint8_t *levels,
+                      int channels, uint64_t samples,
+                      uint8_t *out, int unitsize);
+
+} // namespace data
+} // namespace pv
+
+#endif // DSVIEW_PV_DATA_BITPLANES_H
@@ -0,0 +1,77 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * The AVX2 kernel of bitplanes.cpp. Built with -mavx2 where the
+ * compiler has it, see CMakeLists.txt, and only called where the CPU
+ * has it.
+ */
+#ifdef __AVX2__
+#include <stdint.h>
+#include <immintrin.h>
+
+namespace pv {
+namespace data {
+
+static inline __m256i transpose_bits(__m256i x)
+{
+    __m256i t;
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 7)),
+                         _mm256_set1_epi64x(0x00AA00AA00AA00AALL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 7));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 14)),
+                         _mm256_set1_epi64x(0x0000CCCC0000CCCCLL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 14));
+    t = _mm256_and_si256(_mm256_xor_si256(x, _mm256_srli_epi64(x, 28)),
+                         _mm256_set1_epi64x(0x00000000F0F0F0F0LL));
+    x = _mm256_xor_si256(_mm256_xor_si256(x, t), _mm256_slli_epi64(t, 28));
+    return x;
+}
+
+static inline void store_lanes(uint8_t *dst, __m256i x)
+{
+    _mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(x));
+    _mm_storeu_si128((__m128i *)(dst + 64), _mm256_extracti128_si256(x, 1));
+}
+
+// two consecutive words, one in each lane, unpacks stay within lanes
+void transpose_words_avx2(const uint64_t *w0, const uint64_t *w1, uint8_t *dst)
+{
+    __m256i x[8];
+    for (int c = 0; c < 8; c++)
+        x[c] = _mm256_set_epi64x(0, w1[c], 0, w0[c]);
+    const __m256i x01 = _mm256_unpacklo_epi8(x[0], x[1]);
+    const __m256i x23 = _mm256_unpacklo_epi8(x[2], x[3]);
+    const __m256i x45 = _mm256_unpacklo_epi8(x[4], x[5]);
+    const __m256i x67 = _mm256_unpacklo_epi8(x[6], x[7]);
+    const __m256i y0 = _mm256_unpacklo_epi16(x01, x23);
+    const __m256i y1 = _mm256_unpackhi_epi16(x01, x23);
+    const __m256i y2 = _mm256_unpacklo_epi16(x45, x67);
+    const __m256i y3 = _mm256_unpackhi_epi16(x45, x67);
+    store_lanes(dst + 0, transpose_bits(_mm256_unpacklo_epi32(y0, y2)));
+    store_lanes(dst + 16, transpose_bits(_mm256_unpackhi_epi32(y0, y2)));
+    store_lanes(dst + 32, transpose_bits(_mm256_unpacklo_epi32(y1, y3)));
+    store_lanes(dst + 48, transpose_bits(_mm256_unpackhi_epi32(y1, y3)));
+}
+
+} // namespace data
+} // namespace pv
+#endif
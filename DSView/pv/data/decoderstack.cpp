@@ -122,6 +122,7 @@ void DecoderStack::remove(boost::shared_ptr<Decoder> &decoder)
 
 void DecoderStack::build_row()
 {
+    boost::lock_guard<boost::recursive_mutex> lock(_output_mutex);
     _rows.clear();
     // Add classes
     BOOST_FOREACH (const boost::shared_ptr<decode::Decoder> &dec, _stack)
@@ -191,7 +192,8 @@ void DecoderStack::get_annotation_subset(
 	const Row &row, uint64_t start_sample,
 	uint64_t end_sample) const
 {
-    //lock_guard<mutex> lock(_output_mutex);
+    // the view's render thread reads while the rows are decoded
+    boost::lock_guard<boost::recursive_mutex> lock(_output_mutex);
 
     std::map<const Row, decode::RowData>::const_iterator iter =
         _rows.find(row);
@@ -487,6 +489,8 @@ void DecoderStack::decode_data(
           i < decode_end && !_no_memory)
     {
         //lock_guard<mutex> decode_lock(_global_decode_mutex);
+        // keep the chunk's leaves alive while the decoders read them
+        LogicSnapshot::ReadGuard guard(*_snapshot);
         std::vector<const uint8_t *> chunk;
         std::vector<uint8_t> chunk_const;
         uint64_t chunk_end = decode_end;
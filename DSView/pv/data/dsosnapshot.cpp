@@ -78,6 +78,7 @@ void DsoSnapshot::init()
     _ring_sample_count = 0;
     _memory_failed = false;
     _last_ended = true;
+    publish();
     _envelope_done = false;
     _ch_enable.clear();
     for (unsigned int i = 0; i < _channel_num; i++) {
@@ -99,6 +100,8 @@ void DsoSnapshot::clear()
 void DsoSnapshot::first_payload(const sr_datafeed_dso &dso, uint64_t total_sample_count,
                                 std::map<int, bool> ch_enable, bool instant)
 {
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+
     bool re_alloc = false;
     unsigned int channel_num = 0;
     for (auto& iter:ch_enable) {
@@ -166,6 +169,8 @@ void DsoSnapshot::append_payload(const sr_datafeed_dso &dso)
         if (_envelope_en)
             append_payload_to_envelope_levels(dso.samplerate_tog);
     }
+
+    publish();
 }
 
 void DsoSnapshot::append_data(void *data, uint64_t samples, bool instant)
@@ -44,10 +44,6 @@ const int GroupSnapshot::EnvelopeScaleFactor = 1 << EnvelopeScalePower;
 const float GroupSnapshot::LogEnvelopeScaleFactor =
 	logf(EnvelopeScaleFactor);
 const uint64_t GroupSnapshot::EnvelopeDataUnit = 64*1024;	// bytes
-const uint16_t GroupSnapshot::value_mask[16] = {0x1, 0x2, 0x4, 0x8,
-                                                0x10, 0x20, 0x40, 0x80,
-                                                0x100, 0x200, 0x400, 0x800,
-                                                0x1000, 0x2000, 0x4000, 0x8000};
 
 GroupSnapshot::GroupSnapshot(const boost::shared_ptr<LogicSnapshot> &_logic_snapshot, std::list<int> index_list)
 {
@@ -55,40 +51,15 @@ GroupSnapshot::GroupSnapshot(const boost::shared_ptr<LogicSnapshot> &_logic_snap
 
     //boost::lock_guard<boost::recursive_mutex> lock(_mutex);
 	memset(_envelope_levels, 0, sizeof(_envelope_levels));
-    _data = _logic_snapshot->get_data();
+    _snapshot = _logic_snapshot;
     _sample_count = _logic_snapshot->get_sample_count();
-    _unit_size = _logic_snapshot->unit_size();
     _index_list = index_list;
 
-    _mask = 0;
-    std::list<int>::iterator j = _index_list.begin();
-    while(j != _index_list.end())
-        _mask |= value_mask[(*j++)];
-
-    for (int i=0; i<32; i++) {
-        _bubble_start[i] = -1;
-        _bubble_end[i] = -1;
-    }
-    uint16_t mask = _mask;
-    int i = 0;
-    int k = 0;
-    int zero = 0;
-    int zero_pre = 0;
-    // max bubble count: 31
-    do {
-        if (mask & 0x1) {
-            if (_bubble_start[k] != -1 &&
-                _bubble_end[k] == -1)
-                _bubble_end[k++] = i - zero_pre;
-        } else {
-            if (_bubble_start[k] == -1) {
-                _bubble_start[k] = i - zero;
-                zero_pre = zero;
-            }
-            zero++;
-        }
-        i++;
-    }while(mask >>= 1);
+    // the group value has the bits of its channels, lowest index first
+    _channels.assign(_index_list.begin(), _index_list.end());
+    std::sort(_channels.begin(), _channels.end());
+    if (_channels.size() > (size_t)MaxChannels)
+        _channels.resize(MaxChannels);
 
     append_payload();
 }
@@ -133,27 +104,11 @@ const uint16_t* GroupSnapshot::get_samples(
 	assert(end_sample < (int64_t)_sample_count);
 	assert(start_sample <= end_sample);
 
-    int64_t i;
-    uint16_t tmpl, tmpr;
     //boost::lock_guard<boost::recursive_mutex> lock(_mutex);
 
     uint16_t *const data = new uint16_t[end_sample - start_sample];
-//    memcpy(data, (uint16_t*)_data + start_sample, sizeof(uint16_t) *
-//		(end_sample - start_sample));
-//    memset(data, 0, sizeof(uint16_t) * (end_sample - start_sample));
-    for(i = start_sample; i < end_sample; i++) {
-        if (_unit_size == 2)
-            tmpl = *((uint16_t*)_data + i) & _mask;
-        else
-            tmpl = *((uint8_t*)_data + i) & _mask;
-        for(int j=0; _bubble_start[j] != -1; j++) {
-            tmpr = tmpl & (0xffff >> (16 - _bubble_start[j]));
-            tmpl >>= _bubble_end[j];
-            tmpl <<= _bubble_start[j];
-            tmpl += tmpr;
-        }
-        *(data + i - start_sample) = tmpl;
-    }
+    _snapshot->get_units(start_sample, end_sample - start_sample, _channels,
+                         (uint8_t *)data, sizeof(uint16_t));
 	return data;
 }
 
@@ -212,34 +167,22 @@ void GroupSnapshot::append_payload_to_envelope_levels()
 	dest_ptr = e0.samples + prev_length;
 
 	// Iterate through the samples to populate the first level mipmap
-    uint16_t group_value[EnvelopeScaleFactor];
-    const uint8_t *const end_src_ptr = (uint8_t*)_data +
-        e0.length * EnvelopeScaleFactor * _unit_size;
-    for (const uint8_t *src_ptr = (uint8_t*)_data +
-        prev_length * EnvelopeScaleFactor * _unit_size;
-        src_ptr < end_src_ptr; src_ptr += EnvelopeScaleFactor * _unit_size)
-	{
-        uint16_t tmpr;
-        for(int i = 0; i < EnvelopeScaleFactor; i++) {
-            if (_unit_size == 2)
-                group_value[i] = *((uint16_t*)src_ptr + i) & _mask;
-            else
-                group_value[i] = *((uint8_t*)src_ptr + i) & _mask;
-            for(int j=0; _bubble_start[j] != -1; j++) {
-                tmpr = group_value[i] & (0xffff >> (16 - _bubble_start[j]));
-                group_value[i] >>= _bubble_end[j];
-                group_value[i] <<= _bubble_start[j];
-                group_value[i] += tmpr;
-            }
+    uint16_t *const group_value = new uint16_t[EnvelopeChunk];
+    const uint64_t end = e0.length * EnvelopeScaleFactor;
+    for (uint64_t index = prev_length * EnvelopeScaleFactor; index < end;
+         index += EnvelopeChunk) {
+        const uint64_t count = min(end - index, (uint64_t)EnvelopeChunk);
+        _snapshot->get_units(index, count, _channels,
+                             (uint8_t *)group_value, sizeof(uint16_t));
+        for (uint64_t i = 0; i < count; i += EnvelopeScaleFactor) {
+            const EnvelopeSample sub_sample = {
+                *min_element(group_value + i, group_value + i + EnvelopeScaleFactor),
+                *max_element(group_value + i, group_value + i + EnvelopeScaleFactor),
+            };
+            *dest_ptr++ = sub_sample;
         }
-
-		const EnvelopeSample sub_sample = {
-            *min_element(group_value, group_value + EnvelopeScaleFactor),
-            *max_element(group_value, group_value + EnvelopeScaleFactor),
-		};
-
-		*dest_ptr++ = sub_sample;
-	}
+    }
+    delete[] group_value;
 
 	// Compute higher level mipmaps
 	for (unsigned int level = 1; level < ScaleStepCount; level++)
@@ -72,7 +72,8 @@ private:
 	static const int EnvelopeScaleFactor;
 	static const float LogEnvelopeScaleFactor;
 	static const uint64_t EnvelopeDataUnit;
-    static const uint16_t value_mask[16];
+    static const uint64_t EnvelopeChunk = 64 * 1024;
+    static const int MaxChannels = 16;
 
 public:
     GroupSnapshot(const boost::shared_ptr<LogicSnapshot> &_logic_snapshot, std::list<int> index_list);
@@ -100,14 +101,11 @@ private:
 private:
 	struct Envelope _envelope_levels[ScaleStepCount];
     //mutable boost::recursive_mutex _mutex;
-    const void *_data;
+    boost::shared_ptr<LogicSnapshot> _snapshot;
     uint64_t _sample_count;
-    int _unit_size;
     boost::shared_ptr<view::Signal> _signal;
     std::list<int> _index_list;
-    uint16_t _mask;
-    int _bubble_start[32];
-    int _bubble_end[32];
+    std::vector<int> _channels;
 
     friend class GroupSnapshotTest::Basic;
 };
@@ -52,6 +52,7 @@ void Logic::clear()
     //_snapshots.clear();
     BOOST_FOREACH(const boost::shared_ptr<LogicSnapshot> s, _snapshots)
         s->clear();
+    _history.clear();
 }
 
 void Logic::init()
@@ -61,5 +62,24 @@ void Logic::init()
         s->init();
 }
 
+void Logic::push_history(const Capture &capture, int depth, uint64_t budget)
+{
+    _history.push_front(capture);
+
+    uint64_t size = 0;
+    deque<Capture>::iterator i = _history.begin();
+    for (int n = 0; i != _history.end(); i++, n++) {
+        size += i->snapshot->get_memory_size();
+        if (n >= depth || size > budget)
+            break;
+    }
+    _history.erase(i, _history.end());
+}
+
+deque<Logic::Capture>& Logic::get_history()
+{
+    return _history;
+}
+
 } // namespace data
 } // namespace pv
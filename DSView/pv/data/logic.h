@@ -49,8 +49,25 @@ public:
 
     void init();
 
+    // a previous capture and the settings it was taken with
+    struct Capture
+    {
+        boost::shared_ptr<LogicSnapshot> snapshot;
+        uint64_t samplerate;
+        uint64_t trigger_pos;
+    };
+
+    /**
+     * Previous captures, newest first. Older ones are dropped once there
+     * are more than depth of them or they need more than budget bytes.
+     */
+    void push_history(const Capture &capture, int depth, uint64_t budget);
+
+    std::deque<Capture>& get_history();
+
 private:
 	std::deque< boost::shared_ptr<LogicSnapshot> > _snapshots;
+    std::deque<Capture> _history;
 };
 
 } // namespace data
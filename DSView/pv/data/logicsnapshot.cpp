@@ -29,9 +29,13 @@
 #include <stdlib.h>
 #include <math.h>
 
+#include <algorithm>
+
 #include <boost/foreach.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "logicsnapshot.h"
+#include "bitplanes.h"
 
 using namespace boost;
 using namespace std;
@@ -52,30 +56,98 @@ const uint64_t LogicSnapshot::LevelOffset[LogicSnapshot::ScaleLevel] = {
     (uint64_t)pow(Scale, 3) + (uint64_t)pow(Scale, 2) + (uint64_t)pow(Scale, 1),
 };
 
+std::atomic<bool> LogicSnapshot::_leaf_dedup(true);
+boost::mutex LogicSnapshot::_leaf_pool_mutex;
+std::multimap<uint64_t, void *> LogicSnapshot::_leaf_pool;
+std::map<void *, LogicSnapshot::SharedLeaf> LogicSnapshot::_shared_leaves;
+uint64_t LogicSnapshot::_shared_refs = 0;
+std::map<void *, GMappedFile *> LogicSnapshot::_mapped_leaves;
+boost::mutex LogicSnapshot::_holders_mutex;
+std::vector<LogicSnapshot::Holder *> LogicSnapshot::_holders;
+uint64_t LogicSnapshot::_lazy_budget = 512ULL << 20;
+uint64_t LogicSnapshot::_empty_leaf[LogicSnapshot::LeafBlockSpace / sizeof(uint64_t)];
+uint64_t LogicSnapshot::_full_leaf[LogicSnapshot::LeafBlockSpace / sizeof(uint64_t)];
+thread_local LogicSnapshot::CachedOnly *LogicSnapshot::_cached_only = NULL;
+std::atomic<uint64_t> LogicSnapshot::_generations(0);
+
+LogicSnapshot::LazyLeaves::LazyLeaves(sr_session_reader *reader,
+                                      uint64_t channels, uint64_t blocks) :
+    reader(sr_session_reader_ref(reader)),
+    blocks(blocks),
+    recorded(0),
+    last(channels * ((blocks + 63) / 64), 0),
+    stamps(new std::atomic<uint64_t>[channels * blocks]()),
+    clock(0),
+    has_evicted(false),
+    failed(channels * ((blocks + 63) / 64), 0),
+    pending(channels * ((blocks + 63) / 64), 0),
+    stop(false)
+{
+}
+
+LogicSnapshot::LazyLeaves::~LazyLeaves()
+{
+    sr_session_reader_unref(reader);
+}
+
+LogicSnapshot::CachedOnly::CachedOnly() :
+    _outer(_cached_only),
+    _missed(false)
+{
+    _cached_only = this;
+}
+
+LogicSnapshot::CachedOnly::~CachedOnly()
+{
+    _cached_only = _outer;
+    if (_outer != NULL && _missed)
+        _outer->_missed = true;
+}
+
+bool LogicSnapshot::CachedOnly::missed() const
+{
+    return _missed;
+}
+
 LogicSnapshot::LogicSnapshot() :
     Snapshot(1, 0, 0),
-    _block_num(0)
+    _block_num(0),
+    _leaf_loaded(false),
+    _recording(false),
+    _generation(++_generations)
 {
 }
 
 LogicSnapshot::~LogicSnapshot()
 {
+    free_data();
+    reclaim(true);
 }
 
 void LogicSnapshot::free_data()
 {
+    // lock-free readers find no samples from here on, and the holders
+    // (e.g. the view's render thread) let go of the snapshot first
+    stop_loader();
+    _sample_count = 0;
+    publish();
+    release_holders();
+
+    drop_lazy();
     Snapshot::free_data();
+    _generation = ++_generations;
     for(auto& iter:_ch_data) {
         for(auto& iter_rn:iter) {
             for (unsigned int k = 0; k < Scale; k++)
                 if (iter_rn.lbp[k] != NULL)
-                    free(iter_rn.lbp[k]);
+                    free_leaf(iter_rn.lbp[k]);
         }
         std::vector<struct RootNode> void_vector;
         iter.swap(void_vector);
     }
     _ch_data.clear();
     _sample_count = 0;
+    publish();
 }
 
 void LogicSnapshot::init()
@@ -91,6 +163,9 @@ void LogicSnapshot::init()
     _data = NULL;
     _memory_failed = false;
     _last_ended = true;
+    _leaf_loaded = false;
+    _generation = ++_generations;
+    publish();
 }
 
 void LogicSnapshot::clear()
@@ -107,35 +182,54 @@ void LogicSnapshot::capture_ended()
     //assert(_ch_fraction == 0);
     //assert(_byte_fraction == 0);
     uint64_t block_index = _ring_sample_count / LeafBlockSamples;
-    uint64_t block_offset = (_ring_sample_count % LeafBlockSamples) / Scale;
-    if (block_offset != 0) {
+    uint64_t block_samples = _ring_sample_count % LeafBlockSamples;
+    uint64_t block_offset = block_samples / Scale;
+    const uint64_t tail_bits = block_samples % Scale;
+    // loaded leaves are complete (and read-only)
+    if (block_samples != 0 && !_leaf_loaded) {
         uint64_t index0 = block_index / RootScale;
         uint64_t index1 = block_index % RootScale;
         int order = 0;
         for(auto& iter:_ch_data) {
+            // constant blocks of an import have no leaf
+            if (iter[index0].lbp[index1] == NULL) {
+                order++;
+                continue;
+            }
+            // the tail past the last sample holds data of earlier captures,
+            // which must neither show as edges nor take part in sharing:
+            // the last word is padded with the last sample, the rest zeroed
             const uint64_t *end_ptr = (uint64_t *)iter[index0].lbp[index1] + (LeafBlockSamples / Scale);
             uint64_t *ptr = (uint64_t *)iter[index0].lbp[index1] + block_offset;
+            if (tail_bits != 0) {
+                const uint64_t valid = (1ULL << tail_bits) - 1;
+                *ptr = (*ptr & (1ULL << (tail_bits - 1))) ? (*ptr | ~valid) : (*ptr & valid);
+                ptr++;
+            }
             while (ptr < end_ptr)
                 *ptr++ = 0;
 
             // calc mipmap of current block
-            calc_mipmap(order, index0, index1, block_offset * Scale);
+            calc_mipmap(order, index0, index1, (block_samples + Scale - 1) / Scale * Scale);
 
             // calc root of current block
             if (*((uint64_t *)iter[index0].lbp[index1]) != 0)
                 iter[index0].value += 1ULL << index1;
             if (*((uint64_t *)iter[index0].lbp[index1] + LeafBlockSpace / sizeof(uint64_t) - 1) != 0) {
                 iter[index0].tog += 1ULL << index1;
+                share_leaf(iter[index0].lbp[index1]);
             } else {
                // trim leaf to free space
-               free(iter[index0].lbp[index1]);
+               void *leaf = iter[index0].lbp[index1];
                iter[index0].lbp[index1] = NULL;
+               retire(leaf);
             }
 
             order++;
         }
     }
     _sample_count = _ring_sample_count;
+    publish();
 }
 
 void LogicSnapshot::first_payload(const sr_datafeed_logic &logic, uint64_t total_sample_count, GSList *channels)
@@ -195,6 +289,12 @@ void LogicSnapshot::first_payload(const sr_datafeed_logic &logic, uint64_t total
         _block_cnt.push_back(0);
         _ring_sample_cnt.push_back(0);
     }
+    drop_lazy();
+    _leaf_loaded = false;
+    // set up before any block is published, readers check _lazy unlocked
+    if (_recording)
+        _lazy.reset(new LazyLeaves(NULL, _ch_data.size(),
+            (_total_sample_count + LeafBlockSamples - 1) / LeafBlockSamples));
 
     append_payload(logic);
     _last_ended = false;
@@ -209,6 +309,11 @@ void LogicSnapshot::append_payload(
         append_cross_payload(logic);
     else if (logic.format == LA_SPLIT_DATA)
         append_split_payload(logic);
+    else if (logic.format == LA_LEAF_DATA)
+        append_leaf_payload(logic);
+
+    // readers only go as far as the published counts
+    publish();
 }
 
 void LogicSnapshot::append_cross_payload(
@@ -234,11 +339,10 @@ void LogicSnapshot::append_cross_payload(
     }
 
     while (_sample_count > _block_num * LeafBlockSamples) {
-        uint8_t index0 = _block_num / RootScale;
-        uint8_t index1 = _block_num % RootScale;
+        uint64_t index0 = _block_num / RootScale;
+        uint64_t index1 = _block_num % RootScale;
         for(auto& iter:_ch_data) {
-            if (iter[index0].lbp[index1] == NULL)
-                iter[index0].lbp[index1] = malloc(LeafBlockSpace);
+            iter[index0].lbp[index1] = alloc_leaf(iter[index0].lbp[index1]);
             if (iter[index0].lbp[index1] == NULL) {
                 _memory_failed = true;
                 return;
@@ -324,10 +428,12 @@ void LogicSnapshot::append_cross_payload(
                         iter[index0].value +=  1ULL<< index1;
                     if (*((uint64_t *)iter[index0].lbp[index1] + LeafBlockSpace / sizeof(uint64_t) - 1) != 0) {
                         iter[index0].tog += 1ULL << index1;
+                        share_leaf(iter[index0].lbp[index1]);
                     } else {
                         // trim leaf to free space
-                        free(iter[index0].lbp[index1]);
+                        void *leaf = iter[index0].lbp[index1];
                         iter[index0].lbp[index1] = NULL;
+                        retire(leaf);
                     }
 
                     index1++;
@@ -389,10 +495,9 @@ void LogicSnapshot::append_split_payload(
     }
 
     while (_sample_cnt[order] > _block_cnt[order] * LeafBlockSamples) {
-        uint8_t index0 = _block_cnt[order] / RootScale;
-        uint8_t index1 = _block_cnt[order] % RootScale;
-        if (_ch_data[order][index0].lbp[index1] == NULL)
-            _ch_data[order][index0].lbp[index1] = malloc(LeafBlockSpace);
+        uint64_t index0 = _block_cnt[order] / RootScale;
+        uint64_t index1 = _block_cnt[order] % RootScale;
+        _ch_data[order][index0].lbp[index1] = alloc_leaf(_ch_data[order][index0].lbp[index1]);
         if (_ch_data[order][index0].lbp[index1] == NULL) {
             _memory_failed = true;
             return;
@@ -421,10 +526,12 @@ void LogicSnapshot::append_split_payload(
                 _ch_data[order][index0].value +=  1ULL<< index1;
             if (*((uint64_t *)_ch_data[order][index0].lbp[index1] + LeafBlockSpace / sizeof(uint64_t) - 1) != 0) {
                 _ch_data[order][index0].tog += 1ULL << index1;
+                share_leaf(_ch_data[order][index0].lbp[index1]);
             } else {
                 // trim leaf to free space
-                free(_ch_data[order][index0].lbp[index1]);
+                void *leaf = _ch_data[order][index0].lbp[index1];
                 _ch_data[order][index0].lbp[index1] = NULL;
+                retire(leaf);
             }
         } else {
             memcpy((uint8_t*)_dest_ptr, (uint8_t *)logic.data, samples/8);
@@ -437,7 +544,84 @@ void LogicSnapshot::append_split_payload(
     _ring_sample_count = *min_element(_ring_sample_cnt.begin(), _ring_sample_cnt.end());
 }
 
-void LogicSnapshot::calc_mipmap(unsigned int order, uint8_t index0, uint8_t index1, uint64_t samples)
+void LogicSnapshot::append_leaf_payload(
+    const sr_datafeed_logic &logic)
+{
+    assert(logic.format == LA_LEAF_DATA);
+
+    const sr_datafeed_leaf *const leaf = (const sr_datafeed_leaf *)logic.data;
+    const uint16_t order = logic.order;
+    assert(order < _ch_data.size());
+    assert(_ring_sample_cnt[order] % LeafBlockSamples == 0);
+    static_assert(LeafBlockSpace == LA_LEAF_SPACE, "leaves are copied as they come");
+
+    if (_sample_cnt[order] >= _total_sample_count)
+        return;
+
+    const uint64_t samples = std::min(logic.length * 8,
+                                      _total_sample_count - _sample_cnt[order]);
+    const uint64_t index0 = _block_cnt[order] / RootScale;
+    const uint64_t index1 = _block_cnt[order] % RootScale;
+    struct RootNode &rn = _ch_data[order][index0];
+
+    if (leaf->leaf != NULL && leaf->mapping == NULL) {
+        // built by the sender for this packet only, see sr_datafeed_leaf
+        rn.lbp[index1] = alloc_leaf(rn.lbp[index1]);
+        if (rn.lbp[index1] == NULL) {
+            _memory_failed = true;
+            return;
+        }
+        memcpy(rn.lbp[index1], leaf->leaf, LeafBlockSpace);
+    } else if (rn.lbp[index1] != NULL) {
+        // a leaf of an earlier capture is replaced, not written to
+        void *old = rn.lbp[index1];
+        rn.lbp[index1] = NULL;
+        retire(old);
+    }
+
+    if (leaf->leaf != NULL) {
+        if (leaf->mapping != NULL) {
+            assert(((uintptr_t)leaf->leaf & (sizeof(uint64_t) - 1)) == 0);
+            rn.lbp[index1] = map_leaf(leaf->leaf, leaf->mapping);
+        }
+        rn.tog += 1ULL << index1;
+        if (*((const uint64_t *)rn.lbp[index1]) != 0)
+            rn.value += 1ULL << index1;
+    } else if (leaf->reader != NULL) {
+        // only the index of a lazily loaded block, see load_leaf()
+        const uint64_t blocks = (_total_sample_count + LeafBlockSamples - 1) / LeafBlockSamples;
+        if (!_lazy)
+            _lazy.reset(new LazyLeaves(leaf->reader, _ch_data.size(), blocks));
+        if (leaf->edges)
+            rn.tog += 1ULL << index1;
+        else if (leaf->value)
+            rn.value += 1ULL << index1;
+        if (leaf->value)
+            _lazy->last[order * ((blocks + 63) / 64) + _block_cnt[order] / 64] |=
+                1ULL << (_block_cnt[order] % 64);
+    } else if (leaf->value) {
+        rn.value += 1ULL << index1;
+    }
+
+    // a split block may follow, its mipmap starts from this level
+    _last_sample[order] = leaf->value ? ~0ULL : 0ULL;
+    _block_cnt[order]++;
+    _sample_cnt[order] += samples;
+    _ring_sample_cnt[order] += samples;
+    if (leaf->leaf != NULL || leaf->reader != NULL)
+        _leaf_loaded = true;
+
+    _sample_count = *min_element(_sample_cnt.begin(), _sample_cnt.end());
+    _ring_sample_count = *min_element(_ring_sample_cnt.begin(), _ring_sample_cnt.end());
+}
+
+void LogicSnapshot::calc_mipmap(unsigned int order, uint64_t index0, uint64_t index1, uint64_t samples)
+{
+    calc_mipmap((uint64_t *)_ch_data[order][index0].lbp[index1],
+                _last_sample[order], samples);
+}
+
+void LogicSnapshot::calc_mipmap(uint64_t *leaf, uint64_t &last_sample, uint64_t samples)
 {
     uint8_t offset;
     uint64_t *src_ptr;
@@ -445,20 +629,20 @@ void LogicSnapshot::calc_mipmap(unsigned int order, uint8_t index0, uint8_t inde
     unsigned int i;
 
     // level 1
-    src_ptr = (uint64_t *)_ch_data[order][index0].lbp[index1];
+    src_ptr = leaf;
     dest_ptr = src_ptr + (LeafBlockSamples / Scale) - 1;
     const uint64_t mask =  1ULL << (Scale - 1);
     for(i = 0; i < samples / Scale; i++) {
         offset = i % Scale;
         if (offset == 0)
             dest_ptr++;
-        *dest_ptr += ((_last_sample[order] ^ *src_ptr) != 0 ? 1ULL : 0ULL) << offset;
-        _last_sample[order] = *src_ptr & mask ? ~0ULL : 0ULL;
+        *dest_ptr += ((last_sample ^ *src_ptr) != 0 ? 1ULL : 0ULL) << offset;
+        last_sample = *src_ptr & mask ? ~0ULL : 0ULL;
         src_ptr++;
     }
 
     // level 2/3
-    src_ptr = (uint64_t *)_ch_data[order][index0].lbp[index1] + (LeafBlockSamples / Scale);
+    src_ptr = leaf + (LeafBlockSamples / Scale);
     dest_ptr = src_ptr + (LeafBlockSamples / Scale / Scale) - 1;
     for(i = LeafBlockSamples / Scale; i < LeafBlockSpace / sizeof(uint64_t) - 1; i++) {
         offset = i % Scale;
@@ -486,15 +670,15 @@ const uint8_t *LogicSnapshot::get_samples(uint64_t start_sample, uint64_t &end_s
                  ~(~0ULL << LeafBlockPower);
     end_sample = min(end_sample + 1, get_sample_count());
 
-    if (order == -1 ||
-        _ch_data[order][root_index].lbp[root_pos] == NULL)
+    if (order == -1)
         return NULL;
-    else
-        return (uint8_t *)_ch_data[order][root_index].lbp[root_pos] + block_offset;
+    const uint8_t *lbp = (const uint8_t *)get_leaf(order, root_index, root_pos);
+    return (lbp == NULL) ? NULL : lbp + block_offset;
 }
 
 bool LogicSnapshot::get_sample(uint64_t index, int sig_index)
 {
+    ReadGuard guard(*this);
     int order = get_ch_order(sig_index);
     assert(order != -1);
     assert(_ch_data[order].size() != 0);
@@ -509,7 +693,7 @@ bool LogicSnapshot::get_sample(uint64_t index, int sig_index)
         if ((_ch_data[order][root_index].tog & root_pos_mask) == 0) {
             return (_ch_data[order][root_index].value & root_pos_mask) != 0;
         } else {
-            uint64_t *lbp = (uint64_t *)_ch_data[order][root_index].lbp[root_pos];
+            uint64_t *lbp = (uint64_t *)get_leaf(order, root_index, root_pos);
             return *(lbp + ((index & LeafMask) >> ScalePower)) & index_mask;
         }
     } else {
@@ -522,6 +706,7 @@ bool LogicSnapshot::get_display_edges(std::vector<std::pair<bool, bool> > &edges
     uint64_t start, uint64_t end, uint16_t width, uint16_t max_togs,
     double pixels_offset, double min_length, uint16_t sig_index)
 {
+    ReadGuard guard(*this);
     if (!edges.empty())
         edges.clear();
     if (!togs.empty())
@@ -574,10 +759,133 @@ bool LogicSnapshot::get_display_edges(std::vector<std::pair<bool, bool> > &edges
     return start_sample;
 }
 
+/*
+ * The pixels of get_display_edges(), with the edges of a pixel taken
+ * from the mipmap spans it overlaps, see coarse_segment(). A span wider
+ * than a pixel has its edges shown on all the pixels it overlaps.
+ */
+bool LogicSnapshot::get_coarse_edges(std::vector<std::pair<bool, bool> > &edges,
+    std::vector<std::pair<uint16_t, bool> > &togs,
+    uint64_t start, uint64_t end, uint16_t width, uint16_t max_togs,
+    double pixels_offset, double min_length, uint16_t sig_index)
+{
+    ReadGuard guard(*this);
+    if (!edges.empty())
+        edges.clear();
+    if (!togs.empty())
+        togs.clear();
+
+    if (get_sample_count() == 0)
+        return false;
+
+    assert(end < get_sample_count());
+    assert(start <= end);
+    assert(min_length > 0);
+
+    const int order = get_ch_order(sig_index);
+    if (order == -1)
+        return false;
+
+    uint64_t index = start;
+    uint64_t pixel_start = start;
+    uint64_t seg_end = start;
+    bool seg_edges = false;
+    bool value;
+    bool last_sample;
+    bool start_sample;
+
+    start_sample = last_sample = coarse_sample(order, start);
+    togs.push_back(pair<uint16_t, bool>(0, last_sample));
+    for (uint16_t x = 0; x < width; x++) {
+        // the samples of the pixel, as get_display_edges() places them
+        const double bound = ceil((pixels_offset + x + 1) * min_length);
+        const uint64_t pixel_end = (bound <= 0) ? 0 : min((uint64_t)bound, end + 1);
+
+        bool has_edge = seg_edges && seg_end > pixel_start;
+        while (index < pixel_end) {
+            coarse_segment(order, index, end, seg_end, seg_edges, value);
+            has_edge = has_edge || seg_edges || value != last_sample;
+            last_sample = value;
+            index = seg_end;
+        }
+        pixel_start = max(pixel_start, pixel_end);
+
+        edges.push_back(pair<bool, bool>(has_edge, last_sample));
+        if (has_edge && togs.size() < max_togs)
+            togs.push_back(pair<uint16_t, bool>(x, last_sample));
+    }
+
+    if (togs.size() < max_togs)
+        togs.push_back(pair<uint16_t, bool>(edges.size() - 1, last_sample));
+
+    return start_sample;
+}
+
+/*
+ * The sample at index if the mipmap or a leaf in memory has it, the
+ * sample before the block of a lazily loaded file not read yet.
+ */
+bool LogicSnapshot::coarse_sample(int order, uint64_t index)
+{
+    const uint64_t block = index >> LeafBlockPower;
+    const struct RootNode &rn = _ch_data[order][block / RootScale];
+    const uint64_t pos = block % RootScale;
+
+    if ((rn.tog & (1ULL << pos)) == 0)
+        return (rn.value >> pos) & 1;
+
+    const uint64_t *leaf = (const uint64_t *)load_lbp(rn.lbp[pos]);
+    if (leaf != NULL)
+        return (leaf[(index & LeafMask) >> ScalePower] >> (index & LevelMask[0])) & 1;
+
+    if (!_lazy || block == 0)
+        return false;
+    const uint64_t prev = block - 1;
+    return (_lazy->last[order * ((_lazy->blocks + 63) / 64) + prev / 64] >> (prev % 64)) & 1;
+}
+
+/*
+ * The span of samples from index that the mipmap alone tells about: a
+ * bit of the coarsest level of a leaf in memory, a whole block
+ * otherwise. seg_end is the sample after it, value its last sample up
+ * to end.
+ */
+void LogicSnapshot::coarse_segment(int order, uint64_t index, uint64_t end,
+    uint64_t &seg_end, bool &edges, bool &value)
+{
+    const uint64_t block = index >> LeafBlockPower;
+    const struct RootNode &rn = _ch_data[order][block / RootScale];
+    const uint64_t pos = block % RootScale;
+
+    seg_end = (block + 1) << LeafBlockPower;
+    if ((rn.tog & (1ULL << pos)) == 0) {
+        edges = false;
+        value = (rn.value >> pos) & 1;
+        return;
+    }
+
+    const uint64_t *leaf = (const uint64_t *)load_lbp(rn.lbp[pos]);
+    if (leaf == NULL) {
+        // a block of a lazily loaded file not read yet
+        edges = true;
+        value = _lazy &&
+                ((_lazy->last[order * ((_lazy->blocks + 63) / 64) + block / 64] >>
+                  (block % 64)) & 1);
+        return;
+    }
+
+    const uint64_t bit = (index & LeafMask) >> CoarsePower;
+    seg_end = (block << LeafBlockPower) + ((bit + 1) << CoarsePower);
+    edges = (leaf[LevelOffset[ScaleLevel - 1]] >> bit) & 1;
+    const uint64_t last = min(seg_end - 1, end) & LeafMask;
+    value = (leaf[last >> ScalePower] >> (last & LevelMask[0])) & 1;
+}
+
 bool LogicSnapshot::get_nxt_edge(
     uint64_t &index, bool last_sample, uint64_t end,
     double min_length, int sig_index)
 {
+    ReadGuard guard(*this);
     if (index > end)
         return false;
 
@@ -598,7 +906,7 @@ bool LogicSnapshot::get_nxt_edge(
             uint64_t cur_tog = _ch_data[order][i].tog & cur_mask;
             if (cur_tog != 0) {
                 uint64_t first_edge_pos = bsf_folded(cur_tog);
-                uint64_t *lbp = (uint64_t *)_ch_data[order][i].lbp[first_edge_pos];
+                uint64_t *lbp = (uint64_t *)get_leaf(order, i, first_edge_pos);
                 uint64_t blk_start = (i << (LeafBlockPower + RootScalePower)) + (first_edge_pos << LeafBlockPower);
                 index = max(blk_start, index);
                 if (min_level < ScaleLevel) {
@@ -624,6 +932,7 @@ bool LogicSnapshot::get_nxt_edge(
 bool LogicSnapshot::get_pre_edge(uint64_t &index, bool last_sample,
     double min_length, int sig_index)
 {
+    ReadGuard guard(*this);
     assert(index < get_sample_count());
 
     int order = get_ch_order(sig_index);
@@ -643,7 +952,7 @@ bool LogicSnapshot::get_pre_edge(uint64_t &index, bool last_sample,
             uint64_t cur_tog = _ch_data[order][i].tog & cur_mask;
             if (cur_tog != 0) {
                 uint64_t first_edge_pos = bsr64(cur_tog);
-                uint64_t *lbp = (uint64_t *)_ch_data[order][i].lbp[first_edge_pos];
+                uint64_t *lbp = (uint64_t *)get_leaf(order, i, first_edge_pos);
                 uint64_t blk_end = ((i << (LeafBlockPower + RootScalePower)) +
                                    (first_edge_pos << LeafBlockPower)) | LeafMask;
                 index = min(blk_end, index);
@@ -859,6 +1168,7 @@ bool LogicSnapshot::block_pre_edge(uint64_t *lbp, uint64_t &index, bool last_sam
 bool LogicSnapshot::pattern_search(int64_t start, int64_t end, bool nxt, int64_t &index,
                     std::map<uint16_t, QString> pattern)
 {
+    ReadGuard guard(*this);
     int start_match_pos = pattern.size() - 1;
     int end_match_pos = 0;
     if (pattern.empty()) {
@@ -1068,6 +1378,93 @@ uint64_t LogicSnapshot::get_block_size(int block_index)
     }
 }
 
+/*
+ * Whether a block has edges, and its last sample, without reading
+ * blocks of lazily loaded captures back. Callers hold a ReadGuard.
+ */
+void LogicSnapshot::get_block_state(int block_index, int sig_index,
+                                    bool &edges, bool &last)
+{
+    const int order = get_ch_order(sig_index);
+    edges = false;
+    last = false;
+    if (order == -1)
+        return;
+
+    const uint64_t index0 = block_index / RootScale;
+    const uint64_t index1 = block_index % RootScale;
+    const struct RootNode &rn = _ch_data[order][index0];
+    edges = (rn.tog >> index1) & 1;
+    if (!edges) {
+        last = (rn.value >> index1) & 1;
+        return;
+    }
+
+    const uint64_t *leaf = (const uint64_t *)load_lbp(rn.lbp[index1]);
+    if (leaf != NULL) {
+        const uint64_t pos = get_block_size(block_index) * 8 - 1;
+        last = (leaf[pos / Scale] >> (pos % Scale)) & 1;
+    } else if (_lazy) {
+        boost::lock_guard<boost::mutex> lock(_lazy->mutex);
+        const uint64_t words = (_lazy->blocks + 63) / 64;
+        last = (_lazy->last[order * words + block_index / 64] >> (block_index % 64)) & 1;
+    }
+}
+
+/*
+ * Samples of several channels as units, with bit k from channel
+ * sig_index[k], as exports and group traces take them.
+ */
+void LogicSnapshot::get_units(uint64_t start, uint64_t count,
+                              const std::vector<int> &sig_index,
+                              uint8_t *out, int unitsize)
+{
+    ReadGuard guard(*this);
+    const size_t channels = sig_index.size();
+    std::vector<int> orders(channels);
+    std::vector<const uint64_t *> planes(channels);
+    std::vector<uint8_t> levels(channels);
+    uint8_t head[Scale * MaxPlanesUnitSize];
+
+    for (size_t k = 0; k < channels; k++)
+        orders[k] = get_ch_order(sig_index[k]);
+
+    while (count > 0) {
+        const uint64_t block = start >> LeafBlockPower;
+        const uint64_t index0 = block / RootScale;
+        const uint64_t index1 = block % RootScale;
+        const uint64_t offset = start & LeafMask;
+        for (size_t k = 0; k < channels; k++) {
+            const int order = orders[k];
+            planes[k] = NULL;
+            levels[k] = 0;
+            if (order == -1 || index0 >= _ch_data[order].size())
+                continue;
+            const uint64_t *leaf = (const uint64_t *)get_leaf(order, index0, index1);
+            if (leaf != NULL)
+                planes[k] = leaf + (offset >> ScalePower);
+            else
+                levels[k] = (_ch_data[order][index0].value >> index1) & 1;
+        }
+
+        // to the end of the block, or of the first word if not aligned
+        const uint64_t skip = offset & LevelMask[0];
+        uint64_t n = LeafBlockSamples - offset;
+        if (skip != 0)
+            n = Scale - skip;
+        n = (count < n) ? count : n;
+        if (skip != 0) {
+            transpose_planes(&planes[0], &levels[0], channels, Scale, head, unitsize);
+            memcpy(out, head + skip * unitsize, n * unitsize);
+        } else {
+            transpose_planes(&planes[0], &levels[0], channels, n, out, unitsize);
+        }
+        out += n * unitsize;
+        start += n;
+        count -= n;
+    }
+}
+
 uint8_t *LogicSnapshot::get_block_buf(int block_index, int sig_index, bool &sample)
 {
     assert(block_index < get_block_num());
@@ -1079,7 +1476,7 @@ uint8_t *LogicSnapshot::get_block_buf(int block_index, int sig_index, bool &samp
     }
     uint64_t index = block_index / RootScale;
     uint8_t pos = block_index % RootScale;
-    uint8_t *lbp = (uint8_t *)_ch_data[order][index].lbp[pos];
+    uint8_t *lbp = (uint8_t *)get_leaf(order, index, pos);
 
     if (lbp == NULL)
         sample = (_ch_data[order][index].value & 1ULL << pos) != 0;
@@ -1087,6 +1484,541 @@ uint8_t *LogicSnapshot::get_block_buf(int block_index, int sig_index, bool &samp
     return lbp;
 }
 
+boost::shared_ptr<LogicSnapshot> LogicSnapshot::detach()
+{
+    // the loader works on this snapshot, not the one that takes _lazy
+    stop_loader();
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    boost::shared_ptr<LogicSnapshot> snapshot(new LogicSnapshot());
+
+    snapshot->_ch_data = _ch_data;
+    snapshot->_ch_index = _ch_index;
+    snapshot->_total_sample_count = _total_sample_count;
+    snapshot->_channel_num = _channel_num;
+    snapshot->_sample_count = _sample_count;
+    snapshot->_ring_sample_count = _ring_sample_count;
+    snapshot->_block_num = _block_num;
+    snapshot->_sample_cnt.swap(_sample_cnt);
+    snapshot->_block_cnt.swap(_block_cnt);
+    snapshot->_ring_sample_cnt.swap(_ring_sample_cnt);
+    snapshot->_last_sample.swap(_last_sample);
+    snapshot->_leaf_loaded = _leaf_loaded;
+    snapshot->_lazy.swap(_lazy);
+    snapshot->_last_ended = true;
+    snapshot->publish();
+
+    // leaves are not copied, they now belong to the new snapshot and
+    // the next capture here allocates its own
+    for(auto& iter:_ch_data) {
+        for(auto& iter_rn:iter) {
+            iter_rn.tog = 0;
+            iter_rn.value = 0;
+            memset(iter_rn.lbp, 0, sizeof(iter_rn.lbp));
+        }
+    }
+    _sample_count = 0;
+    _ring_sample_count = 0;
+    _block_num = 0;
+    _sample_cnt.assign(_channel_num, 0);
+    _block_cnt.assign(_channel_num, 0);
+    _ring_sample_cnt.assign(_channel_num, 0);
+    _last_sample.assign(_channel_num, 0);
+    _generation = ++_generations;
+    publish();
+
+    return snapshot;
+}
+
+uint64_t LogicSnapshot::get_memory_size() const
+{
+    boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+    uint64_t size = 0;
+    for(auto& iter:_ch_data) {
+        size += iter.size() * sizeof(struct RootNode);
+        for(auto& iter_rn:iter) {
+            for (unsigned int k = 0; k < Scale; k++) {
+                if (iter_rn.lbp[k] == NULL)
+                    continue;
+                // mapped leaves live in the page cache
+                if (_mapped_leaves.find(iter_rn.lbp[k]) != _mapped_leaves.end())
+                    continue;
+                // a shared leaf is charged in equal parts to its users
+                std::map<void *, SharedLeaf>::const_iterator i =
+                    _shared_leaves.find(iter_rn.lbp[k]);
+                size += (i == _shared_leaves.end()) ?
+                        LeafBlockSpace : LeafBlockSpace / i->second.refs;
+            }
+        }
+    }
+    return size;
+}
+
+uint64_t LogicSnapshot::get_generation() const
+{
+    return _generation;
+}
+
+void LogicSnapshot::set_leaf_dedup(bool enable)
+{
+    _leaf_dedup = enable;
+}
+
+void LogicSnapshot::get_leaf_dedup(uint64_t &refs, uint64_t &leaves)
+{
+    boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+    refs = _shared_refs;
+    leaves = _shared_leaves.size();
+}
+
+uint64_t LogicSnapshot::get_leaf_samples()
+{
+    return LeafBlockSamples;
+}
+
+uint64_t LogicSnapshot::get_leaf_space()
+{
+    return LeafBlockSpace;
+}
+
+uint64_t LogicSnapshot::get_coarse_samples()
+{
+    return CoarseSamples;
+}
+
+void LogicSnapshot::add_holder(Holder *holder)
+{
+    boost::lock_guard<boost::mutex> lock(_holders_mutex);
+    _holders.push_back(holder);
+}
+
+void LogicSnapshot::remove_holder(Holder *holder)
+{
+    boost::lock_guard<boost::mutex> lock(_holders_mutex);
+    _holders.erase(std::remove(_holders.begin(), _holders.end(), holder),
+                   _holders.end());
+}
+
+/*
+ * The holders are called without the lock, a holder may free snapshots
+ * of its own while this one waits for it.
+ */
+void LogicSnapshot::release_holders() const
+{
+    std::vector<Holder *> holders;
+    {
+        boost::lock_guard<boost::mutex> lock(_holders_mutex);
+        holders = _holders;
+    }
+    BOOST_FOREACH(Holder *h, holders)
+        h->release(this);
+}
+
+void LogicSnapshot::set_lazy_budget(uint64_t bytes)
+{
+    _lazy_budget = bytes;
+}
+
+uint64_t LogicSnapshot::get_lazy_budget()
+{
+    return _lazy_budget;
+}
+
+void LogicSnapshot::set_recording(bool recording)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
+    _recording = recording;
+}
+
+/*
+ * The first blocks of the capture are in the recording, readable with
+ * reader. From now on they are treated like the loaded blocks of a lazy
+ * file: the least recently used ones are dropped to stay within the
+ * lazy budget, and read back when used again. Called by the recorder
+ * while the capture goes on, only for blocks the writer is done with.
+ */
+void LogicSnapshot::recorded(uint64_t blocks, sr_session_reader *reader)
+{
+    LazyLeaves *const lazy = _lazy.get();
+    if (lazy == NULL)
+        return;
+
+    boost::lock_guard<boost::mutex> lock(lazy->mutex);
+    if (reader != lazy->reader) {
+        sr_session_reader_ref(reader);
+        sr_session_reader_unref(lazy->reader);
+        lazy->reader = reader;
+    }
+
+    const uint64_t words = (lazy->blocks + 63) / 64;
+    blocks = std::min(blocks, lazy->blocks);
+    for (uint64_t block = lazy->recorded; block < blocks; block++) {
+        const uint64_t index0 = block / RootScale;
+        const uint64_t index1 = block % RootScale;
+        const uint64_t pos = get_block_size(block) * 8 - 1;
+        for (uint64_t order = 0; order < _ch_data.size(); order++) {
+            const struct RootNode &rn = _ch_data[order][index0];
+            const uint64_t *leaf = (const uint64_t *)rn.lbp[index1];
+            const bool last = (leaf != NULL) ?
+                (leaf[pos / Scale] >> (pos % Scale)) & 1 :
+                (rn.value >> index1) & 1;
+            if (last)
+                lazy->last[order * words + block / 64] |= 1ULL << (block % 64);
+            if (leaf == NULL)
+                continue;
+            lazy->stamps[order * lazy->blocks + block].store(
+                lazy->clock.fetch_add(1, std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+            lazy->loaded.push_back(order * lazy->blocks + block);
+        }
+    }
+    lazy->recorded = std::max(lazy->recorded, blocks);
+
+    // a budget of 0 keeps all blocks in memory, as for files
+    while (_lazy_budget != 0 && !lazy->loaded.empty() &&
+           lazy->loaded.size() * LeafBlockSpace > _lazy_budget)
+        evict_leaf();
+}
+
+void LogicSnapshot::release(void *ptr)
+{
+    free_leaf(ptr);
+}
+
+void *LogicSnapshot::touch_leaf(int order, uint64_t block, void *leaf)
+{
+    if (leaf == NULL && _cached_only != NULL) {
+        if ((_ch_data[order][block / RootScale].tog & (1ULL << (block % RootScale))) == 0)
+            return NULL;
+        _cached_only->_missed = true;
+        queue_leaf(order, block);
+        return constant_leaf(order, block);
+    }
+    if (leaf == NULL)
+        return load_leaf(order, block);
+
+    _lazy->stamps[order * _lazy->blocks + block].store(
+        _lazy->clock.fetch_add(1, std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    return leaf;
+}
+
+/*
+ * Read a block of a lazily loaded file, and calculate its mipmap.
+ * Called by readers, so the leaf is only linked once it is complete.
+ */
+void *LogicSnapshot::load_leaf(int order, uint64_t block)
+{
+    LazyLeaves &lazy = *_lazy;
+    boost::lock_guard<boost::mutex> lock(lazy.mutex);
+
+    const uint64_t index0 = block / RootScale;
+    const uint64_t index1 = block % RootScale;
+    const uint64_t words = (lazy.blocks + 63) / 64;
+    struct RootNode &rn = _ch_data[order][index0];
+    if (rn.lbp[index1] != NULL)
+        return rn.lbp[index1];
+    if ((rn.tog & (1ULL << index1)) == 0)
+        return NULL;
+    if (lazy.failed[order * words + block / 64] & (1ULL << (block % 64)))
+        return constant_leaf(order, block);
+
+    while (!lazy.loaded.empty() &&
+           (lazy.loaded.size() + 1) * LeafBlockSpace > _lazy_budget)
+        evict_leaf();
+
+    const uint64_t block_start = block * LeafBlockSamples;
+    const uint64_t sample_count = max(get_sample_count(), block_start);
+    const uint64_t size = (sample_count - block_start < LeafBlockSamples) ?
+        (sample_count - block_start) / 8 : LeafBlockSamples / 8;
+    uint64_t read = 0;
+    uint64_t *leaf = (uint64_t *)malloc(LeafBlockSpace);
+    if (leaf == NULL ||
+        sr_session_reader_read(lazy.reader, block, _ch_index[order],
+                               SR_CHANNEL_LOGIC, leaf, size, &read) != SR_OK) {
+        // show the block as constant rather than failing every access
+        qDebug() << "Failed to load block" << block << "of channel" << _ch_index[order];
+        free(leaf);
+        lazy.failed[order * words + block / 64] |= 1ULL << (block % 64);
+        return constant_leaf(order, block);
+    }
+    memset((uint8_t *)leaf + read, 0, LeafBlockSpace - read);
+
+    // the first mipmap bit compares with the previous block
+    const uint64_t prev = block - 1;
+    uint64_t last_sample = (block != 0 &&
+        (lazy.last[order * words + prev / 64] & (1ULL << (prev % 64)))) ?
+        ~0ULL : 0ULL;
+    calc_mipmap(leaf, last_sample, read * 8 / Scale * Scale);
+
+    lazy.stamps[order * lazy.blocks + block].store(
+        lazy.clock.fetch_add(1, std::memory_order_relaxed) + 1,
+        std::memory_order_relaxed);
+    lazy.loaded.push_back(order * lazy.blocks + block);
+    store_lbp(rn.lbp[index1], leaf);
+
+    return leaf;
+}
+
+/*
+ * What a block shows while it is not read, or if it could not be: its
+ * last sample throughout, with no edges in the mipmap.
+ */
+void *LogicSnapshot::constant_leaf(int order, uint64_t block)
+{
+    static const bool full_leaf_set =
+        (std::fill(_full_leaf, _full_leaf + LeafBlockSamples / Scale, ~0ULL), true);
+    (void)full_leaf_set;
+
+    const uint64_t words = (_lazy->blocks + 63) / 64;
+    return (_lazy->last[order * words + block / 64] & (1ULL << (block % 64))) ?
+        _full_leaf : _empty_leaf;
+}
+
+/*
+ * Have the loader thread read a block a CachedOnly reader missed.
+ */
+void LogicSnapshot::queue_leaf(int order, uint64_t block)
+{
+    LazyLeaves &lazy = *_lazy;
+    boost::lock_guard<boost::mutex> lock(lazy.mutex);
+
+    const uint64_t bit = (order * ((lazy.blocks + 63) / 64) + block / 64);
+    if (lazy.stop || (lazy.pending[bit] & (1ULL << (block % 64))))
+        return;
+    lazy.pending[bit] |= 1ULL << (block % 64);
+    lazy.queued.push_back(order * lazy.blocks + block);
+    if (lazy.loader.get_id() == boost::thread::id())
+        lazy.loader = boost::thread(&LogicSnapshot::load_proc, this);
+    lazy.wake.notify_one();
+}
+
+void LogicSnapshot::load_proc()
+{
+    LazyLeaves &lazy = *_lazy;
+    const uint64_t words = (lazy.blocks + 63) / 64;
+    boost::unique_lock<boost::mutex> lock(lazy.mutex);
+    for (;;) {
+        while (!lazy.stop && lazy.queued.empty())
+            lazy.wake.wait(lock);
+        if (lazy.stop)
+            break;
+
+        const uint64_t next = lazy.queued.front();
+        lazy.queued.pop_front();
+        const int order = next / lazy.blocks;
+        const uint64_t block = next % lazy.blocks;
+        lazy.pending[order * words + block / 64] &= ~(1ULL << (block % 64));
+
+        lock.unlock();
+        {
+            ReadGuard guard(*this);
+            if (block * LeafBlockSamples < get_sample_count())
+                load_leaf(order, block);
+        }
+        lock.lock();
+    }
+}
+
+/*
+ * Called before _lazy is dropped or moved, never with lazy.mutex held.
+ */
+void LogicSnapshot::stop_loader()
+{
+    LazyLeaves *const lazy = _lazy.get();
+    if (lazy == NULL)
+        return;
+
+    {
+        boost::lock_guard<boost::mutex> lock(lazy->mutex);
+        lazy->stop = true;
+        lazy->queued.clear();
+        std::fill(lazy->pending.begin(), lazy->pending.end(), 0);
+        lazy->wake.notify_one();
+    }
+    if (lazy->loader.joinable())
+        lazy->loader.join();
+
+    boost::lock_guard<boost::mutex> lock(lazy->mutex);
+    lazy->loader = boost::thread();
+    lazy->stop = false;
+}
+
+/*
+ * Unlink the least recently used block. Readers may still hold it, it
+ * is freed by readers_left() once they have left.
+ */
+void LogicSnapshot::evict_leaf()
+{
+    LazyLeaves &lazy = *_lazy;
+    std::vector<uint64_t>::iterator oldest = lazy.loaded.begin();
+    for (std::vector<uint64_t>::iterator i = lazy.loaded.begin();
+         i != lazy.loaded.end(); i++) {
+        if (lazy.stamps[*i].load(std::memory_order_relaxed) <
+            lazy.stamps[*oldest].load(std::memory_order_relaxed))
+            oldest = i;
+    }
+
+    const uint64_t order = *oldest / lazy.blocks;
+    const uint64_t block = *oldest % lazy.blocks;
+    void *&lbp = _ch_data[order][block / RootScale].lbp[block % RootScale];
+    void *const leaf = lbp;
+    store_lbp(lbp, NULL);
+    lazy.evicted.push_back(std::make_pair(retire_epoch(), leaf));
+    *oldest = lazy.loaded.back();
+    lazy.loaded.pop_back();
+    lazy.has_evicted.store(true, std::memory_order_relaxed);
+}
+
+void LogicSnapshot::readers_left() const
+{
+    LazyLeaves *const lazy = _lazy.get();
+    if (lazy == NULL || !lazy->has_evicted.load(std::memory_order_relaxed))
+        return;
+
+    boost::unique_lock<boost::mutex> lock(lazy->mutex, boost::try_to_lock);
+    if (!lock.owns_lock())
+        return;
+
+    // evicted in order, so the oldest are freed first; recorded blocks
+    // may be shared leaves of the capture
+    std::vector< std::pair<uint32_t, void *> >::iterator i = lazy->evicted.begin();
+    while (i != lazy->evicted.end() && grace_passed(i->first))
+        free_leaf((i++)->second);
+    lazy->evicted.erase(lazy->evicted.begin(), i);
+    lazy->has_evicted.store(!lazy->evicted.empty(), std::memory_order_relaxed);
+}
+
+/*
+ * Stop loading lazily: loaded blocks stay, as ordinary leaves, and the
+ * evicted ones are freed with the writer's retired memory.
+ */
+void LogicSnapshot::drop_lazy()
+{
+    if (!_lazy)
+        return;
+
+    stop_loader();
+    {
+        boost::lock_guard<boost::mutex> lock(_lazy->mutex);
+        for (size_t i = 0; i < _lazy->evicted.size(); i++)
+            retire(_lazy->evicted[i].second);
+        _lazy->evicted.clear();
+    }
+    _lazy.reset();
+}
+
+/*
+ * Get a leaf the next block can be written to. Leaves from an earlier
+ * capture are reused, unless they are shared or mapped and so read-only.
+ */
+void *LogicSnapshot::alloc_leaf(void *leaf)
+{
+    if (leaf != NULL) {
+        bool shared;
+        {
+            boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+            shared = (_shared_leaves.find(leaf) != _shared_leaves.end()) ||
+                     (_mapped_leaves.find(leaf) != _mapped_leaves.end());
+        }
+        if (shared) {
+            retire(leaf);
+            leaf = NULL;
+        }
+    }
+    return (leaf != NULL) ? leaf : malloc(LeafBlockSpace);
+}
+
+/*
+ * Content-addressed sharing of completed leaves: clock lines and periodic
+ * signals repeat byte-identical leaves across channels and captures.
+ * The leaf (data and mipmap) is hashed, and if an identical one is
+ * already pooled, that one is referenced instead.
+ */
+void LogicSnapshot::share_leaf(void *&leaf)
+{
+    if (!_leaf_dedup)
+        return;
+
+    const uint64_t *ptr = (const uint64_t *)leaf;
+    const uint64_t *const end = ptr + LeafBlockSpace / sizeof(uint64_t);
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (ptr < end)
+        hash = (hash ^ *ptr++) * 0x100000001b3ULL;
+
+    boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+    std::pair<std::multimap<uint64_t, void *>::iterator,
+              std::multimap<uint64_t, void *>::iterator> range =
+        _leaf_pool.equal_range(hash);
+    for (std::multimap<uint64_t, void *>::iterator i = range.first;
+         i != range.second; i++) {
+        if (i->second != leaf &&
+            memcmp(i->second, leaf, LeafBlockSpace) == 0) {
+            _shared_leaves[i->second].refs++;
+            _shared_refs++;
+            void *dup = leaf;
+            leaf = i->second;
+            retire(dup);
+            return;
+        }
+    }
+
+    _leaf_pool.insert(std::make_pair(hash, leaf));
+    SharedLeaf shared = {hash, 1};
+    _shared_leaves[leaf] = shared;
+    _shared_refs++;
+}
+
+void LogicSnapshot::free_leaf(void *leaf)
+{
+    if (leaf == NULL)
+        return;
+
+    {
+        boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+        std::map<void *, GMappedFile *>::iterator m = _mapped_leaves.find(leaf);
+        if (m != _mapped_leaves.end()) {
+            g_mapped_file_unref(m->second);
+            _mapped_leaves.erase(m);
+            return;
+        }
+        std::map<void *, SharedLeaf>::iterator i = _shared_leaves.find(leaf);
+        if (i != _shared_leaves.end()) {
+            _shared_refs--;
+            if (--i->second.refs != 0)
+                return;
+            std::pair<std::multimap<uint64_t, void *>::iterator,
+                      std::multimap<uint64_t, void *>::iterator> range =
+                _leaf_pool.equal_range(i->second.hash);
+            for (std::multimap<uint64_t, void *>::iterator j = range.first;
+                 j != range.second; j++) {
+                if (j->second == leaf) {
+                    _leaf_pool.erase(j);
+                    break;
+                }
+            }
+            _shared_leaves.erase(i);
+        }
+    }
+    free(leaf);
+}
+
+/*
+ * Use a leaf of a mapped session file in place. Each use holds a
+ * reference to the mapping, so it outlives the device that loaded it.
+ * A mapped leaf has a single user, free_leaf() drops its entry.
+ */
+void *LogicSnapshot::map_leaf(const void *leaf, GMappedFile *mapping)
+{
+    void *ptr = const_cast<void *>(leaf);
+    boost::lock_guard<boost::mutex> lock(_leaf_pool_mutex);
+    std::map<void *, GMappedFile *>::iterator m = _mapped_leaves.find(ptr);
+    assert(m == _mapped_leaves.end());
+    if (m != _mapped_leaves.end())
+        g_mapped_file_unref(m->second);
+    _mapped_leaves[ptr] = g_mapped_file_ref(mapping);
+    return ptr;
+}
+
 int LogicSnapshot::get_ch_order(int sig_index)
 {
     uint16_t order = 0;
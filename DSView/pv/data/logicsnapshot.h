@@ -30,6 +30,14 @@
 
 #include <QString>
 
+#include <boost/scoped_array.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <atomic>
+#include <deque>
+#include <map>
 #include <utility>
 #include <vector>
 
@@ -39,6 +47,7 @@ class Basic;
 class LargeData;
 class Pulses;
 class LongPulses;
+class Detach;
 }
 
 namespace pv {
@@ -60,6 +69,10 @@ private:
     static const uint64_t LeafBlockSamples = 1 << LeafBlockPower;
     static const uint64_t RootNodeSamples = LeafBlockSamples*RootScale;
 
+    // the coarsest mipmap level, a bit per CoarseSamples
+    static const uint64_t CoarsePower = (ScaleLevel - 1)*ScalePower;
+    static const uint64_t CoarseSamples = 1 << CoarsePower;
+
     static const uint64_t RootMask = ~(~0ULL << RootScalePower) << LeafBlockPower;
     static const uint64_t LeafMask = ~(~0ULL << LeafBlockPower);
     static const uint64_t LevelMask[ScaleLevel];
@@ -88,6 +101,7 @@ public:
 
 	void append_payload(const sr_datafeed_logic &logic);
 
+    // during capture, hold a ReadGuard for as long as the block is used
     const uint8_t * get_samples(uint64_t start_sample, uint64_t& end_sample, int sig_index);
 
     bool get_sample(uint64_t index, int sig_index);
@@ -100,6 +114,15 @@ public:
                            uint16_t max_togs, double pixels_offset,
                            double min_length, uint16_t sig_index);
 
+    // a preview of get_display_edges() from the mipmap alone, which
+    // neither reads the samples nor loads the blocks of lazily loaded
+    // files, for at least get_coarse_samples() samples per pixel
+    bool get_coarse_edges(std::vector<std::pair<bool, bool>> &edges,
+                          std::vector<std::pair<uint16_t, bool>> &togs,
+                          uint64_t start, uint64_t end, uint16_t width,
+                          uint16_t max_togs, double pixels_offset,
+                          double min_length, uint16_t sig_index);
+
     bool get_nxt_edge(uint64_t &index, bool last_sample, uint64_t end,
                       double min_length, int sig_index);
 
@@ -110,16 +133,127 @@ public:
     int get_block_num();
     uint64_t get_block_size(int block_index);
     uint8_t *get_block_buf(int block_index, int sig_index, bool &sample);
+    void get_block_state(int block_index, int sig_index, bool &edges, bool &last);
+    void get_units(uint64_t start, uint64_t count,
+                   const std::vector<int> &sig_index,
+                   uint8_t *out, int unitsize);
 
     bool pattern_search(int64_t start, int64_t end, bool nxt, int64_t& index,
                         std::map<uint16_t, QString> pattern);
 
+    // capture history: move the finished capture's leaves into a new snapshot
+    boost::shared_ptr<LogicSnapshot> detach();
+    uint64_t get_memory_size() const;
+
+    // changes whenever the samples are reset, never the same for two captures
+    uint64_t get_generation() const;
+
+    // leaf deduplication, shared by all logic snapshots;
+    // disabling it only stops new leaves from being pooled
+    static void set_leaf_dedup(bool enable);
+    static void get_leaf_dedup(uint64_t &refs, uint64_t &leaves);
+
+    // leaf geometry, for files that store leaves as they are
+    static uint64_t get_leaf_samples();
+    static uint64_t get_leaf_space();
+    static uint64_t get_coarse_samples();
+
+    /**
+     * While in scope, blocks of lazily loaded files that are not in
+     * memory are not read by this thread: they are queued for a
+     * background loader and show as constant meanwhile. For the paint
+     * path, which tries again later if missed() is set.
+     */
+    class CachedOnly
+    {
+    public:
+        CachedOnly();
+        ~CachedOnly();
+
+        bool missed() const;
+
+    private:
+        CachedOnly *const _outer;
+        bool _missed;
+
+        friend class LogicSnapshot;
+    };
+
+    /**
+     * A reader that walks snapshots outside of the writer's control,
+     * such as the view's render thread. Before the data of a snapshot
+     * is freed, release() is called from the freeing thread: the holder
+     * stops reading the snapshot and returns once it is done with it.
+     */
+    class Holder
+    {
+    public:
+        virtual ~Holder() {}
+        virtual void release(const LogicSnapshot *snapshot) = 0;
+    };
+
+    static void add_holder(Holder *holder);
+    static void remove_holder(Holder *holder);
+
+    // memory for the blocks of lazily loaded files, 0 loads files at once
+    static void set_lazy_budget(uint64_t bytes);
+    static uint64_t get_lazy_budget();
+
+    // recording to disk: recorded blocks are dropped from memory beyond
+    // the lazy budget, and read back from the recording when used
+    void set_recording(bool recording);
+    void recorded(uint64_t blocks, sr_session_reader *reader);
+
+protected:
+    void release(void *ptr);
+    void readers_left() const;
+
 private:
     int get_ch_order(int sig_index);
-    void calc_mipmap(unsigned int order, uint8_t index0, uint8_t index1, uint64_t samples);
+    void calc_mipmap(unsigned int order, uint64_t index0, uint64_t index1, uint64_t samples);
 
     void append_cross_payload(const sr_datafeed_logic &logic);
     void append_split_payload(const sr_datafeed_logic &logic);
+    void append_leaf_payload(const sr_datafeed_logic &logic);
+
+    // the leaves of lazily loaded blocks are linked and unlinked while
+    // readers walk the root nodes
+    static inline void *load_lbp(void *const &lbp)
+    {
+        return __atomic_load_n(&lbp, __ATOMIC_ACQUIRE);
+    }
+    static inline void store_lbp(void *&lbp, void *leaf)
+    {
+        __atomic_store_n(&lbp, leaf, __ATOMIC_RELEASE);
+    }
+
+    // the leaf of a block, read from the file first if loaded lazily
+    inline void *get_leaf(int order, uint64_t index0, uint64_t index1)
+    {
+        if (!_lazy)
+            return _ch_data[order][index0].lbp[index1];
+        void *leaf = load_lbp(_ch_data[order][index0].lbp[index1]);
+        return touch_leaf(order, index0 * RootScale + index1, leaf);
+    }
+    void *touch_leaf(int order, uint64_t block, void *leaf);
+    void *load_leaf(int order, uint64_t block);
+    void *constant_leaf(int order, uint64_t block);
+    void queue_leaf(int order, uint64_t block);
+    void load_proc();
+    void stop_loader();
+    void evict_leaf();
+    void drop_lazy();
+    void release_holders() const;
+    static void calc_mipmap(uint64_t *leaf, uint64_t &last_sample, uint64_t samples);
+
+    void *alloc_leaf(void *leaf);
+    void share_leaf(void *&leaf);
+    static void free_leaf(void *leaf);
+    static void *map_leaf(const void *leaf, GMappedFile *mapping);
+
+    bool coarse_sample(int order, uint64_t index);
+    void coarse_segment(int order, uint64_t index, uint64_t end,
+                        uint64_t &seg_end, bool &edges, bool &value);
 
     bool block_nxt_edge(uint64_t *lbp, uint64_t &index, uint64_t block_end, bool last_sample,
                         unsigned int min_level);
@@ -190,12 +324,64 @@ private:
     std::vector<uint64_t> _block_cnt;
     std::vector<uint64_t> _ring_sample_cnt;
     std::vector<uint64_t> _last_sample;
+    bool _leaf_loaded;
+    bool _recording;
+    std::atomic<uint64_t> _generation;
+    static std::atomic<uint64_t> _generations;
+
+    struct SharedLeaf
+    {
+        uint64_t hash;
+        uint64_t refs;
+    };
+    static std::atomic<bool> _leaf_dedup;
+    static boost::mutex _leaf_pool_mutex;
+    static std::multimap<uint64_t, void *> _leaf_pool;
+    static std::map<void *, SharedLeaf> _shared_leaves;
+    static uint64_t _shared_refs;
+    static std::map<void *, GMappedFile *> _mapped_leaves;
+
+    static boost::mutex _holders_mutex;
+    static std::vector<Holder *> _holders;
+
+    // blocks of a lazily loaded file, read when first used, and the
+    // least recently used ones dropped to stay within _lazy_budget
+    struct LazyLeaves
+    {
+        LazyLeaves(sr_session_reader *reader, uint64_t channels, uint64_t blocks);
+        ~LazyLeaves();
+
+        sr_session_reader *reader;
+        uint64_t blocks;
+        uint64_t recorded;
+        std::vector<uint64_t> last;
+        boost::scoped_array<std::atomic<uint64_t>> stamps;
+        std::atomic<uint64_t> clock;
+        boost::mutex mutex;
+        std::vector<uint64_t> loaded;
+        std::vector< std::pair<uint32_t, void *> > evicted;
+        std::atomic<bool> has_evicted;
+        // blocks that could not be read, shown as constant
+        std::vector<uint64_t> failed;
+        // blocks missed by CachedOnly readers, for the loader thread
+        std::deque<uint64_t> queued;
+        std::vector<uint64_t> pending;
+        boost::condition_variable wake;
+        boost::thread loader;
+        bool stop;
+    };
+    boost::shared_ptr<LazyLeaves> _lazy;
+    static uint64_t _lazy_budget;
+    static uint64_t _empty_leaf[LeafBlockSpace / sizeof(uint64_t)];
+    static uint64_t _full_leaf[LeafBlockSpace / sizeof(uint64_t)];
+    static thread_local CachedOnly *_cached_only;
 
 	friend class LogicSnapshotTest::Pow2;
 	friend class LogicSnapshotTest::Basic;
 	friend class LogicSnapshotTest::LargeData;
 	friend class LogicSnapshotTest::Pulses;
 	friend class LogicSnapshotTest::LongPulses;
+	friend class LogicSnapshotTest::Detach;
 };
 
 } // namespace data
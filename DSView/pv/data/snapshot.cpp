@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <boost/foreach.hpp>
+
 using namespace boost;
 
 namespace pv {
@@ -43,8 +45,14 @@ Snapshot::Snapshot(int unit_size, uint64_t total_sample_count, unsigned int chan
     _ring_sample_count(0),
     _unit_size(unit_size),
     _memory_failed(false),
-    _last_ended(true)
+    _last_ended(true),
+    _pub_seq(0),
+    _pub_sample_count(0),
+    _pub_ring_sample_count(0),
+    _epoch(0)
 {
+    _readers[0] = 0;
+    _readers[1] = 0;
     assert(_unit_size > 0);
     _unit_bytes = 1;
     _unit_pitch = 0;
@@ -53,6 +61,7 @@ Snapshot::Snapshot(int unit_size, uint64_t total_sample_count, unsigned int chan
 Snapshot::~Snapshot()
 {
     free_data();
+    reclaim(true);
 }
 
 void Snapshot::free_data()
@@ -64,6 +73,109 @@ void Snapshot::free_data()
         _sample_count = 0;
     }
     _ch_index.clear();
+    publish();
+}
+
+/*
+ * A reader that enters late in an old epoch's slot only reads after the
+ * epoch moved on, so it sees what was unlinked before and is counted
+ * with the newer readers.
+ */
+Snapshot::ReadGuard::ReadGuard(const Snapshot &snapshot) :
+    _snapshot(snapshot),
+    _slot(snapshot._epoch.load() & 1)
+{
+    _snapshot._readers[_slot].fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+Snapshot::ReadGuard::~ReadGuard()
+{
+    if (_snapshot._readers[_slot].fetch_sub(1, std::memory_order_release) == 1)
+        _snapshot.readers_left();
+}
+
+/**
+ * Make the writer's sample counts, and all data written below them,
+ * visible to lock-free readers. Called by the writer at the end of
+ * each payload and whenever the counts are reset.
+ */
+void Snapshot::publish()
+{
+    const uint32_t seq = _pub_seq.load(std::memory_order_relaxed);
+    _pub_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    _pub_sample_count.store(_sample_count, std::memory_order_relaxed);
+    _pub_ring_sample_count.store(_ring_sample_count, std::memory_order_relaxed);
+    _pub_seq.store(seq + 2, std::memory_order_release);
+
+    reclaim(false);
+}
+
+/**
+ * Free ptr once no reader can still hold it. The caller has already
+ * unlinked it, so readers arriving later can not find it any more.
+ */
+void Snapshot::retire(void *ptr)
+{
+    if (ptr)
+        _retired.push_back(std::make_pair(retire_epoch(), ptr));
+}
+
+void Snapshot::reclaim(bool force)
+{
+    while (!_retired.empty() &&
+           (force || grace_passed(_retired.front().first))) {
+        release(_retired.front().second);
+        _retired.pop_front();
+    }
+}
+
+void Snapshot::release(void *ptr)
+{
+    free(ptr);
+}
+
+bool Snapshot::has_readers() const
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return _readers[0].load(std::memory_order_relaxed) != 0 ||
+           _readers[1].load(std::memory_order_relaxed) != 0;
+}
+
+/**
+ * The epoch to tag memory with, called after it has been unlinked.
+ * Pairs with the fence in ReadGuard: a reader we miss here will see the
+ * unlinked pointers.
+ */
+uint32_t Snapshot::retire_epoch() const
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return _epoch.load(std::memory_order_relaxed);
+}
+
+/**
+ * Whether memory tagged with epoch can be freed. The epoch moves on
+ * whenever the slot of the epoch before the current one is empty, so
+ * once it is two ahead of the tag, every reader that could see the
+ * memory has left.
+ */
+bool Snapshot::grace_passed(uint32_t epoch) const
+{
+    for (int i = 0; i < 2; i++) {
+        uint32_t cur = _epoch.load();
+        if (cur - epoch >= 2)
+            return true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_readers[(cur + 1) & 1].load(std::memory_order_relaxed) != 0)
+            return false;
+        _epoch.compare_exchange_strong(cur, cur + 1);
+    }
+    return _epoch.load() - epoch >= 2;
+}
+
+void Snapshot::readers_left() const
+{
 }
 
 bool Snapshot::memory_failed() const
@@ -89,30 +201,45 @@ void Snapshot::set_last_ended(bool ended)
     _last_ended = ended;
 }
 
+void Snapshot::get_published(uint64_t &sample_count, uint64_t &ring_sample_count) const
+{
+    uint32_t seq0, seq1;
+    do {
+        seq0 = _pub_seq.load(std::memory_order_acquire);
+        sample_count = _pub_sample_count.load(std::memory_order_relaxed);
+        ring_sample_count = _pub_ring_sample_count.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        seq1 = _pub_seq.load(std::memory_order_relaxed);
+    } while ((seq0 & 1) || seq0 != seq1);
+}
+
 uint64_t Snapshot::get_sample_count() const
 {
-    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
-    return _sample_count;
+    uint64_t sample_count, ring_sample_count;
+    get_published(sample_count, ring_sample_count);
+    return sample_count;
 }
 
 uint64_t Snapshot::get_ring_start() const
 {
-    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
-    if (_sample_count < _total_sample_count)
+    uint64_t sample_count, ring_sample_count;
+    get_published(sample_count, ring_sample_count);
+    if (sample_count < _total_sample_count)
         return 0;
     else
-        return _ring_sample_count;
+        return ring_sample_count;
 }
 
 uint64_t Snapshot::get_ring_end() const
 {
-    boost::lock_guard<boost::recursive_mutex> lock(_mutex);
-    if (_sample_count == 0)
+    uint64_t sample_count, ring_sample_count;
+    get_published(sample_count, ring_sample_count);
+    if (sample_count == 0)
         return 0;
-    else if (_ring_sample_count == 0)
+    else if (ring_sample_count == 0)
         return _total_sample_count - 1;
     else
-        return _ring_sample_count - 1;
+        return ring_sample_count - 1;
 }
 
 const void* Snapshot::get_data() const
@@ -135,6 +262,11 @@ unsigned int Snapshot::get_channel_num() const
     return _channel_num;
 }
 
+boost::recursive_mutex &Snapshot::get_mutex() const
+{
+    return _mutex;
+}
+
 void Snapshot::capture_ended()
 {
     set_last_ended(true);
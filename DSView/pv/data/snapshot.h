@@ -25,11 +25,35 @@
 
 #include <boost/thread.hpp>
 
+#include <atomic>
+#include <deque>
+#include <utility>
+#include <vector>
+
 namespace pv {
 namespace data {
 
 class Snapshot
 {
+public:
+    /**
+     * Readers walk snapshot memory without taking the lock. Hold a
+     * ReadGuard while doing so, and memory the writer retires meanwhile
+     * (e.g. trimmed logic leaves) is kept until the reader has left.
+     * Readers are counted per epoch, so memory is freed once the readers
+     * that could see it have left, even while newer readers overlap.
+     */
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const Snapshot &snapshot);
+        ~ReadGuard();
+
+    private:
+        const Snapshot &_snapshot;
+        unsigned int _slot;
+    };
+
 public:
     Snapshot(int unit_size, uint64_t total_sample_count, unsigned int channel_num);
 
@@ -39,6 +63,7 @@ public:
     virtual void init() = 0;
 
 	uint64_t get_sample_count() const;
+    void get_published(uint64_t &sample_count, uint64_t &ring_sample_count) const;
     uint64_t get_ring_start() const;
     uint64_t get_ring_end() const;
 
@@ -55,6 +80,9 @@ public:
 
     unsigned int get_channel_num() const;
 
+    // held by readers off the GUI thread, the data is not freed meanwhile
+    boost::recursive_mutex &get_mutex() const;
+
     virtual void capture_ended();
     virtual bool has_data(int index) = 0;
     virtual int get_block_num() = 0;
@@ -63,6 +91,19 @@ public:
 protected:
     virtual void free_data();
 
+    // writer side of the lock-free reader access
+    void publish();
+    void retire(void *ptr);
+    void reclaim(bool force);
+    virtual void release(void *ptr);
+
+    // reader side: memory unlinked by readers themselves is tagged with
+    // retire_epoch() and can be freed once grace_passed() the tag
+    bool has_readers() const;
+    uint32_t retire_epoch() const;
+    bool grace_passed(uint32_t epoch) const;
+    virtual void readers_left() const;
+
 protected:
     mutable boost::recursive_mutex _mutex;
 
@@ -80,6 +121,15 @@ protected:
     uint16_t _unit_pitch;
     bool _memory_failed;
     bool _last_ended;
+
+private:
+    // sample counts as last published, guarded by a sequence counter
+    std::atomic<uint32_t> _pub_seq;
+    std::atomic<uint64_t> _pub_sample_count;
+    std::atomic<uint64_t> _pub_ring_sample_count;
+    mutable std::atomic<uint32_t> _epoch;
+    mutable std::atomic<int> _readers[2];
+    std::deque< std::pair<uint32_t, void *> > _retired;
 };
 
 } // namespace data
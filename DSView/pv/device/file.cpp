@@ -45,7 +45,7 @@ QString File::format_device_title() const
     return fi.fileName();
 }
 
-File* File::create(QString name)
+File* File::create(QString name, const QMap<QString, QString> &options)
 {
     if (sr_session_load(name.toUtf8().data()) == SR_OK) {
 		GSList *devlist = NULL;
@@ -63,7 +63,7 @@ File* File::create(QString name)
 		}
 	}
 
-    return new InputFile(name);
+    return new InputFile(name, options);
 }
 
 QJsonArray File::get_decoders()
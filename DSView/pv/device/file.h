@@ -27,6 +27,7 @@
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QFile>
+#include <QMap>
 
 #include "devinst.h"
 
@@ -39,7 +40,8 @@ protected:
     File(QString path);
 
 public:
-    static File* create(QString name);
+    static File* create(QString name,
+        const QMap<QString, QString> &options = QMap<QString, QString>());
 
     QJsonArray get_decoders();
 
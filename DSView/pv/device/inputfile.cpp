@@ -23,6 +23,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <string.h>
+
+#include <QFileInfo>
 
 #include "inputfile.h"
 
@@ -31,8 +34,9 @@ using std::string;
 namespace pv {
 namespace device {
 
-InputFile::InputFile(QString path) :
+InputFile::InputFile(QString path, const QMap<QString, QString> &options) :
 	File(path),
+	_options(options),
 	_input(NULL)
 {
 }
@@ -45,21 +49,22 @@ sr_dev_inst* InputFile::dev_inst() const
 
 void InputFile::use(SigSession *owner)
 {
-    (void)owner;
 	assert(!_input);
 
-    // only *.dsl file is valid
-    // don't allow other types of file input
-    throw tr("Not a valid DSView data file.");
-    return;
+    // imports are loaded by the session, like *.dsl files, so only
+    // the input modules that can be fed from its loop are allowed
+    sr_input_format *const format = determine_input_file_format(_path);
+    if (!format || !format->receive)
+        throw tr("Not a valid DSView data file.");
+
+    _input = load_input_file_format(_path, format, _options);
 
-//	_input = load_input_file_format(_path, NULL);
-//	File::use(owner);
+	sr_session_new();
 
-//	sr_session_new();
+	if (sr_session_dev_add(_input->sdi) != SR_OK)
+		throw tr("Failed to add session device.");
 
-//	if (sr_session_dev_add(_input->sdi) != SR_OK)
-//		throw tr("Failed to add session device.");
+	File::use(owner);
 }
 
 void InputFile::release()
@@ -70,10 +75,23 @@ void InputFile::release()
 	assert(_input);
 	File::release();
 	sr_dev_close(_input->sdi);
+	sr_dev_clear(_input->sdi->driver);
 	sr_session_destroy();
+	if (_input->param)
+		g_hash_table_destroy(_input->param);
+	delete _input;
 	_input = NULL;
 }
 
+bool InputFile::is_raw(const QString filename)
+{
+	if (QFileInfo(filename).suffix().compare("dsl", Qt::CaseInsensitive) == 0)
+		return false;
+
+	sr_input_format *const format = determine_input_file_format(filename);
+	return format && strcmp(format->id, "binary") == 0;
+}
+
 sr_input_format* InputFile::determine_input_file_format(const QString filename)
 {
 	int i;
@@ -101,7 +119,7 @@ sr_input_format* InputFile::determine_input_file_format(const QString filename)
 }
 
 sr_input* InputFile::load_input_file_format(const QString filename,
-	sr_input_format *format)
+	sr_input_format *format, const QMap<QString, QString> &options)
 {
 	struct stat st;
 	sr_input *in;
@@ -122,25 +140,25 @@ sr_input* InputFile::load_input_file_format(const QString filename,
 
 	in->format = format;
 	in->param = NULL;
+	in->sdi = NULL;
+	in->internal = NULL;
+	if (!options.isEmpty()) {
+		in->param = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		for (QMap<QString, QString>::const_iterator i = options.begin();
+			i != options.end(); i++)
+			g_hash_table_insert(in->param, g_strdup(i.key().toUtf8().data()),
+				g_strdup(i.value().toUtf8().data()));
+	}
 	if (in->format->init &&
         in->format->init(in, filename.toUtf8().data()) != SR_OK) {
+		if (in->param)
+			g_hash_table_destroy(in->param);
+		delete in;
 		throw tr("Failed to load file");
 	}
 
 	return in;
 }
 
-void InputFile::start()
-{
-}
-
-void InputFile::run()
-{
-	assert(_input);
-	assert(_input->format);
-	assert(_input->format->loadfile);
-    _input->format->loadfile(_input, _path.toUtf8().data());
-}
-
 } // device
 } // pv
@@ -26,6 +26,8 @@
 
 #include <string>
 
+#include <QMap>
+
 struct sr_input;
 struct sr_input_format;
 
@@ -35,18 +37,20 @@ namespace device {
 class InputFile : public File
 {
 public:
-    InputFile(QString path);
+    InputFile(QString path, const QMap<QString, QString> &options);
 
 	sr_dev_inst* dev_inst() const;
 
+	/**
+	 * Whether only the raw binary input takes the file, which has no
+	 * header, so that its layout has to be given in the options.
+	 */
+	static bool is_raw(const QString filename);
+
     virtual void use(SigSession *owner);
 
 	virtual void release();
 
-	virtual void start();
-
-	virtual void run();
-
 private:
 	/**
 	 * Attempts to autodetect the format. Failing that
@@ -58,8 +62,9 @@ private:
         const QString filename);
 
     static sr_input* load_input_file_format(const QString filename,
-		sr_input_format *format);
+		sr_input_format *format, const QMap<QString, QString> &options);
 private:
+	const QMap<QString, QString> _options;
 	sr_input *_input;
 };
 
@@ -0,0 +1,120 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2017 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#include "preferences.h"
+
+#include <QGridLayout>
+#include <QSettings>
+#include <QApplication>
+
+#include "../data/logicsnapshot.h"
+#include "../storesession.h"
+#include "../view/view.h"
+
+namespace pv {
+namespace dialogs {
+
+Preferences::Preferences(SigSession &session, QWidget *parent) :
+    DSDialog(parent),
+    _session(session),
+    _button_box(QDialogButtonBox::Ok | QDialogButtonBox::Cancel,
+        Qt::Horizontal, this)
+{
+    setMinimumWidth(300);
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+
+    _history_depth_spinBox = new QSpinBox(this);
+    _history_depth_spinBox->setRange(0, 256);
+    _history_depth_spinBox->setValue(
+        settings.value("HistoryDepth", SigSession::HistoryDepth).toInt());
+
+    _history_budget_spinBox = new QSpinBox(this);
+    _history_budget_spinBox->setRange(0, 1 << 20);
+    _history_budget_spinBox->setSingleStep(64);
+    _history_budget_spinBox->setSuffix(" MiB");
+    _history_budget_spinBox->setValue(
+        settings.value("HistoryBudget", SigSession::HistoryBudget >> 20).toInt());
+
+    _leaf_dedup_checkBox = new QCheckBox(this);
+    _leaf_dedup_checkBox->setChecked(settings.value("LeafDedup", true).toBool());
+
+    _compress_level_spinBox = new QSpinBox(this);
+    _compress_level_spinBox->setRange(1, 9);
+    _compress_level_spinBox->setValue(
+        settings.value("SaveCompressionLevel", StoreSession::Compress_Level).toInt());
+
+    _max_fps_spinBox = new QSpinBox(this);
+    _max_fps_spinBox->setRange(1, 1000);
+    _max_fps_spinBox->setSuffix(" FPS");
+    _max_fps_spinBox->setValue(
+        settings.value("MaxFps", view::View::MaxFps).toInt());
+
+    _show_fps_checkBox = new QCheckBox(this);
+    _show_fps_checkBox->setChecked(settings.value("ShowFps", false).toBool());
+
+    QGridLayout *glayout = new QGridLayout(this);
+    glayout->addWidget(new QLabel(tr("Repetitive history captures: "), this), 0, 0);
+    glayout->addWidget(_history_depth_spinBox, 0, 1);
+    glayout->addWidget(new QLabel(tr("Repetitive history memory: "), this), 1, 0);
+    glayout->addWidget(_history_budget_spinBox, 1, 1);
+    glayout->addWidget(new QLabel(tr("Share identical sample blocks: "), this), 2, 0);
+    glayout->addWidget(_leaf_dedup_checkBox, 2, 1);
+    glayout->addWidget(new QLabel(tr("Save compression level: "), this), 3, 0);
+    glayout->addWidget(_compress_level_spinBox, 3, 1);
+    glayout->addWidget(new QLabel(tr("Maximum frame rate: "), this), 4, 0);
+    glayout->addWidget(_max_fps_spinBox, 4, 1);
+    glayout->addWidget(new QLabel(tr("Show frame rate: "), this), 5, 0);
+    glayout->addWidget(_show_fps_checkBox, 5, 1);
+    glayout->addWidget(&_button_box, 6, 1);
+
+    layout()->addLayout(glayout);
+    setTitle(tr("Preferences"));
+
+    connect(&_button_box, SIGNAL(accepted()), this, SLOT(accept()));
+    connect(&_button_box, SIGNAL(rejected()), this, SLOT(reject()));
+}
+
+void Preferences::accept()
+{
+    using namespace Qt;
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    settings.setValue("HistoryDepth", _history_depth_spinBox->value());
+    settings.setValue("HistoryBudget", _history_budget_spinBox->value());
+    settings.setValue("LeafDedup", _leaf_dedup_checkBox->isChecked());
+    data::LogicSnapshot::set_leaf_dedup(_leaf_dedup_checkBox->isChecked());
+    settings.setValue("SaveCompressionLevel", _compress_level_spinBox->value());
+    settings.setValue("MaxFps", _max_fps_spinBox->value());
+    view::View::set_max_fps(_max_fps_spinBox->value());
+    settings.setValue("ShowFps", _show_fps_checkBox->isChecked());
+    view::View::set_fps_shown(_show_fps_checkBox->isChecked());
+    QDialog::accept();
+}
+
+void Preferences::reject()
+{
+    using namespace Qt;
+
+    QDialog::reject();
+}
+
+} // namespace dialogs
+} // namespace pv
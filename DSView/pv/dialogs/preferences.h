@@ -0,0 +1,65 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2017 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef DSVIEW_PV_PREFERENCES_H
+#define DSVIEW_PV_PREFERENCES_H
+
+#include <QLabel>
+#include <QSpinBox>
+#include <QCheckBox>
+#include <QDialogButtonBox>
+
+#include "../sigsession.h"
+#include "../toolbars/titlebar.h"
+#include "dsdialog.h"
+
+namespace pv {
+namespace dialogs {
+
+class Preferences : public DSDialog
+{
+	Q_OBJECT
+
+public:
+    Preferences(SigSession &session, QWidget *parent);
+
+protected:
+	void accept();
+    void reject();
+
+private:
+    SigSession &_session;
+
+    QSpinBox *_history_depth_spinBox;
+    QSpinBox *_history_budget_spinBox;
+    QCheckBox *_leaf_dedup_checkBox;
+    QSpinBox *_compress_level_spinBox;
+    QSpinBox *_max_fps_spinBox;
+    QCheckBox *_show_fps_checkBox;
+
+    QDialogButtonBox _button_box;
+};
+
+} // namespace dialogs
+} // namespace pv
+
+#endif // DSVIEW_PV_PREFERENCES_H
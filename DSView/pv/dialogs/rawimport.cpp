@@ -0,0 +1,92 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "rawimport.h"
+
+#include <QApplication>
+#include <QFormLayout>
+#include <QRegExpValidator>
+#include <QSettings>
+
+namespace pv {
+namespace dialogs {
+
+RawImport::RawImport(QWidget *parent) :
+    DSDialog(parent),
+    _button_box(QDialogButtonBox::Ok | QDialogButtonBox::Cancel,
+        Qt::Horizontal, this)
+{
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+
+    setMinimumWidth(300);
+    _layout_combobox = new QComboBox(this);
+    _layout_combobox->addItem(tr("Interleaved"), "interleaved");
+    _layout_combobox->addItem(tr("Planar"), "planar");
+    _layout_combobox->setCurrentIndex(
+        _layout_combobox->findData(settings.value("RawLayout", "interleaved")));
+
+    _channels_spinbox = new QSpinBox(this);
+    _channels_spinbox->setRange(1, 512);
+    _channels_spinbox->setValue(settings.value("RawChannels", 8).toInt());
+
+    // sizes as libsigrok parses them, such as 100k or 25M
+    _samplerate_edit = new QLineEdit(this);
+    _samplerate_edit->setValidator(new QRegExpValidator(
+        QRegExp("[0-9]+[kKmMgG]?"), this));
+    _samplerate_edit->setText(settings.value("RawSamplerate", "1M").toString());
+
+    QFormLayout *flayout = new QFormLayout();
+    flayout->addRow(tr("Layout: "), _layout_combobox);
+    flayout->addRow(tr("Channels: "), _channels_spinbox);
+    flayout->addRow(tr("Sample Rate(Hz): "), _samplerate_edit);
+    flayout->addRow(&_button_box);
+
+    layout()->addLayout(flayout);
+    setTitle(tr("Raw Binary Import"));
+
+    connect(&_button_box, SIGNAL(accepted()), this, SLOT(accept()));
+    connect(&_button_box, SIGNAL(rejected()), this, SLOT(reject()));
+}
+
+QMap<QString, QString> RawImport::options() const
+{
+    QMap<QString, QString> options;
+    options["layout"] = _layout_combobox->currentData().toString();
+    options["numprobes"] = QString::number(_channels_spinbox->value());
+    options["samplerate"] = _samplerate_edit->text();
+    return options;
+}
+
+void RawImport::accept()
+{
+    using namespace Qt;
+    if (!_samplerate_edit->hasAcceptableInput())
+        return;
+
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    settings.setValue("RawLayout", _layout_combobox->currentData());
+    settings.setValue("RawChannels", _channels_spinbox->value());
+    settings.setValue("RawSamplerate", _samplerate_edit->text());
+    QDialog::accept();
+}
+
+} // namespace dialogs
+} // namespace pv
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+
+#ifndef DSVIEW_PV_RAWIMPORT_H
+#define DSVIEW_PV_RAWIMPORT_H
+
+#include <QComboBox>
+#include <QSpinBox>
+#include <QLineEdit>
+#include <QDialogButtonBox>
+#include <QMap>
+
+#include "dsdialog.h"
+
+namespace pv {
+namespace dialogs {
+
+/**
+ * Asks how a raw binary file is laid out, as it has no header to
+ * tell: the channel count, the sample rate, and whether the samples
+ * are interleaved or stored as a bit plane per channel.
+ */
+class RawImport : public DSDialog
+{
+	Q_OBJECT
+
+public:
+    RawImport(QWidget *parent);
+
+    // the options of the binary input module
+    QMap<QString, QString> options() const;
+
+protected:
+	void accept();
+
+private:
+    QComboBox *_layout_combobox;
+    QSpinBox *_channels_spinbox;
+    QLineEdit *_samplerate_edit;
+
+    QDialogButtonBox _button_box;
+};
+
+} // namespace dialogs
+} // namespace pv
+
+#endif // DSVIEW_PV_RAWIMPORT_H
@@ -54,6 +54,7 @@
 #include "devicemanager.h"
 #include "device/device.h"
 #include "device/file.h"
+#include "device/inputfile.h"
 
 #include "data/logicsnapshot.h"
 #include "data/dsosnapshot.h"
@@ -64,6 +65,7 @@
 #include "dialogs/storeprogress.h"
 #include "dialogs/waitingdialog.h"
 #include "dialogs/regionoptions.h"
+#include "dialogs/rawimport.h"
 
 #include "toolbars/samplingbar.h"
 #include "toolbars/trigbar.h"
@@ -157,6 +159,8 @@ void MainWindow::setup_ui()
             SLOT(on_save()));
     connect(_file_bar, SIGNAL(on_export()), this,
             SLOT(on_export()));
+    connect(_file_bar, SIGNAL(on_record(bool)), this,
+            SLOT(on_record(bool)));
     connect(_file_bar, SIGNAL(on_screenShot()), this,
             SLOT(on_screenShot()), Qt::QueuedConnection);
     connect(_file_bar, SIGNAL(load_session(QString)), this,
@@ -396,7 +400,13 @@ void MainWindow::update_device_list()
         // load session
         load_session_json(file_dev->get_session(), true);
 
-        // load data
+        // load data, logic blocks on demand if the file has a block index
+        QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+        const uint64_t lazy_budget = settings.value("LazyLoadBudget", 512).toULongLong() << 20;
+        data::LogicSnapshot::set_lazy_budget(lazy_budget);
+        selected_device->set_config(NULL, NULL, SR_CONF_LAZY_LOAD,
+                                    g_variant_new_boolean(lazy_budget != 0));
+
         const QString errorMessage(
             QString(tr("Failed to capture file data!")));
         _session.start_capture(true, boost::bind(&MainWindow::session_error, this,
@@ -478,10 +488,19 @@ void MainWindow::reload()
 
 void MainWindow::load_file(QString file_name)
 {
+    // raw files don't tell how to read them
+    QMap<QString, QString> options;
+    if (device::InputFile::is_raw(file_name)) {
+        dialogs::RawImport dlg(this);
+        if (!dlg.exec())
+            return;
+        options = dlg.options();
+    }
+
     try {
         if (strncmp(_session.get_device()->name().toUtf8(), "virtual", 7))
             session_save();
-        _session.set_file(file_name);
+        _session.set_file(file_name, options);
     } catch(QString e) {
         show_session_error(tr("Failed to load ") + file_name, e);
         _session.set_default_device(boost::bind(&MainWindow::session_error, this,
@@ -685,6 +704,11 @@ void MainWindow::show_error()
         title = tr("Data Overflow");
         details = tr("USB bandwidth can not support current sample rate! \nPlease reduce the sample rate!");
         break;
+    case SigSession::Record_err:
+        _session.stop_capture();
+        title = tr("Recording Failed");
+        details = tr("Failed to write the recording file!\nPlease check free space and write permission of this path.");
+        break;
     default:
         title = tr("Undefined Error");
         details = tr("Not expected error!");
@@ -727,6 +751,13 @@ void MainWindow::capture_state_changed(int state)
         prgRate(0);
         _view->repeat_unshow();
     }
+
+    // a recording is started once, by the capture after it was chosen
+    if (state == SigSession::Running && _file_bar->get_recording() &&
+        _session.get_record_file().isEmpty()) {
+        _file_bar->set_recording(false);
+        _sampling_bar->update_sample_count_selector();
+    }
 }
 
 void MainWindow::session_save()
@@ -908,6 +939,60 @@ void MainWindow::on_export()
     dlg->export_run();
 }
 
+void MainWindow::on_record(bool checked)
+{
+    if (!checked) {
+        _session.set_record_file(QString(), QString());
+        _sampling_bar->update_sample_count_selector();
+        return;
+    }
+
+    bool stream_mode = false;
+    GVariant *gvar = _session.get_device()->get_config(NULL, NULL, SR_CONF_STREAM);
+    if (gvar != NULL) {
+        stream_mode = g_variant_get_boolean(gvar);
+        g_variant_unref(gvar);
+    }
+    if (_session.get_device()->dev_inst()->mode != LOGIC || !stream_mode) {
+        _file_bar->set_recording(false);
+        show_session_error(tr("Attension"),
+                           tr("Recording to disk is only supported by logic captures in stream mode!"));
+        return;
+    }
+
+    const QString DIR_KEY("SavePath");
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    QString file_name = QFileDialog::getSaveFileName(
+        this, tr("Record to Disk"), settings.value(DIR_KEY).toString(),
+        tr("DSView Data (*.dsl)"));
+    if (file_name.isEmpty()) {
+        _file_bar->set_recording(false);
+        return;
+    }
+    if (QFileInfo(file_name).suffix().compare("dsl"))
+        file_name.append(tr(".dsl"));
+    settings.setValue(DIR_KEY, QDir().filePath(file_name));
+
+    // the settings are stored with the recording, as with saved files
+    QString session_file;
+    QDir dir;
+    #if QT_VERSION >= 0x050400
+    QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    #else
+    QString path = QStandardPaths::writableLocation(QStandardPaths::DataLocation);
+    #endif
+    if(dir.mkpath(path)) {
+        dir.cd(path);
+
+        session_file = dir.absolutePath() + "/DSView-record-XXXXXX";
+        if (!store_session(session_file))
+            session_file.clear();
+    }
+
+    _session.set_record_file(file_name, session_file);
+    _sampling_bar->update_sample_count_selector();
+}
+
 bool MainWindow::load_session(QString name)
 {
     QFile sessionFile(name);
@@ -1295,6 +1380,12 @@ bool MainWindow::eventFilter(QObject *object, QEvent *event)
             _view->set_scale_offset(_view->scale(),
                                     _view->offset() + _view->get_view_width());
 
+            break;
+        case Qt::Key_BracketLeft:
+            _session.set_history_index(_session.get_history_index() + 1);
+            break;
+        case Qt::Key_BracketRight:
+            _session.set_history_index(_session.get_history_index() - 1);
             break;
         case Qt::Key_Left:
             _view->zoom(1);
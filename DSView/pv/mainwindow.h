@@ -132,6 +132,8 @@ private slots:
 
     void on_export();
 
+    void on_record(bool checked);
+
     bool load_session(QString name);
     bool load_session_json(QJsonDocument json, bool file_dev);
     bool store_session(QString name);
@@ -27,6 +27,7 @@
 #include "sigsession.h"
 #include "mainwindow.h"
 #include "devicemanager.h"
+#include "storesession.h"
 #include "device/device.h"
 #include "device/file.h"
 
@@ -58,6 +59,8 @@
 #include <sys/stat.h>
 
 #include <QDebug>
+#include <QSettings>
+#include <QApplication>
 #include <QProgressDialog>
 #include <QFile>
 #include <QJsonArray>
@@ -97,7 +100,13 @@ SigSession::SigSession(DeviceManager &device_manager) :
     _repeat_intvl(1),
     _repeating(false),
     _repeat_hold_prg(0),
-    _map_zoom(0)
+    _history_index(0),
+    _live_samplerate(0),
+    _live_trigger_pos(0),
+    _map_zoom(0),
+    _ring_hwm(0),
+    _ring_size(0),
+    _ring_overrun(0)
 {
 	// TODO: This should not be necessary
 	_session = this;
@@ -118,6 +127,9 @@ SigSession::SigSession(DeviceManager &device_manager) :
     _dso_feed = false;
     _stop_scale = 1;
 
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    data::LogicSnapshot::set_leaf_dedup(settings.value("LeafDedup", true).toBool());
+
     // Create snapshots & data containers
     _cur_logic_snapshot.reset(new data::LogicSnapshot());
     _logic_data.reset(new data::Logic());
@@ -137,6 +149,10 @@ SigSession::SigSession(DeviceManager &device_manager) :
 SigSession::~SigSession()
 {
 	stop_capture();
+    if (_recorder) {
+        _recorder->record_end();
+        _recorder.reset();
+    }
 		       
     ds_trigger_destroy();
 
@@ -189,12 +205,13 @@ void SigSession::set_device(boost::shared_ptr<device::DevInst> dev_inst)
             return;
         }
         sr_session_datafeed_callback_add(data_feed_in_proc, NULL);
+        sr_session_buffer_provider_set(buffer_alloc_proc, buffer_release_proc, NULL);
         device_setted();
     }
 }
 
 
-void SigSession::set_file(QString name)
+void SigSession::set_file(QString name, const QMap<QString, QString> &options)
 {
     // Deslect the old device, because file type detection in File::create
     // destorys the old session inside libsigrok.
@@ -205,7 +222,7 @@ void SigSession::set_file(QString name)
         return;
     }
     try {
-        set_device(boost::shared_ptr<device::DevInst>(device::File::create(name)));
+        set_device(boost::shared_ptr<device::DevInst>(device::File::create(name, options)));
     } catch(const QString e) {
         throw(e);
         return;
@@ -344,6 +361,23 @@ void SigSession::set_cur_samplelimits(uint64_t samplelimits)
 
 void SigSession::capture_init()
 {
+    // keep the previous repeat capture before it is overwritten
+    set_history_index(0);
+    if (_dev_inst->dev_inst()->mode == LOGIC &&
+        get_run_mode() == Repetitive &&
+        !_cur_logic_snapshot->empty() &&
+        _cur_logic_snapshot->last_ended()) {
+        QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+        data::Logic::Capture capture;
+        capture.snapshot = _cur_logic_snapshot->detach();
+        capture.samplerate = _cur_snap_samplerate;
+        capture.trigger_pos = _trigger_pos;
+        _logic_data->push_history(capture,
+            settings.value("HistoryDepth", HistoryDepth).toInt(),
+            settings.value("HistoryBudget", HistoryBudget >> 20).toULongLong() << 20);
+        history_changed();
+    }
+
     if (!_instant)
         set_repeating(get_run_mode() == Repetitive);
     // update instant setting
@@ -365,9 +399,52 @@ void SigSession::capture_init()
     _noData_cnt = 0;
     data_unlock();
 
+    // the previous recording still reads the snapshot
+    if (_recorder) {
+        _recorder->record_end();
+        _recorder.reset();
+    }
+
     // container init
     container_init();
 
+    // recording is for stream captures, which may be longer than memory
+    bool stream_mode = false;
+    GVariant *gvar = _dev_inst->get_config(NULL, NULL, SR_CONF_STREAM);
+    if (gvar != NULL) {
+        stream_mode = g_variant_get_boolean(gvar);
+        g_variant_unref(gvar);
+    }
+    const bool record = _dev_inst->dev_inst()->mode == LOGIC &&
+                        get_run_mode() == Single && stream_mode &&
+                        !_record_file.isEmpty();
+    _cur_logic_snapshot->set_recording(record);
+    if (record) {
+        _recorder.reset(new StoreSession(*this));
+        if (!_recorder->record_start(_record_file, _record_session_file)) {
+            qDebug() << "Failed to record to" << _record_file << ":" << _recorder->error();
+            _recorder.reset();
+            _cur_logic_snapshot->set_recording(false);
+            _error = Record_err;
+            session_error();
+        }
+        // each recording is started from the file bar
+        _record_file.clear();
+    }
+
+    // size the analog ring up front, so transfers can land in it directly
+    if (_dev_inst->dev_inst()->mode == ANALOG && _cur_analog_snapshot) {
+        gvar = _dev_inst->get_config(NULL, NULL, SR_CONF_UNIT_BITS);
+        if (gvar != NULL) {
+            const int unit_bits = g_variant_get_byte(gvar);
+            g_variant_unref(gvar);
+            if (!_cur_analog_snapshot->init_storage(_dev_inst->get_sample_limit(),
+                                                   _dev_inst->dev_inst()->channels,
+                                                   unit_bits))
+                _cur_analog_snapshot->clear();  // retried and reported on first payload
+        }
+    }
+
     // update current hw offset
     BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _signals)
     {
@@ -584,6 +661,24 @@ void SigSession::sample_thread_proc(boost::shared_ptr<device::DevInst> dev_inst,
 
     set_capture_state(Stopped);
 
+    // keep usb transfer ring usage of this capture for the status bar
+    GVariant *gvar = dev_inst->get_config(NULL, NULL, SR_CONF_RING_SIZE);
+    _ring_size = 0;
+    if (gvar != NULL) {
+        _ring_size = g_variant_get_int32(gvar);
+        g_variant_unref(gvar);
+    }
+    gvar = dev_inst->get_config(NULL, NULL, SR_CONF_RING_HWM);
+    if (gvar != NULL) {
+        _ring_hwm = g_variant_get_int32(gvar);
+        g_variant_unref(gvar);
+    }
+    gvar = dev_inst->get_config(NULL, NULL, SR_CONF_RING_OVERRUN);
+    if (gvar != NULL) {
+        _ring_overrun = g_variant_get_int32(gvar);
+        g_variant_unref(gvar);
+    }
+
     // Confirm that SR_DF_END was received
     assert(_cur_logic_snapshot->last_ended());
     assert(_cur_dso_snapshot->last_ended());
@@ -1203,6 +1298,9 @@ void SigSession::data_feed_in(const struct sr_dev_inst *sdi,
             _cur_logic_snapshot->capture_ended();
             _cur_dso_snapshot->capture_ended();
             _cur_analog_snapshot->capture_ended();
+            // the recording is completed and closed in the background
+            if (_recorder)
+                _recorder->record_end();
 #ifdef ENABLE_DECODE
             BOOST_FOREACH(const boost::shared_ptr<view::DecodeTrace> d, _decode_traces)
                 d->frame_ended();
@@ -1229,6 +1327,27 @@ void SigSession::data_feed_in_proc(const struct sr_dev_inst *sdi,
 	_session->data_feed_in(sdi, packet);
 }
 
+void *SigSession::buffer_alloc_proc(size_t size, void *cb_data)
+{
+    (void) cb_data;
+
+    assert(_session);
+    if (!_session->_cur_analog_snapshot ||
+        _session->_dev_inst->dev_inst()->mode != ANALOG)
+        return NULL;
+    return _session->_cur_analog_snapshot->alloc_transfer_buffer(size);
+}
+
+gboolean SigSession::buffer_release_proc(void *buf, void *cb_data)
+{
+    (void) cb_data;
+
+    assert(_session);
+    if (!_session->_cur_analog_snapshot)
+        return FALSE;
+    return _session->_cur_analog_snapshot->release_transfer_buffer(buf);
+}
+
 /*
  * hotplug function
  */
@@ -1633,7 +1752,7 @@ void SigSession::feed_timeout()
 boost::shared_ptr<data::Snapshot> SigSession::get_snapshot(int type)
 {
     if (type == SR_CHANNEL_LOGIC)
-        return _cur_logic_snapshot;
+        return _logic_data->get_snapshots().front();
     else if (type == SR_CHANNEL_ANALOG)
         return _cur_analog_snapshot;
     else if (type == SR_CHANNEL_DSO)
@@ -1658,6 +1777,27 @@ void SigSession::clear_error()
     _error = No_err;
 }
 
+void SigSession::set_record_file(QString file_name, QString session_file)
+{
+    _record_file = file_name;
+    _record_session_file = session_file;
+}
+
+QString SigSession::get_record_file() const
+{
+    return _record_file;
+}
+
+/*
+ * Called by the recorder thread, the capture is stopped from the
+ * queued error handler.
+ */
+void SigSession::record_error()
+{
+    _error = Record_err;
+    session_error();
+}
+
 uint64_t SigSession::get_error_pattern() const
 {
     return _error_pattern;
@@ -1733,6 +1873,62 @@ int SigSession::get_repeat_hold() const
         return 0;
 }
 
+int SigSession::get_history_size() const
+{
+    return _logic_data->get_history().size();
+}
+
+void SigSession::get_ring_usage(int &hwm, int &size, int &overrun) const
+{
+    hwm = _ring_hwm;
+    size = _ring_size;
+    overrun = _ring_overrun;
+}
+
+int SigSession::get_history_index() const
+{
+    return _history_index;
+}
+
+void SigSession::set_history_index(int index)
+{
+    std::deque<data::Logic::Capture> &history = _logic_data->get_history();
+    index = max(0, min(index, (int)history.size()));
+    if (index == _history_index)
+        return;
+    if (index != 0 && get_capture_state() == Running)
+        return;
+
+    if (_history_index == 0) {
+        _live_samplerate = _cur_snap_samplerate;
+        _live_trigger_pos = _trigger_pos;
+    }
+
+    // views and decoders follow the front snapshot
+    if (index == 0) {
+        _logic_data->get_snapshots().front() = _cur_logic_snapshot;
+        _trigger_pos = _live_trigger_pos;
+        set_cur_snap_samplerate(_live_samplerate);
+    } else {
+        const data::Logic::Capture &capture = history.at(index - 1);
+        _logic_data->get_snapshots().front() = capture.snapshot;
+        _trigger_pos = capture.trigger_pos;
+        set_cur_snap_samplerate(capture.samplerate);
+    }
+    _history_index = index;
+    receive_trigger(_trigger_pos);
+
+#ifdef ENABLE_DECODE
+    BOOST_FOREACH(const boost::shared_ptr<view::DecodeTrace> d, _decode_traces)
+    {
+        d->decoder()->stop_decode();
+        d->decoder()->begin_decode();
+    }
+#endif
+    history_changed();
+    data_updated();
+}
+
 void SigSession::set_map_zoom(int index)
 {
     _map_zoom = index;
@@ -58,6 +58,7 @@ struct srd_channel;
 namespace pv {
 
 class DeviceManager;
+class StoreSession;
 
 namespace data {
 class SignalData;
@@ -104,6 +105,9 @@ private:
 public:
     static const int FeedInterval = 50;
     static const int WaitShowTime = 500;
+    // defaults of the "HistoryDepth" and "HistoryBudget" (MiB) settings
+    static const int HistoryDepth = 16;
+    static const uint64_t HistoryBudget = 1ULL << 30;
 
 public:
 	enum capture_state {
@@ -124,7 +128,8 @@ public:
         Test_data_err,
         Test_timeout_err,
         Pkt_data_err,
-        Data_overflow
+        Data_overflow,
+        Record_err
     };
 
 public:
@@ -139,7 +144,8 @@ public:
 	 */
     void set_device(boost::shared_ptr<device::DevInst> dev_inst);
 
-    void set_file(QString name);
+    void set_file(QString name,
+        const QMap<QString, QString> &options = QMap<QString, QString>());
 
     void close_file(boost::shared_ptr<pv::device::DevInst> dev_inst);
 
@@ -248,8 +254,16 @@ public:
     bool repeat_check();
     int get_repeat_hold() const;
 
+    // capture history of repeat mode, 0 is the latest capture
+    int get_history_size() const;
+    int get_history_index() const;
+    void set_history_index(int index);
+
     int get_map_zoom() const;
 
+    // usb transfer ring usage of the last capture, size is 0 if unknown
+    void get_ring_usage(int &hwm, int &size, int &overrun) const;
+
     void set_save_start(uint64_t start);
     void set_save_end(uint64_t end);
     uint64_t get_save_start() const;
@@ -261,6 +275,11 @@ public:
 
     void exit_capture();
 
+    // record the next stream capture to disk, while it runs
+    void set_record_file(QString file_name, QString session_file);
+    QString get_record_file() const;
+    void record_error();
+
 private:
 	void set_capture_state(capture_state state);
 
@@ -296,6 +315,10 @@ private:
 	static void data_feed_in_proc(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet, void *cb_data);
 
+    // zero-copy transfer buffers
+    static void *buffer_alloc_proc(size_t size, void *cb_data);
+    static gboolean buffer_release_proc(void *buf, void *cb_data);
+
     // thread for hotplug
     void hotplug_proc(boost::function<void (const QString)> error_handler);
     static int hotplug_callback(struct libusb_context *ctx, struct libusb_device *dev,
@@ -363,9 +386,16 @@ private:
     int _repeat_intvl;
     bool _repeating;
     int _repeat_hold_prg;
+    int _history_index;
+    uint64_t _live_samplerate;
+    uint64_t _live_trigger_pos;
 
     int _map_zoom;
 
+    int _ring_hwm;
+    int _ring_size;
+    int _ring_overrun;
+
     uint64_t _save_start;
     uint64_t _save_end;
     bool _saving;
@@ -373,6 +403,10 @@ private:
     bool _dso_feed;
     float _stop_scale;
 
+    QString _record_file;
+    QString _record_session_file;
+    boost::shared_ptr<StoreSession> _recorder;
+
 signals:
 	void capture_state_changed(int state);
 
@@ -414,6 +448,7 @@ signals:
 
     void repeat_hold(int percent);
     void repeat_resume();
+    void history_changed();
 
     void cur_snap_samplerate_changed();
 
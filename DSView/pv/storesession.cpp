@@ -27,6 +27,7 @@
 #include <pv/sigsession.h>
 #include <pv/data/logic.h>
 #include <pv/data/logicsnapshot.h>
+#include <pv/data/bitplanes.h>
 #include <pv/data/dsosnapshot.h>
 #include <pv/data/analogsnapshot.h>
 #include <pv/data/decoderstack.h>
@@ -41,9 +42,14 @@
 #include <pv/dock/protocoldock.h>
 
 #include <boost/foreach.hpp>
+#include <boost/bind.hpp>
+
+#include <functional>
+#include <queue>
 
 #include <QApplication>
 #include <QFileDialog>
+#include <QtEndian>
 
 using boost::dynamic_pointer_cast;
 using boost::mutex;
@@ -63,11 +69,22 @@ namespace pv {
 StoreSession::StoreSession(SigSession &session) :
 	_session(session),
     _outModule(NULL),
+    _recorder(NULL),
+    _file_version(File_Version),
+    _codec(SR_COMPRESS_DEFLATE),
+    _level(Compress_Level),
+    _next_chunk(0),
+    _chunk_written(0),
+    _chunk_window(0),
+    _chunk_stop(false),
+    _fill_size(0),
+    _record_end(false),
 	_units_stored(0),
     _unit_count(0),
     _has_error(false),
     _canceled(false)
 {
+    _fill_buf[0] = _fill_buf[1] = NULL;
 }
 
 StoreSession::~StoreSession()
@@ -161,10 +178,40 @@ bool StoreSession::save_start(QString session_file)
     }
     default_name += _session.get_session_time().toString("-yyMMdd-hhmmss");
 
-    // Show the dialog
+    // Show the dialog, the filter selects the compression
+    const QString CODEC_KEY("SaveCompression");
+    const QString FAST_KEY("SaveFast");
+    const QString ARCHIVE_KEY("SaveArchive");
+    const QString LEVEL_KEY("SaveCompressionLevel");
+    const QString INDEXED_KEY("SaveIndexed");
+    const QString filter_default = tr("DSView Data (*.dsl)");
+    const QString filter_fast = tr("DSView Data, fast compression (*.dsl)");
+    const QString filter_archive = tr("DSView Data, smallest (*.dsl)");
+    const QString filter_store = tr("DSView Data, uncompressed (*.dsl)");
+    const QString filter_indexed = tr("DSView Data, indexed for fast loading (*.dsl)");
+    const int last_codec = settings.value(CODEC_KEY, SR_COMPRESS_DEFLATE).toInt();
+    // the level is set in the preferences, the fast and smallest filters override it
+    const int level = settings.value(LEVEL_KEY, Compress_Level).toInt();
+    const bool logic = (*type_set.begin() == SR_CHANNEL_LOGIC);
+    QString filters = filter_default + ";;" + filter_fast + ";;" + filter_archive + ";;" + filter_store;
+    if (logic)
+        filters += ";;" + filter_indexed;
+    QString filter = (logic && settings.value(INDEXED_KEY, false).toBool()) ? filter_indexed :
+                     (last_codec == SR_COMPRESS_STORE) ? filter_store :
+                     settings.value(FAST_KEY, false).toBool() ? filter_fast :
+                     settings.value(ARCHIVE_KEY, false).toBool() ? filter_archive : filter_default;
     _file_name = QFileDialog::getSaveFileName(
-                    NULL, tr("Save File"), default_name,
-                    tr("DSView Data (*.dsl)"));
+                    NULL, tr("Save File"), default_name, filters, &filter);
+    _file_version = (filter == filter_indexed) ? Leaf_File_Version : File_Version;
+    if (filter == filter_store || filter == filter_indexed) {
+        // leaves are mapped in place when loaded, so never compressed
+        _codec = SR_COMPRESS_STORE;
+        _level = 0;
+    } else {
+        _codec = SR_COMPRESS_DEFLATE;
+        _level = (filter == filter_fast) ? 1 :
+                 (filter == filter_archive) ? Archive_Level : std::max(1, std::min(level, 9));
+    }
 
     if (!_file_name.isEmpty()) {
         QFileInfo f(_file_name);
@@ -172,8 +219,15 @@ bool StoreSession::save_start(QString session_file)
             _file_name.append(tr(".dsl"));
         QDir CurrentDir;
         settings.setValue(DIR_KEY, CurrentDir.filePath(_file_name));
+        settings.setValue(INDEXED_KEY, _file_version == Leaf_File_Version);
+        if (_file_version != Leaf_File_Version) {
+            settings.setValue(CODEC_KEY, _codec);
+            settings.setValue(FAST_KEY, filter == filter_fast);
+            settings.setValue(ARCHIVE_KEY, filter == filter_archive);
+        }
 
-        QString meta_file = meta_gen(snapshot);
+        QString meta_file = meta_gen(snapshot, snapshot->get_sample_count(),
+                                     snapshot->get_block_num());
     #ifdef ENABLE_DECODE
         QString decoders_file = decoders_gen();
     #else
@@ -182,11 +236,19 @@ bool StoreSession::save_start(QString session_file)
         if (meta_file == NULL) {
             _error = tr("Generate temp file failed.");
         } else {
-            int ret = sr_session_save_init(_file_name.toUtf8().data(),
-                                 meta_file.toUtf8().data(),
-                                 decoders_file.toUtf8().data(),
-                                 session_file.toUtf8().data());
+            // entries are written as they are added, nothing waits for the close
+            _recorder = sr_session_recorder_new(_file_name.toUtf8().data());
+            int ret = (_recorder == NULL) ? SR_ERR : record_file("header", meta_file);
+            if (ret == SR_OK && decoders_file != NULL)
+                ret = record_file("decoders", decoders_file);
+            if (ret == SR_OK && session_file != NULL)
+                ret = record_file("session", session_file);
+            QFile::remove(meta_file);
+            if (decoders_file != NULL)
+                QFile::remove(decoders_file);
             if (ret != SR_OK) {
+                sr_session_recorder_close(_recorder);
+                _recorder = NULL;
                 _error = tr("Failed to create zip file. Initialization error.");
             } else {
                 _thread = boost::thread(&StoreSession::save_proc, this, snapshot);
@@ -203,13 +265,20 @@ bool StoreSession::save_start(QString session_file)
 void StoreSession::save_proc(shared_ptr<data::Snapshot> snapshot)
 {
 	assert(snapshot);
+    assert(_recorder);
 
-    int ret = SR_ERR;
+    int ret = SR_OK;
     int num = 0;
     shared_ptr<data::LogicSnapshot> logic_snapshot;
     shared_ptr<data::AnalogSnapshot> analog_snapshot;
     shared_ptr<data::DsoSnapshot> dso_snapshot;
 
+    // blocks are fetched per chunk, see chunk_data()
+    _chunk_snapshot = snapshot;
+    _chunks.clear();
+    _next_chunk = 0;
+    _chunk_stop = false;
+
     if ((logic_snapshot = boost::dynamic_pointer_cast<data::LogicSnapshot>(snapshot))) {
         uint16_t to_save_probes = 0;
         BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
@@ -218,44 +287,35 @@ void StoreSession::save_proc(shared_ptr<data::Snapshot> snapshot)
         }
         _unit_count = logic_snapshot->get_sample_count() / 8 * to_save_probes;
         num = logic_snapshot->get_block_num();
-        bool sample;
+
+        if (_file_version == Leaf_File_Version) {
+            data::Snapshot::ReadGuard guard(*snapshot);
+            queue_leaves(logic_snapshot);
+        } else if (num != 0 && !alloc_fill(logic_snapshot->get_block_size(0))) {
+            // the first block is the largest one
+            _has_error = true;
+            _error = tr("Failed to create zip file. Malloc error.");
+            ret = SR_ERR;
+        }
+        if (ret == SR_OK) {
+            data::Snapshot::ReadGuard guard(*snapshot);
+            ret = add_index(logic_snapshot, to_save_probes);
+        }
+        num = (ret == SR_OK) ? num : 0;
+        if (_file_version == Leaf_File_Version)
+            _unit_count += _leaf_index.size() * sizeof(uint64_t);
 
         BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
             int ch_type = s->get_type();
+            if (_file_version == Leaf_File_Version)
+                break;
             if (ch_type == SR_CHANNEL_LOGIC) {
                 int ch_index = s->get_index();
                 if (!s->enabled() || !logic_snapshot->has_data(ch_index))
                     continue;
-                for (int i = 0; !boost::this_thread::interruption_requested() && i < num; i++) {
-                    uint8_t *buf = logic_snapshot->get_block_buf(i, ch_index, sample);
-                    uint64_t size = logic_snapshot->get_block_size(i);
-                    bool need_malloc = (buf == NULL);
-                    if (need_malloc) {
-                        buf = (uint8_t *)malloc(size);
-                        if (buf == NULL) {
-                            _has_error = true;
-                            _error = tr("Failed to create zip file. Malloc error.");
-                        } else {
-                            memset(buf, sample ? 0xff : 0x0, size);
-                        }
-                    }
-                    ret = sr_session_append(_file_name.toUtf8().data(), buf, size,
-                                      i, ch_index, ch_type, File_Version);
-                    if (ret != SR_OK) {
-                        if (!_has_error) {
-                            _has_error = true;
-                            _error = tr("Failed to create zip file. Please check write permission of this path.");
-                        }
-                        progress_updated();
-                        if (_has_error)
-                            QFile::remove(_file_name);
-                        return;
-                    }
-                    _units_stored += size;
-                    if (need_malloc)
-                        free(buf);
-                    progress_updated();
-                }
+                for (int i = 0; i < num; i++)
+                    _chunks.push_back(SaveChunk(NULL, logic_snapshot->get_block_size(i),
+                                                i, ch_index, ch_type, false));
             }
         }
     } else {
@@ -274,49 +334,289 @@ void StoreSession::save_proc(shared_ptr<data::Snapshot> snapshot)
             const uint8_t *buf_start = (uint8_t *)snapshot->get_data();
             const uint8_t *buf_end = buf_start + _unit_count;
 
-            for (int i = 0; !boost::this_thread::interruption_requested() && i < num; i++) {
+            for (int i = 0; ret == SR_OK && i < num; i++) {
                 const uint64_t size = snapshot->get_block_size(i);
                 if ((buf + size) > buf_end) {
                     uint8_t *tmp = (uint8_t *)malloc(size);
                     if (tmp == NULL) {
                         _has_error = true;
                         _error = tr("Failed to create zip file. Malloc error.");
+                        ret = SR_ERR;
                     } else {
                         memcpy(tmp, buf, buf_end-buf);
                         memcpy(tmp+(buf_end-buf), buf_start, buf+size-buf_end);
+                        _chunks.push_back(SaveChunk(tmp, size, i, 0, ch_type, true));
                     }
-                    ret = sr_session_append(_file_name.toUtf8().data(), tmp, size,
-                                      i, 0, ch_type, File_Version);
                     buf += (size - _unit_count);
-                    if (tmp)
-                        free(tmp);
                 } else {
-                    ret = sr_session_append(_file_name.toUtf8().data(), buf, size,
-                                      i, 0, ch_type, File_Version);
+                    _chunks.push_back(SaveChunk(buf, size, i, 0, ch_type, false));
                     buf += size;
                 }
-                if (ret != SR_OK) {
-                    if (!_has_error) {
-                        _has_error = true;
-                        _error = tr("Failed to create zip file. Please check write permission of this path.");
-                    }
-                    progress_updated();
-                    if (_has_error)
-                        QFile::remove(_file_name);
-                    return;
-                }
-                _units_stored += size;
-                progress_updated();
             }
         }
     }
-	progress_updated();
 
-    if (_canceled || num == 0)
+    if (ret == SR_OK)
+        ret = write_chunks();
+    if (ret == SR_OK && _file_version == Leaf_File_Version)
+        _units_stored += _leaf_index.size() * sizeof(uint64_t);
+
+    // the chunks are on disk already, only the directory is left
+    if (num != 0 && ret == SR_OK && !_canceled &&
+        !boost::this_thread::interruption_requested()) {
+        ret = sr_session_recorder_close(_recorder);
+        _recorder = NULL;
+        if (ret == SR_OK) {
+            _units_stored = _unit_count;
+        } else {
+            _has_error = true;
+            QFile::remove(_file_name);
+        }
+    } else {
+        sr_session_recorder_close(_recorder);
+        _recorder = NULL;
         QFile::remove(_file_name);
+        if (num != 0 && !_canceled && ret != SR_OK)
+            _has_error = true;
+    }
+    if (_has_error && _error.isEmpty())
+        _error = tr("Failed to create zip file. Please check write permission of this path.");
+
+    BOOST_FOREACH(SaveChunk &chunk, _chunks) {
+        if (chunk.owned)
+            free((void *)chunk.buf);
+        g_free(chunk.comp_buf);
+    }
+    _chunks.clear();
+    _chunk_snapshot.reset();
+    free_fill();
+	progress_updated();
+}
+
+/*
+ * Version 3: queue the leaves (samples and mipmap) of all logic
+ * channels as they are. Blocks without edges have no leaf, their
+ * level is in the block index.
+ */
+void StoreSession::queue_leaves(shared_ptr<data::LogicSnapshot> snapshot)
+{
+    const int num = snapshot->get_block_num();
+    const uint64_t leaf_space = data::LogicSnapshot::get_leaf_space();
+    bool edges, last;
+
+    _unit_count = 0;
+    BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
+        const int ch_index = s->get_index();
+        if (s->get_type() != SR_CHANNEL_LOGIC ||
+            !s->enabled() || !snapshot->has_data(ch_index))
+            continue;
+
+        // only blocks with edges have a leaf, fetched when it is written
+        for (int i = 0; i < num; i++) {
+            snapshot->get_block_state(i, ch_index, edges, last);
+            if (edges) {
+                _chunks.push_back(SaveChunk(NULL, leaf_space, i, ch_index,
+                                            SR_CHANNEL_LOGIC, false));
+                _unit_count += leaf_space;
+            }
+        }
+    }
+}
+
+/*
+ * Add the block index of the logic channels: whether each block has
+ * edges, and its last sample. Version 3 files are mapped with it, and
+ * version 2 files can be loaded lazily.
+ */
+int StoreSession::add_index(shared_ptr<data::LogicSnapshot> snapshot,
+                            uint16_t channels)
+{
+    const int num = snapshot->get_block_num();
+    const uint64_t words = (num + 63) / 64;
+    bool edges, last;
+
+    _leaf_index.clear();
+    _leaf_index.push_back(data::LogicSnapshot::get_leaf_samples());
+    _leaf_index.push_back(data::LogicSnapshot::get_leaf_space());
+    _leaf_index.push_back(channels);
+    _leaf_index.push_back(num);
+
+    BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
+        const int ch_index = s->get_index();
+        if (s->get_type() != SR_CHANNEL_LOGIC ||
+            !s->enabled() || !snapshot->has_data(ch_index))
+            continue;
+
+        const size_t edges_pos = _leaf_index.size() + 1;
+        const size_t levels = edges_pos + words;
+        _leaf_index.push_back(ch_index);
+        _leaf_index.resize(levels + words, 0);
+        for (int i = 0; i < num; i++) {
+            snapshot->get_block_state(i, ch_index, edges, last);
+            if (edges)
+                _leaf_index[edges_pos + i / 64] |= 1ULL << (i % 64);
+            if (last)
+                _leaf_index[levels + i / 64] |= 1ULL << (i % 64);
+        }
+    }
+
+    for (size_t i = 0; i < _leaf_index.size(); i++)
+        _leaf_index[i] = qToLittleEndian<quint64>(_leaf_index[i]);
+
+    return sr_session_recorder_add(_recorder, "index",
+                                   (const unsigned char *)&_leaf_index[0],
+                                   _leaf_index.size() * sizeof(uint64_t));
+}
+
+int StoreSession::write_chunks()
+{
+    // blocks are deflated on a worker pool, and written to the file
+    // in order as soon as they are ready; the workers stay at most a
+    // few blocks ahead, so the compressed ones don't pile up in memory
+    const unsigned int workers = (_codec == SR_COMPRESS_STORE) ? 0 : std::max(1U,
+        std::min(boost::thread::hardware_concurrency(), (unsigned int)_chunks.size()));
+    _chunk_written = 0;
+    _chunk_window = 2 * workers;
+    boost::thread_group pool;
+    for (unsigned int i = 0; i < workers; i++)
+        pool.create_thread(boost::bind(&StoreSession::compress_proc, this));
+
+    // cancel() interrupts this thread, poll for it instead of throwing
+    boost::this_thread::disable_interruption no_interrupt;
+    int ret = SR_OK;
+    for (size_t i = 0; ret == SR_OK && i < _chunks.size(); i++) {
+        SaveChunk &chunk = _chunks[i];
+        if (_codec == SR_COMPRESS_STORE) {
+            data::Snapshot::ReadGuard guard(*_chunk_snapshot);
+            const uint8_t *buf = chunk_data(chunk);
+            ret = (buf == NULL) ? SR_ERR :
+                sr_session_recorder_append(_recorder, buf, chunk.size,
+                    chunk.chunk_num, chunk.index, chunk.type, _file_version);
+            _units_stored += chunk.size;
+            progress_updated();
+            if (_canceled || boost::this_thread::interruption_requested())
+                ret = SR_ERR;
+            continue;
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(_chunk_mutex);
+            while (!chunk.done && !_canceled &&
+                   !boost::this_thread::interruption_requested())
+                _chunk_cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+        }
+        if (!chunk.done) {
+            ret = SR_ERR;
+            break;
+        }
+        if (chunk.ret == SR_OK) {
+            ret = sr_session_recorder_append_deflated(_recorder, chunk.comp_buf,
+                    chunk.comp_size, chunk.size, chunk.crc,
+                    chunk.chunk_num, chunk.index, chunk.type, _file_version);
+            chunk.comp_buf = NULL;
+        } else {
+            ret = chunk.ret;
+        }
+        _units_stored += chunk.size;
+        progress_updated();
+        {
+            boost::lock_guard<boost::mutex> lock(_chunk_mutex);
+            _chunk_written = i + 1;
+            _chunk_cond.notify_all();
+        }
+        if (_canceled || boost::this_thread::interruption_requested())
+            ret = SR_ERR;
+    }
+
+    {
+        boost::lock_guard<boost::mutex> lock(_chunk_mutex);
+        _chunk_stop = true;
+    }
+    pool.join_all();
+    return ret;
+}
+
+void StoreSession::compress_proc()
+{
+    while (true) {
+        size_t i;
+        {
+            boost::unique_lock<boost::mutex> lock(_chunk_mutex);
+            while (!_chunk_stop && !_canceled &&
+                   _next_chunk >= _chunk_written + _chunk_window)
+                _chunk_cond.timed_wait(lock, boost::posix_time::milliseconds(100));
+            if (_chunk_stop || _canceled || _next_chunk >= _chunks.size())
+                return;
+            i = _next_chunk++;
+        }
+
+        SaveChunk &chunk = _chunks[i];
+        unsigned char *comp_buf = NULL;
+        uint64_t comp_size = 0;
+        uint32_t crc = 0;
+        int ret;
+        {
+            data::Snapshot::ReadGuard guard(*_chunk_snapshot);
+            const uint8_t *buf = chunk_data(chunk);
+            ret = (buf == NULL) ? SR_ERR :
+                sr_session_deflate(buf, chunk.size, _level,
+                                   &comp_buf, &comp_size, &crc);
+        }
+
+        boost::lock_guard<boost::mutex> lock(_chunk_mutex);
+        chunk.comp_buf = comp_buf;
+        chunk.comp_size = comp_size;
+        chunk.crc = crc;
+        chunk.ret = ret;
+        chunk.done = true;
+        _chunk_cond.notify_all();
+    }
+}
+
+/*
+ * The data of a chunk. Logic blocks are fetched only here, under the
+ * caller's ReadGuard, which is held while the data is used: blocks of
+ * lazily loaded captures may be evicted, and read back, meanwhile.
+ * Blocks without a leaf are written as fill blocks of their level.
+ */
+const uint8_t *StoreSession::chunk_data(const SaveChunk &chunk)
+{
+    if (chunk.buf != NULL)
+        return chunk.buf;
+
+    data::LogicSnapshot *const snapshot =
+        static_cast<data::LogicSnapshot *>(_chunk_snapshot.get());
+    bool sample;
+    const uint8_t *buf = snapshot->get_block_buf(chunk.chunk_num, chunk.index, sample);
+    if (buf == NULL && chunk.size <= _fill_size)
+        buf = _fill_buf[sample ? 1 : 0];
+    return buf;
+}
+
+bool StoreSession::alloc_fill(uint64_t size)
+{
+    free_fill();
+    _fill_buf[0] = (uint8_t *)malloc(size);
+    _fill_buf[1] = (uint8_t *)malloc(size);
+    if (_fill_buf[0] == NULL || _fill_buf[1] == NULL) {
+        free_fill();
+        return false;
+    }
+    memset(_fill_buf[0], 0x0, size);
+    memset(_fill_buf[1], 0xff, size);
+    _fill_size = size;
+    return true;
+}
+
+void StoreSession::free_fill()
+{
+    free(_fill_buf[0]);
+    free(_fill_buf[1]);
+    _fill_buf[0] = _fill_buf[1] = NULL;
+    _fill_size = 0;
 }
 
-QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot)
+QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot,
+                               uint64_t samples, int blocks)
 {
     GSList *l;
     GVariant *gvar;
@@ -349,7 +649,7 @@ QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot)
     }
 
     fprintf(meta, "[version]\n");
-    fprintf(meta, "version = %d\n", File_Version);
+    fprintf(meta, "version = %d\n", _file_version);
 
     /* metadata */
     fprintf(meta, "[header]\n");
@@ -360,11 +660,14 @@ QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot)
 
     /* metadata */
     fprintf(meta, "capturefile = data\n");
-    fprintf(meta, "total samples = %" PRIu64 "\n", snapshot->get_sample_count());
+    fprintf(meta, "compression = %s\n", sr_session_codec_name(_codec));
+    if (_codec != SR_COMPRESS_STORE)
+        fprintf(meta, "compression level = %d\n", _level);
+    fprintf(meta, "total samples = %" PRIu64 "\n", samples);
 
     if (sdi->mode != LOGIC) {
         fprintf(meta, "total probes = %d\n", snapshot->get_channel_num());
-        fprintf(meta, "total blocks = %d\n", snapshot->get_block_num());
+        fprintf(meta, "total blocks = %d\n", blocks);
     }
 
     shared_ptr<data::LogicSnapshot> logic_snapshot;
@@ -376,7 +679,7 @@ QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot)
                 to_save_probes++;
         }
         fprintf(meta, "total probes = %d\n", to_save_probes);
-        fprintf(meta, "total blocks = %d\n", logic_snapshot->get_block_num());
+        fprintf(meta, "total blocks = %d\n", blocks);
     }
 
     s = sr_samplerate_string(_session.cur_snap_samplerate());
@@ -511,6 +814,193 @@ QString StoreSession::meta_gen(boost::shared_ptr<data::Snapshot> snapshot)
     return metafile;
 }
 
+/*
+ * Record a logic capture to disk while it runs. Blocks are added as
+ * soon as the capture is past them, and the file is a complete
+ * session file again after every sync. The blocks added after a sync
+ * replace its directory, so a file left by a crash needs a zip repair
+ * tool to be loaded.
+ */
+bool StoreSession::record_start(QString file_name, QString session_file)
+{
+    _file_name = file_name;
+    _file_version = File_Version;
+    _codec = SR_COMPRESS_DEFLATE;
+    _level = Record_Level;
+    _record_end = false;
+    _units_stored = 0;
+    _unit_count = 0;
+    _has_error = false;
+    _error.clear();
+    _canceled = false;
+
+    _recorder = sr_session_recorder_new(_file_name.toUtf8().data());
+    if (_recorder == NULL) {
+        _error = tr("Failed to create zip file. Please check write permission of this path.");
+        return false;
+    }
+
+    #ifdef ENABLE_DECODE
+    QString decoders_file = decoders_gen();
+    #else
+    QString decoders_file = NULL;
+    #endif
+    int ret = SR_OK;
+    if (decoders_file != NULL)
+        ret = record_file("decoders", decoders_file);
+    if (ret == SR_OK && session_file != NULL)
+        ret = record_file("session", session_file);
+    if (ret != SR_OK) {
+        sr_session_recorder_close(_recorder);
+        _recorder = NULL;
+        QFile::remove(_file_name);
+        _error = tr("Failed to create zip file. Please check write permission of this path.");
+        return false;
+    }
+
+    _thread = boost::thread(&StoreSession::record_proc, this);
+    return true;
+}
+
+void StoreSession::record_end()
+{
+    boost::lock_guard<boost::mutex> lock(_record_mutex);
+    _record_end = true;
+    _record_cond.notify_all();
+}
+
+void StoreSession::record_proc()
+{
+    const uint64_t leaf_samples = data::LogicSnapshot::get_leaf_samples();
+    const shared_ptr<data::LogicSnapshot> snapshot =
+        dynamic_pointer_cast<data::LogicSnapshot>(_session.get_snapshot(SR_CHANNEL_LOGIC));
+    assert(snapshot);
+
+    vector<int> channels;
+    uint64_t blocks = 0;
+    uint64_t synced = 0;
+    boost::posix_time::ptime sync_time = boost::posix_time::microsec_clock::universal_time();
+    bool ended = false;
+    int ret = SR_OK;
+
+    while (ret == SR_OK && !ended) {
+        {
+            boost::unique_lock<boost::mutex> lock(_record_mutex);
+            if (!_record_end)
+                _record_cond.timed_wait(lock, boost::posix_time::milliseconds(Record_Poll));
+            ended = _record_end;
+        }
+
+        // the writer is done with the blocks before the current one,
+        // and with all of them once the capture ended
+        uint64_t sample_count, ring_sample_count;
+        snapshot->get_published(sample_count, ring_sample_count);
+        const uint64_t done = ended ? snapshot->get_block_num() :
+                                      ring_sample_count / leaf_samples;
+        if (done == 0 || (done <= blocks && !ended))
+            continue;
+
+        if (channels.empty()) {
+            BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
+                if (s->get_type() == SR_CHANNEL_LOGIC && s->enabled() &&
+                    snapshot->has_data(s->get_index()))
+                    channels.push_back(s->get_index());
+            }
+        }
+
+        // fill blocks for trimmed leaves, all recorded blocks are complete
+        if (_fill_size == 0 && !alloc_fill(leaf_samples / 8)) {
+            _error = tr("Failed to create zip file. Malloc error.");
+            ret = SR_ERR;
+            break;
+        }
+
+        _chunk_snapshot = snapshot;
+        _chunks.clear();
+        _next_chunk = 0;
+        _chunk_stop = false;
+        for (uint64_t i = blocks; i < done; i++) {
+            BOOST_FOREACH(int ch_index, channels)
+                _chunks.push_back(SaveChunk(NULL, snapshot->get_block_size(i), i,
+                                            ch_index, SR_CHANNEL_LOGIC, false));
+        }
+        if (!_chunks.empty())
+            ret = write_chunks();
+        BOOST_FOREACH(SaveChunk &chunk, _chunks)
+            g_free(chunk.comp_buf);
+        _chunks.clear();
+        _chunk_snapshot.reset();
+        if (ret != SR_OK)
+            break;
+        blocks = std::max(blocks, done);
+
+        // add a directory, and read back from what is on disk
+        const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+        if (ended || (blocks != synced &&
+                      (now - sync_time).total_milliseconds() >= Record_Sync)) {
+            ret = record_sync(snapshot, blocks, channels.size(), ended);
+            if (ret != SR_OK)
+                break;
+            struct sr_session_reader *reader =
+                sr_session_reader_new(_file_name.toUtf8().data(), _file_version);
+            if (reader != NULL) {
+                snapshot->recorded(blocks, reader);
+                sr_session_reader_unref(reader);
+            }
+            synced = blocks;
+            sync_time = now;
+        }
+    }
+
+    if (sr_session_recorder_close(_recorder) != SR_OK)
+        ret = SR_ERR;
+    _recorder = NULL;
+    if (blocks == 0)
+        QFile::remove(_file_name);
+    free_fill();
+
+    if (ret != SR_OK) {
+        _has_error = true;
+        if (_error.isEmpty())
+            _error = tr("Failed to create zip file. Please check write permission of this path.");
+        _session.record_error();
+    }
+}
+
+int StoreSession::record_file(const char *name, QString file_name)
+{
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly))
+        return SR_ERR;
+    const QByteArray data = file.readAll();
+    return sr_session_recorder_add(_recorder, name,
+                                   (const unsigned char *)data.constData(),
+                                   data.size());
+}
+
+/*
+ * Add the header for the recorded blocks again, and a new directory
+ * after it. The block index is only added once the capture ended.
+ */
+int StoreSession::record_sync(shared_ptr<data::LogicSnapshot> snapshot,
+                              uint64_t blocks, uint16_t channels, bool ended)
+{
+    const uint64_t samples = ended ? snapshot->get_sample_count() :
+                             blocks * data::LogicSnapshot::get_leaf_samples();
+    QString meta_file = meta_gen(snapshot, samples, blocks);
+    if (meta_file == NULL)
+        return SR_ERR;
+
+    int ret = record_file("header", meta_file);
+    if (ret == SR_OK && ended) {
+        data::Snapshot::ReadGuard guard(*snapshot);
+        ret = add_index(snapshot, channels);
+    }
+    if (ret == SR_OK)
+        ret = sr_session_recorder_sync(_recorder);
+    return ret;
+}
+
 bool StoreSession::export_start()
 {
     std::set<int> type_set;
@@ -625,10 +1115,8 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
     if(_outModule->init)
         _outModule->init(&output, params);
     QFile file(_file_name);
+    // the output modules format UTF-8 already, it is written as it is
     file.open(QIODevice::WriteOnly | QIODevice::Text);
-    QTextStream out(&file);
-    out.setCodec("UTF-8");
-    //out.setGenerateByteOrderMark(true);  // UTF-8 without BOM
 
     // Meta
     GString *data_out;
@@ -671,7 +1159,7 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
     p.payload = &meta;
     _outModule->receive(&output, &p, &data_out);
     if(data_out){
-        out << QString::fromUtf8((char*) data_out->str);
+        file.write(data_out->str, data_out->len);
         g_string_free(data_out,TRUE);
     }
     for (GSList *l = meta.config; l; l = l->next) {
@@ -680,7 +1168,11 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
     }
     g_slist_free(meta.config);
 
-    if (channel_type == SR_CHANNEL_LOGIC) {
+    if (channel_type == SR_CHANNEL_LOGIC &&
+        (!strcmp(_outModule->id, "vcd") || !strcmp(_outModule->id, "csv"))) {
+        _unit_count = logic_snapshot->get_sample_count();
+        export_changes(logic_snapshot, &output, file);
+    } else if (channel_type == SR_CHANNEL_LOGIC) {
         _unit_count = logic_snapshot->get_sample_count();
         int blk_num = logic_snapshot->get_block_num();
         bool sample;
@@ -688,6 +1180,8 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
         std::vector<bool> buf_sample;
         for (int blk = 0; !boost::this_thread::interruption_requested()  &&
                           blk < blk_num; blk++) {
+            // keep lazily loaded blocks until this one is written
+            data::LogicSnapshot::ReadGuard guard(*logic_snapshot);
             uint64_t buf_sample_num = logic_snapshot->get_block_size(blk) * 8;
             buf_vec.clear();
             buf_sample.clear();
@@ -704,28 +1198,32 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
             }
 
             uint16_t unitsize = ceil(buf_vec.size() / 8.0);
+            if (unitsize > data::MaxPlanesUnitSize) {
+                _has_error = true;
+                _error = tr("Too many channels to export.");
+                return;
+            }
             unsigned int usize = 8192;
             unsigned int size = usize;
             struct sr_datafeed_logic lp;
+            std::vector<const uint64_t *> planes(buf_vec.size());
+            std::vector<uint8_t> levels(buf_vec.size());
+            uint8_t *xbuf = (uint8_t *)malloc(usize * unitsize);
+            if (xbuf == NULL) {
+                _has_error = true;
+                _error = tr("xbuffer malloc failed.");
+                return;
+            }
             for(uint64_t i = 0; !boost::this_thread::interruption_requested() &&
                                 i < buf_sample_num; i+=usize){
                 if(buf_sample_num - i < usize)
                     size = buf_sample_num - i;
-                uint8_t *xbuf = (uint8_t *)malloc(size * unitsize);
-                if (xbuf == NULL) {
-                    _has_error = true;
-                    _error = tr("xbuffer malloc failed.");
-                    return;
-                }
-                memset(xbuf, 0, size * unitsize);
-                for (uint64_t j = 0; j < size; j++) {
-                    for (unsigned int k = 0; k < buf_vec.size(); k++) {
-                        if (buf_vec[k] == NULL && buf_sample[k])
-                            xbuf[j*unitsize+k/8] +=  1 << k%8;
-                        else if (buf_vec[k] && (buf_vec[k][(i+j)/8] & (1 << j%8)))
-                            xbuf[j*unitsize+k/8] +=  1 << k%8;
-                    }
+                for (unsigned int k = 0; k < buf_vec.size(); k++) {
+                    planes[k] = buf_vec[k] ? (const uint64_t *)(buf_vec[k] + i / 8) : NULL;
+                    levels[k] = buf_sample[k];
                 }
+                data::transpose_planes(planes.data(), levels.data(), buf_vec.size(),
+                                       size, xbuf, unitsize);
                 lp.data = xbuf;
                 lp.length = size * unitsize;
                 lp.unitsize = unitsize;
@@ -734,15 +1232,14 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
                 p.payload = &lp;
                 _outModule->receive(&output, &p, &data_out);
                 if(data_out){
-                    out << QString::fromUtf8((char*) data_out->str);
+                    file.write(data_out->str, data_out->len);
                     g_string_free(data_out,TRUE);
                 }
 
                 _units_stored += size;
-                if (xbuf)
-                    free(xbuf);
                 progress_updated();
             }
+            free(xbuf);
         }
     } else if (channel_type == SR_CHANNEL_DSO) {
         _unit_count = snapshot->get_sample_count();
@@ -760,7 +1257,7 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
             p.payload = &dp;
             _outModule->receive(&output, &p, &data_out);
             if(data_out){
-                out << (char*) data_out->str;
+                file.write(data_out->str, data_out->len);
                 g_string_free(data_out,TRUE);
             }
 
@@ -783,7 +1280,7 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
             p.payload = &ap;
             _outModule->receive(&output, &p, &data_out);
             if(data_out){
-                out << (char*) data_out->str;
+                file.write(data_out->str, data_out->len);
                 g_string_free(data_out,TRUE);
             }
 
@@ -802,6 +1299,94 @@ void StoreSession::export_proc(shared_ptr<data::Snapshot> snapshot)
     progress_updated();
 }
 
+/*
+ * VCD, and logic CSV, only have a line for each change: walk the edges
+ * of all channels with the mipmap, and merge them in time order,
+ * instead of comparing every sample. The output module formats the
+ * changes, sent in SR_DF_LOGIC_CHANGES packets.
+ */
+void StoreSession::export_changes(shared_ptr<data::LogicSnapshot> snapshot,
+                                  struct sr_output *output, QFile &file)
+{
+    typedef pair<uint64_t, int> Edge;
+    const uint64_t sample_count = snapshot->get_sample_count();
+    vector<int> channels;
+    BOOST_FOREACH(const boost::shared_ptr<view::Signal> s, _session.get_signals()) {
+        if (s->get_type() == SR_CHANNEL_LOGIC &&
+            snapshot->has_data(s->get_index()))
+            channels.push_back(s->get_index());
+    }
+    if (channels.empty() || sample_count == 0 ||
+        _session.cur_snap_samplerate() == 0)
+        return;
+
+    // the first sample, and the next edge of each channel
+    const uint16_t unitsize = (channels.size() + 7) / 8;
+    vector<uint8_t> sample(unitsize, 0);
+    vector<char> value(channels.size());
+    std::priority_queue<Edge, vector<Edge>, std::greater<Edge> > edges;
+    for (size_t k = 0; k < channels.size(); k++) {
+        value[k] = snapshot->get_sample(0, channels[k]);
+        if (value[k])
+            sample[k / 8] |= 1 << (k % 8);
+        uint64_t index = 1;
+        if (snapshot->get_nxt_edge(index, value[k], sample_count - 1, 1, channels[k]))
+            edges.push(Edge(index, k));
+    }
+
+    vector<uint64_t> indexes;
+    vector<uint8_t> samples;
+    indexes.reserve(Export_Changes);
+    samples.reserve(Export_Changes * unitsize);
+    indexes.push_back(0);
+    samples.insert(samples.end(), sample.begin(), sample.end());
+
+    struct sr_datafeed_packet p;
+    struct sr_datafeed_changes cp;
+    GString *data_out;
+    p.type = SR_DF_LOGIC_CHANGES;
+    p.status = SR_PKT_OK;
+    p.payload = &cp;
+    cp.unitsize = unitsize;
+    for (;;) {
+        const bool ended = edges.empty() ||
+                           boost::this_thread::interruption_requested();
+        if (!ended) {
+            const uint64_t index = edges.top().first;
+            while (!edges.empty() && edges.top().first == index) {
+                const int k = edges.top().second;
+                edges.pop();
+                value[k] = !value[k];
+                sample[k / 8] ^= 1 << (k % 8);
+                uint64_t next = index;
+                if (snapshot->get_nxt_edge(next, value[k], sample_count - 1, 1, channels[k]))
+                    edges.push(Edge(next, k));
+            }
+            indexes.push_back(index);
+            samples.insert(samples.end(), sample.begin(), sample.end());
+            if (indexes.size() < (size_t)Export_Changes)
+                continue;
+        }
+
+        // the samples up to the next change are sent with this one
+        cp.num_changes = indexes.size();
+        cp.index = indexes.data();
+        cp.data = samples.data();
+        cp.num_samples = edges.empty() ? sample_count : edges.top().first;
+        _outModule->receive(output, &p, &data_out);
+        if (data_out) {
+            file.write(data_out->str, data_out->len);
+            g_string_free(data_out, TRUE);
+        }
+        _units_stored = cp.num_samples;
+        progress_updated();
+        indexes.clear();
+        samples.clear();
+        if (ended)
+            break;
+    }
+}
+
 #ifdef ENABLE_DECODE
 QString StoreSession::decoders_gen()
 {
@@ -24,11 +24,14 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include <boost/thread.hpp>
 
 #include <QObject>
 
+class QFile;
+
 #include <libsigrok4DSL/libsigrok.h>
 #include <libsigrokdecode4DSL/libsigrokdecode.h>
 
@@ -38,6 +41,7 @@ class SigSession;
 
 namespace data {
 class Snapshot;
+class LogicSnapshot;
 }
 
 namespace dock {
@@ -50,6 +54,42 @@ class StoreSession : public QObject
 
 private:
     const static int File_Version = 2;
+    // logic leaves stored as they are, with a block index
+    const static int Leaf_File_Version = 3;
+    // recording keeps up with the capture, and the file readable
+    const static int Record_Level = 1;
+    const static int Record_Poll = 200;
+    const static int Record_Sync = 1000;
+    // changes sent to the output module at a time
+    const static int Export_Changes = 8192;
+
+    struct SaveChunk
+    {
+        SaveChunk(const uint8_t *buf, uint64_t size, int chunk_num,
+                  int index, int type, bool owned) :
+            buf(buf), size(size), chunk_num(chunk_num), index(index),
+            type(type), owned(owned), done(false), ret(SR_OK),
+            comp_buf(NULL), comp_size(0), crc(0) {}
+
+        const uint8_t *buf;
+        uint64_t size;
+        int chunk_num;
+        int index;
+        int type;
+        bool owned;
+
+        bool done;
+        int ret;
+        unsigned char *comp_buf;
+        uint64_t comp_size;
+        uint32_t crc;
+    };
+
+public:
+    // deflate level of saved files, the "SaveCompressionLevel" preference
+    const static int Compress_Level = 6;
+    // deflate level of the "smallest" save filter
+    const static int Archive_Level = 9;
 
 public:
     StoreSession(SigSession &session);
@@ -66,14 +106,33 @@ public:
 
     bool export_start();
 
+    bool record_start(QString file_name, QString session_file);
+
+    void record_end();
+
 	void wait();
 
 	void cancel();
 
 private:
     void save_proc(boost::shared_ptr<pv::data::Snapshot> snapshot);
-    QString meta_gen(boost::shared_ptr<data::Snapshot> snapshot);
+    void queue_leaves(boost::shared_ptr<pv::data::LogicSnapshot> snapshot);
+    int add_index(boost::shared_ptr<pv::data::LogicSnapshot> snapshot,
+                  uint16_t channels);
+    int write_chunks();
+    const uint8_t *chunk_data(const SaveChunk &chunk);
+    bool alloc_fill(uint64_t size);
+    void free_fill();
+    void compress_proc();
+    QString meta_gen(boost::shared_ptr<data::Snapshot> snapshot,
+                     uint64_t samples, int blocks);
+    void record_proc();
+    int record_file(const char *name, QString file_name);
+    int record_sync(boost::shared_ptr<pv::data::LogicSnapshot> snapshot,
+                    uint64_t blocks, uint16_t channels, bool ended);
     void export_proc(boost::shared_ptr<pv::data::Snapshot> snapshot);
+    void export_changes(boost::shared_ptr<pv::data::LogicSnapshot> snapshot,
+                        struct sr_output *output, QFile &file);
     #ifdef ENABLE_DECODE
     QString decoders_gen();
     #endif
@@ -99,8 +158,31 @@ private:
 	boost::thread _thread;
 
     const struct sr_output_module* _outModule;
+    struct sr_session_recorder *_recorder;
+    int _file_version;
+    int _codec;
+    int _level;
+    std::vector<uint64_t> _leaf_index;
 
     //mutable boost::mutex _mutex;
+    std::vector<SaveChunk> _chunks;
+    // chunks without buf are blocks of this logic snapshot
+    boost::shared_ptr<data::Snapshot> _chunk_snapshot;
+    // fill blocks for logic blocks without a leaf, low and high
+    uint8_t *_fill_buf[2];
+    uint64_t _fill_size;
+    size_t _next_chunk;
+    // compressed chunks wait for the file in a bounded window
+    size_t _chunk_written;
+    size_t _chunk_window;
+    bool _chunk_stop;
+    boost::mutex _chunk_mutex;
+    boost::condition_variable _chunk_cond;
+
+    bool _record_end;
+    boost::mutex _record_mutex;
+    boost::condition_variable _record_cond;
+
 	uint64_t _units_stored;
 	uint64_t _unit_count;
     bool _has_error;
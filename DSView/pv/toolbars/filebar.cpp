@@ -75,6 +75,11 @@ FileBar::FileBar(SigSession &session, QWidget *parent) :
     _action_export->setObjectName(QString::fromUtf8("actionExport"));
     connect(_action_export, SIGNAL(triggered()), this, SIGNAL(on_export()));
 
+    _action_record = new QAction(this);
+    _action_record->setObjectName(QString::fromUtf8("actionRecord"));
+    _action_record->setCheckable(true);
+    connect(_action_record, SIGNAL(triggered(bool)), this, SIGNAL(on_record(bool)));
+
 
     _action_capture = new QAction(this);
     _action_capture->setObjectName(QString::fromUtf8("actionCapture"));
@@ -88,6 +93,7 @@ FileBar::FileBar(SigSession &session, QWidget *parent) :
     _menu->addAction(_action_open);
     _menu->addAction(_action_save);
     _menu->addAction(_action_export);
+    _menu->addAction(_action_record);
     _menu->addAction(_action_capture);
     _file_button.setMenu(_menu);
     addWidget(&_file_button);
@@ -114,6 +120,7 @@ void FileBar::retranslateUi()
     _action_open->setText(tr("&Open..."));
     _action_save->setText(tr("&Save..."));
     _action_export->setText(tr("&Export..."));
+    _action_record->setText(tr("&Record to Disk..."));
     _action_capture->setText(tr("&Capture..."));
 }
 
@@ -128,6 +135,7 @@ void FileBar::reStyle()
     _action_open->setIcon(QIcon(iconPath+"/open.svg"));
     _action_save->setIcon(QIcon(iconPath+"/save.svg"));
     _action_export->setIcon(QIcon(iconPath+"/export.svg"));
+    _action_record->setIcon(QIcon(iconPath+"/save.svg"));
     _action_capture->setIcon(QIcon(iconPath+"/capture.svg"));
     _file_button.setIcon(QIcon(iconPath+"/file.svg"));
 }
@@ -139,7 +147,7 @@ void FileBar::on_actionOpen_triggered()
     // Show the dialog
     const QString file_name = QFileDialog::getOpenFileName(
         this, tr("Open File"), settings.value(DIR_KEY).toString(), tr(
-            "DSView Data (*.dsl)"));
+            "DSView Data (*.dsl);;Value Change Dump (*.vcd);;Wave Audio (*.wav);;sigrok Session (*.sr);;Raw Binary (*.bin *.raw);;All Files (*)"));
     if (!file_name.isEmpty()) {
         QDir CurrentDir;
         settings.setValue(DIR_KEY, CurrentDir.absoluteFilePath(file_name));
@@ -247,5 +255,15 @@ void FileBar::set_settings_en(bool enable)
     _menu_session->setDisabled(!enable);
 }
 
+void FileBar::set_recording(bool recording)
+{
+    _action_record->setChecked(recording);
+}
+
+bool FileBar::get_recording() const
+{
+    return _action_record->isChecked();
+}
+
 } // namespace toolbars
 } // namespace pv
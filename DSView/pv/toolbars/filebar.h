@@ -44,6 +44,9 @@ public:
 
     void set_settings_en(bool enable);
 
+    void set_recording(bool recording);
+    bool get_recording() const;
+
 private:
     void changeEvent(QEvent *event);
     void retranslateUi();
@@ -58,6 +61,7 @@ signals:
     void load_file(QString);
     void on_save();
     void on_export();
+    void on_record(bool);
     void on_screenShot();
     void load_session(QString);
     void store_session(QString);
@@ -85,6 +89,7 @@ private:
     QAction *_action_open;
     QAction *_action_save;
     QAction *_action_export;
+    QAction *_action_record;
     QAction *_action_capture;
 };
 
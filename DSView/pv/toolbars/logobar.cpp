@@ -30,6 +30,7 @@
 
 #include "logobar.h"
 #include "../dialogs/about.h"
+#include "../dialogs/preferences.h"
 #include "../dialogs/dsmessagebox.h"
 
 namespace pv {
@@ -76,8 +77,14 @@ LogoBar::LogoBar(SigSession &session, QWidget *parent) :
     _logo_button.addAction(_issue);
     connect(_issue, SIGNAL(triggered()), this, SLOT(on_actionIssue_triggered()));
 
+    _preferences = new QAction(this);
+    _preferences->setObjectName(QString::fromUtf8("actionPreferences"));
+    _logo_button.addAction(_preferences);
+    connect(_preferences, SIGNAL(triggered()), this, SLOT(on_actionPreferences_triggered()));
+
     _menu = new QMenu(this);
     _menu->addMenu(_language);
+    _menu->addAction(_preferences);
     _menu->addAction(_about);
     _menu->addAction(_manual);
     _menu->addAction(_issue);
@@ -115,6 +122,7 @@ void LogoBar::retranslateUi()
     _about->setText(tr("&About..."));
     _manual->setText(tr("&Manual"));
     _issue->setText(tr("&Bug Report"));
+    _preferences->setText(tr("&Preferences..."));
 
     if (qApp->property("Language") == QLocale::Chinese)
         _language->setIcon(QIcon(":/icons/Chinese.svg"));
@@ -129,6 +137,7 @@ void LogoBar::reStyle()
     _about->setIcon(QIcon(iconPath+"/about.svg"));
     _manual->setIcon(QIcon(iconPath+"/manual.svg"));
     _issue->setIcon(QIcon(iconPath+"/bug.svg"));
+    _preferences->setIcon(QIcon(iconPath+"/gear.svg"));
     if (_connected)
         _logo_button.setIcon(QIcon(iconPath+"/logo_color.svg"));
     else
@@ -203,6 +212,12 @@ void LogoBar::on_actionIssue_triggered()
                 QUrl(QLatin1String("https://github.com/DreamSourceLab/DSView/issues")));
 }
 
+void LogoBar::on_actionPreferences_triggered()
+{
+    dialogs::Preferences dlg(_session, this);
+    dlg.exec();
+}
+
 void LogoBar::enable_toggle(bool enable)
 {
     _logo_button.setDisabled(!enable);
@@ -66,6 +66,7 @@ private slots:
     void on_actionAbout_triggered();
     void on_actionManual_triggered();
     void on_actionIssue_triggered();
+    void on_actionPreferences_triggered();
 
 private:
     bool _enable;
@@ -83,6 +84,7 @@ private:
     QAction *_about;
     QAction *_manual;
     QAction *_issue;
+    QAction *_preferences;
 };
 
 } // namespace toolbars
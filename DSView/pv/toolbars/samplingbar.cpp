@@ -564,6 +564,10 @@ void SamplingBar::update_sample_count_selector()
     } else {
         sw_depth = AnalogMaxSWDepth;
     }
+    // recorded stream captures only keep a window of blocks in memory
+    if (dev_inst->dev_inst()->mode == LOGIC && stream_mode &&
+        !_session.get_record_file().isEmpty())
+        sw_depth = LogicMaxRecordDepth;
 
     if (dev_inst->dev_inst()->mode == LOGIC)  {
         gvar = dev_inst->get_config(NULL, NULL, SR_CONF_RLE_SUPPORT);
@@ -64,6 +64,7 @@ private:
     static const int RefreshShort = 500;
     static const uint64_t LogicMaxSWDepth64 = SR_GB(16);
     static const uint64_t LogicMaxSWDepth32 = SR_GB(8);
+    static const uint64_t LogicMaxRecordDepth = SR_GB(1024);
     static const uint64_t AnalogMaxSWDepth = SR_Mn(100);
     static const QString RLEString;
     static const QString DIVString;
@@ -78,6 +79,7 @@ public:
     boost::shared_ptr<pv::device::DevInst> get_selected_device() const;
 
     void update_sample_rate_selector();
+    void update_sample_count_selector();
 
 	void set_sampling(bool sampling);
     bool get_sampling() const;
@@ -111,7 +113,6 @@ private:
     void reStyle();
 
 	void update_sample_rate_selector_value();
-    void update_sample_count_selector();
     void update_sample_count_selector_value();
     void commit_settings();
     void setting_adj();
@@ -24,6 +24,8 @@
 
 #include <math.h>
 
+#include <boost/bind.hpp>
+
 #include "../view/analogsignal.h"
 #include "../data/analog.h"
 #include "../data/analogsnapshot.h"
@@ -52,7 +54,6 @@ AnalogSignal::AnalogSignal(boost::shared_ptr<pv::device::DevInst> dev_inst,
                            sr_channel *probe) :
     Signal(dev_inst, probe),
     _data(data),
-    _rects(NULL),
     _hover_en(false),
     _hover_index(0),
     _hover_point(QPointF(-1, -1)),
@@ -101,7 +102,6 @@ AnalogSignal::AnalogSignal(boost::shared_ptr<view::AnalogSignal> s,
                          sr_channel *probe) :
     Signal(*s.get(), probe),
     _data(data),
-    _rects(NULL),
     _hover_en(false),
     _hover_index(0),
     _hover_point(QPointF(-1, -1)),
@@ -118,10 +118,6 @@ AnalogSignal::AnalogSignal(boost::shared_ptr<view::AnalogSignal> s,
 
 AnalogSignal::~AnalogSignal()
 {
-    if (_rects) {
-        delete[] _rects;
-        _rects = NULL;
-    }
 }
 
 boost::shared_ptr<pv::data::SignalData> AnalogSignal::data() const
@@ -428,17 +424,6 @@ int AnalogSignal::get_zero_offset() const
     return _zero_offset;
 }
 
-/**
- * Event
- **/
-void AnalogSignal::resize()
-{
-    if (_rects) {
-        delete[] _rects;
-        _rects = NULL;
-    }
-}
-
 /**
  * Paint
  **/
@@ -496,14 +481,55 @@ void AnalogSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QCol
     (void)fore;
     (void)back;
 
+    TracePaint t;
+    if (get_trace_paint(t, left, right))
+        paint_signal(t, p);
+}
+
+bool AnalogSignal::get_frame_paint(FrameRenderer::Paint &paint,
+    int left, int right, QColor fore, QColor back)
+{
+    (void)fore;
+    (void)back;
+
+    TracePaint t;
+    if (!get_trace_paint(t, left, right))
+        return true;
+
+    paint.id = this;
+    paint.state.clear();
+    paint.state.push_back(t.index);
+    paint.state.push_back(t.order);
+    paint.state.push_back(t.zeroY);
+    // the samples painted follow the offset, the frame has it
+    paint.state.push_back(t.snapshot->get_sample_count());
+    paint.state.push_back(t.snapshot->get_ring_start());
+    paint.state.push_back(t.samples_per_pixel);
+    paint.state.push_back(t.top);
+    paint.state.push_back(t.bottom);
+    paint.state.push_back(t.width);
+    paint.state.push_back(t.envelope);
+    paint.state.push_back(t.colour.rgba());
+    paint.state.push_back(t.scale);
+    paint.state.push_back(t.hw_offset);
+    paint.state.push_back(t.sample_limits);
+    paint.pans = true;
+    paint.right = right;
+    paint.draw = boost::bind(&AnalogSignal::paint_signal, t, _1);
+    return true;
+}
+
+/*
+ * What painting the signal between left and right uses. Returns false
+ * if there is nothing to paint.
+ */
+bool AnalogSignal::get_trace_paint(TracePaint &t, int left, int right)
+{
     assert(_data);
     assert(_view);
     assert(right >= left);
 
     const int height = get_totalHeight();
-    const float top = get_y() - height * 0.5;
-    const float bottom = get_y() + height * 0.5;
-    const float zeroY = ratio2pos(get_zero_ratio());
     const int width = right - left + 1;
 
     const double scale = _view->scale();
@@ -513,16 +539,16 @@ void AnalogSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QCol
     const deque< boost::shared_ptr<pv::data::AnalogSnapshot> > &snapshots =
         _data->get_snapshots();
     if (snapshots.empty())
-        return;
+        return false;
 
     const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot =
         snapshots.front();
     if (snapshot->empty())
-        return;
+        return false;
 
     const int order = snapshot->get_ch_order(get_index());
     if (order == -1)
-        return;
+        return false;
 
     const double pixels_offset = offset;
     const double samplerate = _data->samplerate();
@@ -530,26 +556,47 @@ void AnalogSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QCol
     const double samples_per_pixel = samplerate * scale;
     const uint64_t ring_start = snapshot->get_ring_start();
 
-    int64_t start_pixel;
-    uint64_t start_index;
     const double index_offset = pixels_offset * samples_per_pixel;
-    start_index = (uint64_t)(ring_start + floor(index_offset)) % cur_sample_count;
-    start_pixel = (floor(index_offset) - index_offset) / samples_per_pixel ;
+    t.start_index = (uint64_t)(ring_start + floor(index_offset)) % cur_sample_count;
+    t.start_pixel = (floor(index_offset) - index_offset) / samples_per_pixel ;
+
+    t.sample_count = min(floor(cur_sample_count - floor(index_offset)), ceil(width*samples_per_pixel + 1));
+    if (t.sample_count <= 0)
+        return false;
 
-    int64_t show_length = min(floor(cur_sample_count - floor(index_offset)), ceil(width*samples_per_pixel + 1));
-    if (show_length <= 0)
+    t.snapshot = snapshot;
+    t.index = get_index();
+    t.order = order;
+    t.zeroY = ratio2pos(get_zero_ratio());
+    t.samples_per_pixel = samples_per_pixel;
+    t.top = get_y() - height * 0.5;
+    t.bottom = get_y() + height * 0.5;
+    t.width = width;
+    t.envelope = samples_per_pixel >= EnvelopeThreshold;
+    t.colour = _colour;
+    t.scale = _scale;
+    t.hw_offset = get_hw_offset();
+    t.sample_limits = _view->session().cur_samplelimits();
+    return true;
+}
+
+/*
+ * Paints the signal, from t alone: on the render thread, the signal may
+ * be changed or deleted meanwhile. The snapshot is locked, so that a new
+ * capture does not free the samples under the painting.
+ */
+void AnalogSignal::paint_signal(const TracePaint &t, QPainter &p)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(t.snapshot->get_mutex());
+    if (t.snapshot->empty() ||
+        t.snapshot->get_ch_order(t.index) != t.order ||
+        t.start_index >= t.snapshot->get_sample_count())
         return;
 
-    if (samples_per_pixel < EnvelopeThreshold)
-        paint_trace(p, snapshot, zeroY,
-            start_pixel, start_index, show_length,
-            samples_per_pixel, order,
-            top, bottom, width);
+    if (t.envelope)
+        paint_envelope(p, t);
     else
-        paint_envelope(p, snapshot, zeroY,
-            start_pixel, start_index, show_length,
-            samples_per_pixel, order,
-            top, bottom, width);
+        paint_trace(p, t);
 }
 
 void AnalogSignal::paint_fore(QPainter &p, int left, int right, QColor fore, QColor back)
@@ -570,38 +617,32 @@ void AnalogSignal::paint_fore(QPainter &p, int left, int right, QColor fore, QCo
     }
 }
 
-void AnalogSignal::paint_trace(QPainter &p,
-    const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot,
-    int zeroY, const int start_pixel,
-    const uint64_t start_index, const int64_t sample_count,
-    const double samples_per_pixel, const int order,
-    const float top, const float bottom, const int width)
+void AnalogSignal::paint_trace(QPainter &p, const TracePaint &t)
 {
-    (void)width;
-
+    const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot = t.snapshot;
     const int64_t channel_num = snapshot->get_channel_num();
+    const int64_t sample_count = t.sample_count;
     if (sample_count > 0) {
         const uint8_t unit_bytes = snapshot->get_unit_bytes();
         const uint8_t *const samples = snapshot->get_samples(0);
         assert(samples);
 
-        p.setPen(_colour);
+        p.setPen(t.colour);
         //p.setPen(QPen(_colour, 2, Qt::SolidLine));
 
         QPointF *points = new QPointF[sample_count];
         QPointF *point = points;
-        uint64_t yindex = start_index;
+        uint64_t yindex = t.start_index;
 
-        const int hw_offset = get_hw_offset();
-        float x = start_pixel;
-        double  pixels_per_sample = 1.0/samples_per_pixel;
+        float x = t.start_pixel;
+        double  pixels_per_sample = 1.0/t.samples_per_pixel;
         for (int64_t sample = 0; sample < sample_count; sample++) {
-            uint64_t index = (yindex * channel_num + order) * unit_bytes;
+            uint64_t index = (yindex * channel_num + t.order) * unit_bytes;
             float yvalue = samples[index];
             for(uint8_t i = 1; i < unit_bytes; i++)
                 yvalue += (samples[++index] << i*8);
-            yvalue = zeroY + (yvalue - hw_offset) * _scale;
-            yvalue = min(max(yvalue, top), bottom);
+            yvalue = t.zeroY + (yvalue - t.hw_offset) * t.scale;
+            yvalue = min(max(yvalue, t.top), t.bottom);
             *point++ = QPointF(x, yvalue);
             if (yindex == snapshot->get_ring_end())
                 break;
@@ -614,46 +655,46 @@ void AnalogSignal::paint_trace(QPainter &p,
     }
 }
 
-void AnalogSignal::paint_envelope(QPainter &p,
-    const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot,
-    int zeroY, const int start_pixel,
-    const uint64_t start_index, const int64_t sample_count,
-    const double samples_per_pixel, const int order,
-    const float top, const float bottom, const int width)
+void AnalogSignal::paint_envelope(QPainter &p, const TracePaint &t)
 {
     using namespace Qt;
     using pv::data::AnalogSnapshot;
 
+    const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot = t.snapshot;
+    const float zeroY = t.zeroY;
+    const float top = t.top;
+    const float bottom = t.bottom;
+    const double samples_per_pixel = t.samples_per_pixel;
+
     AnalogSnapshot::EnvelopeSection e;
-    snapshot->get_envelope_section(e, start_index, sample_count,
-                                   samples_per_pixel, order);
+    snapshot->get_envelope_section(e, t.start_index, t.sample_count,
+                                   samples_per_pixel, t.order);
     if (e.samples_num == 0)
         return;
 
     p.setPen(QPen(NoPen));
-    p.setBrush(_colour);
+    p.setBrush(t.colour);
 
-    if (!_rects)
-        _rects = new QRectF[width+10];
-    QRectF *rect = _rects;
+    vector<QRectF> rects(t.width + 10);
+    QRectF *rect = &rects[0];
     int px = -1, pre_px;
     float y_min = zeroY, y_max = zeroY, pre_y_min = zeroY, pre_y_max = zeroY;
     int pcnt = 0;
     const double scale_pixels_per_samples = e.scale / samples_per_pixel;
     const uint64_t ring_end = max((int64_t)0, (int64_t)snapshot->get_ring_end() / e.scale - 1);
-    const int hw_offset = get_hw_offset();
+    const int hw_offset = t.hw_offset;
 
-    float x = start_pixel;
+    float x = t.start_pixel;
     for(uint64_t sample = 0; sample < e.length; sample++) {
-        const uint64_t ring_index = (e.start + sample) % (_view->session().cur_samplelimits() / e.scale);
+        const uint64_t ring_index = (e.start + sample) % (t.sample_limits / e.scale);
         if (sample != 0 && ring_index == ring_end)
             break;
 
         const AnalogSnapshot::EnvelopeSample *const ev =
             e.samples + ((e.start + sample) % e.samples_num);
 
-        const float b = min(max((float)(zeroY + (ev->max - hw_offset) * _scale + 0.5), top), bottom);
-        const float t = min(max((float)(zeroY + (ev->min - hw_offset) * _scale + 0.5), top), bottom);
+        const float b = min(max((float)(zeroY + (ev->max - hw_offset) * t.scale + 0.5), top), bottom);
+        const float t = min(max((float)(zeroY + (ev->min - hw_offset) * t.scale + 0.5), top), bottom);
 
         pre_px = px;
         if(px != floor(x)) {
@@ -684,7 +725,7 @@ void AnalogSignal::paint_envelope(QPainter &p,
         x += scale_pixels_per_samples;
     }
 
-    p.drawRects(_rects, pcnt);
+    p.drawRects(&rects[0], pcnt);
 }
 
 void AnalogSignal::paint_hover_measure(QPainter &p, QColor fore, QColor back)
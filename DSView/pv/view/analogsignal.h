@@ -106,11 +106,6 @@ public:
     double value2ratio(int value) const;
     double pos2ratio(int pos) const;
 
-    /**
-     * Event
-     **/
-    void resize();
-
     /**
      * Paints the background layer of the trace with a QPainter
      * @param p the QPainter to paint into.
@@ -127,6 +122,13 @@ public:
 	 **/
     void paint_mid(QPainter &p, int left, int right, QColor fore, QColor back);
 
+    /**
+     * Paints the signal on the view's render thread, see
+     * Trace::get_frame_paint().
+     **/
+    bool get_frame_paint(FrameRenderer::Paint &paint,
+        int left, int right, QColor fore, QColor back);
+
     /**
      * Paints the signal with a QPainter
      * @param p the QPainter to paint into.
@@ -136,27 +138,37 @@ public:
     void paint_fore(QPainter &p, int left, int right, QColor fore, QColor back);
 
 private:
-    void paint_trace(QPainter &p,
-                     const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot,
-                     int zeroY, const int start_pixel,
-                     const uint64_t start_index, const int64_t sample_count,
-                     const double samples_per_pixel, const int order,
-                     const float top, const float bottom, const int width);
-
-    void paint_envelope(QPainter &p,
-                        const boost::shared_ptr<pv::data::AnalogSnapshot> &snapshot,
-                        int zeroY, const int start_pixel,
-                        const uint64_t start_index, const int64_t sample_count,
-                        const double samples_per_pixel, const int order,
-                        const float top, const float bottom, const int width);
+    // all painting the signal uses, so that the signal is not needed
+    struct TracePaint
+    {
+        boost::shared_ptr<pv::data::AnalogSnapshot> snapshot;
+        int index;
+        int order;
+        float zeroY;
+        int start_pixel;
+        uint64_t start_index;
+        int64_t sample_count;
+        double samples_per_pixel;
+        float top, bottom;
+        int width;
+        bool envelope;
+        QColor colour;
+        float scale;
+        int hw_offset;
+        uint64_t sample_limits;
+    };
+
+private:
+    bool get_trace_paint(TracePaint &t, int left, int right);
+    static void paint_signal(const TracePaint &t, QPainter &p);
+    static void paint_trace(QPainter &p, const TracePaint &t);
+    static void paint_envelope(QPainter &p, const TracePaint &t);
 
     void paint_hover_measure(QPainter &p, QColor fore, QColor back);
 
 private:
 	boost::shared_ptr<pv::data::Analog> _data;
 
-    QRectF *_rects;
-
 	float _scale;
     double _zero_vrate;
     int _zero_offset;
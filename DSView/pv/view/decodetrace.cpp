@@ -25,6 +25,7 @@ extern "C" {
 
 #include <extdef.h>
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 #include <boost/functional/hash.hpp>
 
@@ -38,6 +39,7 @@ extern "C" {
 #include <QDialog>
 #include <QDialogButtonBox>
 #include <QScrollArea>
+#include <QFontMetrics>
 
 #include "decodetrace.h"
 
@@ -49,6 +51,7 @@ extern "C" {
 #include "../data/decode/annotation.h"
 #include "../view/logicsignal.h"
 #include "../view/view.h"
+#include "../view/viewport.h"
 #include "../widgets/decodergroupbox.h"
 #include "../widgets/decodermenu.h"
 #include "../device/devinst.h"
@@ -242,15 +245,66 @@ void DecodeTrace::paint_back(QPainter &p, int left, int right, QColor fore, QCol
 }
 
 void DecodeTrace::paint_mid(QPainter &p, int left, int right, QColor fore, QColor back)
+{
+    RowsPaint r;
+    if (get_rows_paint(r, left, right, fore, back, p.font()))
+        paint_rows(r, p);
+}
+
+/*
+ * The rows are laid out here, on the GUI thread, and painted by the
+ * render thread from a copy of all they use. The decoder stack locks
+ * the annotations being decoded, TextCache::mutex the texts laid out.
+ */
+bool DecodeTrace::get_frame_paint(FrameRenderer::Paint &paint,
+    int left, int right, QColor fore, QColor back)
+{
+    RowsPaint r;
+    if (!get_rows_paint(r, left, right, fore, back,
+                        get_viewport() ? get_viewport()->font() : QFont()))
+        return true;
+
+    paint.id = this;
+    paint.state.clear();
+    paint.state.push_back(r.left);
+    paint.state.push_back(r.right);
+    paint.state.push_back(r.y);
+    paint.state.push_back(r.height);
+    paint.state.push_back(r.annotation_height);
+    paint.state.push_back(r.mark_index);
+    paint.state.push_back(r.text_colour.rgba());
+    paint.state.push_back(r.fore.rgba());
+    paint.state.push_back(r.back.rgba());
+    paint.state.push_back(qHash(r.error));
+    paint.state.push_back(qHash(r.font.toString()));
+    // the annotations published since are painted again
+    paint.state.push_back(_decoder_stack->samples_decoded());
+    BOOST_FOREACH(const RowPaint &row, r.rows) {
+        paint.state.push_back(row.kind);
+        paint.state.push_back(row.y);
+    }
+    BOOST_FOREACH(const MarkPaint &m, r.marks) {
+        paint.state.push_back(m.type);
+        paint.state.push_back(m.y);
+    }
+    // the labels are laid out on the part of the annotations on screen
+    paint.pans = false;
+    paint.right = right;
+    paint.draw = boost::bind(&DecodeTrace::paint_rows, r, _1);
+    return true;
+}
+
+/*
+ * What painting the rows between left and right uses. Sets the row
+ * headings, returns false if the trace has no sample there.
+ */
+bool DecodeTrace::get_rows_paint(RowsPaint &r, int left, int right,
+    QColor fore, QColor back, const QFont &font)
 {
     using namespace pv::data::decode;
 
     assert(_decoder_stack);
-    const QString err = _decoder_stack->error_message();
-    if (!err.isEmpty())
-    {
-        draw_error(p, err, left, right);
-    }
+    assert(_view);
 
     const double scale = _view->scale();
     assert(scale > 0);
@@ -259,32 +313,48 @@ void DecodeTrace::paint_mid(QPainter &p, int left, int right, QColor fore, QColo
 
     _cur_row_headings.clear();
 
+    // the texts laid out in another font or theme are dropped
+    QFont texts_font = font;
+    texts_font.setPointSize(DefaultFontSize);
+    if (!_texts || _texts->font != texts_font) {
+        _texts.reset(new TextCache);
+        _texts->font = texts_font;
+    }
+
     // Show sample rate as 1Hz when it is unknown
     if (samplerate == 0.0)
         samplerate = 1.0;
 
-    const int64_t pixels_offset = _view->offset();
-    const double samples_per_pixel = samplerate * scale;
-
-    uint64_t start_sample = (uint64_t)max((left + pixels_offset) *
-        samples_per_pixel, 0.0);
-    uint64_t end_sample = (uint64_t)max((right + pixels_offset) *
-        samples_per_pixel, 0.0);
+    r.decoder_stack = _decoder_stack;
+    r.texts = _texts;
+    r.error = _decoder_stack->error_message();
+    r.font = font;
+    r.left = left;
+    r.right = right;
+    r.y = get_y();
+    r.height = _totalHeight;
+    r.annotation_height = _view->get_signalHeight();
+    r.pixels_offset = _view->offset();
+    r.samples_per_pixel = samplerate * scale;
+    r.mark_index = _decoder_stack->get_mark_index();
+    r.text_colour = get_text_colour();
+    r.fore = fore;
+    r.back = back;
+
+    r.start_sample = (uint64_t)max((left + r.pixels_offset) *
+        r.samples_per_pixel, 0.0);
+    r.end_sample = (uint64_t)max((right + r.pixels_offset) *
+        r.samples_per_pixel, 0.0);
     BOOST_FOREACH(const boost::shared_ptr<data::decode::Decoder> &dec, _decoder_stack->stack()) {
-        start_sample = max(dec->decode_start(), start_sample);
-        end_sample = min(dec->decode_end(), end_sample);
+        r.start_sample = max(dec->decode_start(), r.start_sample);
+        r.end_sample = min(dec->decode_end(), r.end_sample);
         break;
     }
-    if (end_sample < start_sample)
-        return;
-
-    const int annotation_height = _view->get_signalHeight();
+    if (r.end_sample < r.start_sample)
+        return !r.error.isEmpty();
 
     // Iterate through the rows
-    assert(_view);
-    int y =  get_y() - (_totalHeight - annotation_height)*0.5;
-
-    assert(_decoder_stack);
+    int y = r.y - (_totalHeight - r.annotation_height)*0.5;
 
     BOOST_FOREACH(boost::shared_ptr<data::decode::Decoder> dec,
         _decoder_stack->stack()) {
@@ -295,41 +365,91 @@ void DecodeTrace::paint_mid(QPainter &p, int left, int right, QColor fore, QColo
                 if ((*i).first.decoder() == dec->decoder() &&
                     _decoder_stack->has_annotations((*i).first)) {
                     if ((*i).second) {
-                        const Row &row = (*i).first;
+                        RowPaint row;
+                        row.row = (*i).first;
+                        row.y = y;
 
                         const uint64_t min_annotation =
-                                _decoder_stack->get_min_annotation(row);
-                        const double min_annWidth = min_annotation / samples_per_pixel;
+                                _decoder_stack->get_min_annotation(row.row);
+                        row.min_annWidth = min_annotation / r.samples_per_pixel;
 
                         const uint64_t max_annotation =
-                                _decoder_stack->get_max_annotation(row);
-                        const double max_annWidth = max_annotation / samples_per_pixel;
+                                _decoder_stack->get_max_annotation(row.row);
+                        const double max_annWidth = max_annotation / r.samples_per_pixel;
                         if ((max_annWidth > 100) ||
-                            (max_annWidth > 10 && min_annWidth > 1) ||
-                            (max_annWidth == 0 && samples_per_pixel < 10)) {
-                            vector<Annotation> annotations;
-                            _decoder_stack->get_annotation_subset(annotations, row,
-                                start_sample, end_sample);
-                            if (!annotations.empty()) {
-                                BOOST_FOREACH(const Annotation &a, annotations)
-                                    draw_annotation(a, p, get_text_colour(),
-                                        annotation_height, left, right,
-                                        samples_per_pixel, pixels_offset, y,
-                                        0, min_annWidth, fore, back);
-                            }
-                        } else {
-                            draw_nodetail(p, annotation_height, left, right, y, 0, fore, back);
-                        }
-                        y += annotation_height;
-                        _cur_row_headings.push_back(row.title());
+                            (max_annWidth > 10 && row.min_annWidth > 1) ||
+                            (max_annWidth == 0 && r.samples_per_pixel < 10))
+                            row.kind = AnnotationRow;
+                        else
+                            row.kind = NodetailRow;
+                        r.rows.push_back(row);
+                        y += r.annotation_height;
+                        _cur_row_headings.push_back(row.row.title());
                     }
                 }
             }
         } else {
-            draw_unshown_row(p, y, annotation_height, left, right, tr("Unshown"), fore, back);
-            y += annotation_height;
+            RowPaint row;
+            row.kind = UnshownRow;
+            row.y = y;
+            row.min_annWidth = 0;
+            r.rows.push_back(row);
+            y += r.annotation_height;
             _cur_row_headings.push_back(dec->decoder()->name);
         }
+
+        // the logic signals marked by the annotations of the decoder
+        for (auto& iter: dec->channels()) {
+            const int type = dec->get_channel_type(iter.first);
+            if (type == SRD_CHANNEL_COMMON)
+                continue;
+            boost::shared_ptr<LogicSignal> logic_sig;
+            BOOST_FOREACH(boost::shared_ptr<view::Signal> sig, _session.get_signals()) {
+                if((sig->get_index() == iter.second) &&
+                   (logic_sig = dynamic_pointer_cast<view::LogicSignal>(sig))) {
+                    MarkPaint m;
+                    m.type = type;
+                    m.y = logic_sig->get_y();
+                    r.marks.push_back(m);
+                    break;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Paints the rows, from r alone: on the render thread, the trace may be
+ * changed or deleted meanwhile.
+ */
+void DecodeTrace::paint_rows(const RowsPaint &r, QPainter &p)
+{
+    using namespace pv::data::decode;
+
+    boost::lock_guard<boost::mutex> lock(r.texts->mutex);
+
+    p.setFont(r.font);
+    if (!r.error.isEmpty())
+        draw_error(p, r.error, r.y, r.height, r.left, r.right);
+
+    BOOST_FOREACH(const RowPaint &row, r.rows) {
+        if (row.kind == UnshownRow) {
+            draw_unshown_row(p, row.y, r.annotation_height, r.left, r.right,
+                             tr("Unshown"), r.fore, r.back);
+        } else if (row.kind == NodetailRow) {
+            draw_nodetail(p, r.annotation_height, r.left, r.right, row.y,
+                          0, r.fore, r.back);
+        } else {
+            vector<Annotation> annotations;
+            r.decoder_stack->get_annotation_subset(annotations, row.row,
+                r.start_sample, r.end_sample);
+            if (!annotations.empty()) {
+                RowTexts &texts = r.texts->rows[row.row];
+                BOOST_FOREACH(const Annotation &a, annotations)
+                    draw_annotation(a, p, r, row.y, 0, row.min_annWidth, texts);
+            }
+        }
     }
 }
 
@@ -486,14 +606,16 @@ void DecodeTrace::populate_popup_form(QWidget *parent, QFormLayout *form)
 }
 
 void DecodeTrace::draw_annotation(const pv::data::decode::Annotation &a,
-    QPainter &p, QColor text_color, int h, int left, int right,
-    double samples_per_pixel, double pixels_offset, int y,
-    size_t base_colour, double min_annWidth, QColor fore, QColor back) const
+    QPainter &p, const RowsPaint &r, int y, size_t base_colour,
+    double min_annWidth, RowTexts &texts)
 {
-    const double start = max(a.start_sample() / samples_per_pixel -
-        pixels_offset, (double)left);
-    const double end = min(a.end_sample() / samples_per_pixel -
-        pixels_offset, (double)right);
+    const int left = r.left;
+    const int right = r.right;
+    const int h = r.annotation_height;
+    const double start = max(a.start_sample() / r.samples_per_pixel -
+        r.pixels_offset, (double)left);
+    const double end = min(a.end_sample() / r.samples_per_pixel -
+        r.pixels_offset, (double)right);
 
     const size_t colour = ((base_colour + a.type()) % MaxAnnType) % countof(Colours);
 	const QColor &fill = Colours[colour];
@@ -502,10 +624,10 @@ void DecodeTrace::draw_annotation(const pv::data::decode::Annotation &a,
 	if (start > right + DrawPadding || end < left - DrawPadding)
 		return;
 
-    if (_decoder_stack->get_mark_index() == (int64_t)(a.start_sample()+ a.end_sample())/2) {
+    if (r.mark_index == (int64_t)(a.start_sample()+ a.end_sample())/2) {
         p.setPen(View::Blue);
         int xpos = (start+end)/2;
-        int ypos = get_y()+_totalHeight*0.5 + 1;
+        int ypos = r.y+r.height*0.5 + 1;
         const QPoint triangle[] = {
             QPoint(xpos, ypos),
             QPoint(xpos-1, ypos + 1),
@@ -521,28 +643,16 @@ void DecodeTrace::draw_annotation(const pv::data::decode::Annotation &a,
     }
 
 	if (a.start_sample() == a.end_sample())
-		draw_instant(a, p, fill, outline, text_color, h,
+		draw_instant(a, p, fill, outline, r.text_colour, h,
             start, y, min_annWidth);
     else {
-		draw_range(a, p, fill, outline, text_color, h,
-            start, end, y, fore, back);
+		draw_range(a, p, fill, outline, r.text_colour, h,
+            start, end, y, r.fore, r.back, r.texts->font, texts);
         if ((a.type()/100 == 2) && (end - start > 20)) {
-            BOOST_FOREACH(boost::shared_ptr<data::decode::Decoder> dec,
-                _decoder_stack->stack()) {
-                for (auto& iter: dec->channels()) {
-                    int type = dec->get_channel_type(iter.first);
-                    if ((type == SRD_CHANNEL_COMMON) ||
-                        ((type%100 != a.type()%100) && (type%100 != 0)))
-                        continue;
-                    boost::shared_ptr<LogicSignal> logic_sig;
-                    BOOST_FOREACH(boost::shared_ptr<view::Signal> sig, _session.get_signals()) {
-                        if((sig->get_index() == iter.second) &&
-                           (logic_sig = dynamic_pointer_cast<view::LogicSignal>(sig))) {
-                            logic_sig->paint_mark(p, start, end, type/100);
-                            break;
-                        }
-                    }
-                }
+            BOOST_FOREACH(const MarkPaint &m, r.marks) {
+                if ((m.type%100 != a.type()%100) && (m.type%100 != 0))
+                    continue;
+                LogicSignal::paint_mark(p, m.y, start, end, m.type/100);
             }
         }
     }
@@ -550,7 +660,7 @@ void DecodeTrace::draw_annotation(const pv::data::decode::Annotation &a,
 
 void DecodeTrace::draw_nodetail(QPainter &p,
     int h, int left, int right, int y,
-    size_t base_colour, QColor fore, QColor back) const
+    size_t base_colour, QColor fore, QColor back)
 {
     (void)base_colour;
     (void)back;
@@ -599,13 +709,14 @@ void DecodeTrace::draw_instant(const pv::data::decode::Annotation &a, QPainter &
 
 void DecodeTrace::draw_range(const pv::data::decode::Annotation &a, QPainter &p,
 	QColor fill, QColor outline, QColor text_color, int h, double start,
-    double end, int y, QColor fore, QColor back) const
+    double end, int y, QColor fore, QColor back, const QFont &font,
+    RowTexts &texts)
 {
     (void)fore;
 
 	const double top = y + .5 - h / 2;
 	const double bottom = y + .5 + h / 2;
-	const vector<QString> annotations = a.annotations();
+	const vector<QString> &annotations = a.annotations();
 
     p.setPen(outline);
     p.setBrush(fill);
@@ -636,38 +747,69 @@ void DecodeTrace::draw_range(const pv::data::decode::Annotation &a, QPainter &p,
 
 	QRectF rect(start + cap_width, y - h / 2,
 		end - start - cap_width * 2, h);
-	if (rect.width() <= 4)
+	const int width = (int)rect.width() / TextWidthBucket * TextWidthBucket;
+	if (width == 0)
 		return;
 
 	p.setPen(text_color);
+    p.setFont(font);
+
+    const QStaticText &text = get_shown_text(a, width, font, texts);
+    const QSizeF size = text.size();
+    p.drawStaticText(QPointF(rect.center().x() - size.width() / 2,
+                             rect.center().y() - size.height() / 2), text);
+}
+
+/*
+ * The longest annotation text that fits in width, or the last one
+ * elided. The widths of the texts and the ones elided are cached in the
+ * row, so dense rows are only laid out once.
+ */
+const QStaticText &DecodeTrace::get_shown_text(const pv::data::decode::Annotation &a,
+    int width, const QFont &font, RowTexts &texts)
+{
+    const vector<QString> &annotations = a.annotations();
+
+    if (texts.widths.size() > MaxRowTexts)
+        texts.widths.clear();
+    if (texts.shown.size() > MaxRowTexts)
+        texts.shown.clear();
 
 	// Try to find an annotation that will fit
 	QString best_annotation;
 	int best_width = 0;
 
-	BOOST_FOREACH(const QString &a, annotations) {
-		const int w = p.boundingRect(QRectF(), 0, a).width();
-		if (w <= rect.width() && w > best_width)
-			best_annotation = a, best_width = w;
+	BOOST_FOREACH(const QString &t, annotations) {
+        QHash<QString, int>::const_iterator i = texts.widths.constFind(t);
+        if (i == texts.widths.constEnd())
+            i = texts.widths.insert(t, QFontMetrics(font).boundingRect(t).width());
+		const int w = i.value();
+		if (w <= width && w > best_width)
+			best_annotation = t, best_width = w;
 	}
 
-	if (best_annotation.isEmpty())
+	// If not ellide the last in the list, a text which fits is the
+	// same for all the widths
+	const bool elide = best_annotation.isEmpty();
+	if (elide)
 		best_annotation = annotations.back();
 
-	// If not ellide the last in the list
-    QFont font=p.font();
-    font.setPointSize(DefaultFontSize);
-    p.setFont(font);
-    p.drawText(rect, Qt::AlignCenter, p.fontMetrics().elidedText(
-        best_annotation, Qt::ElideRight, rect.width()));
+    const QPair<QString, int> key(best_annotation, elide ? width : 0);
+    QHash<QPair<QString, int>, QStaticText>::iterator i = texts.shown.find(key);
+    if (i == texts.shown.end()) {
+        QStaticText text(elide ?
+            QFontMetrics(font).elidedText(best_annotation, Qt::ElideRight, width) :
+            best_annotation);
+        text.setTextFormat(Qt::PlainText);
+        text.prepare(QTransform(), font);
+        i = texts.shown.insert(key, text);
+    }
+    return i.value();
 }
 
 void DecodeTrace::draw_error(QPainter &p, const QString &message,
-	int left, int right)
+	int y, int h, int left, int right)
 {
-	const int y = get_y();
-    const int h = get_totalHeight();
-
     const QRectF text_rect(left, y - h/2 + 0.5, right - left, h);
     const QRectF bounding_rect = p.boundingRect(text_rect,
             Qt::AlignCenter, message);
@@ -903,6 +1045,7 @@ void DecodeTrace::on_del_stack(boost::shared_ptr<data::decode::Decoder> &dec)
     assert(dec);
     assert(_decoder_stack);
     _decoder_stack->remove(dec);
+    _texts.reset();
 
     create_popup_form();
 }
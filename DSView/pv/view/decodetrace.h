@@ -26,13 +26,20 @@
 
 #include <list>
 #include <map>
+#include <vector>
 
 #include <QSignalMapper>
 #include <QFormLayout>
+#include <QFont>
+#include <QHash>
+#include <QPair>
+#include <QStaticText>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <pv/prop/binding/decoderoptions.h>
+#include <pv/data/decode/row.h>
 #include "../dialogs/dsdialog.h"
 
 struct srd_channel;
@@ -50,7 +57,6 @@ class DecoderStack;
 namespace decode {
 class Annotation;
 class Decoder;
-class Row;
 }
 }
 
@@ -90,6 +96,11 @@ private:
 	static const QColor OutlineColours[16];
 
     static const int DefaultFontSize = 10;
+
+    // annotation texts are laid out for widths rounded down to buckets
+    static const int TextWidthBucket = 8;
+    static const int MaxRowTexts = 4096;
+
     static const int ControlRectWidth = 5;
     static const int MaxAnnType = 100;
 
@@ -124,6 +135,13 @@ public:
 	 **/
     void paint_mid(QPainter &p, int left, int right, QColor fore, QColor back);
 
+    /**
+     * Paints the mid-layer on the view's render thread, see
+     * Trace::get_frame_paint().
+     **/
+    bool get_frame_paint(FrameRenderer::Paint &paint,
+        int left, int right, QColor fore, QColor back);
+
 	/**
 	 * Paints the foreground layer of the trace with a QPainter
 	 * @param p the QPainter to paint into.
@@ -148,31 +166,95 @@ public:
 protected:
     void paint_type_options(QPainter &p, int right, const QPoint pt, QColor fore);
 
+private:
+    // the annotation texts of a row, laid out in TextCache::font
+    struct RowTexts
+    {
+        QHash<QString, int> widths;
+        // the text shown for an annotation, elided to a width bucket
+        QHash<QPair<QString, int>, QStaticText> shown;
+    };
+
+    // kept across repaints, replaced when the font changes
+    struct TextCache
+    {
+        boost::mutex mutex;
+        QFont font;
+        std::map<const pv::data::decode::Row, RowTexts> rows;
+    };
+
+    enum RowKind {
+        AnnotationRow,
+        NodetailRow,
+        UnshownRow
+    };
+
+    struct RowPaint
+    {
+        RowKind kind;
+        pv::data::decode::Row row;
+        double min_annWidth;
+        int y;
+    };
+
+    // a logic signal the annotations of type 2xx mark
+    struct MarkPaint
+    {
+        int type;
+        int y;
+    };
+
+    // all painting the rows uses, so that the trace is not needed
+    struct RowsPaint
+    {
+        boost::shared_ptr<pv::data::DecoderStack> decoder_stack;
+        boost::shared_ptr<TextCache> texts;
+        QString error;
+        QFont font;
+        int left, right;
+        int y, height;
+        int annotation_height;
+        uint64_t start_sample, end_sample;
+        double samples_per_pixel;
+        double pixels_offset;
+        int64_t mark_index;
+        QColor text_colour, fore, back;
+        std::vector<RowPaint> rows;
+        std::vector<MarkPaint> marks;
+    };
+
 private:
     void create_popup_form();
 
 	void populate_popup_form(QWidget *parent, QFormLayout *form);
 
-    void draw_annotation(const pv::data::decode::Annotation &a, QPainter &p,
-        QColor text_colour, int text_height, int left, int right,
-        double samples_per_pixel, double pixels_offset, int y,
-        size_t base_colour, double min_annWidth, QColor fore, QColor back) const;
-    void draw_nodetail(QPainter &p,
+    bool get_rows_paint(RowsPaint &r, int left, int right,
+        QColor fore, QColor back, const QFont &font);
+    static void paint_rows(const RowsPaint &r, QPainter &p);
+
+    static void draw_annotation(const pv::data::decode::Annotation &a,
+        QPainter &p, const RowsPaint &r, int y, size_t base_colour,
+        double min_annWidth, RowTexts &texts);
+    static void draw_nodetail(QPainter &p,
         int text_height, int left, int right, int y,
-        size_t base_colour, QColor fore, QColor back) const;
+        size_t base_colour, QColor fore, QColor back);
 
-	void draw_instant(const pv::data::decode::Annotation &a, QPainter &p,
+	static void draw_instant(const pv::data::decode::Annotation &a, QPainter &p,
 		QColor fill, QColor outline, QColor text_color, int h, double x,
-        int y, double min_annWidth) const;
+        int y, double min_annWidth);
 
-    void draw_range(const pv::data::decode::Annotation &a, QPainter &p,
+    static void draw_range(const pv::data::decode::Annotation &a, QPainter &p,
         QColor fill, QColor outline, QColor text_color, int h, double start,
-        double end, int y, QColor fore, QColor back) const;
+        double end, int y, QColor fore, QColor back, const QFont &font,
+        RowTexts &texts);
 
-	void draw_error(QPainter &p, const QString &message,
-		int left, int right);
+    static const QStaticText &get_shown_text(const pv::data::decode::Annotation &a,
+        int width, const QFont &font, RowTexts &texts);
 
-    void draw_unshown_row(QPainter &p, int y, int h, int left,
+	static void draw_error(QPainter &p, const QString &message,
+		int y, int h, int left, int right);
+
+    static void draw_unshown_row(QPainter &p, int y, int h, int left,
                           int right, QString info, QColor fore, QColor back);
 
     void create_decoder_form(boost::shared_ptr<data::DecoderStack> &decoder_stack,
@@ -223,6 +305,8 @@ private:
 
 	std::vector<QString> _cur_row_headings;
 
+    boost::shared_ptr<TextCache> _texts;
+
     QFormLayout *_popup_form;
     dialogs::DSDialog *_popup;
 };
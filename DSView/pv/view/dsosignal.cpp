@@ -30,6 +30,7 @@
 #include "../sigsession.h"
 #include "../device/devinst.h"
 
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
 
 #include <QDebug>
@@ -831,102 +832,179 @@ void DsoSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QColor
     (void)fore;
     (void)back;
 
+    TracePaint t;
+    if (get_trace_paint(t, left, right))
+        paint_signal(t, p);
+}
+
+bool DsoSignal::get_frame_paint(FrameRenderer::Paint &paint,
+    int left, int right, QColor fore, QColor back)
+{
+    (void)fore;
+    (void)back;
+
+    TracePaint t;
+    if (!get_trace_paint(t, left, right))
+        return true;
+
+    paint.id = this;
+    paint.state.clear();
+    paint.state.push_back(t.index);
+    paint.state.push_back(t.zeroY);
+    paint.state.push_back(t.left);
+    // the samples painted follow the offset, the frame has it
+    paint.state.push_back(t.snapshot->get_sample_count());
+    paint.state.push_back(t.hw_offset);
+    paint.state.push_back(t.samples_per_pixel);
+    paint.state.push_back(t.trig_hoff);
+    paint.state.push_back(t.num_channels);
+    paint.state.push_back(t.envelope);
+    paint.state.push_back(t.colour.rgba());
+    paint.state.push_back(t.scale);
+    paint.state.push_back(t.top);
+    paint.state.push_back(t.bottom);
+    paint.state.push_back(t.right);
+    paint.pans = true;
+    paint.right = t.right;
+    paint.draw = boost::bind(&DsoSignal::paint_signal, t, _1);
+    return true;
+}
+
+/*
+ * What painting the trace between left and right uses, with the envelope
+ * built if it is painted, and the measures of the device updated.
+ * Returns false if there is nothing to paint.
+ */
+bool DsoSignal::get_trace_paint(TracePaint &t, int left, int right)
+{
     if (!_show)
-        return;
+        return false;
 
     assert(_data);
     assert(_view);
     assert(right >= left);
 
-    if (enabled()) {
-        const int index = get_index();
-        const int width = right - left;
-        const float zeroY = get_zero_vpos();
+    if (!enabled())
+        return false;
 
-        const double scale = _view->scale();
-        assert(scale > 0);
-        const int64_t offset = _view->offset();
+    const int index = get_index();
+    const int width = right - left;
 
-        const deque< boost::shared_ptr<pv::data::DsoSnapshot> > &snapshots =
-            _data->get_snapshots();
-        if (snapshots.empty())
-            return;
-        const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot =
-            snapshots.front();
-        if (snapshot->empty())
-            return;
+    const double scale = _view->scale();
+    assert(scale > 0);
+    const int64_t offset = _view->offset();
 
-        if (!snapshot->has_data(index))
-            return;
+    const deque< boost::shared_ptr<pv::data::DsoSnapshot> > &snapshots =
+        _data->get_snapshots();
+    if (snapshots.empty())
+        return false;
+    const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot =
+        snapshots.front();
+    if (snapshot->empty())
+        return false;
 
-        const uint16_t enabled_channels = snapshot->get_channel_num();
-        const double pixels_offset = offset;
-        const double samplerate = _data->samplerate();
-        //const double samplerate = _dev_inst->get_sample_rate();
-        //const double samplerate = _view->session().cur_snap_samplerate();
-        const int64_t last_sample = max((int64_t)(snapshot->get_sample_count() - 1), (int64_t)0);
-        const double samples_per_pixel = samplerate * scale;
-        const double start = offset * samples_per_pixel - _view->trig_hoff();
-        const double end = start + samples_per_pixel * width;
-
-        const int64_t start_sample = min(max((int64_t)floor(start),
-            (int64_t)0), last_sample);
-        const int64_t end_sample = min(max((int64_t)ceil(end) + 1,
-            (int64_t)0), last_sample);
-        const int hw_offset = get_hw_offset();
+    if (!snapshot->has_data(index))
+        return false;
 
-        if (samples_per_pixel < EnvelopeThreshold) {
-            snapshot->enable_envelope(false);
-            paint_trace(p, snapshot, zeroY, left,
-                start_sample, end_sample, hw_offset,
-                pixels_offset, samples_per_pixel, enabled_channels);
-        } else {
-            snapshot->enable_envelope(true);
-            paint_envelope(p, snapshot, zeroY, left,
-                start_sample, end_sample, hw_offset,
-                pixels_offset, samples_per_pixel, enabled_channels);
-        }
+    const uint16_t enabled_channels = snapshot->get_channel_num();
+    const double samplerate = _data->samplerate();
+    //const double samplerate = _dev_inst->get_sample_rate();
+    //const double samplerate = _view->session().cur_snap_samplerate();
+    const int64_t last_sample = max((int64_t)(snapshot->get_sample_count() - 1), (int64_t)0);
+    const double samples_per_pixel = samplerate * scale;
+    const double start = offset * samples_per_pixel - _view->trig_hoff();
+    const double end = start + samples_per_pixel * width;
+
+    t.snapshot = snapshot;
+    t.index = index;
+    t.zeroY = get_zero_vpos();
+    t.left = left;
+    t.start = min(max((int64_t)floor(start),
+        (int64_t)0), last_sample);
+    t.end = min(max((int64_t)ceil(end) + 1,
+        (int64_t)0), last_sample);
+    t.hw_offset = get_hw_offset();
+    t.pixels_offset = offset;
+    t.samples_per_pixel = samples_per_pixel;
+    t.trig_hoff = _view->trig_hoff();
+    t.num_channels = enabled_channels;
+    t.envelope = samples_per_pixel >= EnvelopeThreshold;
+    t.colour = _colour;
+    t.scale = _scale;
+    t.top = get_view_rect().top();
+    t.bottom = get_view_rect().bottom();
+    t.right = get_view_rect().right();
+
+    snapshot->enable_envelope(t.envelope);
+    update_measure(snapshot, t.hw_offset, samplerate);
+    return true;
+}
 
-        sr_status status;
-        if (sr_status_get(_dev_inst->dev_inst(), &status, false) == SR_OK) {
-            _mValid = true;
-            if (status.measure_valid) {
-                _min = (index == 0) ? status.ch0_min : status.ch1_min;
-                _max = (index == 0) ? status.ch0_max : status.ch1_max;
-
-                _level_valid = (index == 0) ? status.ch0_level_valid : status.ch1_level_valid;
-                _low = (index == 0) ? status.ch0_low_level : status.ch1_low_level;
-                _high = (index == 0) ? status.ch0_high_level : status.ch1_high_level;
-
-                const uint32_t count  = (index == 0) ? status.ch0_cyc_cnt : status.ch1_cyc_cnt;
-                const bool plevel = (index == 0) ? status.ch0_plevel : status.ch1_plevel;
-                const bool startXORend = (index == 0) ? (status.ch0_cyc_llen == 0) : (status.ch1_cyc_llen == 0);
-                const uint16_t total_channels = g_slist_length(_dev_inst->dev_inst()->channels);
-                const double tfactor = (total_channels / enabled_channels) * SR_GHZ(1) * 1.0 / samplerate;
-
-                double samples = (index == 0) ? status.ch0_cyc_tlen : status.ch1_cyc_tlen;
-                _period = ((count == 0) ? 0 : samples / count) * tfactor;
-
-                samples = (index == 0) ? status.ch0_cyc_flen : status.ch1_cyc_flen;
-                _rise_time = ((count == 0) ? 0 : samples / ((plevel && startXORend) ? count : count + 1)) * tfactor;
-                samples = (index == 0) ? status.ch0_cyc_rlen : status.ch1_cyc_rlen;
-                _fall_time = ((count == 0) ? 0 : samples / ((!plevel && startXORend) ? count : count + 1)) * tfactor;
-
-                samples = (index == 0) ? (status.ch0_plevel ? status.ch0_cyc_plen - status.ch0_cyc_llen :
-                                                              status.ch0_cyc_tlen - status.ch0_cyc_plen + status.ch0_cyc_llen) :
-                                         (status.ch1_plevel ? status.ch1_cyc_plen - status.ch1_cyc_llen :
-                                                              status.ch1_cyc_tlen - status.ch1_cyc_plen + status.ch1_cyc_llen);
-                _high_time = ((count == 0) ? 0 : samples / count) * tfactor;
-
-                samples = (index == 0) ? status.ch0_cyc_tlen + status.ch0_cyc_llen : status.ch1_cyc_flen + status.ch1_cyc_llen;
-                _burst_time = samples * tfactor;
-
-                _pcount = count + (plevel & !startXORend);
-                _rms = (index == 0) ? status.ch0_acc_square : status.ch1_acc_square;
-                _rms = sqrt(_rms / snapshot->get_sample_count());
-                _mean = (index == 0) ? status.ch0_acc_mean : status.ch1_acc_mean;
-                _mean = hw_offset - _mean / snapshot->get_sample_count();
-            }
+/*
+ * Paints the trace, from t alone: on the render thread, the signal may
+ * be changed or deleted meanwhile. The snapshot is locked, so that a new
+ * capture does not free the samples under the painting.
+ */
+void DsoSignal::paint_signal(const TracePaint &t, QPainter &p)
+{
+    boost::lock_guard<boost::recursive_mutex> lock(t.snapshot->get_mutex());
+    if (t.snapshot->empty() || !t.snapshot->has_data(t.index) ||
+        t.end >= (int64_t)t.snapshot->get_sample_count() ||
+        t.num_channels != t.snapshot->get_channel_num())
+        return;
+
+    if (t.envelope)
+        paint_envelope(p, t);
+    else
+        paint_trace(p, t);
+}
+
+void DsoSignal::update_measure(
+    const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
+    int hw_offset, double samplerate)
+{
+    const int index = get_index();
+    const uint16_t enabled_channels = snapshot->get_channel_num();
+
+    sr_status status;
+    if (sr_status_get(_dev_inst->dev_inst(), &status, false) == SR_OK) {
+        _mValid = true;
+        if (status.measure_valid) {
+            _min = (index == 0) ? status.ch0_min : status.ch1_min;
+            _max = (index == 0) ? status.ch0_max : status.ch1_max;
+
+            _level_valid = (index == 0) ? status.ch0_level_valid : status.ch1_level_valid;
+            _low = (index == 0) ? status.ch0_low_level : status.ch1_low_level;
+            _high = (index == 0) ? status.ch0_high_level : status.ch1_high_level;
+
+            const uint32_t count  = (index == 0) ? status.ch0_cyc_cnt : status.ch1_cyc_cnt;
+            const bool plevel = (index == 0) ? status.ch0_plevel : status.ch1_plevel;
+            const bool startXORend = (index == 0) ? (status.ch0_cyc_llen == 0) : (status.ch1_cyc_llen == 0);
+            const uint16_t total_channels = g_slist_length(_dev_inst->dev_inst()->channels);
+            const double tfactor = (total_channels / enabled_channels) * SR_GHZ(1) * 1.0 / samplerate;
+
+            double samples = (index == 0) ? status.ch0_cyc_tlen : status.ch1_cyc_tlen;
+            _period = ((count == 0) ? 0 : samples / count) * tfactor;
+
+            samples = (index == 0) ? status.ch0_cyc_flen : status.ch1_cyc_flen;
+            _rise_time = ((count == 0) ? 0 : samples / ((plevel && startXORend) ? count : count + 1)) * tfactor;
+            samples = (index == 0) ? status.ch0_cyc_rlen : status.ch1_cyc_rlen;
+            _fall_time = ((count == 0) ? 0 : samples / ((!plevel && startXORend) ? count : count + 1)) * tfactor;
+
+            samples = (index == 0) ? (status.ch0_plevel ? status.ch0_cyc_plen - status.ch0_cyc_llen :
+                                                          status.ch0_cyc_tlen - status.ch0_cyc_plen + status.ch0_cyc_llen) :
+                                     (status.ch1_plevel ? status.ch1_cyc_plen - status.ch1_cyc_llen :
+                                                          status.ch1_cyc_tlen - status.ch1_cyc_plen + status.ch1_cyc_llen);
+            _high_time = ((count == 0) ? 0 : samples / count) * tfactor;
+
+            samples = (index == 0) ? status.ch0_cyc_tlen + status.ch0_cyc_llen : status.ch1_cyc_flen + status.ch1_cyc_llen;
+            _burst_time = samples * tfactor;
+
+            _pcount = count + (plevel & !startXORend);
+            _rms = (index == 0) ? status.ch0_acc_square : status.ch1_acc_square;
+            _rms = sqrt(_rms / snapshot->get_sample_count());
+            _mean = (index == 0) ? status.ch0_acc_mean : status.ch1_acc_mean;
+            _mean = hw_offset - _mean / snapshot->get_sample_count();
         }
     }
 }
@@ -1027,39 +1105,34 @@ QRectF DsoSignal::get_trig_rect(int left, int right) const
                   SquareWidth, SquareWidth);
 }
 
-void DsoSignal::paint_trace(QPainter &p,
-    const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
-    int zeroY, int left, const int64_t start, const int64_t end, int hw_offset,
-    const double pixels_offset, const double samples_per_pixel, uint64_t num_channels)
+void DsoSignal::paint_trace(QPainter &p, const TracePaint &t)
 {
-    const int64_t sample_count = end - start + 1;
+    const int64_t sample_count = t.end - t.start + 1;
 
     if (sample_count > 0) {
-        const uint8_t *const samples = snapshot->get_samples(start, end, get_index());
+        const uint8_t *const samples = t.snapshot->get_samples(t.start, t.end, t.index);
         assert(samples);
 
-        QColor trace_colour = _colour;
+        QColor trace_colour = t.colour;
         trace_colour.setAlpha(View::ForeAlpha);
         p.setPen(trace_colour);
 
         QPointF *points = new QPointF[sample_count];
         QPointF *point = points;
 
-        float top = get_view_rect().top();
-        float bottom = get_view_rect().bottom();
-        double  pixels_per_sample = 1.0/samples_per_pixel;
+        double  pixels_per_sample = 1.0/t.samples_per_pixel;
 
         uint8_t value;
-        int64_t sample_end = sample_count*num_channels;
-        float x = (start / samples_per_pixel - pixels_offset) + left + _view->trig_hoff()*pixels_per_sample;
-        for (int64_t sample = 0; sample < sample_end; sample+=num_channels) {
+        int64_t sample_end = sample_count*t.num_channels;
+        float x = (t.start / t.samples_per_pixel - t.pixels_offset) + t.left + t.trig_hoff*pixels_per_sample;
+        for (int64_t sample = 0; sample < sample_end; sample+=t.num_channels) {
             value = samples[sample];
-            const float y = min(max(top, zeroY + (value - hw_offset) * _scale), bottom);
-            if (x > get_view_rect().right()) {
+            const float y = min(max(t.top, t.zeroY + (value - t.hw_offset) * t.scale), t.bottom);
+            if (x > t.right) {
                 point--;
-                const float lastY = point->y() + (y - point->y()) / (x - point->x()) * (get_view_rect().right() - point->x());
+                const float lastY = point->y() + (y - point->y()) / (x - point->x()) * (t.right - point->x());
                 point++;
-                *point++ = QPointF(get_view_rect().right(), lastY);
+                *point++ = QPointF(t.right, lastY);
                 break;
             }
             *point++ = QPointF(x, y);
@@ -1072,49 +1145,44 @@ void DsoSignal::paint_trace(QPainter &p,
     }
 }
 
-void DsoSignal::paint_envelope(QPainter &p,
-    const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
-    int zeroY, int left, const int64_t start, const int64_t end, int hw_offset,
-    const double pixels_offset, const double samples_per_pixel, uint64_t num_channels)
+void DsoSignal::paint_envelope(QPainter &p, const TracePaint &t)
 {
 	using namespace Qt;
     using pv::data::DsoSnapshot;
 
     DsoSnapshot::EnvelopeSection e;
-    const uint16_t index = get_index() % num_channels;
-    snapshot->get_envelope_section(e, start, end, samples_per_pixel, index);
+    const uint16_t index = t.index % t.num_channels;
+    t.snapshot->get_envelope_section(e, t.start, t.end, t.samples_per_pixel, index);
 
 	if (e.length < 2)
 		return;
 
     p.setPen(QPen(NoPen));
     //p.setPen(QPen(_colour, 2, Qt::SolidLine));
-    QColor envelope_colour = _colour;
+    QColor envelope_colour = t.colour;
     envelope_colour.setAlpha(View::ForeAlpha);
     p.setBrush(envelope_colour);
 
 	QRectF *const rects = new QRectF[e.length];
 	QRectF *rect = rects;
-    float top = get_view_rect().top();
-    float bottom = get_view_rect().bottom();
     for(uint64_t sample = 0; sample < e.length-1; sample++) {
 		const float x = ((e.scale * sample + e.start) /
-            samples_per_pixel - pixels_offset) + left + _view->trig_hoff()/samples_per_pixel;
+            t.samples_per_pixel - t.pixels_offset) + t.left + t.trig_hoff/t.samples_per_pixel;
         const DsoSnapshot::EnvelopeSample *const s =
 			e.samples + sample;
 
 		// We overlap this sample with the next so that vertical
 		// gaps do not appear during steep rising or falling edges
-        const float b = min(max(top, ((max(s->max, (s+1)->min) - hw_offset) * _scale + zeroY)), bottom);
-        const float t = min(max(top, ((min(s->min, (s+1)->max) - hw_offset) * _scale + zeroY)), bottom);
+        const float b = min(max(t.top, ((max(s->max, (s+1)->min) - t.hw_offset) * t.scale + t.zeroY)), t.bottom);
+        const float top = min(max(t.top, ((min(s->min, (s+1)->max) - t.hw_offset) * t.scale + t.zeroY)), t.bottom);
 
-		float h = b - t;
+		float h = b - top;
 		if(h >= 0.0f && h <= 1.0f)
 			h = 1.0f;
 		if(h <= 0.0f && h >= -1.0f)
 			h = -1.0f;
 
-		*rect++ = QRectF(x, t, 1.0f, h);
+		*rect++ = QRectF(x, top, 1.0f, h);
 	}
 
 	p.drawRects(rects, e.length);
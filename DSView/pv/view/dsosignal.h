@@ -189,6 +189,13 @@ public:
 	 **/
     void paint_mid(QPainter &p, int left, int right, QColor fore, QColor back);
 
+    /**
+     * Paints the signal on the view's render thread, see
+     * Trace::get_frame_paint().
+     **/
+    bool get_frame_paint(FrameRenderer::Paint &paint,
+        int left, int right, QColor fore, QColor back);
+
     /**
      * Paints the signal with a QPainter
      * @param p the QPainter to paint into.
@@ -214,17 +221,33 @@ protected:
     void paint_type_options(QPainter &p, int right, const QPoint pt, QColor fore);
 
 private:
-    void paint_trace(QPainter &p,
-        const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
-        int zeroY, int left, const int64_t start, const int64_t end, int hw_offset,
-        const double pixels_offset, const double samples_per_pixel,
-        uint64_t num_channels);
-
-    void paint_envelope(QPainter &p,
-        const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
-        int zeroY, int left, const int64_t start, const int64_t end, int hw_offset,
-        const double pixels_offset, const double samples_per_pixel,
-        uint64_t num_channels);
+    // all painting the trace uses, so that the signal is not needed
+    struct TracePaint
+    {
+        boost::shared_ptr<pv::data::DsoSnapshot> snapshot;
+        int index;
+        float zeroY;
+        int left;
+        int64_t start, end;
+        int hw_offset;
+        double pixels_offset;
+        double samples_per_pixel;
+        double trig_hoff;
+        uint64_t num_channels;
+        bool envelope;
+        QColor colour;
+        float scale;
+        float top, bottom, right;
+    };
+
+private:
+    bool get_trace_paint(TracePaint &t, int left, int right);
+    static void paint_signal(const TracePaint &t, QPainter &p);
+    static void paint_trace(QPainter &p, const TracePaint &t);
+    static void paint_envelope(QPainter &p, const TracePaint &t);
+
+    void update_measure(const boost::shared_ptr<pv::data::DsoSnapshot> &snapshot,
+        int hw_offset, double samplerate);
 
     void paint_hover_measure(QPainter &p, QColor fore, QColor back);
     void auto_set();
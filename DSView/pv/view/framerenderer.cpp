@@ -0,0 +1,579 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include "framerenderer.h"
+#include "logicsignal.h"
+#include "../data/logicsnapshot.h"
+
+#include <QPainter>
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/foreach.hpp>
+
+using namespace boost;
+using namespace std;
+
+namespace pv {
+namespace view {
+
+bool FrameRenderer::Frame::same(const Frame &frame) const
+{
+    if (offset != frame.offset || scale != frame.scale ||
+        size != frame.size || layers.size() != frame.layers.size())
+        return false;
+
+    for (unsigned int i = 0; i < layers.size(); i++) {
+        const Layer &a = layers[i];
+        const Layer &b = frame.layers[i];
+        if (a.id != b.id || a.generation != b.generation || a.index != b.index ||
+            a.sample_count != b.sample_count || a.ring_start != b.ring_start ||
+            a.samplerate != b.samplerate ||
+            a.right != b.right || a.high_offset != b.high_offset ||
+            a.low_offset != b.low_offset || a.colour != b.colour)
+            return false;
+    }
+    return same_paints(frame);
+}
+
+bool FrameRenderer::Frame::same_paints(const Frame &frame) const
+{
+    if (paints.empty() && frame.paints.empty())
+        return true;
+    if (offset != frame.offset || scale != frame.scale ||
+        size != frame.size || update != frame.update ||
+        paints.size() != frame.paints.size())
+        return false;
+
+    for (unsigned int i = 0; i < paints.size(); i++) {
+        if (paints[i].id != frame.paints[i].id ||
+            paints[i].state != frame.paints[i].state)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * The paints which pan are the same, at any offset.
+ */
+bool FrameRenderer::Frame::same_pans(const Frame &frame) const
+{
+    if (scale != frame.scale || size != frame.size || update != frame.update)
+        return false;
+
+    unsigned int i = 0, j = 0;
+    for (;; i++, j++) {
+        while (i < paints.size() && !paints[i].pans)
+            i++;
+        while (j < frame.paints.size() && !frame.paints[j].pans)
+            j++;
+        if (i == paints.size() || j == frame.paints.size())
+            break;
+        if (paints[i].id != frame.paints[j].id ||
+            paints[i].right != frame.paints[j].right ||
+            paints[i].state != frame.paints[j].state)
+            return false;
+    }
+    return i == paints.size() && j == frame.paints.size();
+}
+
+bool FrameRenderer::TileKey::operator<(const TileKey &key) const
+{
+    if (id != key.id)
+        return id < key.id;
+    if (generation != key.generation)
+        return generation < key.generation;
+    if (index != key.index)
+        return index < key.index;
+    if (scale_step != key.scale_step)
+        return scale_step < key.scale_step;
+    return tile < key.tile;
+}
+
+// the tile of a pixel, rounded down
+static int64_t tile_of(int64_t x)
+{
+    const int64_t w = FrameRenderer::TileWidth;
+    return x >= 0 ? x / w : -((w - 1 - x) / w);
+}
+
+/*
+ * A relative step of 2^-ScaleStepBits moves the pixels of a tile by less
+ * than a hundredth at offsets of 10^10 pixels.
+ */
+int64_t FrameRenderer::scale_step(double samples_per_pixel)
+{
+    return llround(log2(samples_per_pixel) * (double)(1LL << ScaleStepBits));
+}
+
+static uint64_t image_bytes(const QImage &image)
+{
+    return (uint64_t)image.bytesPerLine() * image.height();
+}
+
+FrameRenderer::FrameRenderer(QObject *parent) :
+    QObject(parent),
+    _stop(false),
+    _pending(false),
+    _has_last(false),
+    _serial(0),
+    _has_done(false),
+    _tiles_bytes(0),
+    _stamp(0),
+    _has_overlay(false)
+{
+    _thread = boost::thread(&FrameRenderer::render_proc, this);
+    pv::data::LogicSnapshot::add_holder(this);
+}
+
+FrameRenderer::~FrameRenderer()
+{
+    pv::data::LogicSnapshot::remove_holder(this);
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        _stop = true;
+        _serial++;
+        _cond.notify_one();
+    }
+    _thread.join();
+}
+
+void FrameRenderer::request(const Frame &frame)
+{
+    // snapshots are let go of once unlocked, freeing one calls release()
+    Frame dropped;
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if (_has_last && _last.same(frame))
+        return;
+
+    _last = frame;
+    BOOST_FOREACH(Layer &l, _last.layers)
+        l.snapshot.reset();
+    BOOST_FOREACH(Paint &p, _last.paints)
+        p.draw.clear();
+    _has_last = true;
+
+    std::swap(dropped, _requested);
+    _requested = frame;
+    for (unsigned int i = 0; i < _requested.layers.size(); ) {
+        const Layer &l = _requested.layers[i];
+        std::map<const pv::data::LogicSnapshot *, uint64_t>::iterator r =
+            _released.find(l.id);
+        if (r == _released.end()) {
+            i++;
+        } else if (r->second != l.generation) {
+            _released.erase(r);
+            i++;
+        } else {
+            dropped.layers.push_back(l);
+            _requested.layers.erase(_requested.layers.begin() + i);
+        }
+    }
+    _pending = true;
+    _serial++;
+    _cond.notify_one();
+}
+
+bool FrameRenderer::get_frame(Frame &frame, QImage &image, QImage &overlay) const
+{
+    boost::lock_guard<boost::mutex> lock(_mutex);
+    if (!_has_done)
+        return false;
+
+    frame = _done;
+    image = _image;
+    overlay = _done_overlay;
+    return true;
+}
+
+/*
+ * Called by LogicSnapshot::free_data() before the data of the snapshot
+ * is freed, from any thread. Its layers are dropped from the request,
+ * and skipped in the ones made until it has a new generation. The frame
+ * being rendered is cancelled if it reads the snapshot, this returns
+ * once the render thread is done with it, within a tile.
+ */
+void FrameRenderer::release(const pv::data::LogicSnapshot *snapshot)
+{
+    // the render thread frees snapshots it was the last to hold
+    if (boost::this_thread::get_id() == _thread.get_id())
+        return;
+
+    std::vector<Layer> dropped;
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    _released[snapshot] = snapshot->get_generation();
+    _has_last = false;
+    for (unsigned int i = 0; i < _requested.layers.size(); ) {
+        if (_requested.layers[i].id == snapshot) {
+            dropped.push_back(_requested.layers[i]);
+            _requested.layers.erase(_requested.layers.begin() + i);
+        } else {
+            i++;
+        }
+    }
+
+    if (std::find(_reading.begin(), _reading.end(), snapshot) == _reading.end())
+        return;
+    _serial++;
+    while (std::find(_reading.begin(), _reading.end(), snapshot) != _reading.end())
+        _idle.wait(lock);
+}
+
+void FrameRenderer::render_proc()
+{
+    boost::unique_lock<boost::mutex> lock(_mutex);
+    while (!_stop) {
+        if (!_pending) {
+            _cond.wait(lock);
+            continue;
+        }
+
+        Frame frame;
+        std::swap(frame, _requested);
+        const uint64_t serial = _serial;
+        _pending = false;
+        BOOST_FOREACH(const Layer &l, frame.layers)
+            _reading.push_back(l.id);
+        lock.unlock();
+
+        QImage image;
+        if (render(frame, serial, image))
+            publish(frame, serial, image);
+
+        lock.lock();
+        _reading.clear();
+        _idle.notify_all();
+        lock.unlock();
+        BOOST_FOREACH(Layer &l, frame.layers)
+            l.snapshot.reset();
+        BOOST_FOREACH(Paint &p, frame.paints)
+            p.draw.clear();
+
+        lock.lock();
+    }
+}
+
+void FrameRenderer::publish(const Frame &frame, uint64_t serial, const QImage &image)
+{
+    {
+        boost::lock_guard<boost::mutex> lock(_mutex);
+        if (serial != _serial)
+            return;
+        _done = frame;
+        BOOST_FOREACH(Layer &l, _done.layers)
+            l.snapshot.reset();
+        BOOST_FOREACH(Paint &p, _done.paints)
+            p.draw.clear();
+        _image = image;
+        _done_overlay = _overlay;
+        _has_done = true;
+    }
+    frame_ready();
+}
+
+/*
+ * The overlay is painted first. The tiles of the frame missing from the
+ * cache are rendered in parallel, then the frame is composited from the
+ * cache. If they can all be drawn coarse, a coarse frame is published
+ * first. Returns false if a newer request cancelled the frame, its tiles
+ * done are kept.
+ */
+bool FrameRenderer::render(const Frame &frame, uint64_t serial, QImage &image)
+{
+    std::vector<TileJob> jobs;
+
+    if (!paint_overlay(frame, serial))
+        return false;
+
+    _stamp++;
+    collect_jobs(frame, false, jobs);
+
+    bool coarse = !jobs.empty();
+    BOOST_FOREACH(const TileJob &job, jobs)
+        coarse = coarse && frame.layers[job.layer].samplerate * frame.scale >=
+                           pv::data::LogicSnapshot::get_coarse_samples();
+    if (coarse) {
+        std::vector<TileJob> coarse_jobs;
+        collect_jobs(frame, true, coarse_jobs);
+        run_jobs(frame, serial, coarse_jobs);
+        if (_serial != serial) {
+            evict_tiles();
+            return false;
+        }
+        composite(frame, image);
+        publish(frame, serial, image);
+    }
+
+    run_jobs(frame, serial, jobs);
+    if (_serial != serial) {
+        evict_tiles();
+        return false;
+    }
+
+    composite(frame, image);
+    evict_tiles();
+    return true;
+}
+
+/*
+ * The paints of the frame, in order, unless the overlay has them
+ * already. The paints which pan are painted into a layer of their own:
+ * if they are the same but for the offset, the last layer is shifted
+ * and only the strip exposed is painted. The others are painted again,
+ * over it. Returns false if a newer request cancelled the frame.
+ */
+bool FrameRenderer::paint_overlay(const Frame &frame, uint64_t serial)
+{
+    if (_has_overlay && _overlay_frame.same_paints(frame))
+        return true;
+
+    const int width = frame.size.width();
+    const int height = frame.size.height();
+    bool has_pans = false;
+    bool has_fixed = false;
+    int right = width - 1;
+    BOOST_FOREACH(const Paint &paint, frame.paints) {
+        if (paint.pans) {
+            has_pans = true;
+            right = min(right, paint.right);
+        } else {
+            has_fixed = true;
+        }
+    }
+
+    QImage pan_layer;
+    if (has_pans) {
+        const int64_t dx = frame.offset - _overlay_frame.offset;
+        const bool shift = _has_overlay && !_pan_layer.isNull() &&
+                           _overlay_frame.same_pans(frame) && llabs(dx) < width;
+
+        pan_layer = QImage(frame.size, QImage::Format_ARGB32_Premultiplied);
+        pan_layer.fill(Qt::transparent);
+        QPainter p(&pan_layer);
+        QRect strip = pan_layer.rect();
+        if (shift) {
+            // the columns right of the paints are painted again, their
+            // pixels shifted in are cleared
+            strip = dx > 0 ? QRect(QPoint(max(right + 1 - (int)dx, 0), 0),
+                                   QPoint(width - 1, height - 1)) :
+                             QRect(0, 0, (int)-dx, height);
+            p.drawImage((int)-dx, 0, _pan_layer);
+            p.setCompositionMode(QPainter::CompositionMode_Source);
+            p.fillRect(strip, Qt::transparent);
+            p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+            p.setClipRect(strip);
+        }
+        if (!strip.isEmpty()) {
+            BOOST_FOREACH(const Paint &paint, frame.paints) {
+                if (!paint.pans)
+                    continue;
+                if (_serial != serial)
+                    return false;
+                p.save();
+                paint.draw(p);
+                p.restore();
+            }
+        }
+        p.end();
+    }
+
+    QImage overlay = pan_layer;
+    if (has_fixed) {
+        if (overlay.isNull()) {
+            overlay = QImage(frame.size, QImage::Format_ARGB32_Premultiplied);
+            overlay.fill(Qt::transparent);
+        }
+        QPainter p(&overlay);
+        BOOST_FOREACH(const Paint &paint, frame.paints) {
+            if (paint.pans)
+                continue;
+            if (_serial != serial)
+                return false;
+            p.save();
+            paint.draw(p);
+            p.restore();
+        }
+        p.end();
+    }
+
+    _overlay = overlay;
+    _pan_layer = pan_layer;
+    _overlay_frame.offset = frame.offset;
+    _overlay_frame.scale = frame.scale;
+    _overlay_frame.size = frame.size;
+    _overlay_frame.update = frame.update;
+    _overlay_frame.paints = frame.paints;
+    BOOST_FOREACH(Paint &p, _overlay_frame.paints)
+        p.draw.clear();
+    _has_overlay = true;
+    return true;
+}
+
+/*
+ * The tiles of the frame to render, the ones in the cache are marked
+ * used. Coarse tiles only do if coarse is set, and jobs are drawn
+ * coarse then.
+ */
+void FrameRenderer::collect_jobs(const Frame &frame, bool coarse,
+                                 std::vector<TileJob> &jobs)
+{
+    TileKey key;
+
+    for (unsigned int i = 0; i < frame.layers.size(); i++) {
+        const Layer &l = frame.layers[i];
+        key.id = l.id;
+        key.generation = l.generation;
+        key.index = l.index;
+        key.scale_step = scale_step(l.samplerate * frame.scale);
+        const int64_t last = tile_of(frame.offset + l.right - 1);
+        for (key.tile = tile_of(frame.offset); key.tile <= last; key.tile++) {
+            std::map<TileKey, Tile>::iterator t = _tiles.find(key);
+            if (t != _tiles.end() && tile_valid(t->second, l, coarse)) {
+                t->second.used = _stamp;
+                continue;
+            }
+            TileJob job;
+            job.key = key;
+            job.layer = i;
+            job.tile.coarse = coarse;
+            job.done = false;
+            jobs.push_back(job);
+        }
+    }
+}
+
+void FrameRenderer::run_jobs(const Frame &frame, uint64_t serial,
+                             std::vector<TileJob> &jobs)
+{
+    const unsigned int threads = min(max(boost::thread::hardware_concurrency(), 1U),
+                                     (unsigned int)jobs.size());
+    if (threads > 1) {
+        boost::thread_group pool;
+        for (unsigned int i = 1; i < threads; i++)
+            pool.create_thread(boost::bind(&FrameRenderer::tiles_proc, this,
+                                           boost::cref(frame), serial,
+                                           boost::ref(jobs), i, threads));
+        tiles_proc(frame, serial, jobs, 0, threads);
+        pool.join_all();
+    } else if (threads == 1) {
+        tiles_proc(frame, serial, jobs, 0, 1);
+    }
+
+    BOOST_FOREACH(const TileJob &job, jobs) {
+        if (!job.done)
+            continue;
+        Tile &t = _tiles[job.key];
+        _tiles_bytes -= image_bytes(t.image);
+        t = job.tile;
+        t.used = _stamp;
+        _tiles_bytes += image_bytes(t.image);
+    }
+}
+
+void FrameRenderer::composite(const Frame &frame, QImage &image) const
+{
+    TileKey key;
+
+    image = QImage(frame.size, QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+    QPainter p(&image);
+    BOOST_FOREACH(const Layer &l, frame.layers) {
+        key.id = l.id;
+        key.generation = l.generation;
+        key.index = l.index;
+        key.scale_step = scale_step(l.samplerate * frame.scale);
+        p.setClipRect(0, l.high_offset, l.right, l.low_offset - l.high_offset + 1);
+        const int64_t last = tile_of(frame.offset + l.right - 1);
+        for (key.tile = tile_of(frame.offset); key.tile <= last; key.tile++) {
+            std::map<TileKey, Tile>::const_iterator t = _tiles.find(key);
+            if (t != _tiles.end())
+                p.drawImage(key.tile * TileWidth - frame.offset, l.high_offset,
+                            t->second.image);
+        }
+    }
+    p.end();
+}
+
+bool FrameRenderer::tile_valid(const Tile &tile, const Layer &layer, bool coarse) const
+{
+    return tile.ring_start == layer.ring_start &&
+           tile.colour == layer.colour &&
+           tile.image.height() == layer.low_offset - layer.high_offset + 1 &&
+           (tile.complete || tile.sample_count == layer.sample_count) &&
+           (coarse || !tile.coarse);
+}
+
+void FrameRenderer::tiles_proc(const Frame &frame, uint64_t serial,
+                               std::vector<TileJob> &jobs,
+                               unsigned int first, unsigned int step)
+{
+    std::vector< std::pair<bool, bool> > pulses;
+    std::vector< std::pair<uint16_t, bool> > edges;
+
+    for (unsigned int i = first; i < jobs.size(); i += step) {
+        if (_serial != serial)
+            return;
+        TileJob &job = jobs[i];
+        const Layer &l = frame.layers[job.layer];
+        const int height = l.low_offset - l.high_offset + 1;
+
+        // from a pixel before the tile, for the edges right at its start
+        const int64_t offset = job.key.tile * TileWidth - 1;
+        job.tile.image = QImage(TileWidth, height, QImage::Format_ARGB32_Premultiplied);
+        job.tile.image.fill(Qt::transparent);
+        LogicSignal::raster_wave(job.tile.image, -1, l.colour, pulses, edges,
+                                 l.snapshot, l.index, l.samplerate, frame.scale, offset,
+                                 0, TileWidth + 1, 0, height - 1, job.tile.coarse);
+
+        job.tile.sample_count = l.sample_count;
+        job.tile.ring_start = l.ring_start;
+        job.tile.complete = ceil((offset + TileWidth + 2) * l.samplerate * frame.scale) <
+                            (double)l.sample_count;
+        job.tile.colour = l.colour;
+        job.done = true;
+    }
+}
+
+/*
+ * Over the budget, the tiles off the last frame are dropped.
+ */
+void FrameRenderer::evict_tiles()
+{
+    if (_tiles_bytes <= TileCacheBytes)
+        return;
+
+    std::map<TileKey, Tile>::iterator i = _tiles.begin();
+    while (i != _tiles.end()) {
+        if (i->second.used != _stamp) {
+            _tiles_bytes -= image_bytes(i->second.image);
+            _tiles.erase(i++);
+        } else {
+            i++;
+        }
+    }
+}
+
+} // namespace view
+} // namespace pv
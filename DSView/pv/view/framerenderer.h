@@ -0,0 +1,234 @@
+/*
+ * This file is part of the DSView project.
+ * DSView is based on PulseView.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#ifndef DSVIEW_PV_VIEW_FRAMERENDERER_H
+#define DSVIEW_PV_VIEW_FRAMERENDERER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include <QColor>
+#include <QImage>
+#include <QLine>
+#include <QObject>
+#include <QSize>
+
+#include "../data/logicsnapshot.h"
+
+namespace pv {
+
+namespace view {
+
+/**
+ * Renders the waves of logic channels into an image on a thread of
+ * its own, so the GUI thread only composites finished frames. A new
+ * request cancels the frame being rendered.
+ *
+ * Frames are made of tiles of TileWidth pixels per channel, cached at
+ * the scale they were rendered at, so panning only renders the tiles
+ * newly exposed. The scale is keyed in steps of 2^-ScaleStepBits of a
+ * power of two, so that scales computed again a few ulps apart find the
+ * same tiles.
+ *
+ * Zoomed out to more than LogicSnapshot::get_coarse_samples() samples
+ * per pixel, the missing tiles are first drawn from the mipmap alone
+ * and that frame is shown, before they are rendered from the samples.
+ *
+ * The other traces (decoders, DSO and analog channels) are painted by
+ * the render thread too, into an overlay over the whole frame, from
+ * copies of what they need taken on the GUI thread. The overlay is not
+ * tiled: the paints which pan, DSO and analog channels, are kept in a
+ * layer of their own, shifted on a change of offset alone so that only
+ * the strip exposed is painted again. Decoder rows are painted again on
+ * any change of offset, as their labels follow the part of the
+ * annotations on screen, and a change of scale, size or data paints the
+ * whole overlay again.
+ */
+class FrameRenderer : public QObject, public pv::data::LogicSnapshot::Holder
+{
+    Q_OBJECT
+
+public:
+    static const int TileWidth = 256;
+    static const int ScaleStepBits = 40;
+    static const uint64_t TileCacheBytes = 64 << 20;
+
+public:
+    // the band of a channel in a frame
+    struct Layer {
+        boost::shared_ptr<pv::data::LogicSnapshot> snapshot;
+        // identifies the layer once the frame is done
+        const pv::data::LogicSnapshot *id;
+        uint64_t generation;
+        uint16_t index;
+        // the frame is rendered again as the snapshot grows
+        uint64_t sample_count;
+        uint64_t ring_start;
+        double samplerate;
+        int right;
+        int high_offset;
+        int low_offset;
+        QColor colour;
+    };
+
+    // a trace painted into the overlay, by a function bound to copies
+    // of what it uses and to the data it reads
+    struct Paint {
+        const void *id;
+        // what the painting depends on, besides the frame
+        std::vector<double> state;
+        // draws the same pixels shifted as the offset changes alone
+        bool pans;
+        // the last column painted
+        int right;
+        boost::function<void (QPainter &)> draw;
+    };
+
+    struct Frame {
+        int64_t offset;
+        double scale;
+        QSize size;
+        std::vector<Layer> layers;
+        // bumped by the view as the data of the paints changes
+        uint64_t update;
+        std::vector<Paint> paints;
+
+        bool same(const Frame &frame) const;
+        bool same_paints(const Frame &frame) const;
+        bool same_pans(const Frame &frame) const;
+    };
+
+public:
+    explicit FrameRenderer(QObject *parent = 0);
+    ~FrameRenderer();
+
+    /**
+     * Requests a frame, unless it is the last one requested.
+     */
+    void request(const Frame &frame);
+
+    /**
+     * Gets the last frame rendered, and its overlay, null if the frame
+     * has no paints.
+     * @return false if there is none.
+     */
+    bool get_frame(Frame &frame, QImage &image, QImage &overlay) const;
+
+    void release(const pv::data::LogicSnapshot *snapshot);
+
+signals:
+    void frame_ready();
+
+private:
+    struct TileKey {
+        const pv::data::LogicSnapshot *id;
+        uint64_t generation;
+        uint16_t index;
+        // log2 of the samples per pixel, see scale_step()
+        int64_t scale_step;
+        int64_t tile;
+
+        bool operator<(const TileKey &key) const;
+    };
+
+    struct Tile {
+        QImage image;
+        uint64_t sample_count;
+        uint64_t ring_start;
+        // all the samples of the tile were there
+        bool complete;
+        // drawn from the mipmap, to be rendered again
+        bool coarse;
+        QColor colour;
+        uint64_t used;
+    };
+
+    struct TileJob {
+        TileKey key;
+        unsigned int layer;
+        Tile tile;
+        bool done;
+    };
+
+private:
+    static int64_t scale_step(double samples_per_pixel);
+
+    void render_proc();
+    void publish(const Frame &frame, uint64_t serial, const QImage &image);
+    bool render(const Frame &frame, uint64_t serial, QImage &image);
+    bool paint_overlay(const Frame &frame, uint64_t serial);
+    void collect_jobs(const Frame &frame, bool coarse, std::vector<TileJob> &jobs);
+    void run_jobs(const Frame &frame, uint64_t serial, std::vector<TileJob> &jobs);
+    void composite(const Frame &frame, QImage &image) const;
+    bool tile_valid(const Tile &tile, const Layer &layer, bool coarse) const;
+    void tiles_proc(const Frame &frame, uint64_t serial,
+                    std::vector<TileJob> &jobs,
+                    unsigned int first, unsigned int step);
+    void evict_tiles();
+
+private:
+    boost::thread _thread;
+    mutable boost::mutex _mutex;
+    boost::condition_variable _cond;
+    // signalled as the render thread is done with a frame
+    boost::condition_variable _idle;
+    bool _stop;
+
+    bool _pending;
+    Frame _requested;
+    Frame _last;
+    bool _has_last;
+    // bumped by each request, frames of older ones are dropped
+    std::atomic<uint64_t> _serial;
+    // the snapshots of the frame being rendered
+    std::vector<const pv::data::LogicSnapshot *> _reading;
+    // released snapshots, and their generation then: layers of these
+    // requested afterwards are skipped
+    std::map<const pv::data::LogicSnapshot *, uint64_t> _released;
+
+    Frame _done;
+    QImage _image;
+    QImage _done_overlay;
+    bool _has_done;
+
+    // only used by the render thread
+    std::map<TileKey, Tile> _tiles;
+    uint64_t _tiles_bytes;
+    uint64_t _stamp;
+    QImage _overlay;
+    // the paints which pan, in the overlay
+    QImage _pan_layer;
+    // the frame the overlay was painted for, without its functions
+    Frame _overlay_frame;
+    bool _has_overlay;
+};
+
+} // namespace view
+} // namespace pv
+
+#endif // DSVIEW_PV_VIEW_FRAMERENDERER_H
@@ -28,6 +28,8 @@
 
 #include <math.h>
 
+#include <algorithm>
+
 #include "logicsignal.h"
 #include "view.h"
 #include "pv/data/logic.h"
@@ -148,6 +150,61 @@ void LogicSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QColo
     if (snapshot->empty() || !snapshot->has_data(_probe->index))
         return;
 
+    std::vector<QLine> wave_lines;
+    get_wave_lines(wave_lines, _cur_pulses, _cur_edges, snapshot, _probe->index,
+                   samplerate, scale, offset, left, right, high_offset, low_offset);
+
+    p.setPen(_colour.isValid() ? _colour : fore);
+    p.drawLines(wave_lines.data(), wave_lines.size());
+}
+
+bool LogicSignal::get_frame_layer(FrameRenderer::Layer &layer, QColor fore)
+{
+	assert(_data);
+    assert(_view);
+
+    const int y = get_y() + _totalHeight * 0.5;
+
+	const deque< boost::shared_ptr<pv::data::LogicSnapshot> > &snapshots =
+		_data->get_snapshots();
+    const double samplerate = _data->samplerate();
+    if (snapshots.empty() || samplerate == 0)
+		return false;
+
+	const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot =
+		snapshots.front();
+    if (snapshot->empty() || !snapshot->has_data(_probe->index))
+        return false;
+
+    layer.snapshot = snapshot;
+    layer.id = snapshot.get();
+    layer.generation = snapshot->get_generation();
+    layer.index = _probe->index;
+    layer.sample_count = snapshot->get_sample_count();
+    layer.ring_start = snapshot->get_ring_start();
+    layer.samplerate = samplerate;
+    layer.right = get_view_rect().right();
+    layer.high_offset = y - _totalHeight + 0.5f;
+    layer.low_offset = y + 0.5f;
+    layer.colour = _colour.isValid() ? _colour : fore;
+    return true;
+}
+
+/*
+ * The pulses and edges of a channel between the left and right pixels,
+ * see LogicSnapshot::get_display_edges(), or get_coarse_edges() for a
+ * coarse wave. The edges are the ones to draw if there are less than
+ * max_togs of them, the pulses otherwise.
+ */
+bool LogicSignal::get_wave(std::vector<std::pair<bool, bool>> &pulses,
+    std::vector<std::pair<uint16_t, bool>> &edges,
+    const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot, uint16_t index,
+    double samplerate, double scale, int64_t offset,
+    int left, int right, bool coarse, uint16_t &max_togs, bool &first_sample)
+{
+    if (snapshot->empty())
+        return false;
+
     const int64_t last_sample =  snapshot->get_sample_count() - 1;
 	const double samples_per_pixel = samplerate * scale;
 
@@ -155,50 +212,145 @@ void LogicSignal::paint_mid(QPainter &p, int left, int right, QColor fore, QColo
     const double start = offset * samples_per_pixel;
     const double end = (offset + width + 1) * samples_per_pixel;
     const uint64_t end_index = min(max((int64_t)ceil(end), (int64_t)0), last_sample);
-    const uint64_t start_index = max((uint64_t)floor(start), (uint64_t)0);
+    const uint64_t start_index = max((int64_t)floor(start), (int64_t)0);
     if (start_index > end_index)
-        return;
+        return false;
     width = min(width, (uint16_t)ceil((end_index + 1)/samples_per_pixel - offset));
-    const uint16_t max_togs = width / TogMaxScale;
+    max_togs = width / TogMaxScale;
+
+    if (coarse)
+        first_sample = snapshot->get_coarse_edges(pulses, edges,
+                                                  start_index, end_index, width, max_togs,
+                                                  offset,
+                                                  samples_per_pixel, index);
+    else
+        first_sample = snapshot->get_display_edges(pulses, edges,
+                                                   start_index, end_index, width, max_togs,
+                                                   offset,
+                                                   samples_per_pixel, index);
+    // cleared meanwhile, by another thread than the caller's
+    return !pulses.empty() && pulses.size() >= width;
+}
 
-    const bool first_sample = snapshot->get_display_edges(_cur_pulses, _cur_edges,
-                                                          start_index, end_index, width, max_togs,
-                                                          offset,
-                                                          samples_per_pixel, _probe->index);
-    assert(_cur_pulses.size() >= width);
+void LogicSignal::get_wave_lines(std::vector<QLine> &lines,
+    std::vector<std::pair<bool, bool>> &pulses,
+    std::vector<std::pair<uint16_t, bool>> &edges,
+    const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot, uint16_t index,
+    double samplerate, double scale, int64_t offset,
+    int left, int right, int high_offset, int low_offset)
+{
+    uint16_t max_togs;
+    bool first_sample;
+
+    lines.clear();
+    if (!get_wave(pulses, edges, snapshot, index, samplerate, scale, offset,
+                  left, right, false, max_togs, first_sample))
+        return;
 
     int preX = 0;
     int preY = first_sample ? high_offset : low_offset;
     int x = preX;
-    std::vector<QLine> wave_lines;
-    if (_cur_edges.size() < max_togs) {
+    if (edges.size() < max_togs) {
         std::vector<std::pair<uint16_t, bool>>::const_iterator i;
-        for (i = _cur_edges.begin() + 1; i != _cur_edges.end() - 1; i++) {
+        for (i = edges.begin() + 1; i != edges.end() - 1; i++) {
             x = (*i).first;
-            wave_lines.push_back(QLine(preX, preY, x, preY));
-            wave_lines.push_back(QLine(x, high_offset, x, low_offset));
+            lines.push_back(QLine(preX, preY, x, preY));
+            lines.push_back(QLine(x, high_offset, x, low_offset));
             preX = x;
             preY = (*i).second ? high_offset : low_offset;
         }
         x = (*i).first;
-        wave_lines.push_back(QLine(preX, preY, x, preY));
+        lines.push_back(QLine(preX, preY, x, preY));
     } else {
-        std::vector<std::pair<bool, bool>>::const_iterator i = _cur_pulses.begin();
-        while (i != _cur_pulses.end() - 1) {
+        std::vector<std::pair<bool, bool>>::const_iterator i = pulses.begin();
+        while (i != pulses.end() - 1) {
             if ((*i).first) {
-                wave_lines.push_back(QLine(preX, preY, x, preY));
-                wave_lines.push_back(QLine(x, high_offset, x, low_offset));
+                lines.push_back(QLine(preX, preY, x, preY));
+                lines.push_back(QLine(x, high_offset, x, low_offset));
                 preX = x;
                 preY = (*i).second ? high_offset : low_offset;
             }
             x++;
             i++;
         }
-        wave_lines.push_back(QLine(preX, preY, x, preY));
+        lines.push_back(QLine(preX, preY, x, preY));
     }
+}
 
-    p.setPen(_colour.isValid() ? _colour : fore);
-    p.drawLines(wave_lines.data(), wave_lines.size());
+// pixels of a 32-bit image, clipped to it
+static void raster_run(uchar *bits, int bpl, int width, int height,
+                       int y, int x0, int x1, QRgb rgb)
+{
+    x0 = max(x0, 0);
+    x1 = min(x1, width - 1);
+    if (y < 0 || y >= height || x0 > x1)
+        return;
+    QRgb *const line = (QRgb *)(bits + y * bpl);
+    std::fill(line + x0, line + x1 + 1, rgb);
+}
+
+static void raster_column(uchar *bits, int bpl, int width, int height,
+                          int x, int y0, int y1, QRgb rgb)
+{
+    y0 = max(y0, 0);
+    y1 = min(y1, height - 1);
+    if (x < 0 || x >= width)
+        return;
+    for (int y = y0; y <= y1; y++)
+        ((QRgb *)(bits + y * bpl))[x] = rgb;
+}
+
+void LogicSignal::raster_wave(QImage &image, int dx, QColor colour,
+    std::vector<std::pair<bool, bool>> &pulses,
+    std::vector<std::pair<uint16_t, bool>> &edges,
+    const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot, uint16_t index,
+    double samplerate, double scale, int64_t offset,
+    int left, int right, int high_offset, int low_offset, bool coarse)
+{
+    uint16_t max_togs;
+    bool first_sample;
+
+    assert(image.format() == QImage::Format_ARGB32_Premultiplied ||
+           image.format() == QImage::Format_RGB32);
+    if (!get_wave(pulses, edges, snapshot, index, samplerate, scale, offset,
+                  left, right, coarse, max_togs, first_sample))
+        return;
+
+    uchar *const bits = image.bits();
+    const int bpl = image.bytesPerLine();
+    const int w = image.width();
+    const int h = image.height();
+    const QRgb rgb = qPremultiply(colour.rgba());
+
+    // the lines of get_wave_lines(), end points included
+    int preX = dx;
+    int preY = first_sample ? high_offset : low_offset;
+    int x = preX;
+    if (edges.size() < max_togs) {
+        std::vector<std::pair<uint16_t, bool>>::const_iterator i;
+        for (i = edges.begin() + 1; i != edges.end() - 1; i++) {
+            x = (*i).first + dx;
+            raster_run(bits, bpl, w, h, preY, preX, x, rgb);
+            raster_column(bits, bpl, w, h, x, high_offset, low_offset, rgb);
+            preX = x;
+            preY = (*i).second ? high_offset : low_offset;
+        }
+        x = (*i).first + dx;
+        raster_run(bits, bpl, w, h, preY, preX, x, rgb);
+    } else {
+        std::vector<std::pair<bool, bool>>::const_iterator i = pulses.begin();
+        while (i != pulses.end() - 1) {
+            if ((*i).first) {
+                raster_run(bits, bpl, w, h, preY, preX, x, rgb);
+                raster_column(bits, bpl, w, h, x, high_offset, low_offset, rgb);
+                preX = x;
+                preY = (*i).second ? high_offset : low_offset;
+            }
+            x++;
+            i++;
+        }
+        raster_run(bits, bpl, w, h, preY, preX, x, rgb);
+    }
 }
 
 void LogicSignal::paint_caps(QPainter &p, QLineF *const lines,
@@ -506,9 +658,8 @@ QRectF LogicSignal::get_rect(LogicSetRegions type, int y, int right)
 }
 
 
-void LogicSignal::paint_mark(QPainter &p, int xstart, int xend, int type)
+void LogicSignal::paint_mark(QPainter &p, int ypos, int xstart, int xend, int type)
 {
-    const int ypos = get_y();
     const int msize = 3;
     p.setPen(p.brush().color());
     if (type == SRD_CHANNEL_SDATA) {
@@ -25,6 +25,7 @@
 #define DSVIEW_PV_LOGICSIGNAL_H
 
 #include "signal.h"
+#include "framerenderer.h"
 
 #include <vector>
 
@@ -34,6 +35,7 @@ namespace pv {
 
 namespace data {
 class Logic;
+class LogicSnapshot;
 class Analog;
 }
 
@@ -93,6 +95,42 @@ public:
 	 **/
     void paint_mid(QPainter &p, int left, int right, QColor fore, QColor back);
 
+    /**
+     * Gets the layer of the signal in a frame rendered off the GUI
+     * thread, see FrameRenderer.
+     * @return false if there is nothing to draw.
+     **/
+    bool get_frame_layer(FrameRenderer::Layer &layer, QColor fore);
+
+    /**
+     * Gets the lines of a channel's wave between the left and right
+     * pixels, at the scale and offset given. Safe off the GUI thread
+     * with pulses and edges buffers of the caller's own.
+     * @param high_offset the y-coordinate of the high level.
+     * @param low_offset the y-coordinate of the low level.
+     **/
+    static void get_wave_lines(std::vector<QLine> &lines,
+                               std::vector<std::pair<bool, bool>> &pulses,
+                               std::vector<std::pair<uint16_t, bool>> &edges,
+                               const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot,
+                               uint16_t index, double samplerate, double scale, int64_t offset,
+                               int left, int right, int high_offset, int low_offset);
+
+    /**
+     * Rasterises the wave of a channel straight into a 32-bit image, as
+     * get_wave_lines() would draw it with a pen of the colour given.
+     * @param dx the x-coordinate in the image of the left pixel.
+     * @param coarse draws the preview of the mipmap alone, see
+     * LogicSnapshot::get_coarse_edges().
+     **/
+    static void raster_wave(QImage &image, int dx, QColor colour,
+                            std::vector<std::pair<bool, bool>> &pulses,
+                            std::vector<std::pair<uint16_t, bool>> &edges,
+                            const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot,
+                            uint16_t index, double samplerate, double scale, int64_t offset,
+                            int left, int right, int high_offset, int low_offset,
+                            bool coarse);
+
     bool measure(const QPointF &p, uint64_t &index0, uint64_t &index1, uint64_t &index2) const;
 
     bool edge(const QPointF &p, uint64_t &index, int radius) const;
@@ -105,12 +143,19 @@ public:
 
     QRectF get_rect(LogicSetRegions type, int y, int right);
 
-    void paint_mark(QPainter &p, int xstart, int xend, int type);
+    // marks the signal at ypos, from the annotations of a decoder
+    static void paint_mark(QPainter &p, int ypos, int xstart, int xend, int type);
 
 protected:
     void paint_type_options(QPainter &p, int right, const QPoint pt, QColor fore);
 
 private:
+    static bool get_wave(std::vector<std::pair<bool, bool>> &pulses,
+                         std::vector<std::pair<uint16_t, bool>> &edges,
+                         const boost::shared_ptr<pv::data::LogicSnapshot> &snapshot,
+                         uint16_t index, double samplerate, double scale, int64_t offset,
+                         int left, int right, bool coarse,
+                         uint16_t &max_togs, bool &first_sample);
 
 	void paint_caps(QPainter &p, QLineF *const lines,
         std::vector< std::pair<uint64_t, bool> > &edges,
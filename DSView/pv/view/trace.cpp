@@ -239,6 +239,17 @@ void Trace::paint_mid(QPainter &p, int left, int right, QColor fore, QColor back
     (void)back;
 }
 
+bool Trace::get_frame_paint(FrameRenderer::Paint &paint,
+                            int left, int right, QColor fore, QColor back)
+{
+    (void)paint;
+    (void)left;
+    (void)right;
+    (void)fore;
+    (void)back;
+    return false;
+}
+
 void Trace::paint_fore(QPainter &p, int left, int right, QColor fore, QColor back)
 {
 	(void)p;
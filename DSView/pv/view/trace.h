@@ -33,6 +33,7 @@
 
 #include "selectableitem.h"
 #include "dsldial.h"
+#include "framerenderer.h"
 
 class QFormLayout;
 
@@ -174,6 +175,18 @@ public:
 	 **/
     virtual void paint_mid(QPainter &p, int left, int right, QColor fore, QColor back);
 
+    /**
+     * Gets the mid-layer of the trace as a paint for the render thread,
+     * bound to copies of what it uses.
+     * @param paint the paint to fill, left without a function when there
+     * is nothing to paint.
+     * @param left the x-coordinate of the left edge of the signal
+     * @param right the x-coordinate of the right edge of the signal
+     * @return false if the trace is painted by paint_mid().
+     **/
+    virtual bool get_frame_paint(FrameRenderer::Paint &paint,
+                                 int left, int right, QColor fore, QColor back);
+
 	/**
 	 * Paints the foreground layer of the trace with a QPainter
 	 * @param p the QPainter to paint into.
@@ -30,6 +30,7 @@
 #include <QEvent>
 #include <QMouseEvent>
 #include <QScrollBar>
+#include <QSettings>
 
 #include "groupsignal.h"
 #include "decodetrace.h"
@@ -77,6 +78,9 @@ const QColor View::Blue = QColor(17, 133, 209,  255);
 const QColor View::Green = QColor(0, 153, 37, 255);
 const QColor View::Purple = QColor(109, 50, 156, 255);
 const QColor View::LightBlue = QColor(17, 133, 209, 200);
+
+int View::_max_fps = View::MaxFps;
+bool View::_show_fps = false;
 const QColor View::LightRed = QColor(213, 15, 37, 200);
 
 
@@ -98,10 +102,17 @@ View::View(SigSession &session, pv::toolbars::SamplingBar *sampling_bar, QWidget
     _hover_point(-1, -1),
     _dso_auto(true),
     _show_lissajous(false),
-    _back_ready(false)
+    _back_ready(false),
+    _frame_layout(false)
 {
     setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
 
+    QSettings settings(QApplication::organizationName(), QApplication::applicationName());
+    set_max_fps(settings.value("MaxFps", MaxFps).toInt());
+    set_fps_shown(settings.value("ShowFps", false).toBool());
+    _frame_timer.setSingleShot(true);
+    connect(&_frame_timer, SIGNAL(timeout()), this, SLOT(on_frame_timer()));
+
 	connect(horizontalScrollBar(), SIGNAL(valueChanged(int)),
 		this, SLOT(h_scroll_value_changed(int)));
 	connect(verticalScrollBar(), SIGNAL(valueChanged(int)),
@@ -184,6 +195,8 @@ View::View(SigSession &session, pv::toolbars::SamplingBar *sampling_bar, QWidget
             _time_viewport, SLOT(show_wait_trigger()));
     connect(&_session, SIGNAL(repeat_hold(int)),
             this, SLOT(repeat_show()));
+    connect(&_session, SIGNAL(history_changed()),
+            _viewbottom, SLOT(update()));
 
     connect(_devmode, SIGNAL(dev_changed(bool)),
             this, SLOT(dev_changed(bool)), Qt::DirectConnection);
@@ -788,7 +801,7 @@ void View::signals_changed()
     header_updated();
     normalize_layout();
     update_scale_offset();
-    data_updated();
+    update_frame();
 }
 
 bool View::eventFilter(QObject *object, QEvent *event)
@@ -909,7 +922,59 @@ void View::v_scroll_value_changed(int value)
     viewport_update();
 }
 
+/*
+ * Updates of the data (captured samples, decoder progress...) are
+ * coalesced into frames of at most _max_fps, and HiddenFps while the
+ * window is minimised or hidden, leaving the CPU to the capture.
+ */
 void View::data_updated()
+{
+    _frame_layout = true;
+    start_frame();
+}
+
+void View::progress_updated()
+{
+    start_frame();
+}
+
+void View::start_frame()
+{
+    if (_frame_timer.isActive())
+        return;
+
+    const int fps = (!isVisible() || window()->isMinimized()) ? HiddenFps : _max_fps;
+    const qint64 elapsed = _frame_clock.isValid() ? _frame_clock.elapsed() : 1000;
+    _frame_timer.start(max(1000 / fps - elapsed, (qint64)0));
+}
+
+void View::on_frame_timer()
+{
+    _frame_clock.start();
+    if (_frame_layout) {
+        _frame_layout = false;
+        update_frame();
+    } else {
+        viewport_update();
+    }
+}
+
+void View::set_max_fps(int fps)
+{
+    _max_fps = qBound(1, fps, 1000);
+}
+
+bool View::fps_shown()
+{
+    return _show_fps;
+}
+
+void View::set_fps_shown(bool shown)
+{
+    _show_fps = shown;
+}
+
+void View::update_frame()
 {
     setViewportMargins(headerWidth(), RulerHeight, 0, 0);
     update_margins();
@@ -35,6 +35,8 @@
 #include <QSizeF>
 #include <QDateTime>
 #include <QSplitter>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include "../../extdef.h"
 #include "../toolbars/samplingbar.h"
@@ -95,6 +97,11 @@ public:
 
     static const int ForeAlpha = 200;
     static const int BackAlpha = 100;
+
+    // data updates are coalesced into frames, at MaxFps by default
+    static const int MaxFps = 30;
+    static const int HiddenFps = 2;
+
     static const QColor Red;
     static const QColor Orange;
     static const QColor Blue;
@@ -234,6 +241,16 @@ public:
     bool back_ready() const;
     void set_back(bool ready);
 
+    /*
+     * frame rate cap and overlay, the "MaxFps" and "ShowFps" settings
+     */
+    static void set_max_fps(int fps);
+    static bool fps_shown();
+    static void set_fps_shown(bool shown);
+
+    // repaints the viewports in the next frame, without a new layout
+    void progress_updated();
+
     /*
      * untils
      */
@@ -266,6 +283,9 @@ private:
 
     void update_margins();
 
+    void start_frame();
+    void update_frame();
+
     static bool compare_trace_v_offsets(
         const boost::shared_ptr<pv::view::Trace> &a,
         const boost::shared_ptr<pv::view::Trace> &b);
@@ -309,6 +329,7 @@ public slots:
     void header_updated();
 
 private slots:
+    void on_frame_timer();
 
 	void h_scroll_value_changed(int value);
 	void v_scroll_value_changed(int value);
@@ -387,6 +408,13 @@ private:
     bool _show_lissajous;
     bool _back_ready;
     bool _trig_time_setted;
+
+    QTimer _frame_timer;
+    QElapsedTimer _frame_clock;
+    // the next frame lays the view out again
+    bool _frame_layout;
+    static int _max_fps;
+    static bool _show_fps;
 };
 
 } // namespace view
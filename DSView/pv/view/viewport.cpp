@@ -57,6 +57,7 @@ Viewport::Viewport(View &parent, View_type type) :
     _view(parent),
     _type(type),
     _need_update(false),
+    _update(0),
     _sample_received(0),
     _action_type(NO_ACTION),
     _measure_type(NO_MEASURE),
@@ -72,7 +73,10 @@ Viewport::Viewport(View &parent, View_type type) :
     _waiting_trig(0),
     _dso_trig_moved(false),
     _curs_moved(false),
-    _xcurs_moved(false)
+    _xcurs_moved(false),
+    _fps(0),
+    _fps_frames(0),
+    _fps_refresh(false)
 {
 	setMouseTracking(true);
 	setAutoFillBackground(true);
@@ -91,14 +95,21 @@ Viewport::Viewport(View &parent, View_type type) :
     // drag inertial
     _drag_strength = 0;
     _drag_timer.setSingleShot(true);
+    _load_timer.setSingleShot(true);
 
     connect(&trigger_timer, SIGNAL(timeout()),
             this, SLOT(on_trigger_timer()));
     connect(&_drag_timer, SIGNAL(timeout()),
             this, SLOT(on_drag_timer()));
+    connect(&_load_timer, SIGNAL(timeout()),
+            this, SLOT(on_load_timer()));
+    _fps_timer.setInterval(1000);
+    connect(&_fps_timer, SIGNAL(timeout()),
+            this, SLOT(on_fps_timer()));
 
     connect(&_view.session(), &SigSession::receive_data,
             this, &Viewport::set_receive_len);
+    connect(&_renderer, SIGNAL(frame_ready()), this, SLOT(update()));
 
     _cmenu = new QMenu(this);
     QAction *yAction = _cmenu->addAction(tr("Add Y-cursor"));
@@ -197,19 +208,74 @@ void Viewport::paintEvent(QPaintEvent *event)
     if (_view.get_signalHeight() != _curSignalHeight)
             _curSignalHeight = _view.get_signalHeight();
 
+    if (_view.fps_shown())
+        paintFps(p, fore);
+
 	p.end();
 }
 
+/*
+ * Frames painted over the last second, to tune the frame rate cap
+ * (see View::data_updated()). The rate is taken by _fps_timer, so it
+ * drops once the repaints stop.
+ */
+void Viewport::paintFps(QPainter &p, QColor fore)
+{
+    if (!_fps_timer.isActive()) {
+        _fps_clock.start();
+        _fps_frames = 0;
+        _fps_timer.start();
+    }
+    // the repaint showing a new rate is not counted in the next one
+    if (_fps_refresh)
+        _fps_refresh = false;
+    else
+        _fps_frames++;
+
+    p.setPen(fore);
+    p.drawText(rect().adjusted(0, View::SignalMargin, -View::SignalMargin, 0),
+               Qt::AlignRight | Qt::AlignTop,
+               QString::number(_fps, 'f', 1) + " FPS");
+}
+
 void Viewport::paintSignals(QPainter &p, QColor fore, QColor back)
 {
     const vector< boost::shared_ptr<Trace> > traces(_view.get_traces(_type));
-    if (_view.session().get_device()->dev_inst()->mode == LOGIC) {
-        BOOST_FOREACH(const boost::shared_ptr<Trace> t, traces)
-        {
-            assert(t);
-            if (t->enabled())
-                t->paint_mid(p, 0, t->get_view_rect().right(), fore, back);
+    // blocks not in memory are not read while painting
+    data::LogicSnapshot::CachedOnly cached;
+
+    // logic signals, and the traces which have a paint for it, are
+    // rendered off the GUI thread, see paintFrame()
+    FrameRenderer::Frame frame;
+    frame.offset = _view.offset();
+    frame.scale = _view.scale();
+    frame.size = size();
+    frame.update = _update;
+    vector< boost::shared_ptr<Trace> > mid_traces;
+    BOOST_FOREACH(const boost::shared_ptr<Trace> t, traces)
+    {
+        assert(t);
+        if (!t->enabled())
+            continue;
+        boost::shared_ptr<LogicSignal> logicSig;
+        FrameRenderer::Layer layer;
+        FrameRenderer::Paint paint;
+        if ((logicSig = dynamic_pointer_cast<LogicSignal>(t))) {
+            if (logicSig->get_frame_layer(layer, fore))
+                frame.layers.push_back(layer);
+        } else if (t->get_frame_paint(paint, 0, t->get_view_rect().right(), fore, back)) {
+            if (paint.draw)
+                frame.paints.push_back(paint);
+        } else {
+            mid_traces.push_back(t);
         }
+    }
+    _renderer.request(frame);
+    paintFrame(p, frame);
+
+    if (_view.session().get_device()->dev_inst()->mode == LOGIC) {
+        BOOST_FOREACH(const boost::shared_ptr<Trace> t, mid_traces)
+            t->paint_mid(p, 0, t->get_view_rect().right(), fore, back);
     } else {
         if (_view.scale() != _curScale ||
             _view.offset() != _curOffset ||
@@ -224,16 +290,14 @@ void Viewport::paintSignals(QPainter &p, QColor fore, QColor back)
 
             QPainter dbp(&pixmap);
             //dbp.begin(this);
-            BOOST_FOREACH(const boost::shared_ptr<Trace> t, traces)
-            {
-                assert(t);
-                if (t->enabled())
-                    t->paint_mid(dbp, 0, t->get_view_rect().right(), fore, back);
-            }
+            BOOST_FOREACH(const boost::shared_ptr<Trace> t, mid_traces)
+                t->paint_mid(dbp, 0, t->get_view_rect().right(), fore, back);
             _need_update = false;
         }
         p.drawPixmap(0, 0, pixmap);
     }
+    if (cached.missed())
+        _load_timer.start(LoadRetryInterval);
 
     // plot cursors
     //const QRect xrect = QRect(rect().left(), rect().top(), _view.get_view_width(), rect().height());
@@ -347,6 +411,44 @@ void Viewport::paintSignals(QPainter &p, QColor fore, QColor back)
     }
 }
 
+/*
+ * Composite the last frame rendered. Until the one requested is done,
+ * the bands of its layers are moved and stretched to the current
+ * offset, scale and heights, and the overlay to the offset and scale.
+ */
+void Viewport::paintFrame(QPainter &p, const FrameRenderer::Frame &frame)
+{
+    FrameRenderer::Frame done;
+    QImage image;
+    QImage overlay;
+    if (!_renderer.get_frame(done, image, overlay))
+        return;
+
+    BOOST_FOREACH(const FrameRenderer::Layer &l, frame.layers)
+    {
+        BOOST_FOREACH(const FrameRenderer::Layer &d, done.layers)
+        {
+            if (d.id != l.id || d.generation != l.generation || d.index != l.index)
+                continue;
+
+            const double ratio = (d.samplerate * done.scale) / (l.samplerate * frame.scale);
+            const QRectF source(0, d.high_offset,
+                                image.width(), d.low_offset - d.high_offset + 1);
+            const QRectF target(done.offset * ratio - frame.offset, l.high_offset,
+                                image.width() * ratio, l.low_offset - l.high_offset + 1);
+            p.drawImage(target, image, source);
+            break;
+        }
+    }
+
+    if (!frame.paints.empty() && !overlay.isNull()) {
+        const double ratio = done.scale / frame.scale;
+        p.drawImage(QRectF(done.offset * ratio - frame.offset, 0,
+                           overlay.width() * ratio, overlay.height()),
+                    overlay, overlay.rect());
+    }
+}
+
 void Viewport::paintProgress(QPainter &p, QColor fore, QColor back)
 {
     (void)back;
@@ -1125,7 +1227,8 @@ void Viewport::set_receive_len(quint64 length)
         else
             _sample_received += length;
     }
-    update();
+    // only the progress is painted, the layout is left to data_updated()
+    _view.progress_updated();
 }
 
 void Viewport::clear_measure()
@@ -1148,6 +1251,7 @@ void Viewport::measure()
 {
     if (_view.session().get_data_lock())
         return;
+    data::LogicSnapshot::CachedOnly cached;
     _measure_type = NO_MEASURE;
     if (_type == TIME_VIEW) {
         const uint64_t sample_rate = _view.session().cur_snap_samplerate();
@@ -1242,6 +1346,8 @@ void Viewport::measure()
         }
     }
 
+    if (cached.missed())
+        _load_timer.start(LoadRetryInterval);
     measure_updated();
 }
 
@@ -1627,9 +1733,35 @@ void Viewport::on_drag_timer()
     }
 }
 
+void Viewport::on_fps_timer()
+{
+    if (!_view.fps_shown()) {
+        _fps_timer.stop();
+        return;
+    }
+
+    const double fps = _fps_frames * 1000.0 / max(_fps_clock.restart(), (qint64)1);
+    _fps_frames = 0;
+    if (fps != _fps) {
+        _fps = fps;
+        _fps_refresh = true;
+        update();
+    }
+}
+
+void Viewport::on_load_timer()
+{
+    _need_update = true;
+    _update++;
+    measure();
+    update();
+}
+
 void Viewport::set_need_update(bool update)
 {
     _need_update = update;
+    if (update)
+        _update++;
 }
 
 void Viewport::show_wait_trigger()
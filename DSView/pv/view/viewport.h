@@ -36,6 +36,7 @@
 #include <QElapsedTimer>
 
 #include "../view/view.h"
+#include "framerenderer.h"
 #include "../../extdef.h"
 
 class QPainter;
@@ -56,6 +57,7 @@ public:
     static const int HitCursorMargin = 10;
     static const double HitCursorTimeMargin;
     static const int DragTimerInterval = 100;
+    static const int LoadRetryInterval = 50;
     static const int MinorDragOffsetUp = 100;
     static const int DsoMeasureStages = 3;
     static const double MinorDragRateUp;
@@ -123,14 +125,18 @@ private:
     bool gestureEvent(QNativeGestureEvent *event);
 
     void paintSignals(QPainter& p, QColor fore, QColor back);
+    void paintFrame(QPainter& p, const FrameRenderer::Frame &frame);
     void paintProgress(QPainter& p, QColor fore, QColor back);
     void paintMeasure(QPainter &p, QColor fore, QColor back);
+    void paintFps(QPainter &p, QColor fore);
 
     void measure();
 
 private slots:
     void on_trigger_timer();
     void on_drag_timer();
+    void on_load_timer();
+    void on_fps_timer();
     void set_receive_len(quint64 length);
 
     void show_contextmenu(const QPoint& pos);
@@ -149,8 +155,11 @@ private:
 	View &_view;
     View_type _type;
     bool _need_update;
+    // bumped with _need_update, the paints of the frames depend on it
+    uint64_t _update;
 
     QPixmap pixmap;
+    FrameRenderer _renderer;
     QMenu *_cmenu;
 
     uint64_t _sample_received;
@@ -204,6 +213,9 @@ private:
 
     QElapsedTimer _elapsed_time;
     QTimer _drag_timer;
+    // blocks of a lazily loaded file missed while painting are read
+    // in the background, paint and measure again once they may be in
+    QTimer _load_timer;
     int _drag_strength;
 
     bool _dso_xm_valid;
@@ -221,6 +233,12 @@ private:
     bool _dso_trig_moved;
     bool _curs_moved;
     bool _xcurs_moved;
+
+    QTimer _fps_timer;
+    QElapsedTimer _fps_clock;
+    double _fps;
+    int _fps_frames;
+    bool _fps_refresh;
 };
 
 } // namespace view
@@ -29,6 +29,7 @@
 
 #include "../view/trace.h"
 #include "../sigsession.h"
+#include "../data/logicsnapshot.h"
 #include "../device/devinst.h"
 #include "../view/view.h"
 #include "../view/trace.h"
@@ -63,6 +64,31 @@ void ViewStatus::paintEvent(QPaintEvent *)
         p.drawText(this->rect(), Qt::AlignLeft | Qt::AlignVCenter, _rle_depth);
         p.drawText(this->rect(), Qt::AlignRight | Qt::AlignVCenter, _trig_time);
 
+        QString extra;
+        const int history_size = _session.get_history_size();
+        if (history_size != 0) {
+            const int history_index = _session.get_history_index();
+            extra += tr("History: ") +
+                (history_index == 0 ? tr("Latest") : "-" + QString::number(history_index)) +
+                "/" + QString::number(history_size) + tr(" ([ ] to switch)") + "    ";
+        }
+        uint64_t dedup_refs, dedup_leaves;
+        data::LogicSnapshot::get_leaf_dedup(dedup_refs, dedup_leaves);
+        if (dedup_leaves != 0)
+            extra += tr("Dedup: ") + QString::number(dedup_refs * 1.0 / dedup_leaves, 'f', 1) + "x    ";
+        int ring_hwm, ring_size, ring_overrun;
+        _session.get_ring_usage(ring_hwm, ring_size, ring_overrun);
+        if (ring_size != 0) {
+            extra += tr("USB Ring: ") + QString::number(ring_hwm) + "/" + QString::number(ring_size);
+            if (ring_overrun != 0)
+                extra += tr(" (") + QString::number(ring_overrun) + tr(" dropped)");
+        }
+        if (!extra.isEmpty()) {
+            const int left = p.boundingRect(this->rect(), Qt::AlignLeft | Qt::AlignVCenter, _rle_depth).width();
+            p.drawText(this->rect().adjusted(left + 20, 0, 0, 0),
+                       Qt::AlignLeft | Qt::AlignVCenter, extra);
+        }
+
         p.setPen(Qt::NoPen);
         p.setBrush(View::Blue);
         p.drawRect(this->rect().left(), this->rect().bottom() - 3,
@@ -22,6 +22,10 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
 
@@ -33,93 +37,172 @@ using pv::data::AnalogSnapshot;
 
 BOOST_AUTO_TEST_SUITE(AnalogSnapshotTest)
 
-void push_analog(AnalogSnapshot &s, unsigned int num_samples,
-	float value)
+/*
+ * Analog channels 0 .. n-1, all enabled.
+ */
+struct Channels
 {
-	sr_datafeed_analog analog;
-	analog.num_samples = num_samples;
+	Channels(int n) :
+		channels(n),
+		list(NULL)
+	{
+		for (int i = n - 1; i >= 0; i--) {
+			memset(&channels[i], 0, sizeof(channels[i]));
+			channels[i].index = i;
+			channels[i].type = SR_CHANNEL_ANALOG;
+			channels[i].enabled = TRUE;
+			list = g_slist_prepend(list, &channels[i]);
+		}
+	}
 
-	float *data = new float[num_samples];
-	analog.data = data;
-	while(num_samples-- != 0)
-		*data++ = value;
+	~Channels()
+	{
+		g_slist_free(list);
+	}
 
-	s.append_payload(analog);
-	delete[] (float*)analog.data;
-}
+	vector<sr_channel> channels;
+	GSList *list;
+};
 
-BOOST_AUTO_TEST_CASE(Basic)
+/*
+ * Push 8 bit samples, interleaved by channel as the drivers send them.
+ */
+void push_analog(AnalogSnapshot &s, const Channels &ch, uint64_t total,
+	const vector<uint8_t> &data)
 {
-	// Create an empty AnalogSnapshot object
 	sr_datafeed_analog analog;
-	analog.num_samples = 0;
-	analog.data = NULL;
-
-	AnalogSnapshot s(analog);
+	memset(&analog, 0, sizeof(analog));
+	analog.num_samples = data.size() / ch.channels.size();
+	analog.unit_bits = 8;
+	analog.data = const_cast<uint8_t*>(data.data());
+	if (s.get_sample_count() == 0)
+		s.first_payload(analog, total, ch.list);
+	else
+		s.append_payload(analog);
+}
 
-	//----- Test AnalogSnapshot::push_analog -----//
+BOOST_AUTO_TEST_CASE(Basic)
+{
+	const uint64_t total = 4096;
+	Channels ch(1);
+	AnalogSnapshot s;
 
-	BOOST_CHECK(s.get_sample_count() == 0);
-	for (unsigned int i = 0; i < AnalogSnapshot::ScaleStepCount; i++)
-	{
-		const AnalogSnapshot::Envelope &m = s._envelope_levels[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.samples == NULL);
-	}
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 0);
 
 	// Push 8 samples of all zeros
-	push_analog(s, 8, 0.0f);
-
-	BOOST_CHECK(s.get_sample_count() == 8);
+	push_analog(s, ch, total, vector<uint8_t>(8, 0));
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 8);
 
 	// There should not be enough samples to have a single mip map sample
 	for (unsigned int i = 0; i < AnalogSnapshot::ScaleStepCount; i++)
-	{
-		const AnalogSnapshot::Envelope &m = s._envelope_levels[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.samples == NULL);
-	}
+		BOOST_CHECK_EQUAL(s._envelope_levels[0][i].length, 0);
 
-	// Push 8 samples of 1.0s to bring the total up to 16
-	push_analog(s, 8, 1.0f);
+	// Push 8 samples of 255 to bring the total up to 16
+	push_analog(s, ch, total, vector<uint8_t>(8, 255));
 
 	// There should now be enough data for exactly one sample
-	// in mip map level 0, and that sample should be 0
-	const AnalogSnapshot::Envelope &e0 = s._envelope_levels[0];
+	// in mip map level 0, spanning both values
+	const AnalogSnapshot::Envelope &e0 = s._envelope_levels[0][0];
 	BOOST_CHECK_EQUAL(e0.length, 1);
-	BOOST_CHECK_EQUAL(e0.data_length, AnalogSnapshot::EnvelopeDataUnit);
 	BOOST_REQUIRE(e0.samples != NULL);
-	BOOST_CHECK_EQUAL(e0.samples[0].min, 0.0f);
-	BOOST_CHECK_EQUAL(e0.samples[0].max, 1.0f);
+	BOOST_CHECK_EQUAL(e0.samples[0].min, 0);
+	BOOST_CHECK_EQUAL(e0.samples[0].max, 255);
 
 	// The higher levels should still be empty
 	for (unsigned int i = 1; i < AnalogSnapshot::ScaleStepCount; i++)
-	{
-		const AnalogSnapshot::Envelope &m = s._envelope_levels[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.samples == NULL);
-	}
+		BOOST_CHECK_EQUAL(s._envelope_levels[0][i].length, 0);
 
-	// Push 240 samples of all zeros to bring the total up to 256
-	push_analog(s, 240, -1.0f);
+	// Push 240 samples of 128 to bring the total up to 256
+	push_analog(s, ch, total, vector<uint8_t>(240, 128));
 
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 256);
 	BOOST_CHECK_EQUAL(e0.length, 16);
-	BOOST_CHECK_EQUAL(e0.data_length, AnalogSnapshot::EnvelopeDataUnit);
-
 	for (unsigned int i = 1; i < e0.length; i++) {
-		BOOST_CHECK_EQUAL(e0.samples[i].min, -1.0f);
-		BOOST_CHECK_EQUAL(e0.samples[i].max, -1.0f);
+		BOOST_CHECK_EQUAL(e0.samples[i].min, 128);
+		BOOST_CHECK_EQUAL(e0.samples[i].max, 128);
 	}
 
-	const AnalogSnapshot::Envelope &e1 = s._envelope_levels[1];
+	const AnalogSnapshot::Envelope &e1 = s._envelope_levels[0][1];
 	BOOST_CHECK_EQUAL(e1.length, 1);
-	BOOST_CHECK_EQUAL(e1.data_length, AnalogSnapshot::EnvelopeDataUnit);
 	BOOST_REQUIRE(e1.samples != NULL);
-	BOOST_CHECK_EQUAL(e1.samples[0].min, -1.0f);
-	BOOST_CHECK_EQUAL(e1.samples[0].max, 1.0f);
+	BOOST_CHECK_EQUAL(e1.samples[0].min, 0);
+	BOOST_CHECK_EQUAL(e1.samples[0].max, 255);
+}
+
+BOOST_AUTO_TEST_CASE(Interleaved)
+{
+	// each channel has an envelope of its own
+	const uint64_t total = 8192;
+	const uint64_t count = 4096;
+	const int factor = 16;
+	Channels ch(2);
+	AnalogSnapshot s;
+
+	vector<uint8_t> data(2 * count);
+	for (uint64_t i = 0; i < count; i++) {
+		data[2 * i] = (uint8_t)(i * 0x9e3779b1 >> 13);
+		data[2 * i + 1] = (uint8_t)(i / 64);
+	}
+	push_analog(s, ch, total, data);
+
+	BOOST_CHECK_EQUAL(s.get_sample_count(), count);
+	BOOST_CHECK_EQUAL(s.get_channel_num(), 2);
+	BOOST_CHECK_EQUAL(s.get_ch_order(1), 1);
+	BOOST_CHECK(memcmp(s.get_samples(100), &data[200], 2) == 0);
+
+	for (int c = 0; c < 2; c++) {
+		const AnalogSnapshot::Envelope &e0 = s._envelope_levels[c][0];
+		BOOST_REQUIRE_EQUAL(e0.length, count / factor);
+		for (uint64_t i = 0; i < e0.length; i++) {
+			uint8_t lo = 255, hi = 0;
+			for (int k = 0; k < factor; k++) {
+				lo = min(lo, data[2 * (i * factor + k) + c]);
+				hi = max(hi, data[2 * (i * factor + k) + c]);
+			}
+			BOOST_REQUIRE_EQUAL(e0.samples[i].min, lo);
+			BOOST_REQUIRE_EQUAL(e0.samples[i].max, hi);
+		}
+
+		const AnalogSnapshot::Envelope &e1 = s._envelope_levels[c][1];
+		BOOST_REQUIRE_EQUAL(e1.length, count / factor / factor);
+		for (uint64_t i = 0; i < e1.length; i++) {
+			uint8_t lo = 255, hi = 0;
+			for (int k = 0; k < factor; k++) {
+				lo = min(lo, e0.samples[i * factor + k].min);
+				hi = max(hi, e0.samples[i * factor + k].max);
+			}
+			BOOST_REQUIRE_EQUAL(e1.samples[i].min, lo);
+			BOOST_REQUIRE_EQUAL(e1.samples[i].max, hi);
+		}
+	}
+}
+
+BOOST_AUTO_TEST_CASE(Wrap)
+{
+	// a roll mode capture keeps the latest samples in the ring
+	const uint64_t total = 512;
+	Channels ch(1);
+	AnalogSnapshot s;
+
+	vector<uint8_t> data(640);
+	for (uint64_t i = 0; i < data.size(); i++)
+		data[i] = (uint8_t)(i < total ? 0 : 1 + i % 7);
+	for (uint64_t pos = 0; pos < data.size(); pos += 64)
+		push_analog(s, ch, total,
+			vector<uint8_t>(data.begin() + pos, data.begin() + pos + 64));
+
+	BOOST_CHECK_EQUAL(s.get_sample_count(), total);
+	BOOST_CHECK_EQUAL(s.get_ring_start(), 128);
+
+	// the head of the ring holds the samples pushed after the wrap
+	const AnalogSnapshot::Envelope &e0 = s._envelope_levels[0][0];
+	BOOST_CHECK_EQUAL(e0.ring_length, 8);
+	for (uint64_t i = 0; i < e0.ring_length; i++) {
+		BOOST_CHECK_EQUAL(e0.samples[i].min, 1);
+		BOOST_CHECK_EQUAL(e0.samples[i].max, 7);
+	}
+	BOOST_CHECK_EQUAL(e0.samples[8].min, 0);
+	BOOST_CHECK_EQUAL(e0.samples[8].max, 0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,157 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include "../../pv/data/bitplanes.h"
+
+using namespace std;
+
+// the builds of bitplanes_scalar.cpp and bitplanes_sse2.cpp
+namespace bitplanes_scalar {
+namespace data {
+void transpose_planes(const uint64_t *const *planes, const uint8_t *levels,
+                      int channels, uint64_t samples,
+                      uint8_t *out, int unitsize);
+}
+}
+namespace bitplanes_sse2 {
+namespace data {
+void transpose_planes(const uint64_t *const *planes, const uint8_t *levels,
+                      int channels, uint64_t samples,
+                      uint8_t *out, int unitsize);
+}
+}
+
+typedef void (*Transpose)(const uint64_t *const *planes, const uint8_t *levels,
+                          int channels, uint64_t samples,
+                          uint8_t *out, int unitsize);
+
+BOOST_AUTO_TEST_SUITE(BitPlanesTest)
+
+/*
+ * Channels with random planes, and every fifth one constant, at
+ * alternating levels.
+ */
+struct Planes
+{
+	Planes(int channels, uint64_t samples) :
+		data(channels),
+		planes(channels),
+		levels(channels)
+	{
+		uint32_t seed = 2463534242U + channels * 977 + (uint32_t)samples;
+		for (int k = 0; k < channels; k++) {
+			levels[k] = (k / 5) & 1;
+			if (k % 5 == 4) {
+				planes[k] = NULL;
+				continue;
+			}
+			data[k].resize((samples + 63) / 64 + 1);
+			for (size_t i = 0; i < data[k].size(); i++) {
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				data[k][i] = ((uint64_t)seed << 32) ^ (seed * 0x9e3779b1ULL);
+			}
+			planes[k] = &data[k][0];
+		}
+	}
+
+	vector< vector<uint64_t> > data;
+	vector<const uint64_t *> planes;
+	vector<uint8_t> levels;
+};
+
+/*
+ * Bit k of each sample from channel k, one at a time; the bits of the
+ * units past the last channel are 0.
+ */
+void reference(const Planes &p, uint64_t samples, uint8_t *out, int unitsize)
+{
+	memset(out, 0, samples * unitsize);
+	for (uint64_t s = 0; s < samples; s++) {
+		for (size_t k = 0; k < p.planes.size(); k++) {
+			const bool bit = p.planes[k] ?
+				(p.planes[k][s / 64] >> (s % 64)) & 1 : p.levels[k];
+			if (bit)
+				out[s * unitsize + k / 8] |= 1 << (k % 8);
+		}
+	}
+}
+
+/*
+ * Compare transpose with the reference, for unit sizes up to
+ * MaxPlanesUnitSize, partial and full units, and sample counts around
+ * the 64 and 128 samples the SIMD code works on. The output past the
+ * samples must not be written.
+ */
+void check(Transpose transpose)
+{
+	const int unitsizes[] = {1, 2, 3, 4, 8, 16, pv::data::MaxPlanesUnitSize};
+	const uint64_t counts[] = {0, 1, 63, 64, 65, 127, 128, 129, 1000, 4096 + 17};
+	const int guard = 64;
+
+	for (size_t u = 0; u < sizeof(unitsizes) / sizeof(unitsizes[0]); u++) {
+		const int unitsize = unitsizes[u];
+		const int channel_counts[] = {1, 7, 8, unitsize * 8 - 3, unitsize * 8};
+		for (size_t c = 0; c < sizeof(channel_counts) / sizeof(channel_counts[0]); c++) {
+			const int channels = channel_counts[c];
+			if (channels < 1 || channels > unitsize * 8)
+				continue;
+			for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+				const uint64_t samples = counts[n];
+				const Planes p(channels, samples);
+				vector<uint8_t> expected(samples * unitsize + guard, 0xa5);
+				vector<uint8_t> out(samples * unitsize + guard, 0xa5);
+
+				reference(p, samples, &expected[0], unitsize);
+				transpose(&p.planes[0], &p.levels[0], channels, samples,
+				          &out[0], unitsize);
+				BOOST_REQUIRE_MESSAGE(out == expected,
+					"unitsize " << unitsize << ", " << channels <<
+					" channels, " << samples << " samples");
+			}
+		}
+	}
+}
+
+// the build's own, AVX2 where the CPU has it
+BOOST_AUTO_TEST_CASE(Default)
+{
+	check(pv::data::transpose_planes);
+}
+
+BOOST_AUTO_TEST_CASE(SSE2)
+{
+	check(bitplanes_sse2::data::transpose_planes);
+}
+
+BOOST_AUTO_TEST_CASE(Scalar)
+{
+	check(bitplanes_scalar::data::transpose_planes);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,32 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * transpose_planes() without the AVX2 kernel, as bitplanes_sse2::data::
+ * transpose_planes(), for test/data/bitplanes.cpp to compare with. The
+ * SSE2 code on x86-64, the portable one elsewhere.
+ */
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#undef BITPLANES_AVX2
+#define pv bitplanes_sse2
+#include "../../pv/data/bitplanes.cpp"
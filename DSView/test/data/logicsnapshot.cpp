@@ -22,515 +22,359 @@
 
 #define __STDC_LIMIT_MACROS
 #include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <vector>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 #include "../../pv/data/logicsnapshot.h"
 
 using namespace std;
 
 using pv::data::LogicSnapshot;
+using pv::data::Snapshot;
 
 BOOST_AUTO_TEST_SUITE(LogicSnapshotTest)
 
-void push_logic(LogicSnapshot &s, unsigned int length, uint8_t value)
-{
-	sr_datafeed_logic logic;
-	logic.unitsize = 1;
-	logic.length = length;
-	logic.data = new uint8_t[length];
-	memset(logic.data, value, length * logic.unitsize);
-	s.append_payload(logic);
-	delete[] (uint8_t*)logic.data;
-}
-
-BOOST_AUTO_TEST_CASE(Pow2)
-{
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(0, 0), 0);
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(1, 0), 1);
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(2, 0), 2);
-
-	BOOST_CHECK_EQUAL(
-		LogicSnapshot::pow2_ceil(INT64_MIN, 0), INT64_MIN);
-	BOOST_CHECK_EQUAL(
-		LogicSnapshot::pow2_ceil(INT64_MAX, 0), INT64_MAX);
-
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(0, 1), 0);
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(1, 1), 2);
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(2, 1), 2);
-	BOOST_CHECK_EQUAL(LogicSnapshot::pow2_ceil(3, 1), 4);
-}
-
-BOOST_AUTO_TEST_CASE(Basic)
+/*
+ * Logic channels 0 .. n-1, all enabled.
+ */
+struct Channels
 {
-	// Create an empty LogicSnapshot object
-	sr_datafeed_logic logic;
-	logic.length = 0;
-	logic.unitsize = 1;
-	logic.data = NULL;
-
-	LogicSnapshot s(logic);
-
-	//----- Test LogicSnapshot::push_logic -----//
-
-	BOOST_CHECK(s.get_sample_count() == 0);
-	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++)
+	Channels(int n) :
+		channels(n),
+		list(NULL)
 	{
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
+		for (int i = n - 1; i >= 0; i--) {
+			memset(&channels[i], 0, sizeof(channels[i]));
+			channels[i].index = i;
+			channels[i].type = SR_CHANNEL_LOGIC;
+			channels[i].enabled = TRUE;
+			list = g_slist_prepend(list, &channels[i]);
+		}
 	}
 
-	// Push 8 samples of all zeros
-	push_logic(s, 8, 0);
-
-	BOOST_CHECK(s.get_sample_count() == 8);
-
-	// There should not be enough samples to have a single mip map sample
-	for (unsigned int i = 0; i < LogicSnapshot::ScaleStepCount; i++)
+	~Channels()
 	{
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
+		g_slist_free(list);
 	}
 
-	// Push 8 samples of 0x11s to bring the total up to 16
-	push_logic(s, 8, 0x11);
-
-	// There should now be enough data for exactly one sample
-	// in mip map level 0, and that sample should be 0
-	const LogicSnapshot::MipMapLevel &m0 = s._mip_map[0];
-	BOOST_CHECK_EQUAL(m0.length, 1);
-	BOOST_CHECK_EQUAL(m0.data_length, LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(m0.data != NULL);
-	BOOST_CHECK_EQUAL(((uint8_t*)m0.data)[0], 0x11);
+	vector<sr_channel> channels;
+	GSList *list;
+};
 
-	// The higher levels should still be empty
-	for (unsigned int i = 1; i < LogicSnapshot::ScaleStepCount; i++)
-	{
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
+/*
+ * Push the samples of one channel, 8 per byte, the first in the lowest
+ * bit. Payloads end at leaf boundaries, as the drivers send them.
+ */
+void push_split(LogicSnapshot &s, const Channels &ch, uint64_t total,
+	int order, const vector<uint8_t> &data)
+{
+	const uint64_t leaf_bytes = LogicSnapshot::get_leaf_samples() / 8;
+	for (uint64_t pos = 0; pos < data.size(); pos += leaf_bytes) {
+		sr_datafeed_logic logic;
+		memset(&logic, 0, sizeof(logic));
+		logic.format = LA_SPLIT_DATA;
+		logic.index = order;
+		logic.order = order;
+		logic.length = min<uint64_t>(leaf_bytes, data.size() - pos);
+		logic.data = const_cast<uint8_t*>(&data[pos]);
+		if (order == 0 && pos == 0)
+			s.first_payload(logic, total, ch.list);
+		else
+			s.append_payload(logic);
 	}
-
-	// Push 240 samples of all zeros to bring the total up to 256
-	push_logic(s, 240, 0);
-
-	BOOST_CHECK_EQUAL(m0.length, 16);
-	BOOST_CHECK_EQUAL(m0.data_length, LogicSnapshot::MipMapDataUnit);
-
-	BOOST_CHECK_EQUAL(((uint8_t*)m0.data)[1], 0x11);
-	for (unsigned int i = 2; i < m0.length; i++)
-		BOOST_CHECK_EQUAL(((uint8_t*)m0.data)[i], 0);
-
-	const LogicSnapshot::MipMapLevel &m1 = s._mip_map[1];
-	BOOST_CHECK_EQUAL(m1.length, 1);
-	BOOST_CHECK_EQUAL(m1.data_length, LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(m1.data != NULL);
-	BOOST_CHECK_EQUAL(((uint8_t*)m1.data)[0], 0x11);
-
-	//----- Test LogicSnapshot::get_subsampled_edges -----//
-
-	// Test a full view at full zoom.
-	vector<LogicSnapshot::EdgePair> edges;
-	s.get_subsampled_edges(edges, 0, 255, 1, 0);
-	BOOST_REQUIRE_EQUAL(edges.size(), 4);
-
-	BOOST_CHECK_EQUAL(edges[0].first, 0);
-	BOOST_CHECK_EQUAL(edges[1].first, 8);
-	BOOST_CHECK_EQUAL(edges[2].first, 16);
-	BOOST_CHECK_EQUAL(edges[3].first, 255);
-
-	// Test a subset at high zoom
-	edges.clear();
-	s.get_subsampled_edges(edges, 6, 17, 0.05f, 0);
-	BOOST_REQUIRE_EQUAL(edges.size(), 4);
-
-	BOOST_CHECK_EQUAL(edges[0].first, 6);
-	BOOST_CHECK_EQUAL(edges[1].first, 8);
-	BOOST_CHECK_EQUAL(edges[2].first, 16);
-	BOOST_CHECK_EQUAL(edges[3].first, 17);
 }
 
-BOOST_AUTO_TEST_CASE(LargeData)
+bool bit(const vector<uint8_t> &data, uint64_t index)
 {
-	uint8_t prev_sample;
-	const unsigned int Length = 1000000;
-
-	sr_datafeed_logic logic;
-	logic.unitsize = 1;
-	logic.length = Length;
-	logic.data = new uint8_t[Length];
-	uint8_t *data = (uint8_t*)logic.data;
-
-	for (unsigned int i = 0; i < Length; i++)
-		*data++ = (uint8_t)(i >> 8);
+	return (data[index / 8] >> (index % 8)) & 1;
+}
 
-	LogicSnapshot s(logic);
-	delete[] (uint8_t*)logic.data;
+BOOST_AUTO_TEST_CASE(Basic)
+{
+	const uint64_t leaf = LogicSnapshot::get_leaf_samples();
+	const uint64_t total = 2 * leaf + leaf / 2;
+	Channels ch(1);
+	LogicSnapshot s;
+
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 0);
+
+	// a pattern, a constant and a partial leaf
+	vector<uint8_t> data(total / 8, 0xff);
+	for (uint64_t i = 0; i < leaf / 8; i++)
+		data[i] = (uint8_t)(i * 0x9e3779b1 >> 13);
+	for (uint64_t i = 2 * leaf / 8; i < total / 8; i++)
+		data[i] = (i % 3) ? 0x0f : 0xf0;
+
+	push_split(s, ch, total, 0, data);
+	s.capture_ended();
+
+	BOOST_CHECK_EQUAL(s.get_sample_count(), total);
+	BOOST_CHECK_EQUAL(s.get_block_num(), 3);
+	for (uint64_t i = 0; i < total; i += 997)
+		BOOST_REQUIRE_EQUAL(s.get_sample(i, 0), bit(data, i));
+	BOOST_CHECK_EQUAL(s.get_sample(total - 1, 0), bit(data, total - 1));
+	BOOST_CHECK_EQUAL(s.get_sample(total, 0), false);
+}
 
-	BOOST_CHECK(s.get_sample_count() == Length);
+BOOST_AUTO_TEST_CASE(Pulses)
+{
+	const uint64_t leaf = LogicSnapshot::get_leaf_samples();
+	const uint64_t total = 2 * leaf;
+	Channels ch(1);
+	LogicSnapshot s;
+
+	// high from 1000 to 1999 and from leaf + 8 on
+	vector<uint8_t> data(total / 8, 0);
+	for (uint64_t i = 1000; i < 2000; i++)
+		data[i / 8] |= 1 << (i % 8);
+	for (uint64_t i = (leaf + 8) / 8; i < total / 8; i++)
+		data[i] = 0xff;
+
+	push_split(s, ch, total, 0, data);
+	s.capture_ended();
+
+	uint64_t index = 0;
+	BOOST_REQUIRE(s.get_nxt_edge(index, false, total, 1, 0));
+	BOOST_CHECK_EQUAL(index, 1000);
+	BOOST_REQUIRE(s.get_nxt_edge(index, true, total, 1, 0));
+	BOOST_CHECK_EQUAL(index, 2000);
+	BOOST_REQUIRE(s.get_nxt_edge(index, false, total, 1, 0));
+	BOOST_CHECK_EQUAL(index, leaf + 8);
+	BOOST_CHECK(!s.get_nxt_edge(index, true, total, 1, 0));
+}
 
-	// Check mip map level 0
-	BOOST_CHECK_EQUAL(s._mip_map[0].length, 62500);
-	BOOST_CHECK_EQUAL(s._mip_map[0].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[0].data != NULL);
+BOOST_AUTO_TEST_CASE(Detach)
+{
+	const uint64_t leaf = LogicSnapshot::get_leaf_samples();
+	const uint64_t total = leaf + leaf / 2;
+	Channels ch(2);
+	LogicSnapshot s;
+
+	vector<uint8_t> data0(total / 8), data1(total / 8);
+	for (uint64_t i = 0; i < total / 8; i++) {
+		data0[i] = (uint8_t)(i * 0x9e3779b1 >> 11);
+		data1[i] = (i & 1) ? 0xaa : 0x55;
+	}
+	push_split(s, ch, total, 0, data0);
+	push_split(s, ch, total, 1, data1);
+	s.capture_ended();
+
+	boost::shared_ptr<LogicSnapshot> old = s.detach();
+
+	// the capture moved over, with its per channel state
+	BOOST_CHECK_EQUAL(old->get_sample_count(), total);
+	BOOST_CHECK_EQUAL(old->get_block_num(), 2);
+	BOOST_CHECK(old->last_ended());
+	BOOST_REQUIRE_EQUAL(old->_sample_cnt.size(), 2);
+	BOOST_CHECK_EQUAL(old->_sample_cnt[1], total);
+	BOOST_CHECK_EQUAL(old->_block_cnt[1], 2);
+	BOOST_CHECK_EQUAL(old->_ring_sample_cnt[1], total);
+	BOOST_CHECK_EQUAL(s.get_sample_count(), 0);
+	BOOST_CHECK_EQUAL(s._sample_cnt[1], 0);
+
+	// the next capture does not touch the detached leaves
+	vector<uint8_t> ones(total / 8, 0xff);
+	push_split(s, ch, total, 0, ones);
+	push_split(s, ch, total, 1, ones);
+	s.capture_ended();
+
+	for (uint64_t i = 0; i < total; i += 1009) {
+		BOOST_REQUIRE_EQUAL(old->get_sample(i, 0), bit(data0, i));
+		BOOST_REQUIRE_EQUAL(old->get_sample(i, 1), bit(data1, i));
+		BOOST_REQUIRE(s.get_sample(i, 1));
+	}
+}
 
-	prev_sample = 0;
-	for (unsigned int i = 0; i < s._mip_map[0].length;)
+BOOST_AUTO_TEST_CASE(Dedup)
+{
+	const uint64_t leaf = LogicSnapshot::get_leaf_samples();
+	// the last leaf ends inside a 64 sample word
+	const uint64_t total = leaf + 1000;
+	Channels ch(3);
+	uint64_t refs0, leaves0, refs, leaves;
+
+	LogicSnapshot::set_leaf_dedup(true);
+	LogicSnapshot::get_leaf_dedup(refs0, leaves0);
 	{
-		BOOST_TEST_MESSAGE("Testing mip_map[0].data[" << i << "]");
-
-		const uint8_t sample = (uint8_t)((i*16) >> 8);
-		BOOST_CHECK_EQUAL(s.get_subsample(0, i++) & 0xFF,
-			prev_sample ^ sample);
-		prev_sample = sample;
-
-		for (int j = 1; i < s._mip_map[0].length && j < 16; j++)
-		{
-			BOOST_TEST_MESSAGE("Testing mip_map[0].data[" << i << "]");
-			BOOST_CHECK_EQUAL(s.get_subsample(0, i++) & 0xFF, 0);
+		LogicSnapshot s;
+		vector<uint8_t> clock(total / 8, 0x33), other(total / 8, 0x0f);
+		// high at the last sample, so padding must not add an edge
+		clock[total / 8 - 1] = 0xb3;
+		push_split(s, ch, total, 0, clock);
+		push_split(s, ch, total, 1, clock);
+		push_split(s, ch, total, 2, other);
+		s.capture_ended();
+
+		// channels 0 and 1 share both their leaves
+		LogicSnapshot::get_leaf_dedup(refs, leaves);
+		BOOST_CHECK_EQUAL(refs - refs0, 6);
+		BOOST_CHECK_EQUAL(leaves - leaves0, 4);
+
+		for (uint64_t i = total - 70; i < total; i++) {
+			BOOST_REQUIRE_EQUAL(s.get_sample(i, 0), bit(clock, i));
+			BOOST_REQUIRE_EQUAL(s.get_sample(i, 1), bit(clock, i));
 		}
+		uint64_t index = total - 2;
+		BOOST_REQUIRE(s.get_nxt_edge(index, false, total, 1, 0));
+		BOOST_CHECK_EQUAL(index, total - 1);
+		index = total - 1;
+		BOOST_CHECK(!s.get_nxt_edge(index, true, total + 64, 1, 0));
 	}
 
-	// Check mip map level 1
-	BOOST_CHECK_EQUAL(s._mip_map[1].length, 3906);
-	BOOST_CHECK_EQUAL(s._mip_map[1].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[1].data != NULL);
+	// the pool lets go of the leaves with their last user
+	LogicSnapshot::get_leaf_dedup(refs, leaves);
+	BOOST_CHECK_EQUAL(refs, refs0);
+	BOOST_CHECK_EQUAL(leaves, leaves0);
+}
 
-	prev_sample = 0;
-	for (unsigned int i = 0; i < s._mip_map[1].length; i++)
+/*
+ * A snapshot that keeps what it releases, so tests can see when and
+ * whether retired memory is given back.
+ */
+class ReclaimSnapshot : public Snapshot
+{
+public:
+	ReclaimSnapshot() :
+		Snapshot(1, 0, 0)
 	{
-		BOOST_TEST_MESSAGE("Testing mip_map[1].data[" << i << "]");
-
-		const uint8_t sample = i;
-		const uint8_t expected = sample ^ prev_sample;
-		prev_sample = i;
-
-		BOOST_CHECK_EQUAL(s.get_subsample(1, i) & 0xFF, expected);
 	}
 
-	// Check mip map level 2
-	BOOST_CHECK_EQUAL(s._mip_map[2].length, 244);
-	BOOST_CHECK_EQUAL(s._mip_map[2].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[2].data != NULL);
-
-	prev_sample = 0;
-	for (unsigned int i = 0; i < s._mip_map[2].length; i++)
+	~ReclaimSnapshot()
 	{
-		BOOST_TEST_MESSAGE("Testing mip_map[2].data[" << i << "]");
-
-		const uint8_t sample = i << 4;
-		const uint8_t expected = (sample ^ prev_sample) | 0x0F;
-		prev_sample = sample;
-
-		BOOST_CHECK_EQUAL(s.get_subsample(2, i) & 0xFF, expected);
+		// Snapshot::~Snapshot() would free() the fake pointers
+		reclaim(true);
 	}
 
-	// Check mip map level 3
-	BOOST_CHECK_EQUAL(s._mip_map[3].length, 15);
-	BOOST_CHECK_EQUAL(s._mip_map[3].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[3].data != NULL);
+	void clear() {}
+	void init() {}
+	bool has_data(int) { return false; }
+	int get_block_num() { return 0; }
+	uint64_t get_block_size(int) { return 0; }
 
-	for (unsigned int i = 0; i < s._mip_map[3].length; i++)
-		BOOST_CHECK_EQUAL(*((uint8_t*)s._mip_map[3].data + i),
-			0xFF);
-
-	// Check the higher levels
-	for (unsigned int i = 4; i < LogicSnapshot::ScaleStepCount; i++)
+	void set_counts(uint64_t sample_count)
 	{
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
+		_sample_count = sample_count;
+		_ring_sample_count = sample_count;
+		publish();
 	}
 
-	//----- Test LogicSnapshot::get_subsampled_edges -----//
-	// Check in normal case
-	vector<LogicSnapshot::EdgePair> edges;
-	s.get_subsampled_edges(edges, 0, Length-1, 1, 7);
+	using Snapshot::retire;
+	using Snapshot::reclaim;
 
-	BOOST_CHECK_EQUAL(edges.size(), 32);
+	vector<void *> released;
 
-	for (unsigned int i = 0; i < edges.size() - 1; i++)
+protected:
+	void release(void *ptr)
 	{
-		BOOST_CHECK_EQUAL(edges[i].first, i * 32768);
-		BOOST_CHECK_EQUAL(edges[i].second, i & 1);
-	}
-
-	BOOST_CHECK_EQUAL(edges[31].first, 999999);
-
-	// Check in very low zoom case
-	edges.clear();
-	s.get_subsampled_edges(edges, 0, Length-1, 50e6f, 7);
-
-	BOOST_CHECK_EQUAL(edges.size(), 2);
-}
-
-BOOST_AUTO_TEST_CASE(Pulses)
-{
-	const int Cycles = 3;
-	const int Period = 64;
-	const int Length = Cycles * Period;
-
-	vector<LogicSnapshot::EdgePair> edges;
-
-	//----- Create a LogicSnapshot -----//
-	sr_datafeed_logic logic;
-	logic.unitsize = 1;
-	logic.length = Length;
-	logic.data = (uint64_t*)new uint8_t[Length];
-	uint8_t *p = (uint8_t*)logic.data;
-
-	for (int i = 0; i < Cycles; i++) {
-		*p++ = 0xFF;
-		for (int j = 1; j < Period; j++)
-			*p++ = 0x00;
+		released.push_back(ptr);
 	}
+};
 
-	LogicSnapshot s(logic);
-	delete[] (uint8_t*)logic.data;
-
-	//----- Check the mip-map -----//
-	// Check mip map level 0
-	BOOST_CHECK_EQUAL(s._mip_map[0].length, 12);
-	BOOST_CHECK_EQUAL(s._mip_map[0].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[0].data != NULL);
-
-	for (unsigned int i = 0; i < s._mip_map[0].length;) {
-		BOOST_TEST_MESSAGE("Testing mip_map[0].data[" << i << "]");
-		BOOST_CHECK_EQUAL(s.get_subsample(0, i++) & 0xFF, 0xFF);
-
-		for (int j = 1;
-			i < s._mip_map[0].length &&
-			j < Period/LogicSnapshot::MipMapScaleFactor; j++) {
-			BOOST_TEST_MESSAGE(
-				"Testing mip_map[0].data[" << i << "]");
-			BOOST_CHECK_EQUAL(s.get_subsample(0, i++) & 0xFF, 0x00);
-		}
-	}
-
-	// Check the higher levels are all inactive
-	for (unsigned int i = 1; i < LogicSnapshot::ScaleStepCount; i++) {
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
-	}
-
-	//----- Test get_subsampled_edges at reduced scale -----//
-	s.get_subsampled_edges(edges, 0, Length-1, 16.0f, 2);
-	BOOST_REQUIRE_EQUAL(edges.size(), Cycles + 2);
-
-	BOOST_CHECK_EQUAL(0, false);
-	for (unsigned int i = 1; i < edges.size(); i++)
-		BOOST_CHECK_EQUAL(edges[i].second, false);
-}
-
-BOOST_AUTO_TEST_CASE(LongPulses)
+BOOST_AUTO_TEST_CASE(RetireWaitsForReaders)
 {
-	const int Cycles = 3;
-	const int Period = 64;
-	const int PulseWidth = 16;
-	const int Length = Cycles * Period;
-
-	int j;
-	vector<LogicSnapshot::EdgePair> edges;
-
-	//----- Create a LogicSnapshot -----//
-	sr_datafeed_logic logic;
-	logic.unitsize = 8;
-	logic.length = Length * 8;
-	logic.data = (uint64_t*)new uint64_t[Length];
-	uint64_t *p = (uint64_t*)logic.data;
-
-	for (int i = 0; i < Cycles; i++) {
-		for (j = 0; j < PulseWidth; j++)
-			*p++ = ~0;
-		for (; j < Period; j++)
-			*p++ = 0;
-	}
-
-	LogicSnapshot s(logic);
-	delete[] (uint64_t*)logic.data;
-
-	//----- Check the mip-map -----//
-	// Check mip map level 0
-	BOOST_CHECK_EQUAL(s._mip_map[0].length, 12);
-	BOOST_CHECK_EQUAL(s._mip_map[0].data_length,
-		LogicSnapshot::MipMapDataUnit);
-	BOOST_REQUIRE(s._mip_map[0].data != NULL);
-
-	for (unsigned int i = 0; i < s._mip_map[0].length;) {
-		for (j = 0; i < s._mip_map[0].length && j < 2; j++) {
-			BOOST_TEST_MESSAGE(
-				"Testing mip_map[0].data[" << i << "]");
-			BOOST_CHECK_EQUAL(s.get_subsample(0, i++), ~0);
-		}
-
-		for (; i < s._mip_map[0].length &&
-			j < Period/LogicSnapshot::MipMapScaleFactor; j++) {
-			BOOST_TEST_MESSAGE(
-				"Testing mip_map[0].data[" << i << "]");
-			BOOST_CHECK_EQUAL(s.get_subsample(0, i++), 0);
-		}
-	}
-
-	// Check the higher levels are all inactive
-	for (unsigned int i = 1; i < LogicSnapshot::ScaleStepCount; i++) {
-		const LogicSnapshot::MipMapLevel &m = s._mip_map[i];
-		BOOST_CHECK_EQUAL(m.length, 0);
-		BOOST_CHECK_EQUAL(m.data_length, 0);
-		BOOST_CHECK(m.data == NULL);
-	}
-
-	//----- Test get_subsampled_edges at a full scale -----//
-	s.get_subsampled_edges(edges, 0, Length-1, 16.0f, 2);
-	BOOST_REQUIRE_EQUAL(edges.size(), Cycles * 2 + 1);
-
-	for (int i = 0; i < Cycles; i++) {
-		BOOST_CHECK_EQUAL(edges[i*2].first, i * Period);
-		BOOST_CHECK_EQUAL(edges[i*2].second, true);
-		BOOST_CHECK_EQUAL(edges[i*2+1].first, i * Period + PulseWidth);
-		BOOST_CHECK_EQUAL(edges[i*2+1].second, false);
-	}
-
-	BOOST_CHECK_EQUAL(edges.back().first, Length-1);
-	BOOST_CHECK_EQUAL(edges.back().second, false);
-
-	//----- Test get_subsampled_edges at a simplified scale -----//
-	edges.clear();
-	s.get_subsampled_edges(edges, 0, Length-1, 17.0f, 2);
-
-	BOOST_CHECK_EQUAL(edges[0].first, 0);
-	BOOST_CHECK_EQUAL(edges[0].second, true);
-	BOOST_CHECK_EQUAL(edges[1].first, 16);
-	BOOST_CHECK_EQUAL(edges[1].second, false);
-	
-	for (int i = 1; i < Cycles; i++) {
-		BOOST_CHECK_EQUAL(edges[i+1].first, i * Period);
-		BOOST_CHECK_EQUAL(edges[i+1].second, false);
-	}
-
-	BOOST_CHECK_EQUAL(edges.back().first, Length-1);
-	BOOST_CHECK_EQUAL(edges.back().second, false);
+	ReclaimSnapshot s;
+	int a, b;
+
+	Snapshot::ReadGuard *const r1 = new Snapshot::ReadGuard(s);
+	s.retire(&a);
+	s.reclaim(false);
+	BOOST_CHECK(s.released.empty());
+
+	// a newer reader overlaps the one that could see a
+	Snapshot::ReadGuard *const r2 = new Snapshot::ReadGuard(s);
+	delete r1;
+	s.reclaim(false);
+	BOOST_REQUIRE_EQUAL(s.released.size(), 1);
+	BOOST_CHECK(s.released[0] == &a);
+
+	s.retire(&b);
+	s.reclaim(false);
+	BOOST_CHECK_EQUAL(s.released.size(), 1);
+	delete r2;
+	s.reclaim(false);
+	BOOST_REQUIRE_EQUAL(s.released.size(), 2);
+	BOOST_CHECK(s.released[1] == &b);
 }
 
-BOOST_AUTO_TEST_CASE(LisaMUsbHid)
+BOOST_AUTO_TEST_CASE(OverlappingReaders)
 {
-	/* This test was created from the beginning of the USB_DM signal in
-	 * sigrok-dumps-usb/lisa_m_usbhid/lisa_m_usbhid.sr
-	 */
-
-	const int Edges[] = {
-		7028, 7033, 7036, 7041, 7044, 7049, 7053, 7066, 7073, 7079,
-		7086, 7095, 7103, 7108, 7111, 7116, 7119, 7124, 7136, 7141,
-		7148, 7162, 7500
-	};
-	const int Length = Edges[countof(Edges) - 1];
-
-	bool state = false;
-	int lastEdgePos = 0;
-
-	//----- Create a LogicSnapshot -----//
-	sr_datafeed_logic logic;
-	logic.unitsize = 1;
-	logic.length = Length;
-	logic.data = new uint8_t[Length];
-	uint8_t *data = (uint8_t*)logic.data;
-
-	for (unsigned int i = 0; i < countof(Edges); i++) {
-		const int edgePos = Edges[i];
-		memset(&data[lastEdgePos], state ? 0x02 : 0,
-			edgePos - lastEdgePos - 1);
-
-		lastEdgePos = edgePos;
-		state = !state;
+	ReclaimSnapshot s;
+	vector<int> items(100);
+
+	// there is always a reader, but each one leaves eventually
+	Snapshot::ReadGuard *reader = new Snapshot::ReadGuard(s);
+	for (size_t i = 0; i < items.size(); i++) {
+		s.retire(&items[i]);
+		Snapshot::ReadGuard *const next = new Snapshot::ReadGuard(s);
+		delete reader;
+		reader = next;
+		s.reclaim(false);
+		// all but what the current reader may still see
+		BOOST_REQUIRE_GE(s.released.size(), i);
 	}
-
-	LogicSnapshot s(logic);
-	delete[] (uint64_t*)logic.data;
-
-	vector<LogicSnapshot::EdgePair> edges;
-
-
-	/* The trailing edge of the pulse train is falling in the source data.
-	 * Check this is always true at different scales
-	 */
-
-	edges.clear();
-	s.get_subsampled_edges(edges, 0, Length-1, 33.333332f, 1);
-	BOOST_CHECK_EQUAL(edges[edges.size() - 2].second, false);
+	delete reader;
+	s.reclaim(false);
+	BOOST_CHECK_EQUAL(s.released.size(), items.size());
 }
 
 /*
- * This test checks the rendering of wide data (more than 8 probes)
- * Probe signals are either all-high, or all-low, but are interleaved such that
- * they would toggle during every sample if treated like 8 probes.
- * The packet contains a large number of samples, so the mipmap generation kicks
- * in.
- *
- * The signals should not toggle (have exactly two edges: the start and end)
+ * Readers race with a writer that publishes counts and retires what
+ * they read. No reader may see a released item or torn counts.
  */
-BOOST_AUTO_TEST_CASE(WideData)
+BOOST_AUTO_TEST_CASE(ConcurrentReaders)
 {
-	const int Length = 512<<10;
-	uint16_t *data = new uint16_t[Length];
-
-	sr_datafeed_logic logic;
-	logic.unitsize = sizeof(data[0]);
-	logic.length = Length * sizeof(data[0]);
-	logic.data = data;
-
-	for (int i = 0; i < Length; i++)
-		data[i] = 0x0FF0;
-
-	LogicSnapshot s(logic);
-
-	vector<LogicSnapshot::EdgePair> edges;
-
-	edges.clear();
-	s.get_subsampled_edges(edges, 0, Length-1, 1, 0);
-	BOOST_CHECK_EQUAL(edges.size(), 2);
-
-	edges.clear();
-	s.get_subsampled_edges(edges, 0, Length-1, 1, 8);
-	BOOST_CHECK_EQUAL(edges.size(), 2);
-
-	// Cleanup
-	delete [] data;
-}
-
-/*
- * This test is a replica of sixteen.sr attached to Bug #33.
- */
-BOOST_AUTO_TEST_CASE(Sixteen)
-{
-	const int Length = 8;
-	uint16_t data[Length];
-
-	sr_datafeed_logic logic;
-	logic.unitsize = sizeof(data[0]);
-	logic.length = Length * sizeof(data[0]);
-	logic.data = data;
-
-	for (int i = 0; i < Length; i++)
-		data[i] = 0xFFFE;
-
-	LogicSnapshot s(logic);
-
-	vector<LogicSnapshot::EdgePair> edges;
-	s.get_subsampled_edges(edges, 0, 2, 0.0004, 1);
+	struct Item
+	{
+		atomic<bool> alive;
+	};
 
-	BOOST_CHECK_EQUAL(edges.size(), 2);
+	ReclaimSnapshot s;
+	atomic<Item *> current(new Item());
+	current.load()->alive = true;
+	atomic<bool> stop(false);
+	atomic<int> failures(0);
+
+	boost::thread_group readers;
+	for (int i = 0; i < 4; i++)
+		readers.create_thread([&]() {
+			while (!stop.load()) {
+				Snapshot::ReadGuard guard(s);
+				if (!current.load()->alive.load())
+					failures++;
+				uint64_t sample_count, ring_sample_count;
+				s.get_published(sample_count, ring_sample_count);
+				if (sample_count != ring_sample_count)
+					failures++;
+			}
+		});
+
+	const int Rounds = 100000;
+	size_t dead = 0;
+	for (int i = 0; i < Rounds; i++) {
+		Item *const item = new Item();
+		item->alive = true;
+		s.retire(current.exchange(item));
+		s.set_counts(i);
+		for (; dead < s.released.size(); dead++)
+			((Item *)s.released[dead])->alive = false;
+	}
+	const size_t released = s.released.size();
+
+	stop = true;
+	readers.join_all();
+	s.reclaim(true);
+	BOOST_CHECK_EQUAL(failures.load(), 0);
+	// freed while readers kept overlapping
+	BOOST_CHECK_GT(released, (size_t)Rounds / 2);
+
+	for (size_t i = 0; i < s.released.size(); i++)
+		delete (Item *)s.released[i];
+	delete current.load();
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -1478,6 +1478,21 @@ SR_PRIV int dsl_config_get(int id, GVariant **data, const struct sr_dev_inst *sd
             return SR_ERR;
         *data = g_variant_new_uint64(devc->limit_samples);
         break;
+    case SR_CONF_RING_SIZE:
+        if (!sdi)
+            return SR_ERR;
+        *data = g_variant_new_int32(NUM_RING_SLOTS);
+        break;
+    case SR_CONF_RING_HWM:
+        if (!sdi)
+            return SR_ERR;
+        *data = g_variant_new_int32(devc->ring_hwm);
+        break;
+    case SR_CONF_RING_OVERRUN:
+        if (!sdi)
+            return SR_ERR;
+        *data = g_variant_new_int32(devc->ring_overrun);
+        break;
     case SR_CONF_SAMPLERATE:
         if (!sdi)
             return SR_ERR;
@@ -2029,10 +2044,206 @@ SR_PRIV unsigned int dsl_get_timeout(const struct sr_dev_inst *sdi)
         return 20;
 }
 
+static void dsl_ring_wake(struct DSL_ring *ring, volatile gint *waiter)
+{
+    if (g_atomic_int_get(waiter)) {
+        g_mutex_lock(&ring->mutex);
+        g_cond_broadcast(&ring->cond);
+        g_mutex_unlock(&ring->mutex);
+    }
+}
+
+static gpointer dsl_ring_ingest_proc(gpointer data)
+{
+    struct sr_dev_inst *sdi = data;
+    struct DSL_context *devc = sdi->priv;
+    struct DSL_ring *ring = devc->ring;
+    struct DSL_ring_slot *slot;
+    struct sr_datafeed_packet packet;
+    struct sr_datafeed_logic logic;
+    struct sr_datafeed_packet overflow;
+    gboolean overflow_sent = FALSE;
+    guint tail, spare_head;
+
+    packet.type = SR_DF_LOGIC;
+    packet.status = SR_PKT_OK;
+    packet.payload = &logic;
+    logic.format = LA_CROSS_DATA;
+    logic.data_error = 0;
+
+    overflow.type = SR_DF_OVERFLOW;
+    overflow.status = SR_PKT_OK;
+    overflow.payload = NULL;
+
+    tail = g_atomic_int_get(&ring->filled_tail);
+    for (;;) {
+        /* report the first dropped payload where it was lost */
+        if (!overflow_sent && g_atomic_int_get(&ring->overrun) &&
+            tail == (guint)g_atomic_int_get(&ring->overrun_at)) {
+            sr_session_send(sdi, &overflow);
+            overflow_sent = TRUE;
+        }
+
+        if (tail == (guint)g_atomic_int_get(&ring->filled_head)) {
+            /* only leave once everything queued so far has been sent */
+            if (g_atomic_int_get(&ring->stop))
+                break;
+            g_mutex_lock(&ring->mutex);
+            g_atomic_int_set(&ring->consumer_wait, 1);
+            if (tail == (guint)g_atomic_int_get(&ring->filled_head) &&
+                !g_atomic_int_get(&ring->stop))
+                g_cond_wait_until(&ring->cond, &ring->mutex,
+                                  g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND);
+            g_atomic_int_set(&ring->consumer_wait, 0);
+            g_mutex_unlock(&ring->mutex);
+            continue;
+        }
+
+        slot = &ring->filled[tail % NUM_RING_SLOTS];
+        logic.length = slot->length;
+        logic.data = slot->buf;
+        sr_session_send(sdi, &packet);
+
+        /* hand the buffer back before releasing the slot */
+        spare_head = g_atomic_int_get(&ring->spare_head);
+        ring->spare[spare_head % NUM_RING_SLOTS] = slot->buf;
+        g_atomic_int_set(&ring->spare_head, spare_head + 1);
+        g_atomic_int_set(&ring->filled_tail, ++tail);
+    }
+
+    return NULL;
+}
+
+static int dsl_ring_start(struct sr_dev_inst *sdi, size_t size)
+{
+    struct DSL_context *devc = sdi->priv;
+    struct DSL_ring *ring;
+
+    devc->ring_hwm = 0;
+    devc->ring_overrun = 0;
+    if (!(ring = g_try_malloc0(sizeof(struct DSL_ring)))) {
+        sr_err("%s: USB transfer ring malloc failed.", __func__);
+        return SR_ERR_MALLOC;
+    }
+    ring->buf_size = size;
+    g_mutex_init(&ring->mutex);
+    g_cond_init(&ring->cond);
+
+    devc->ring = ring;
+    ring->thread = g_thread_try_new("dsl-ingest", dsl_ring_ingest_proc, sdi, NULL);
+    if (!ring->thread) {
+        sr_err("%s: Failed to start ingest thread.", __func__);
+        devc->ring = NULL;
+        g_mutex_clear(&ring->mutex);
+        g_cond_clear(&ring->cond);
+        g_free(ring);
+        return SR_ERR;
+    }
+
+    return SR_OK;
+}
+
+static void dsl_ring_stop(struct DSL_context *devc)
+{
+    struct DSL_ring *ring = devc->ring;
+    guint tail;
+
+    if (!ring)
+        return;
+
+    g_atomic_int_set(&ring->stop, 1);
+    g_mutex_lock(&ring->mutex);
+    g_cond_broadcast(&ring->cond);
+    g_mutex_unlock(&ring->mutex);
+    g_thread_join(ring->thread);
+
+    /* all transfers are gone, every spare buffer is back in the ring */
+    tail = g_atomic_int_get(&ring->spare_tail);
+    while (tail != (guint)g_atomic_int_get(&ring->spare_head))
+        g_free(ring->spare[tail++ % NUM_RING_SLOTS]);
+
+    devc->ring_overrun = g_atomic_int_get(&ring->overrun);
+    sr_info("%s: transfer ring high-water mark %d/%d, %d payloads dropped", __func__,
+            devc->ring_hwm, NUM_RING_SLOTS, devc->ring_overrun);
+
+    devc->ring = NULL;
+    g_mutex_clear(&ring->mutex);
+    g_cond_clear(&ring->cond);
+    g_free(ring);
+}
+
+/*
+ * Take a free buffer for the transfer being resubmitted. This runs in the
+ * libusb callback, so it never waits: NULL means the ring is full (or no
+ * buffer could be allocated at all).
+ */
+static uint8_t *dsl_ring_get_spare(struct DSL_ring *ring)
+{
+    uint8_t *buf;
+    guint tail = g_atomic_int_get(&ring->spare_tail);
+
+    if (tail != (guint)g_atomic_int_get(&ring->spare_head)) {
+        buf = ring->spare[tail % NUM_RING_SLOTS];
+        g_atomic_int_set(&ring->spare_tail, tail + 1);
+        return buf;
+    }
+    if (ring->spare_alloc < NUM_RING_SLOTS &&
+        (buf = g_try_malloc(ring->buf_size))) {
+        ring->spare_alloc++;
+        return buf;
+    }
+
+    return NULL;
+}
+
+/*
+ * Queue the payload of a completed transfer for the ingest thread and
+ * swap a spare buffer into the transfer, so it can be resubmitted at
+ * once. If the ring is full the payload is dropped and counted as an
+ * overrun, which the ingest thread reports as SR_DF_OVERFLOW. Returns
+ * FALSE only if nothing was ever queued, so the caller may send the
+ * data itself without reordering it.
+ */
+static gboolean dsl_ring_push(struct DSL_context *devc,
+                              struct libusb_transfer *transfer, uint64_t length)
+{
+    struct DSL_ring *ring = devc->ring;
+    struct DSL_ring_slot *slot;
+    uint8_t *spare;
+    guint head;
+    int depth;
+
+    head = g_atomic_int_get(&ring->filled_head);
+    if (!(spare = dsl_ring_get_spare(ring))) {
+        if (ring->spare_alloc == 0)
+            return FALSE;
+        if (g_atomic_int_get(&ring->overrun) == 0)
+            g_atomic_int_set(&ring->overrun_at, head);
+        g_atomic_int_inc(&ring->overrun);
+        return TRUE;
+    }
+
+    slot = &ring->filled[head % NUM_RING_SLOTS];
+    slot->buf = transfer->buffer;
+    slot->length = length;
+    g_atomic_int_set(&ring->filled_head, head + 1);
+    transfer->buffer = spare;
+
+    depth = head + 1 - (guint)g_atomic_int_get(&ring->filled_tail);
+    if (depth > devc->ring_hwm)
+        devc->ring_hwm = depth;
+
+    dsl_ring_wake(ring, &ring->consumer_wait);
+    return TRUE;
+}
+
 static void finish_acquisition(struct DSL_context *devc)
 {
     struct sr_datafeed_packet packet;
 
+    /* flush queued payloads ahead of SR_DF_END */
+    dsl_ring_stop(devc);
+
     sr_info("%s: send SR_DF_END packet", __func__);
     /* Terminate session. */
     packet.type = SR_DF_END;
@@ -2047,6 +2258,35 @@ static void finish_acquisition(struct DSL_context *devc)
     devc->status = DSL_FINISH;
 }
 
+/*
+ * Transfer buffers come either from the session's buffer provider or from
+ * the heap. The driver remembers which ones were lent, so a buffer that is
+ * part of the frontend's storage is never passed to g_free, whatever the
+ * provider answers on release.
+ */
+static uint8_t *dsl_buffer_borrow(struct DSL_context *devc, size_t size)
+{
+    uint8_t *buf;
+
+    if ((buf = sr_session_buffer_alloc(size)))
+        devc->lent_bufs = g_slist_prepend(devc->lent_bufs, buf);
+    return buf;
+}
+
+static void dsl_buffer_free(struct DSL_context *devc, uint8_t *buf)
+{
+    GSList *l;
+
+    if (!buf)
+        return;
+    if ((l = g_slist_find(devc->lent_bufs, buf))) {
+        devc->lent_bufs = g_slist_delete_link(devc->lent_bufs, l);
+        sr_session_buffer_release(buf);
+    } else {
+        g_free(buf);
+    }
+}
+
 static void free_transfer(struct libusb_transfer *transfer)
 {
     struct DSL_context *devc;
@@ -2054,7 +2294,7 @@ static void free_transfer(struct libusb_transfer *transfer)
 
     devc = transfer->user_data;
 
-    g_free(transfer->buffer);
+    dsl_buffer_free(devc, transfer->buffer);
     transfer->buffer = NULL;
     libusb_free_transfer(transfer);
 
@@ -2070,6 +2310,39 @@ static void free_transfer(struct libusb_transfer *transfer)
         finish_acquisition(devc);
 }
 
+/*
+ * In zero-copy mode the transfer buffers are regions of the frontend's
+ * sample storage, handed out in submission order. Swap the consumed one
+ * for the next region before resubmitting; once the provider declines,
+ * the remaining transfers move to private buffers for the rest of the
+ * capture. The provider only lends regions over the first lap of its
+ * ring, so a capture that wraps around is copied from then on.
+ */
+static int dsl_buffer_renew(struct DSL_context *devc,
+                            struct libusb_transfer *transfer)
+{
+    uint8_t *buf = NULL;
+
+    if (devc->zero_copy &&
+        !(buf = dsl_buffer_borrow(devc, transfer->length))) {
+        sr_info("%s: Buffer provider declined, fall back to copies.", __func__);
+        devc->zero_copy = FALSE;
+    }
+
+    /* a private buffer is simply kept */
+    if (!buf && !g_slist_find(devc->lent_bufs, transfer->buffer))
+        return SR_OK;
+    if (!buf && !(buf = g_try_malloc(transfer->length))) {
+        dsl_buffer_free(devc, transfer->buffer);
+        transfer->buffer = NULL;
+        return SR_ERR_MALLOC;
+    }
+
+    dsl_buffer_free(devc, transfer->buffer);
+    transfer->buffer = buf;
+    return SR_OK;
+}
+
 static void resubmit_transfer(struct libusb_transfer *transfer)
 {
     int ret;
@@ -2264,8 +2537,11 @@ static void receive_transfer(struct libusb_transfer *transfer)
             logic.length = min(logic.length, remain_length);
 
             /* send data to session bus */
-            if (packet.status == SR_PKT_OK)
-                sr_session_send(sdi, &packet);
+            if (packet.status == SR_PKT_OK) {
+                if (!devc->ring || sdi->mode != LOGIC ||
+                    !dsl_ring_push(devc, transfer, logic.length))
+                    sr_session_send(sdi, &packet);
+            }
         }
 
         devc->num_samples += cur_sample_count;
@@ -2288,6 +2564,12 @@ static void receive_transfer(struct libusb_transfer *transfer)
         }
     }
 
+    if (devc->status == DSL_DATA && sdi->mode == ANALOG &&
+        dsl_buffer_renew(devc, transfer) != SR_OK) {
+        sr_err("%s: USB transfer buffer malloc failed.", __func__);
+        devc->status = DSL_ERROR;
+    }
+
     if (devc->status == DSL_DATA)
         resubmit_transfer(transfer);
     else
@@ -2390,9 +2672,21 @@ SR_PRIV int dsl_start_transfers(const struct sr_dev_inst *sdi)
         devc->submitted_transfers++;
     }
 
+    /* logic payloads are handed off to the ingest thread */
+    if (sdi->mode == LOGIC &&
+        dsl_ring_start(devc->cb_data, size) != SR_OK)
+        sr_warn("%s: Fall back to in-callback ingest.", __func__);
+
+    /* analog payloads may land straight in the frontend's storage */
+    devc->zero_copy = (sdi->mode == ANALOG);
+
     /* data packet transfer */
     for (i = 1; i <= num_transfers; i++) {
-        if (!(buf = g_try_malloc(size))) {
+        buf = NULL;
+        if (devc->zero_copy &&
+            !(buf = dsl_buffer_borrow(devc, size)))
+            devc->zero_copy = FALSE;
+        if (!buf && !(buf = g_try_malloc(size))) {
             sr_err("%s: USB transfer buffer malloc failed.", __func__);
             return SR_ERR_MALLOC;
         }
@@ -2404,7 +2698,7 @@ SR_PRIV int dsl_start_transfers(const struct sr_dev_inst *sdi)
             sr_err("%s: Failed to submit transfer: %s.",
                    __func__, libusb_error_name(ret));
             libusb_free_transfer(transfer);
-            g_free(buf);
+            dsl_buffer_free(devc, buf);
             devc->status = DSL_ERROR;
             devc->abort = TRUE;
             return SR_ERR;
@@ -54,6 +54,7 @@
 #define USB_CONFIGURATION	1
 #define NUM_TRIGGER_STAGES	16
 #define NUM_SIMUL_TRANSFERS	64
+#define NUM_RING_SLOTS      64
 #define MAX_EMPTY_POLL      16
 
 #define DSL_REQUIRED_VERSION_MAJOR	2
@@ -1068,6 +1069,38 @@ static const gboolean default_ms_en[] = {
     FALSE, /* DSO_MS_VP2P */
 };
 
+/*
+ * single-producer/single-consumer ring between the libusb completion
+ * callback (producer) and the ingest thread (consumer)
+ * - filled: transfer buffers waiting to be sent to the session bus
+ * - spare:  drained buffers handed back for the next resubmit
+ */
+struct DSL_ring_slot {
+    uint8_t *buf;
+    uint64_t length;
+};
+
+struct DSL_ring {
+    struct DSL_ring_slot filled[NUM_RING_SLOTS];
+    volatile gint filled_head;
+    volatile gint filled_tail;
+    uint8_t *spare[NUM_RING_SLOTS];
+    volatile gint spare_head;
+    volatile gint spare_tail;
+    int spare_alloc;
+    size_t buf_size;
+
+    GThread *thread;
+    GMutex mutex;
+    GCond cond;
+    volatile gint consumer_wait;
+    volatile gint stop;
+
+    /* payloads dropped because the ring was full, and where it happened */
+    volatile gint overrun;
+    volatile gint overrun_at;
+};
+
 enum {
     DSL_ERROR = -1,
     DSL_INIT = 0,
@@ -1151,6 +1184,12 @@ struct DSL_context {
 	unsigned int num_transfers;
 	struct libusb_transfer **transfers;
 	int *usbfd;
+    struct DSL_ring *ring;
+    int ring_hwm;
+    int ring_overrun;
+    gboolean zero_copy;
+    /* transfer buffers lent by the session's buffer provider */
+    GSList *lent_bufs;
 
     int pipe_fds[2];
     GIOChannel *channel;
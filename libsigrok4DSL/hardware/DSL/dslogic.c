@@ -205,6 +205,11 @@ static struct DSL_context *DSLogic_dev_new(const struct DSL_profile *prof)
         assert(channel_modes[i].id == i);
 
     devc->channel = NULL;
+    devc->ring = NULL;
+    devc->ring_hwm = 0;
+    devc->ring_overrun = 0;
+    devc->zero_copy = FALSE;
+    devc->lent_bufs = NULL;
     devc->profile = prof;
 	devc->fw_updated = 0;
     devc->cur_samplerate = devc->profile->dev_caps.default_samplerate;
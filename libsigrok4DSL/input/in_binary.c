@@ -20,11 +20,9 @@
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/time.h>
 
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/binary: "
@@ -35,11 +33,69 @@
 #define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
 #define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
 
-#define CHUNKSIZE             (512 * 1024)
 #define DEFAULT_NUM_PROBES    8
+#define DEFAULT_SAMPLERATE    SR_MHZ(1)
+
+/* words of a leaf with its mipmap */
+#define LEAF_SPACE_WORDS      (LA_LEAF_SPACE / 8)
+
+/* bound on the leaves built ahead of the one sent */
+#define JOB_BYTES_LIMIT       (256 * 1024 * 1024)
+
+/*
+ * The file is mapped, and cut in blocks of LA_LEAF_SAMPLES samples. The
+ * leaves of each block, its samples and mipmap for every channel, are
+ * built on a thread pool and sent in order as LA_LEAF_DATA packets. With
+ * many channels, the leaves of a block are built by several jobs, each
+ * for a range of the channels.
+ *
+ * The samples are either interleaved, unitsize bytes per sample with
+ * channel k in bit k, or planar: the file is a bit plane per channel,
+ * of 8 samples per byte, the first one in the lowest bit.
+ */
+
+/* The leaves of one block for a range of channels, built by the pool. */
+struct leaf_job {
+	uint64_t block;
+	/* first enabled channel, and how many */
+	int first;
+	int count;
+	uint64_t *leaves;
+	/* leaf of each probe in leaves, for sr_leaf_split() */
+	int *orders;
+	/* per enabled channel: the block has edges, its last sample */
+	gboolean *edges;
+	gboolean *values;
+	gboolean done;
+};
 
 struct context {
 	uint64_t samplerate;
+	int num_probes;
+	gboolean planar;
+	gchar *filename;
+	uint64_t file_size;
+	uint64_t total_samples;
+
+	/* state of a load, see receive() */
+	GMappedFile *mapping;
+	const uint8_t *data;
+	int enabled;
+	/* probe index of each enabled channel, and the reverse */
+	int *probes;
+	int *orders;
+	uint64_t num_blocks;
+	/* enabled channels per job, and jobs per block */
+	int part_channels;
+	int num_parts;
+	GThreadPool *pool;
+	GMutex mutex;
+	GCond cond;
+	struct leaf_job *jobs;
+	int num_jobs;
+	uint64_t next_queued;
+	uint64_t next_sent;
+	gint64 start_time;
 };
 
 static int format_match(const char *filename)
@@ -53,98 +109,386 @@ static int format_match(const char *filename)
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_channel *probe;
-    uint16_t num_probes, i;
+	struct stat st;
+	uint16_t i;
 	char name[SR_MAX_PROBENAME_LEN + 1];
 	char *param;
 	struct context *ctx;
+	uint64_t plane_bytes;
 
-	(void)filename;
+	if (stat(filename, &st) == -1) {
+		sr_err("Failed to stat '%s'.", filename);
+		return SR_ERR;
+	}
 
 	if (!(ctx = g_try_malloc0(sizeof(*ctx)))) {
 		sr_err("Input format context malloc failed.");
 		return SR_ERR_MALLOC;
 	}
 
-	num_probes = DEFAULT_NUM_PROBES;
-	ctx->samplerate = 0;
+	ctx->num_probes = DEFAULT_NUM_PROBES;
+	ctx->samplerate = DEFAULT_SAMPLERATE;
+	ctx->planar = FALSE;
+	ctx->file_size = st.st_size;
+	ctx->filename = g_strdup(filename);
 
 	if (in->param) {
 		param = g_hash_table_lookup(in->param, "numprobes");
 		if (param) {
-			num_probes = strtoul(param, NULL, 10);
-			if (num_probes < 1)
-				return SR_ERR;
+			ctx->num_probes = strtoul(param, NULL, 10);
+			if (ctx->num_probes < 1 || ctx->num_probes > G_MAXUINT16)
+				goto fail;
 		}
 
 		param = g_hash_table_lookup(in->param, "samplerate");
 		if (param) {
-			if (sr_parse_sizestring(param, &ctx->samplerate) != SR_OK)
-				return SR_ERR;
+			if (sr_parse_sizestring(param, &ctx->samplerate) != SR_OK ||
+			    ctx->samplerate == 0)
+				goto fail;
 		}
+
+		param = g_hash_table_lookup(in->param, "layout");
+		if (param) {
+			if (!strcmp(param, "planar"))
+				ctx->planar = TRUE;
+			else if (strcmp(param, "interleaved"))
+				goto fail;
+		}
+	}
+
+	if (ctx->planar) {
+		plane_bytes = ctx->file_size / ctx->num_probes;
+		ctx->total_samples = plane_bytes * 8;
+		if (ctx->file_size % ctx->num_probes)
+			sr_warn("File size is not a multiple of %d planes, "
+				"the last %" PRIu64 " bytes are ignored.", ctx->num_probes,
+				ctx->file_size % ctx->num_probes);
+	} else {
+		ctx->total_samples = ctx->file_size / ((ctx->num_probes + 7) / 8);
+	}
+	if (ctx->total_samples == 0) {
+		sr_err("No samples to load from '%s'.", filename);
+		goto fail;
 	}
 
-	/* Create a virtual device. */
-	in->sdi = sr_dev_inst_new(LOGIC, 0, SR_ST_ACTIVE, NULL, NULL, NULL);
+	/* Create a session device, loaded through receive(). */
 	in->internal = ctx;
+	if (!(in->sdi = sr_input_dev_inst_new(in, LOGIC, filename))) {
+		in->internal = NULL;
+		goto fail;
+	}
 
-	for (i = 0; i < num_probes; i++) {
+	for (i = 0; i < ctx->num_probes; i++) {
 		snprintf(name, SR_MAX_PROBENAME_LEN, "%d", i);
-		/* TODO: Check return value. */
 		if (!(probe = sr_channel_new(i, SR_CHANNEL_LOGIC, TRUE, name)))
-			return SR_ERR;
+			return SR_ERR_MALLOC;
 		in->sdi->channels = g_slist_append(in->sdi->channels, probe);
 	}
 
+	in->sdi->driver->config_set(SR_CONF_SAMPLERATE,
+		g_variant_new_uint64(ctx->samplerate), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_LIMIT_SAMPLES,
+		g_variant_new_uint64(ctx->total_samples), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_CAPTURE_NUM_PROBES,
+		g_variant_new_uint64(ctx->num_probes), in->sdi, NULL, NULL);
+
 	return SR_OK;
+
+fail:
+	g_free(ctx->filename);
+	g_free(ctx);
+	return SR_ERR;
 }
 
-static int loadfile(struct sr_input *in, const char *filename)
+/* Sample s of channel probe, from the mapped file. */
+static gboolean sample_at(const struct context *ctx, int probe, uint64_t s)
 {
-	struct sr_datafeed_packet packet;
-	struct sr_datafeed_meta meta;
-	struct sr_datafeed_logic logic;
-	struct sr_config *src;
-	unsigned char buffer[CHUNKSIZE];
-	int fd, size, num_probes;
-	struct context *ctx;
+	const uint64_t plane_bytes = ctx->total_samples / 8;
+	const int unitsize = (ctx->num_probes + 7) / 8;
+
+	if (ctx->planar)
+		return (ctx->data[probe * plane_bytes + s / 8] >> (s % 8)) & 1;
+	else
+		return (ctx->data[s * unitsize + probe / 8] >> (probe % 8)) & 1;
+}
 
-	ctx = in->internal;
-    packet.status = SR_PKT_OK;
+static void leaf_proc(gpointer data, gpointer user_data)
+{
+	struct leaf_job *job = data;
+	struct context *ctx = user_data;
+	const uint64_t first = job->block * LA_LEAF_SAMPLES;
+	const uint64_t samples = MIN(ctx->total_samples - first, LA_LEAF_SAMPLES);
+	const int unitsize = (ctx->num_probes + 7) / 8;
+	uint64_t *leaf;
+	gboolean last;
+	int i, k, probe;
 
-	if ((fd = open(filename, O_RDONLY)) == -1)
-		return SR_ERR;
+	if (!ctx->planar) {
+		for (i = 0; i < ctx->num_probes; i++) {
+			k = ctx->orders[i];
+			job->orders[i] = (k >= job->first && k < job->first + job->count) ?
+					 k - job->first : -1;
+		}
+		sr_leaf_split(job->leaves, ctx->data + first * unitsize, unitsize,
+			ctx->num_probes, job->orders, samples);
+	}
+
+	for (k = 0; k < job->count; k++) {
+		leaf = job->leaves + k * LEAF_SPACE_WORDS;
+		probe = ctx->probes[job->first + k];
+		if (ctx->planar)
+			memcpy(leaf, ctx->data + probe * (ctx->total_samples / 8) +
+			       first / 8, (samples + 7) / 8);
+		last = first > 0 && sample_at(ctx, probe, first - 1);
+		sr_leaf_finish(leaf, samples, last, &job->edges[k], &job->values[k]);
+	}
 
-	num_probes = g_slist_length(in->sdi->channels);
+	g_mutex_lock(&ctx->mutex);
+	job->done = TRUE;
+	g_cond_signal(&ctx->cond);
+	g_mutex_unlock(&ctx->mutex);
+}
 
-	/* Send header packet to the session bus. */
-	std_session_send_df_header(in->sdi, LOG_PREFIX);
+/*
+ * Keep the jobs busy with the blocks after the one to send. Jobs are
+ * queued and sent in order of blocks, then of channel ranges.
+ */
+static void queue_jobs(struct context *ctx)
+{
+	struct leaf_job *job;
+	int part;
+
+	while (ctx->next_queued < ctx->num_blocks * ctx->num_parts &&
+	       ctx->next_queued < ctx->next_sent + ctx->num_jobs) {
+		job = &ctx->jobs[ctx->next_queued % ctx->num_jobs];
+		part = ctx->next_queued % ctx->num_parts;
+		job->block = ctx->next_queued / ctx->num_parts;
+		job->first = part * ctx->part_channels;
+		job->count = MIN(ctx->enabled - job->first, ctx->part_channels);
+		job->done = FALSE;
+		g_thread_pool_push(ctx->pool, job, NULL);
+		ctx->next_queued++;
+	}
+}
+
+static void end_load(struct context *ctx)
+{
+	int i;
+
+	/* drop queued jobs, wait for running ones */
+	if (ctx->pool)
+		g_thread_pool_free(ctx->pool, TRUE, TRUE);
+	ctx->pool = NULL;
+	if (ctx->jobs) {
+		for (i = 0; i < ctx->num_jobs; i++) {
+			g_free(ctx->jobs[i].leaves);
+			g_free(ctx->jobs[i].orders);
+			g_free(ctx->jobs[i].edges);
+			g_free(ctx->jobs[i].values);
+		}
+		g_mutex_clear(&ctx->mutex);
+		g_cond_clear(&ctx->cond);
+	}
+	g_free(ctx->jobs);
+	ctx->jobs = NULL;
+	g_free(ctx->probes);
+	ctx->probes = NULL;
+	g_free(ctx->orders);
+	ctx->orders = NULL;
+	if (ctx->mapping)
+		g_mapped_file_unref(ctx->mapping);
+	ctx->mapping = NULL;
+	ctx->data = NULL;
+}
 
-	if (ctx->samplerate) {
-		packet.type = SR_DF_META;
-		packet.payload = &meta;
-		src = sr_config_new(SR_CONF_SAMPLERATE,
-				g_variant_new_uint64(ctx->samplerate));
-		meta.config = g_slist_append(NULL, src);
-		sr_session_send(in->sdi, &packet);
-		sr_config_free(src);
+static gboolean start_load(struct sr_input *in, struct context *ctx)
+{
+	const struct sr_channel *probe;
+	GError *error = NULL;
+	const GSList *l;
+	uint64_t job_bytes;
+	int i, threads;
+
+	ctx->start_time = g_get_monotonic_time();
+	if (!(ctx->mapping = g_mapped_file_new(ctx->filename, FALSE, &error))) {
+		sr_err("Failed to map '%s': %s.", ctx->filename, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (g_mapped_file_get_length(ctx->mapping) < ctx->file_size) {
+		sr_err("File '%s' was truncated.", ctx->filename);
+		return FALSE;
+	}
+	ctx->data = (const uint8_t *)g_mapped_file_get_contents(ctx->mapping);
+
+	if (!(ctx->probes = g_try_new(int, ctx->num_probes)) ||
+	    !(ctx->orders = g_try_new(int, ctx->num_probes)))
+		return FALSE;
+	ctx->enabled = 0;
+	for (i = 0; i < ctx->num_probes; i++)
+		ctx->orders[i] = -1;
+	for (l = in->sdi->channels; l; l = l->next) {
+		probe = l->data;
+		if (probe->type != SR_CHANNEL_LOGIC || !probe->enabled ||
+		    probe->index >= ctx->num_probes)
+			continue;
+		ctx->orders[probe->index] = ctx->enabled;
+		ctx->probes[ctx->enabled++] = probe->index;
+	}
+	ctx->num_blocks = (ctx->total_samples + LA_LEAF_SAMPLES - 1) / LA_LEAF_SAMPLES;
+	ctx->next_queued = 0;
+	ctx->next_sent = 0;
+	if (ctx->enabled == 0)
+		return TRUE;
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+	threads = MAX(g_get_num_processors(), 1);
+#else
+	threads = 4;
+#endif
+	/*
+	 * Two jobs per thread, as far as the memory bound allows: with
+	 * many channels, a job only builds the leaves of some of them.
+	 */
+	ctx->part_channels = MAX(1, MIN(ctx->enabled,
+		(int)(JOB_BYTES_LIMIT / (2 * (uint64_t)threads * LA_LEAF_SPACE))));
+	ctx->num_parts = (ctx->enabled + ctx->part_channels - 1) / ctx->part_channels;
+	job_bytes = (uint64_t)ctx->part_channels * LA_LEAF_SPACE;
+	ctx->num_jobs = MAX(1, MIN(2 * threads, (int)(JOB_BYTES_LIMIT / job_bytes)));
+	if (!(ctx->jobs = g_try_new0(struct leaf_job, ctx->num_jobs)))
+		return FALSE;
+	g_mutex_init(&ctx->mutex);
+	g_cond_init(&ctx->cond);
+	for (i = 0; i < ctx->num_jobs; i++) {
+		if (!(ctx->jobs[i].leaves = g_try_malloc(job_bytes)) ||
+		    (!ctx->planar &&
+		     !(ctx->jobs[i].orders = g_try_new(int, ctx->num_probes))) ||
+		    !(ctx->jobs[i].edges = g_try_new(gboolean, ctx->part_channels)) ||
+		    !(ctx->jobs[i].values = g_try_new(gboolean, ctx->part_channels))) {
+			sr_err("%s: leaves malloc failed", __func__);
+			return FALSE;
+		}
+	}
+
+	if (!(ctx->pool = g_thread_pool_new(leaf_proc, ctx, threads, FALSE, &error))) {
+		sr_err("Failed to create loader threads: %s.", error->message);
+		g_error_free(error);
+		return FALSE;
 	}
+	queue_jobs(ctx);
+
+	return TRUE;
+}
+
+/*
+ * Send the leaves of the next job, waiting shortly for them if they are
+ * not built yet. Blocks without edges only have their level sent.
+ */
+static void send_block(struct context *ctx, const struct sr_dev_inst *cb_sdi)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_leaf leaf;
+	struct leaf_job *job = &ctx->jobs[ctx->next_sent % ctx->num_jobs];
+	const uint64_t first = job->block * LA_LEAF_SAMPLES;
+	gint64 end_time;
+	int k;
+
+	g_mutex_lock(&ctx->mutex);
+	end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND;
+	while (!job->done &&
+	       g_cond_wait_until(&ctx->cond, &ctx->mutex, end_time))
+		;
+	g_mutex_unlock(&ctx->mutex);
+	if (!job->done)
+		return;
 
-	/* Chop up the input file into chunks & send it to the session bus. */
 	packet.type = SR_DF_LOGIC;
+	packet.status = SR_PKT_OK;
 	packet.payload = &logic;
-	logic.unitsize = (num_probes + 7) / 8;
-	logic.data = buffer;
-	while ((size = read(fd, buffer, CHUNKSIZE)) > 0) {
-		logic.length = size;
-		sr_session_send(in->sdi, &packet);
+	logic.format = LA_LEAF_DATA;
+	logic.length = (MIN(ctx->total_samples - first, LA_LEAF_SAMPLES) + 7) / 8;
+	logic.data_error = 0;
+	logic.data = &leaf;
+	leaf.mapping = NULL;
+	leaf.reader = NULL;
+	for (k = 0; k < job->count; k++) {
+		leaf.leaf = job->edges[k] ? job->leaves + k * LEAF_SPACE_WORDS : NULL;
+		leaf.value = job->values[k];
+		leaf.edges = job->edges[k];
+		logic.index = ctx->probes[job->first + k];
+		logic.order = job->first + k;
+		sr_session_send(cb_sdi, &packet);
 	}
-	close(fd);
 
-	/* Send end packet to the session bus. */
+	ctx->next_sent++;
+	queue_jobs(ctx);
+}
+
+static int receive(struct sr_input *in, int revents,
+		const struct sr_dev_inst *cb_sdi)
+{
+	struct context *ctx = in->internal;
+	struct sr_datafeed_packet packet;
+	double mbytes, seconds;
+
 	packet.type = SR_DF_END;
-	sr_session_send(in->sdi, &packet);
+	packet.status = SR_PKT_OK;
+	packet.payload = NULL;
 
-	g_free(ctx);
+	if (revents == -1) {
+		/* The session was stopped. */
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
+
+	if (!ctx->mapping && !start_load(in, ctx)) {
+		packet.status = SR_PKT_SOURCE_ERROR;
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
+
+	if (ctx->enabled > 0 && ctx->next_sent < ctx->num_blocks * ctx->num_parts) {
+		send_block(ctx, cb_sdi);
+		if (ctx->next_sent < ctx->num_blocks * ctx->num_parts)
+			return TRUE;
+	}
+
+	sr_session_send(cb_sdi, &packet);
+
+	mbytes = ctx->file_size / (1024.0 * 1024.0);
+	seconds = (g_get_monotonic_time() - ctx->start_time) / (double)G_USEC_PER_SEC;
+	sr_info("Loaded %.1f MB in %.2f s, %.1f MB/s.", mbytes, seconds,
+		seconds > 0 ? mbytes / seconds : 0);
+
+	end_load(ctx);
+	return FALSE;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	(void)filename;
+
+	/* Frontends which run the session have the file loaded from the
+	 * session loop, see receive(). */
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	while (receive(in, 0, in->sdi))
+		;
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_input *in)
+{
+	struct context *ctx = in->internal;
+
+	if (ctx) {
+		end_load(ctx);
+		g_free(ctx->filename);
+		g_free(ctx);
+	}
 	in->internal = NULL;
 
 	return SR_OK;
@@ -156,4 +500,6 @@ SR_PRIV struct sr_input_format input_binary = {
 	.format_match = format_match,
 	.init = init,
 	.loadfile = loadfile,
+	.receive = receive,
+	.cleanup = cleanup,
 };
@@ -0,0 +1,830 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+#include <stdlib.h>
+#include <string.h>
+#include <zip.h>
+
+/* Message logging helpers with subsystem-specific prefix string. */
+#define LOG_PREFIX "input/srzip: "
+#define sr_log(l, s, args...) sr_log(l, LOG_PREFIX s, ## args)
+#define sr_spew(s, args...) sr_spew(LOG_PREFIX s, ## args)
+#define sr_dbg(s, args...) sr_dbg(LOG_PREFIX s, ## args)
+#define sr_info(s, args...) sr_info(LOG_PREFIX s, ## args)
+#define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
+#define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
+
+/* words of a leaf with its mipmap */
+#define LEAF_SPACE_WORDS      (LA_LEAF_SPACE / 8)
+
+/* bound on the chunks and leaves held ahead of the block sent */
+#define JOB_BYTES_LIMIT       (256 * 1024 * 1024)
+
+/*
+ * sigrok session files are zip archives of a "version", a "metadata"
+ * key file and the samples of the logic channels, unitsize bytes per
+ * sample with channel k in bit k, cut in chunks named after the
+ * capturefile key: "logic-1-1", "logic-1-2" and so on, or a single
+ * "logic-1" in the first version.
+ *
+ * The chunks the next blocks of LA_LEAF_SAMPLES samples need are
+ * inflated on a thread pool, each thread on an archive handle of its
+ * own. The leaves of the blocks are built on a second pool as soon as
+ * their chunks are in, and sent in order as LA_LEAF_DATA packets.
+ */
+
+enum chunk_state {
+	CHUNK_IDLE,
+	CHUNK_QUEUED,
+	CHUNK_DONE,
+	CHUNK_FAILED,
+};
+
+struct chunk {
+	zip_uint64_t index;
+	int num;
+	/* bytes of the samples before the chunk, and in it */
+	uint64_t offset;
+	uint64_t size;
+	uint8_t *buf;
+	enum chunk_state state;
+};
+
+/* The leaves of one block, built by the pool. */
+struct leaf_job {
+	uint64_t block;
+	uint64_t *leaves;
+	/* the samples of a block across chunks, and the one before */
+	uint8_t *raw;
+	/* per enabled channel: the block has edges, its last sample */
+	gboolean *edges;
+	gboolean *values;
+	gboolean done;
+};
+
+struct context {
+	uint64_t samplerate;
+	int num_probes;
+	int unitsize;
+	gchar *filename;
+	struct chunk *chunks;
+	int num_chunks;
+	uint64_t total_samples;
+
+	/* state of a load, see receive() */
+	gboolean loading;
+	int enabled;
+	/* probe index of each enabled channel, and the reverse */
+	int *probes;
+	int *orders;
+	uint64_t num_blocks;
+	GThreadPool *inflate_pool;
+	GThreadPool *leaf_pool;
+	GMutex mutex;
+	GCond cond;
+	/* archive handles, the first free_archives are not in use */
+	struct zip **archives;
+	int num_archives;
+	int free_archives;
+	struct leaf_job *jobs;
+	int num_jobs;
+	/* next chunk to inflate, and first one still held */
+	int next_chunk;
+	int first_chunk;
+	uint64_t next_queued;
+	uint64_t next_sent;
+	gboolean failed;
+	gint64 start_time;
+};
+
+/* Read a whole entry of the archive, NUL terminated. */
+static char *read_entry(struct zip *archive, const char *name, zip_uint64_t *size)
+{
+	struct zip_stat zs;
+	struct zip_file *zf;
+	char *buf;
+
+	if (zip_stat(archive, name, 0, &zs) == -1)
+		return NULL;
+	if (!(buf = g_try_malloc(zs.size + 1)))
+		return NULL;
+	if (!(zf = zip_fopen_index(archive, zs.index, 0))) {
+		g_free(buf);
+		return NULL;
+	}
+	if (zip_fread(zf, buf, zs.size) != (zip_int64_t)zs.size) {
+		zip_fclose(zf);
+		g_free(buf);
+		return NULL;
+	}
+	zip_fclose(zf);
+	buf[zs.size] = '\0';
+	if (size)
+		*size = zs.size;
+
+	return buf;
+}
+
+static int format_match(const char *filename)
+{
+	struct zip *archive;
+	char *version;
+	int ret;
+
+	if (!(archive = zip_open(filename, 0, &ret)))
+		return FALSE;
+
+	ret = FALSE;
+	if ((version = read_entry(archive, "version", NULL))) {
+		ret = (version[0] == '1' || version[0] == '2') &&
+		      zip_name_locate(archive, "metadata", 0) != -1;
+		g_free(version);
+	}
+	zip_close(archive);
+
+	return ret;
+}
+
+/* sigrok writes rates as "1 MHz" or "12.5 MHz". */
+static int parse_samplerate(const char *s, uint64_t *samplerate)
+{
+	double rate;
+	char *end;
+
+	rate = g_ascii_strtod(s, &end);
+	while (*end == ' ')
+		end++;
+	switch (*end) {
+	case 'k':
+	case 'K':
+		rate *= SR_KHZ(1);
+		end++;
+		break;
+	case 'M':
+		rate *= SR_MHZ(1);
+		end++;
+		break;
+	case 'G':
+		rate *= SR_GHZ(1);
+		end++;
+		break;
+	}
+	if (end == s || (*end && g_ascii_strcasecmp(end, "Hz")) || rate < 1)
+		return SR_ERR;
+	*samplerate = rate + 0.5;
+
+	return SR_OK;
+}
+
+static int compare_chunks(const void *a, const void *b)
+{
+	return ((const struct chunk *)a)->num - ((const struct chunk *)b)->num;
+}
+
+/* Find the chunks of the samples, in order. */
+static int list_chunks(struct context *ctx, struct zip *archive,
+		const char *capturefile)
+{
+	struct zip_stat zs;
+	const char *name;
+	const size_t len = strlen(capturefile);
+	zip_int64_t num_entries, i;
+	uint64_t offset;
+	char *end;
+	int num, k;
+
+	num_entries = zip_get_num_entries(archive, 0);
+	if (!(ctx->chunks = g_try_new0(struct chunk, MAX(num_entries, 1))))
+		return SR_ERR_MALLOC;
+
+	for (i = 0; i < num_entries; i++) {
+		if (!(name = zip_get_name(archive, i, 0)) ||
+		    strncmp(name, capturefile, len))
+			continue;
+		if (name[len] == '\0') {
+			num = 1;
+		} else if (name[len] == '-' && g_ascii_isdigit(name[len + 1])) {
+			num = strtol(name + len + 1, &end, 10);
+			if (*end)
+				continue;
+		} else {
+			continue;
+		}
+		if (zip_stat_index(archive, i, 0, &zs) == -1 || zs.size == 0)
+			continue;
+		ctx->chunks[ctx->num_chunks].index = i;
+		ctx->chunks[ctx->num_chunks].num = num;
+		ctx->chunks[ctx->num_chunks].size = zs.size;
+		ctx->num_chunks++;
+	}
+
+	qsort(ctx->chunks, ctx->num_chunks, sizeof(struct chunk), compare_chunks);
+	offset = 0;
+	for (k = 0; k < ctx->num_chunks; k++) {
+		ctx->chunks[k].offset = offset;
+		offset += ctx->chunks[k].size;
+	}
+	ctx->total_samples = offset / ctx->unitsize;
+	if (offset % ctx->unitsize)
+		sr_warn("Samples end with a partial one of %d bytes, it is ignored.",
+			(int)(offset % ctx->unitsize));
+
+	return SR_OK;
+}
+
+static int read_metadata(struct context *ctx, struct zip *archive,
+		GKeyFile *kf, gchar ***names)
+{
+	GError *error = NULL;
+	gchar *capturefile, *s, key[16];
+	int i, ret;
+
+	capturefile = g_key_file_get_string(kf, "device 1", "capturefile", NULL);
+	if (!capturefile) {
+		sr_err("No logic capture in the session.");
+		return SR_ERR;
+	}
+
+	ctx->num_probes = g_key_file_get_integer(kf, "device 1", "total probes", &error);
+	if (error || ctx->num_probes < 1 || ctx->num_probes > G_MAXUINT16) {
+		sr_err("Bad number of probes.");
+		g_clear_error(&error);
+		g_free(capturefile);
+		return SR_ERR;
+	}
+
+	ctx->unitsize = (ctx->num_probes + 7) / 8;
+	if (g_key_file_has_key(kf, "device 1", "unitsize", NULL))
+		ctx->unitsize = g_key_file_get_integer(kf, "device 1", "unitsize", NULL);
+	if (ctx->unitsize < (ctx->num_probes + 7) / 8 || ctx->unitsize > 8) {
+		sr_err("Bad unitsize %d for %d probes.", ctx->unitsize, ctx->num_probes);
+		g_free(capturefile);
+		return SR_ERR;
+	}
+
+	s = g_key_file_get_string(kf, "device 1", "samplerate", NULL);
+	if (!s || parse_samplerate(s, &ctx->samplerate) != SR_OK) {
+		sr_err("Bad samplerate '%s'.", s ? s : "");
+		g_free(s);
+		g_free(capturefile);
+		return SR_ERR;
+	}
+	g_free(s);
+
+	if (g_key_file_get_integer(kf, "device 1", "total analog", NULL) > 0)
+		sr_warn("Analog channels are not loaded.");
+
+	/* the probes saved are the enabled ones, numbered from 1 */
+	*names = g_new0(gchar *, ctx->num_probes);
+	for (i = 0; i < ctx->num_probes; i++) {
+		snprintf(key, sizeof(key), "probe%d", i + 1);
+		(*names)[i] = g_key_file_get_string(kf, "device 1", key, NULL);
+	}
+
+	ret = list_chunks(ctx, archive, capturefile);
+	g_free(capturefile);
+
+	return ret;
+}
+
+static int init(struct sr_input *in, const char *filename)
+{
+	struct sr_channel *probe;
+	struct context *ctx;
+	struct zip *archive;
+	GKeyFile *kf;
+	GError *error = NULL;
+	gchar **names = NULL;
+	char name[SR_MAX_PROBENAME_LEN + 1], *metadata;
+	zip_uint64_t size;
+	int i, ret;
+
+	if (!(archive = zip_open(filename, 0, &ret))) {
+		sr_err("Failed to open '%s': zip error %d.", filename, ret);
+		return SR_ERR;
+	}
+	if (!(metadata = read_entry(archive, "metadata", &size))) {
+		sr_err("Failed to read the metadata of '%s'.", filename);
+		zip_close(archive);
+		return SR_ERR;
+	}
+
+	if (!(ctx = g_try_malloc0(sizeof(*ctx)))) {
+		sr_err("Input format context malloc failed.");
+		g_free(metadata);
+		zip_close(archive);
+		return SR_ERR_MALLOC;
+	}
+
+	kf = g_key_file_new();
+	if (!g_key_file_load_from_data(kf, metadata, size, 0, &error)) {
+		sr_err("Failed to parse metadata: %s.", error->message);
+		g_error_free(error);
+		ret = SR_ERR;
+	} else {
+		ret = read_metadata(ctx, archive, kf, &names);
+	}
+	g_key_file_free(kf);
+	g_free(metadata);
+	zip_close(archive);
+	if (ret == SR_OK && ctx->total_samples == 0) {
+		sr_err("No samples to load from '%s'.", filename);
+		ret = SR_ERR;
+	}
+	if (ret != SR_OK)
+		goto fail;
+
+	/* Create a session device, loaded through receive(). */
+	ctx->filename = g_strdup(filename);
+	in->internal = ctx;
+	if (!(in->sdi = sr_input_dev_inst_new(in, LOGIC, filename))) {
+		in->internal = NULL;
+		ret = SR_ERR;
+		goto fail;
+	}
+
+	for (i = 0; i < ctx->num_probes; i++) {
+		if (names[i])
+			g_strlcpy(name, names[i], sizeof(name));
+		else
+			snprintf(name, sizeof(name), "%d", i);
+		if (!(probe = sr_channel_new(i, SR_CHANNEL_LOGIC, names[i] != NULL, name)))
+			break;
+		in->sdi->channels = g_slist_append(in->sdi->channels, probe);
+	}
+	ret = (i < ctx->num_probes) ? SR_ERR_MALLOC : SR_OK;
+	for (i = 0; i < ctx->num_probes; i++)
+		g_free(names[i]);
+	g_free(names);
+	if (ret != SR_OK)
+		return ret;
+
+	in->sdi->driver->config_set(SR_CONF_SAMPLERATE,
+		g_variant_new_uint64(ctx->samplerate), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_LIMIT_SAMPLES,
+		g_variant_new_uint64(ctx->total_samples), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_CAPTURE_NUM_PROBES,
+		g_variant_new_uint64(ctx->num_probes), in->sdi, NULL, NULL);
+
+	return SR_OK;
+
+fail:
+	if (names) {
+		for (i = 0; i < ctx->num_probes; i++)
+			g_free(names[i]);
+		g_free(names);
+	}
+	g_free(ctx->chunks);
+	g_free(ctx->filename);
+	g_free(ctx);
+	return ret;
+}
+
+/* The chunk of byte offset of the samples. */
+static int chunk_at(const struct context *ctx, uint64_t offset)
+{
+	int lo = 0, hi = ctx->num_chunks - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (ctx->chunks[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return lo;
+}
+
+static void inflate_proc(gpointer data, gpointer user_data)
+{
+	struct chunk *chunk = data;
+	struct context *ctx = user_data;
+	struct zip *archive;
+	struct zip_file *zf;
+	zip_int64_t ret;
+	uint64_t done = 0;
+
+	g_mutex_lock(&ctx->mutex);
+	archive = ctx->archives[--ctx->free_archives];
+	g_mutex_unlock(&ctx->mutex);
+
+	if ((chunk->buf = g_try_malloc(chunk->size)) &&
+	    (zf = zip_fopen_index(archive, chunk->index, 0))) {
+		while (done < chunk->size &&
+		       (ret = zip_fread(zf, chunk->buf + done, chunk->size - done)) > 0)
+			done += ret;
+		zip_fclose(zf);
+	}
+
+	g_mutex_lock(&ctx->mutex);
+	ctx->archives[ctx->free_archives++] = archive;
+	chunk->state = (done == chunk->size) ? CHUNK_DONE : CHUNK_FAILED;
+	g_cond_signal(&ctx->cond);
+	g_mutex_unlock(&ctx->mutex);
+}
+
+/* Bytes [from, to) of the samples, [first, first + samples) */
+static void block_range(const struct context *ctx, uint64_t block,
+		uint64_t *from, uint64_t *to)
+{
+	const uint64_t first = block * LA_LEAF_SAMPLES;
+	const uint64_t samples = MIN(ctx->total_samples - first, LA_LEAF_SAMPLES);
+
+	/* with the sample before the block, for its first edge */
+	*from = (first > 0 ? first - 1 : 0) * ctx->unitsize;
+	*to = (first + samples) * ctx->unitsize;
+}
+
+static void leaf_proc(gpointer data, gpointer user_data)
+{
+	struct leaf_job *job = data;
+	struct context *ctx = user_data;
+	const uint64_t first = job->block * LA_LEAF_SAMPLES;
+	const uint64_t samples = MIN(ctx->total_samples - first, LA_LEAF_SAMPLES);
+	const struct chunk *chunk;
+	const uint8_t *src, *prev;
+	uint64_t from, to, pos, n;
+	gboolean last;
+	int k;
+
+	block_range(ctx, job->block, &from, &to);
+	chunk = &ctx->chunks[chunk_at(ctx, from)];
+	if (to <= chunk->offset + chunk->size) {
+		src = chunk->buf + (from - chunk->offset);
+	} else {
+		/* gather the block across its chunks */
+		for (pos = from; pos < to; pos += n, chunk++) {
+			n = MIN(to, chunk->offset + chunk->size) - pos;
+			memcpy(job->raw + (pos - from), chunk->buf + (pos - chunk->offset), n);
+		}
+		src = job->raw;
+	}
+	if (first > 0)
+		src += ctx->unitsize;
+
+	sr_leaf_split(job->leaves, src, ctx->unitsize, ctx->num_probes,
+		ctx->orders, samples);
+	for (k = 0; k < ctx->enabled; k++) {
+		/* the first block starts at the level of its first sample,
+		 * so that a probe held high has no edge there */
+		prev = first > 0 ? src - ctx->unitsize : src;
+		last = (prev[ctx->probes[k] / 8] >> (ctx->probes[k] % 8)) & 1;
+		sr_leaf_finish(job->leaves + k * LEAF_SPACE_WORDS, samples, last,
+			&job->edges[k], &job->values[k]);
+	}
+
+	g_mutex_lock(&ctx->mutex);
+	job->done = TRUE;
+	g_cond_signal(&ctx->cond);
+	g_mutex_unlock(&ctx->mutex);
+}
+
+/*
+ * Inflate the chunks of the blocks after the one to send, and build the
+ * blocks whose chunks are in. Called from the session loop only.
+ */
+static void queue_jobs(struct context *ctx)
+{
+	struct leaf_job *job;
+	struct chunk *chunk;
+	const uint64_t window = MIN(ctx->next_sent + ctx->num_jobs, ctx->num_blocks);
+	uint64_t from, to;
+	int k, last;
+
+	block_range(ctx, window - 1, &from, &to);
+	while (ctx->next_chunk < ctx->num_chunks &&
+	       ctx->chunks[ctx->next_chunk].offset < to) {
+		chunk = &ctx->chunks[ctx->next_chunk++];
+		chunk->state = CHUNK_QUEUED;
+		g_thread_pool_push(ctx->inflate_pool, chunk, NULL);
+	}
+
+	g_mutex_lock(&ctx->mutex);
+	while (ctx->next_queued < window && !ctx->failed) {
+		block_range(ctx, ctx->next_queued, &from, &to);
+		last = chunk_at(ctx, to - 1);
+		for (k = chunk_at(ctx, from); k <= last; k++)
+			if (ctx->chunks[k].state != CHUNK_DONE)
+				break;
+		if (k <= last) {
+			ctx->failed = ctx->chunks[k].state == CHUNK_FAILED;
+			break;
+		}
+		job = &ctx->jobs[ctx->next_queued % ctx->num_jobs];
+		job->block = ctx->next_queued;
+		job->done = FALSE;
+		g_thread_pool_push(ctx->leaf_pool, job, NULL);
+		ctx->next_queued++;
+	}
+	g_mutex_unlock(&ctx->mutex);
+}
+
+/* Free the chunks the blocks left to build don't need. */
+static void release_chunks(struct context *ctx)
+{
+	struct chunk *chunk;
+	uint64_t from, to;
+
+	if (ctx->next_sent >= ctx->num_blocks)
+		return;
+	block_range(ctx, ctx->next_sent, &from, &to);
+	while (ctx->first_chunk < ctx->next_chunk) {
+		chunk = &ctx->chunks[ctx->first_chunk];
+		if (chunk->offset + chunk->size > from)
+			break;
+		g_free(chunk->buf);
+		chunk->buf = NULL;
+		ctx->first_chunk++;
+	}
+}
+
+static void end_load(struct context *ctx)
+{
+	int i;
+
+	/* drop queued jobs, wait for running ones */
+	if (ctx->leaf_pool)
+		g_thread_pool_free(ctx->leaf_pool, TRUE, TRUE);
+	ctx->leaf_pool = NULL;
+	if (ctx->inflate_pool)
+		g_thread_pool_free(ctx->inflate_pool, TRUE, TRUE);
+	ctx->inflate_pool = NULL;
+
+	for (i = 0; i < ctx->num_chunks; i++) {
+		g_free(ctx->chunks[i].buf);
+		ctx->chunks[i].buf = NULL;
+		ctx->chunks[i].state = CHUNK_IDLE;
+	}
+	if (ctx->jobs) {
+		for (i = 0; i < ctx->num_jobs; i++) {
+			g_free(ctx->jobs[i].leaves);
+			g_free(ctx->jobs[i].raw);
+			g_free(ctx->jobs[i].edges);
+			g_free(ctx->jobs[i].values);
+		}
+	}
+	g_free(ctx->jobs);
+	ctx->jobs = NULL;
+	if (ctx->archives) {
+		for (i = 0; i < ctx->num_archives; i++)
+			if (ctx->archives[i])
+				zip_close(ctx->archives[i]);
+	}
+	g_free(ctx->archives);
+	ctx->archives = NULL;
+	if (ctx->loading) {
+		g_mutex_clear(&ctx->mutex);
+		g_cond_clear(&ctx->cond);
+	}
+	g_free(ctx->probes);
+	ctx->probes = NULL;
+	g_free(ctx->orders);
+	ctx->orders = NULL;
+	ctx->loading = FALSE;
+}
+
+static gboolean start_load(struct sr_input *in, struct context *ctx)
+{
+	const struct sr_channel *probe;
+	GError *error = NULL;
+	const GSList *l;
+	uint64_t job_bytes;
+	int i, ret, threads;
+
+	ctx->start_time = g_get_monotonic_time();
+	ctx->loading = TRUE;
+	g_mutex_init(&ctx->mutex);
+	g_cond_init(&ctx->cond);
+	ctx->next_chunk = 0;
+	ctx->first_chunk = 0;
+	ctx->next_queued = 0;
+	ctx->next_sent = 0;
+	ctx->failed = FALSE;
+
+	if (!(ctx->probes = g_try_new(int, ctx->num_probes)) ||
+	    !(ctx->orders = g_try_new(int, ctx->num_probes)))
+		return FALSE;
+	ctx->enabled = 0;
+	for (i = 0; i < ctx->num_probes; i++)
+		ctx->orders[i] = -1;
+	for (l = in->sdi->channels; l; l = l->next) {
+		probe = l->data;
+		if (probe->type != SR_CHANNEL_LOGIC || !probe->enabled ||
+		    probe->index >= ctx->num_probes)
+			continue;
+		ctx->orders[probe->index] = ctx->enabled;
+		ctx->probes[ctx->enabled++] = probe->index;
+	}
+	ctx->num_blocks = (ctx->total_samples + LA_LEAF_SAMPLES - 1) / LA_LEAF_SAMPLES;
+	if (ctx->enabled == 0)
+		return TRUE;
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+	threads = MAX(g_get_num_processors(), 1);
+#else
+	threads = 4;
+#endif
+	/* two blocks per thread, as far as the memory bound allows: the
+	 * leaves, and the block's samples, inflated and maybe gathered */
+	job_bytes = (uint64_t)ctx->enabled * LA_LEAF_SPACE +
+		    2 * (LA_LEAF_SAMPLES + 1) * ctx->unitsize;
+	ctx->num_jobs = MAX(1, MIN(2 * threads, (int)(JOB_BYTES_LIMIT / job_bytes)));
+	if (!(ctx->jobs = g_try_new0(struct leaf_job, ctx->num_jobs)))
+		return FALSE;
+	for (i = 0; i < ctx->num_jobs; i++) {
+		if (!(ctx->jobs[i].leaves = g_try_malloc((uint64_t)ctx->enabled * LA_LEAF_SPACE)) ||
+		    !(ctx->jobs[i].raw = g_try_malloc((LA_LEAF_SAMPLES + 1) * ctx->unitsize)) ||
+		    !(ctx->jobs[i].edges = g_try_new(gboolean, ctx->enabled)) ||
+		    !(ctx->jobs[i].values = g_try_new(gboolean, ctx->enabled))) {
+			sr_err("%s: leaves malloc failed", __func__);
+			return FALSE;
+		}
+	}
+
+	/* an archive handle per inflating thread, libzip ones aren't shared */
+	ctx->num_archives = MIN(threads, ctx->num_chunks);
+	if (!(ctx->archives = g_try_new0(struct zip *, ctx->num_archives)))
+		return FALSE;
+	for (i = 0; i < ctx->num_archives; i++) {
+		if (!(ctx->archives[i] = zip_open(ctx->filename, 0, &ret))) {
+			sr_err("Failed to open '%s': zip error %d.", ctx->filename, ret);
+			return FALSE;
+		}
+	}
+	ctx->free_archives = ctx->num_archives;
+
+	if (!(ctx->inflate_pool = g_thread_pool_new(inflate_proc, ctx,
+			ctx->num_archives, FALSE, &error)) ||
+	    !(ctx->leaf_pool = g_thread_pool_new(leaf_proc, ctx,
+			threads, FALSE, &error))) {
+		sr_err("Failed to create loader threads: %s.", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	queue_jobs(ctx);
+
+	return TRUE;
+}
+
+/*
+ * Send the leaves of the next block, waiting shortly for them if they
+ * are not built yet. Blocks without edges only have their level sent.
+ */
+static gboolean send_block(struct context *ctx, const struct sr_dev_inst *cb_sdi)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_leaf leaf;
+	struct leaf_job *job = &ctx->jobs[ctx->next_sent % ctx->num_jobs];
+	const uint64_t first = ctx->next_sent * LA_LEAF_SAMPLES;
+	gboolean ready;
+	gint64 end_time;
+	int k;
+
+	queue_jobs(ctx);
+	g_mutex_lock(&ctx->mutex);
+	end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND;
+	/* the block is queued once its chunks are in, see queue_jobs() */
+	while (!(ready = ctx->next_queued > ctx->next_sent && job->done) &&
+	       !ctx->failed &&
+	       g_cond_wait_until(&ctx->cond, &ctx->mutex, end_time)) {
+		g_mutex_unlock(&ctx->mutex);
+		queue_jobs(ctx);
+		g_mutex_lock(&ctx->mutex);
+	}
+	g_mutex_unlock(&ctx->mutex);
+	if (ctx->failed) {
+		sr_err("Failed to inflate the samples of '%s'.", ctx->filename);
+		return FALSE;
+	}
+	if (!ready)
+		return TRUE;
+
+	packet.type = SR_DF_LOGIC;
+	packet.status = SR_PKT_OK;
+	packet.payload = &logic;
+	logic.format = LA_LEAF_DATA;
+	logic.length = (MIN(ctx->total_samples - first, LA_LEAF_SAMPLES) + 7) / 8;
+	logic.data_error = 0;
+	logic.data = &leaf;
+	leaf.mapping = NULL;
+	leaf.reader = NULL;
+	for (k = 0; k < ctx->enabled; k++) {
+		leaf.leaf = job->edges[k] ? job->leaves + k * LEAF_SPACE_WORDS : NULL;
+		leaf.value = job->values[k];
+		leaf.edges = job->edges[k];
+		logic.index = ctx->probes[k];
+		logic.order = k;
+		sr_session_send(cb_sdi, &packet);
+	}
+
+	ctx->next_sent++;
+	release_chunks(ctx);
+	queue_jobs(ctx);
+
+	return TRUE;
+}
+
+static int receive(struct sr_input *in, int revents,
+		const struct sr_dev_inst *cb_sdi)
+{
+	struct context *ctx = in->internal;
+	struct sr_datafeed_packet packet;
+	double mbytes, seconds;
+
+	packet.type = SR_DF_END;
+	packet.status = SR_PKT_OK;
+	packet.payload = NULL;
+
+	if (revents == -1) {
+		/* The session was stopped. */
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
+
+	if (!ctx->loading && !start_load(in, ctx)) {
+		packet.status = SR_PKT_SOURCE_ERROR;
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
+
+	if (ctx->enabled > 0 && ctx->next_sent < ctx->num_blocks) {
+		if (!send_block(ctx, cb_sdi)) {
+			packet.status = SR_PKT_SOURCE_ERROR;
+			sr_session_send(cb_sdi, &packet);
+			end_load(ctx);
+			return FALSE;
+		}
+		if (ctx->next_sent < ctx->num_blocks)
+			return TRUE;
+	}
+
+	sr_session_send(cb_sdi, &packet);
+
+	mbytes = ctx->total_samples * ctx->unitsize / (1024.0 * 1024.0);
+	seconds = (g_get_monotonic_time() - ctx->start_time) / (double)G_USEC_PER_SEC;
+	sr_info("Loaded %.1f MB of samples in %.2f s, %.1f MB/s.", mbytes, seconds,
+		seconds > 0 ? mbytes / seconds : 0);
+
+	end_load(ctx);
+	return FALSE;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	(void)filename;
+
+	/* Frontends which run the session have the file loaded from the
+	 * session loop, see receive(). */
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	while (receive(in, 0, in->sdi))
+		;
+
+	return SR_OK;
+}
+
+static int cleanup(struct sr_input *in)
+{
+	struct context *ctx = in->internal;
+
+	if (ctx) {
+		end_load(ctx);
+		g_free(ctx->chunks);
+		g_free(ctx->filename);
+		g_free(ctx);
+	}
+	in->internal = NULL;
+
+	return SR_OK;
+}
+
+SR_PRIV struct sr_input_format input_srzip = {
+	.id = "srzip",
+	.description = "sigrok session",
+	.format_match = format_match,
+	.init = init,
+	.loadfile = loadfile,
+	.receive = receive,
+	.cleanup = cleanup,
+};
@@ -22,10 +22,11 @@
  * numprobes:   Maximum number of probes to use. The probes are
  *              detected in the same order as they are listed
  *              in the $var sections of the VCD file.
+ *              Default: all of them.
  *
  * skip:        Allows skipping until given timestamp in the file.
  *              This can speed up analyzing of long captures.
- *            
+ *
  *              Value < 0: Skip until first timestamp listed in
  *              the file. (default)
  *
@@ -37,10 +38,6 @@
  * downsample:  Divide the samplerate by the given factor.
  *              This can speed up analyzing of long captures.
  *
- * compress:    Compress idle periods longer than this value.
- *              This can speed up analyzing of long captures.
- *              Default 0 = don't compress.
- *
  * Based on Verilog standard IEEE Std 1364-2001 Version C
  *
  * Supported features:
@@ -51,19 +48,25 @@
  * Most important unsupported features:
  * - vector variables (bit vectors etc.)
  * - analog, integer and real number variables
- * - $dumpvars initial value declaration
  * - $scope namespaces
+ *
+ * The file is mapped, and loaded a part at a time from the session
+ * loop. Value changes are written as runs into the bit planes of the
+ * channels, which are sent as LA_SPLIT_DATA packets. A block in which
+ * a channel does not change is sent as a LA_LEAF_DATA packet without
+ * data, so long idle stretches cost next to nothing.
  */
 
-/*  */
-
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
 #include <stdlib.h>
 #include <glib.h>
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/vcd: "
@@ -74,96 +77,138 @@
 #define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
 #define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
 
-#define DEFAULT_NUM_PROBES 8
+/* Probe numbers go into the 16 bit order of logic packets. */
+#define MAX_NUM_PROBES G_MAXUINT16
 
-/* Read until specific type of character occurs in file.
- * Skip input if dest is NULL.
- * Modes:
- * 'W' read until whitespace
- * 'N' read until non-whitespace, and ungetc() the character
- * '$' read until $end
- */
-static gboolean read_until(FILE *file, GString *dest, char mode)
+/* Samples of a LA_SPLIT_DATA packet, a divisor of LA_LEAF_SAMPLES */
+#define CHUNK_SAMPLES (32 * 1024)
+#define CHUNK_BYTES (CHUNK_SAMPLES / 8)
+
+/* Bytes of the file parsed per call of receive() */
+#define RECEIVE_BYTES (4 * 1024 * 1024)
+
+/* Identifiers are printable ASCII, those of one or two characters
+ * are looked up in a table. */
+#define ID_CHARS ('~' - '!' + 1)
+#define ID_SHORT (ID_CHARS + ID_CHARS * ID_CHARS)
+
+/* VCD tokens are printable, anything up to the space is white-space. */
+#define IS_SPACE(c) ((unsigned char)(c) <= ' ')
+
+/* First white-space character at or after p, or end. */
+static const char *find_space(const char *p, const char *end)
 {
-	char prev[4] = "";
-	long startpos = ftell(file);
-	for(;;)
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(' ');
+	while (end - p >= 16)
 	{
-		int c = fgetc(file);
+		const __m128i x = _mm_loadu_si128((const __m128i *)p);
+		const int mask = _mm_movemask_epi8(
+			_mm_cmpeq_epi8(_mm_max_epu8(x, space), space));
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && !IS_SPACE(*p))
+		p++;
+	return p;
+}
 
-		if (c == EOF)
-		{
-			if (mode == '$')
-				sr_err("Unexpected EOF, read started at %ld.", startpos);
-			return FALSE;
-		}
-		
-        if (mode == 'W' && isspace(c))
-			return TRUE;
-		
-        if (mode == 'N' && !isspace(c))
-		{
-			ungetc(c, file);
-			return TRUE;
-		}
-		
-		if (mode == '$')
-		{
-			prev[0] = prev[1]; prev[1] = prev[2]; prev[2] = prev[3]; prev[3] = c;
-			if (prev[0] == '$' && prev[1] == 'e' && prev[2] == 'n' && prev[3] == 'd')
-			{
-				if (dest != NULL)
-					g_string_truncate(dest, dest->len - 3);
-					
-				return TRUE;
-			}
-		}
+/* First non white-space character at or after p, or end. */
+static const char *skip_space(const char *p, const char *end)
+{
+#if defined(__SSE2__)
+	const __m128i space = _mm_set1_epi8(' ');
+	while (end - p >= 16)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i *)p);
+		const int mask = ~_mm_movemask_epi8(
+			_mm_cmpeq_epi8(_mm_max_epu8(x, space), space)) & 0xffff;
+		if (mask)
+			return p + __builtin_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && IS_SPACE(*p))
+		p++;
+	return p;
+}
 
-		if (dest != NULL)
-			g_string_append_c(dest, c);
+/* Position after the next $end at or after p, or NULL. */
+static const char *skip_section(const char *p, const char *end)
+{
+	while ((p = memchr(p, '$', end - p)) != NULL)
+	{
+		if (end - p >= 4 && memcmp(p, "$end", 4) == 0)
+			return p + 4;
+		p++;
 	}
+	return NULL;
 }
 
-/* Reads a single VCD section from input file and parses it to structure.
+/* Parse the decimal number between p and q. */
+static gboolean parse_number(const char *p, const char *q, uint64_t *value)
+{
+	uint64_t v = 0;
+
+	if (p == q)
+		return FALSE;
+	for (; p < q; p++)
+	{
+		if (*p < '0' || *p > '9')
+			return FALSE;
+		v = v * 10 + (*p - '0');
+	}
+	*value = v;
+	return TRUE;
+}
+
+/* Reads a single VCD section and parses it to strings.
  * e.g. $timescale 1ps $end  => "timescale" "1ps"
  */
-static gboolean parse_section(FILE *file, gchar **name, gchar **contents)
+static gboolean parse_section(const char **pos, const char *end,
+		gchar **name, gchar **contents)
 {
-	gboolean status;
-	GString *sname, *scontents;
-	
+	const char *p, *q, *e;
+
 	/* Skip any initial white-space */
-	if (!read_until(file, NULL, 'N')) return FALSE;
-	
+	p = skip_space(*pos, end);
+	if (p == end)
+		return FALSE;
+
 	/* Section tag should start with $. */
-	if (fgetc(file) != '$')
+	if (*p != '$')
 	{
 		sr_err("Expected $ at beginning of section.");
 		return FALSE;
 	}
-	
-	/* Read the section tag */	
-	sname = g_string_sized_new(32);
-	status = read_until(file, sname, 'W');
-	
-	/* Skip whitespace before content */
-	status = status && read_until(file, NULL, 'N');
-	
-	/* Read the content */
-	scontents = g_string_sized_new(128);
-	status = status && read_until(file, scontents, '$');
-	g_strchomp(scontents->str);
-
-	/* Release strings if status is FALSE, return them if status is TRUE */	
-	*name = g_string_free(sname, !status);
-	*contents = g_string_free(scontents, !status);
-	return status;
+
+	/* The section tag, and the content up to $end */
+	q = find_space(p + 1, end);
+	if (!(e = skip_section(q, end)))
+	{
+		sr_err("Unexpected EOF in section '%.*s'.", (int)(q - p - 1), p + 1);
+		return FALSE;
+	}
+
+	*name = g_strndup(p + 1, q - p - 1);
+	*contents = g_strstrip(g_strndup(q, e - 4 - q));
+	*pos = e;
+	return TRUE;
 }
 
-struct probe
+struct channel
 {
-	gchar *name;
-	gchar *identifier;
+	/* position among the enabled probes, -1 if disabled */
+	int order;
+	int index;
+	gboolean level;
+	/* samples of the current chunk written to plane */
+	uint64_t filled;
+	/* data of the current block was sent */
+	gboolean edges;
+	uint8_t *plane;
 };
 
 struct context
@@ -172,22 +217,100 @@ struct context
 	int maxprobes;
 	int probecount;
 	int downsample;
-	unsigned compress;
 	int64_t skip;
-	GSList *probes;
+	gchar *filename;
+	/* probe numbers of identifiers, plus one in ids */
+	int short_ids[ID_SHORT];
+	GHashTable *ids;
+	/* the data section, and the samples it spans */
+	uint64_t data_offset;
+	uint64_t start;
+	uint64_t total_samples;
+
+	/* state of a load, see receive() */
+	GMappedFile *mapping;
+	const char *pos;
+	const char *end;
+	struct channel *channels;
+	uint8_t *planes;
+	uint8_t *fill[2];
+	int edge_channels;
+	uint64_t chunk_start;
+	uint64_t now;
+	gint64 start_time;
 };
 
-static void free_probe(void *data)
+/* Index in short_ids of an identifier of one or two characters, or -1. */
+static int short_code(const char *id, size_t len)
+{
+	unsigned c0;
+
+	if (len == 0)
+		return -1;
+	c0 = (unsigned char)id[0] - (unsigned)'!';
+	if (len == 1 && c0 < ID_CHARS)
+		return c0;
+	if (len == 2 && c0 < ID_CHARS)
+	{
+		const unsigned c1 = (unsigned char)id[1] - (unsigned)'!';
+		if (c1 < ID_CHARS)
+			return ID_CHARS + c0 * ID_CHARS + c1;
+	}
+	return -1;
+}
+
+/* Probe number of an identifier, or -1. */
+static int find_probe(const struct context *ctx, const char *id, size_t len)
 {
-	struct probe *probe = data;
-	g_free(probe->name);
-	g_free(probe->identifier);
-	g_free(probe);
+	char key[64];
+	gchar *long_key;
+	int code, n;
+
+	if ((code = short_code(id, len)) >= 0)
+		return ctx->short_ids[code];
+
+	if (len < sizeof(key))
+	{
+		memcpy(key, id, len);
+		key[len] = '\0';
+		return GPOINTER_TO_INT(g_hash_table_lookup(ctx->ids, key)) - 1;
+	}
+
+	long_key = g_strndup(id, len);
+	n = GPOINTER_TO_INT(g_hash_table_lookup(ctx->ids, long_key)) - 1;
+	g_free(long_key);
+	return n;
+}
+
+static void add_probe(struct context *ctx, const char *id, int n)
+{
+	int code;
+
+	if ((code = short_code(id, strlen(id))) >= 0)
+		ctx->short_ids[code] = n;
+	else
+		g_hash_table_insert(ctx->ids, g_strdup(id), GINT_TO_POINTER(n + 1));
+}
+
+static void end_load(struct context *ctx)
+{
+	if (ctx->mapping)
+		g_mapped_file_unref(ctx->mapping);
+	ctx->mapping = NULL;
+	g_free(ctx->channels);
+	ctx->channels = NULL;
+	g_free(ctx->planes);
+	ctx->planes = NULL;
+	g_free(ctx->fill[0]);
+	ctx->fill[0] = ctx->fill[1] = NULL;
 }
 
 static void release_context(struct context *ctx)
 {
-	g_slist_free_full(ctx->probes, free_probe);
+	end_load(ctx);
+	if (ctx->ids)
+		g_hash_table_destroy(ctx->ids);
+	g_free(ctx->filename);
 	g_free(ctx);
 }
 
@@ -202,27 +325,31 @@ static void remove_empty_parts(gchar **parts)
 		{
 			*dest++ = *src;
 		}
-		
+		else
+		{
+			g_free(*src);
+		}
+
 		src++;
 	}
-	
+
 	*dest = NULL;
 }
 
-/* Parse VCD header to get values for context structure.
- * The context structure should be zeroed before calling this.
+/* Parse VCD header to get values for context structure, and the
+ * names of the probes.
  */
-static gboolean parse_header(FILE *file, struct context *ctx)
+static gboolean parse_header(const char **pos, const char *end,
+		struct context *ctx, GPtrArray *names)
 {
 	uint64_t p, q;
 	gchar *name = NULL, *contents = NULL;
 	gboolean status = FALSE;
-	struct probe *probe;
 
-	while (parse_section(file, &name, &contents))
+	while (parse_section(pos, end, &name, &contents))
 	{
 		sr_dbg("Section '%s', contents '%s'.", name, contents);
-	
+
 		if (g_strcmp0(name, "enddefinitions") == 0)
 		{
 			status = TRUE;
@@ -241,7 +368,7 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 					sr_warn("Inexact rounding of samplerate, %" PRIu64 " / %" PRIu64 " to %" PRIu64 " Hz.",
 						q, p, ctx->samplerate);
 				}
-				
+
 				sr_dbg("Samplerate: %" PRIu64, ctx->samplerate);
 			}
 			else
@@ -251,11 +378,11 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 		}
 		else if (g_strcmp0(name, "var") == 0)
 		{
-			/* Format: $var type size identifier reference $end */
+			/* Format: $var type size identifier reference [bits] $end */
 			gchar **parts = g_strsplit_set(contents, " \r\n\t", 0);
 			remove_empty_parts(parts);
-			
-			if (g_strv_length(parts) != 4)
+
+			if (g_strv_length(parts) != 4 && g_strv_length(parts) != 5)
 			{
 				sr_warn("$var section should have 4 items");
 			}
@@ -267,6 +394,11 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 			{
 				sr_info("Unsupported signal size: '%s'", parts[1]);
 			}
+			else if (find_probe(ctx, parts[2], strlen(parts[2])) >= 0)
+			{
+				sr_info("Skipping '%s', an alias of probe %d.", parts[3],
+					find_probe(ctx, parts[2], strlen(parts[2])));
+			}
 			else if (ctx->probecount >= ctx->maxprobes)
 			{
 				sr_warn("Skipping '%s' because only %d probes requested.", parts[3], ctx->maxprobes);
@@ -274,80 +406,145 @@ static gboolean parse_header(FILE *file, struct context *ctx)
 			else
 			{
 				sr_info("Probe %d is '%s' identified by '%s'.", ctx->probecount, parts[3], parts[2]);
-				probe = g_malloc(sizeof(struct probe));
-				probe->identifier = g_strdup(parts[2]);
-				probe->name = g_strdup(parts[3]);
-				ctx->probes = g_slist_append(ctx->probes, probe);
+				add_probe(ctx, parts[2], ctx->probecount);
+				g_ptr_array_add(names, g_strconcat(parts[3], parts[4], NULL));
 				ctx->probecount++;
 			}
-			
+
 			g_strfreev(parts);
 		}
-		
+
 		g_free(name); name = NULL;
 		g_free(contents); contents = NULL;
 	}
-	
+
 	g_free(name);
 	g_free(contents);
-	
+
 	return status;
 }
 
+/* The $dump sections contain value changes, parse them as normally. */
+static gboolean is_dump_token(const char *p, const char *q)
+{
+	static const char *const tokens[] = {
+		"$dumpvars", "$dumpall", "$dumpon", "$dumpoff", "$end", NULL,
+	};
+	int i;
+
+	for (i = 0; tokens[i]; i++)
+	{
+		if (strlen(tokens[i]) == (size_t)(q - p) &&
+		    memcmp(tokens[i], p, q - p) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* The first timestamp of the data section. */
+static gboolean first_timestamp(const char *p, const char *end, uint64_t *timestamp)
+{
+	const char *q;
+
+	while ((p = skip_space(p, end)) < end)
+	{
+		q = find_space(p, end);
+		if (*p == '#')
+			return parse_number(p + 1, q, timestamp);
+		if (*p == '$' && !is_dump_token(p, q) && !(q = skip_section(q, end)))
+			return FALSE;
+		p = q;
+	}
+	return FALSE;
+}
+
+/* The last timestamp of the data section, searching from its end. */
+static gboolean last_timestamp(const char *start, const char *end, uint64_t *timestamp)
+{
+	const char *p = end;
+
+	while (p > start)
+	{
+		p--;
+		if (*p == '#' && (p == start || IS_SPACE(p[-1])) &&
+		    parse_number(p + 1, find_space(p + 1, end), timestamp))
+			return TRUE;
+	}
+	return FALSE;
+}
+
 static int format_match(const char *filename)
 {
+	static const char *const sections[] = {
+		"date", "version", "timescale", "comment", "scope", "upscope",
+		"var", "enddefinitions", NULL,
+	};
 	FILE *file;
-	gchar *name = NULL, *contents = NULL;
-	gboolean status;
-	
-    file = fopen(filename, "r");
+	char buf[256];
+	const char *p, *q, *end;
+	size_t len;
+	int i;
+
+	file = fopen(filename, "rb");
 	if (file == NULL)
 		return FALSE;
+	len = fread(buf, 1, sizeof(buf), file);
+	fclose(file);
 
-	/* If we can parse the first section correctly,
+	/* If the file starts with a header section,
 	 * then it is assumed to be a VCD file.
 	 */
-	status = parse_section(file, &name, &contents);
-	status = status && (*name != '\0');
-	
-	g_free(name);
-	g_free(contents);
-	fclose(file);
-	
-	return status;
+	end = buf + len;
+	p = skip_space(buf, end);
+	if (p == end || *p != '$')
+		return FALSE;
+	q = find_space(p + 1, end);
+	for (i = 0; sections[i]; i++)
+	{
+		if (strlen(sections[i]) == (size_t)(q - p - 1) &&
+		    memcmp(sections[i], p + 1, q - p - 1) == 0)
+			return TRUE;
+	}
+	return FALSE;
 }
 
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_channel *probe;
-    uint16_t num_probes, i;
-	char name[SR_MAX_PROBENAME_LEN + 1];
+	GMappedFile *mapping;
+	GPtrArray *names;
+	GError *error = NULL;
+	const char *data, *pos, *end;
 	char *param;
 	struct context *ctx;
-
-	(void)filename;
+	uint64_t first = 0, last;
+	int i;
 
 	if (!(ctx = g_try_malloc0(sizeof(*ctx)))) {
 		sr_err("Input format context malloc failed.");
 		return SR_ERR_MALLOC;
 	}
 
-	num_probes = DEFAULT_NUM_PROBES;
+	ctx->maxprobes = MAX_NUM_PROBES;
 	ctx->samplerate = 0;
 	ctx->downsample = 1;
 	ctx->skip = -1;
+	ctx->filename = g_strdup(filename);
+	ctx->ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; i < ID_SHORT; i++)
+		ctx->short_ids[i] = -1;
 
 	if (in->param) {
 		param = g_hash_table_lookup(in->param, "numprobes");
 		if (param) {
-			num_probes = strtoul(param, NULL, 10);
-			if (num_probes < 1)
+			ctx->maxprobes = strtoul(param, NULL, 10);
+			if (ctx->maxprobes < 1 || ctx->maxprobes > MAX_NUM_PROBES)
 			{
 				release_context(ctx);
 				return SR_ERR;
 			}
 		}
-		
+
 		param = g_hash_table_lookup(in->param, "downsample");
 		if (param) {
 			ctx->downsample = strtoul(param, NULL, 10);
@@ -356,248 +553,466 @@ static int init(struct sr_input *in, const char *filename)
 				ctx->downsample = 1;
 			}
 		}
-		
-		param = g_hash_table_lookup(in->param, "compress");
-		if (param) {
-			ctx->compress = strtoul(param, NULL, 10);
-		}
-		
+
 		param = g_hash_table_lookup(in->param, "skip");
 		if (param) {
 			ctx->skip = strtoul(param, NULL, 10) / ctx->downsample;
 		}
 	}
-	
-	/* Maximum number of probes to parse from the VCD */
-	ctx->maxprobes = num_probes;
 
-	/* Create a virtual device. */
-	in->sdi = sr_dev_inst_new(LOGIC, 0, SR_ST_ACTIVE, NULL, NULL, NULL);
+	if (!(mapping = g_mapped_file_new(filename, FALSE, &error))) {
+		sr_err("Failed to map '%s': %s.", filename, error->message);
+		g_error_free(error);
+		release_context(ctx);
+		return SR_ERR;
+	}
+	data = g_mapped_file_get_contents(mapping);
+	end = data + g_mapped_file_get_length(mapping);
+	pos = data;
+
+	names = g_ptr_array_new_with_free_func(g_free);
+	if (!parse_header(&pos, end, ctx, names))
+	{
+		sr_err("VCD parsing failed");
+		goto fail;
+	}
+	ctx->data_offset = pos - data;
+
+	/* The samples span from the first timestamp, or the one to skip
+	 * to, up to the last one. */
+	if (!last_timestamp(pos, end, &last) ||
+	    (ctx->skip < 0 && !first_timestamp(pos, end, &first)))
+	{
+		sr_err("No timestamps in VCD file.");
+		goto fail;
+	}
+	ctx->start = (ctx->skip < 0) ? first / ctx->downsample : (uint64_t)ctx->skip;
+	last /= ctx->downsample;
+	if (last < ctx->start || ctx->probecount == 0)
+	{
+		sr_err("No samples to load from VCD file.");
+		goto fail;
+	}
+	ctx->total_samples = last - ctx->start + 1;
+	g_mapped_file_unref(mapping);
+	mapping = NULL;
+
+	if (ctx->samplerate == 0)
+	{
+		sr_warn("No timescale, assuming 1 ns.");
+		ctx->samplerate = SR_GHZ(1);
+	}
+
+	/* Create a session device, loaded through receive(). */
 	in->internal = ctx;
+	if (!(in->sdi = sr_input_dev_inst_new(in, LOGIC, filename)))
+		goto fail;
 
-	for (i = 0; i < num_probes; i++) {
-		snprintf(name, SR_MAX_PROBENAME_LEN, "%d", i);
-		
-		if (!(probe = sr_channel_new(i, SR_CHANNEL_LOGIC, TRUE, name)))
-		{
-			release_context(ctx);
-			return SR_ERR;
-		}
-			
+	for (i = 0; i < ctx->probecount; i++) {
+		if (!(probe = sr_channel_new(i, SR_CHANNEL_LOGIC, TRUE,
+				g_ptr_array_index(names, i))))
+			break;
 		in->sdi->channels = g_slist_append(in->sdi->channels, probe);
 	}
+	g_ptr_array_free(names, TRUE);
+	if (i < ctx->probecount)
+		return SR_ERR_MALLOC;
+
+	in->sdi->driver->config_set(SR_CONF_SAMPLERATE,
+		g_variant_new_uint64(ctx->samplerate / ctx->downsample), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_LIMIT_SAMPLES,
+		g_variant_new_uint64(ctx->total_samples), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_CAPTURE_NUM_PROBES,
+		g_variant_new_uint64(ctx->probecount), in->sdi, NULL, NULL);
 
 	return SR_OK;
+
+fail:
+	if (mapping)
+		g_mapped_file_unref(mapping);
+	g_ptr_array_free(names, TRUE);
+	in->internal = NULL;
+	release_context(ctx);
+	return SR_ERR;
+}
+
+static int cleanup(struct sr_input *in)
+{
+	if (in->internal)
+		release_context(in->internal);
+	in->internal = NULL;
+
+	return SR_OK;
+}
+
+/* Set the samples [from, to) of a bit plane to level. */
+static void fill_plane(uint8_t *plane, uint64_t from, uint64_t to, gboolean level)
+{
+	const uint64_t head = MIN(to, (from + 7) & ~7ULL);
+	const uint64_t tail = MAX(head, to & ~7ULL);
+
+	for (; from < head; from++)
+	{
+		if (level)
+			plane[from / 8] |= 1 << (from % 8);
+		else
+			plane[from / 8] &= ~(1 << (from % 8));
+	}
+	if (from == to)
+		return;
+
+	memset(plane + from / 8, level ? 0xff : 0x00, (tail - from) / 8);
+	for (from = tail; from < to; from++)
+	{
+		if (level)
+			plane[from / 8] |= 1 << (from % 8);
+		else
+			plane[from / 8] &= ~(1 << (from % 8));
+	}
 }
 
-#define CHUNKSIZE 1024
+static void send_split(const struct sr_dev_inst *cb_sdi,
+		const struct channel *ch, const uint8_t *data, uint64_t bytes)
+{
+	struct sr_datafeed_packet packet;
+	struct sr_datafeed_logic logic;
 
-/* Send N samples of the given value. */
-static void send_samples(const struct sr_dev_inst *sdi, uint64_t sample, uint64_t count)
+	packet.type = SR_DF_LOGIC;
+	packet.status = SR_PKT_OK;
+	packet.payload = &logic;
+	logic.format = LA_SPLIT_DATA;
+	logic.index = ch->index;
+	logic.order = ch->order;
+	logic.length = bytes;
+	logic.data_error = 0;
+	logic.data = (void *)data;
+	sr_session_send(cb_sdi, &packet);
+}
+
+/* A block without changes, only its level is sent. */
+static void send_leaf(const struct sr_dev_inst *cb_sdi,
+		const struct channel *ch, uint64_t bytes)
 {
 	struct sr_datafeed_packet packet;
 	struct sr_datafeed_logic logic;
-	uint64_t buffer[CHUNKSIZE];
-	uint64_t i;
-	unsigned chunksize = CHUNKSIZE;
-		
-	if (count < chunksize)
-		chunksize = count;
-
-	for (i = 0; i < chunksize; i++)
+	struct sr_datafeed_leaf leaf;
+
+	leaf.leaf = NULL;
+	leaf.value = ch->level;
+	leaf.edges = FALSE;
+	leaf.mapping = NULL;
+	leaf.reader = NULL;
+
+	packet.type = SR_DF_LOGIC;
+	packet.status = SR_PKT_OK;
+	packet.payload = &logic;
+	logic.format = LA_LEAF_DATA;
+	logic.index = ch->index;
+	logic.order = ch->order;
+	logic.length = bytes;
+	logic.data_error = 0;
+	logic.data = &leaf;
+	sr_session_send(cb_sdi, &packet);
+}
+
+/* The end of a block of samples: the channels that did not change
+ * in it are sent now. */
+static void end_block(struct context *ctx, const struct sr_dev_inst *cb_sdi,
+		uint64_t samples)
+{
+	struct channel *ch;
+	int n;
+
+	for (n = 0; n < ctx->probecount; n++)
 	{
-		buffer[i] = sample;
+		ch = &ctx->channels[n];
+		if (ch->order < 0)
+			continue;
+		if (ch->edges)
+			ch->edges = FALSE;
+		else
+			send_leaf(cb_sdi, ch, (samples + 7) / 8);
 	}
-	
-	packet.type = SR_DF_LOGIC;
-	packet.payload = &logic;	
-	logic.unitsize = sizeof(uint64_t);
-	logic.data = buffer;
-	
-	while (count)
+	ctx->edge_channels = 0;
+}
+
+/* Move the current sample forward, sending the chunks it leaves. */
+static void advance(struct context *ctx, const struct sr_dev_inst *cb_sdi,
+		uint64_t sample)
+{
+	struct channel *ch;
+	uint64_t block_end;
+	int n;
+
+	while (sample >= ctx->chunk_start + CHUNK_SAMPLES)
+	{
+		if (ctx->edge_channels > 0)
+		{
+			for (n = 0; n < ctx->probecount; n++)
+			{
+				ch = &ctx->channels[n];
+				if (ch->order < 0 || !ch->edges)
+					continue;
+				fill_plane(ch->plane, ch->filled, CHUNK_SAMPLES, ch->level);
+				send_split(cb_sdi, ch, ch->plane, CHUNK_BYTES);
+				ch->filled = 0;
+			}
+			ctx->chunk_start += CHUNK_SAMPLES;
+		}
+		else
+		{
+			/* Nothing changed in this block so far, skip ahead. */
+			block_end = ctx->chunk_start - ctx->chunk_start % LA_LEAF_SAMPLES +
+				LA_LEAF_SAMPLES;
+			ctx->chunk_start = MIN(block_end, sample - sample % CHUNK_SAMPLES);
+		}
+
+		if (ctx->chunk_start % LA_LEAF_SAMPLES == 0)
+			end_block(ctx, cb_sdi, LA_LEAF_SAMPLES);
+	}
+
+	ctx->now = sample;
+}
+
+/* A new value of a channel at the current sample. */
+static void set_level(struct context *ctx, const struct sr_dev_inst *cb_sdi,
+		struct channel *ch, gboolean level)
+{
+	uint64_t sample;
+
+	if (ch->level == level)
+		return;
+
+	/* A change at the first sample of a block, such as the initial
+	 * values, only sets the level the block starts with. */
+	if (ch->order >= 0 && (ch->edges || ctx->now % LA_LEAF_SAMPLES != 0))
+	{
+		if (!ch->edges)
+		{
+			/* The channel was constant up to here in this block. */
+			for (sample = ctx->chunk_start - ctx->chunk_start % LA_LEAF_SAMPLES;
+			     sample < ctx->chunk_start; sample += CHUNK_SAMPLES)
+				send_split(cb_sdi, ch, ctx->fill[ch->level], CHUNK_BYTES);
+			ch->edges = TRUE;
+			ch->filled = 0;
+			ctx->edge_channels++;
+		}
+		fill_plane(ch->plane, ch->filled, ctx->now - ctx->chunk_start, ch->level);
+		ch->filled = ctx->now - ctx->chunk_start;
+	}
+
+	ch->level = level;
+}
+
+/* Send the samples left after the last timestamp. */
+static void finish(struct context *ctx, const struct sr_dev_inst *cb_sdi)
+{
+	const uint64_t total = ctx->total_samples;
+	struct channel *ch;
+	uint64_t rest;
+	int n;
+
+	advance(ctx, cb_sdi, total);
+	if (total % LA_LEAF_SAMPLES == 0)
+		return;
+
+	rest = total - ctx->chunk_start;
+	for (n = 0; n < ctx->probecount && rest > 0; n++)
+	{
+		ch = &ctx->channels[n];
+		if (ch->order < 0 || !ch->edges)
+			continue;
+		fill_plane(ch->plane, ch->filled, rest, ch->level);
+		send_split(cb_sdi, ch, ch->plane, (rest + 7) / 8);
+	}
+	end_block(ctx, cb_sdi, total % LA_LEAF_SAMPLES);
+}
+
+static gboolean start_load(struct sr_input *in, struct context *ctx)
+{
+	struct sr_channel *probe;
+	struct channel *ch;
+	GError *error = NULL;
+	const char *data;
+	GSList *l;
+	int n, enabled;
+
+	if (!(ctx->mapping = g_mapped_file_new(ctx->filename, FALSE, &error)))
+	{
+		sr_err("Failed to map '%s': %s.", ctx->filename, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	data = g_mapped_file_get_contents(ctx->mapping);
+	ctx->end = data + g_mapped_file_get_length(ctx->mapping);
+	ctx->pos = data + ctx->data_offset;
+	if (ctx->pos > ctx->end)
+	{
+		sr_err("File '%s' changed since it was opened.", ctx->filename);
+		return FALSE;
+	}
+
+	if (!(ctx->channels = g_try_new0(struct channel, ctx->probecount)))
+		return FALSE;
+	enabled = 0;
+	for (l = in->sdi->channels, n = 0; l && n < ctx->probecount; l = l->next, n++)
+	{
+		probe = l->data;
+		ch = &ctx->channels[n];
+		ch->index = probe->index;
+		ch->order = probe->enabled ? enabled++ : -1;
+	}
+
+	if (!(ctx->planes = g_try_malloc((enabled + 1) * CHUNK_BYTES)) ||
+	    !(ctx->fill[0] = g_try_malloc(2 * CHUNK_BYTES)))
+		return FALSE;
+	for (n = 0; n < ctx->probecount; n++)
 	{
-		if (count < chunksize)
-			chunksize = count;
-	
-		logic.length = sizeof(uint64_t) * chunksize;
-	
-		sr_session_send(sdi, &packet);
-		count -= chunksize;
+		ch = &ctx->channels[n];
+		if (ch->order >= 0)
+			ch->plane = ctx->planes + ch->order * CHUNK_BYTES;
 	}
+	ctx->fill[1] = ctx->fill[0] + CHUNK_BYTES;
+	memset(ctx->fill[0], 0x00, CHUNK_BYTES);
+	memset(ctx->fill[1], 0xff, CHUNK_BYTES);
+
+	ctx->edge_channels = 0;
+	ctx->chunk_start = 0;
+	ctx->now = 0;
+	ctx->start_time = g_get_monotonic_time();
+
+	return TRUE;
 }
 
-/* Parse the data section of VCD */
-static void parse_contents(FILE *file, const struct sr_dev_inst *sdi, struct context *ctx)
+/* Parse the data section of VCD, up to limit */
+static void parse_contents(struct context *ctx, const struct sr_dev_inst *cb_sdi,
+		const char *limit)
 {
-	GString *token = g_string_sized_new(32);
-	
-	uint64_t prev_timestamp = 0;
-	uint64_t prev_values = 0;
-	
+	const char *p = ctx->pos;
+	const char *const end = ctx->end;
+	const char *q, *id;
+	uint64_t timestamp, sample;
+	int n;
+
 	/* Read one space-delimited token at a time. */
-	while (read_until(file, NULL, 'N') && read_until(file, token, 'W'))
+	while (p < limit && (p = skip_space(p, end)) < end)
 	{
-        if (token->str[0] == '#' && isdigit(token->str[1]))
+		q = find_space(p, end);
+
+		if (*p == '#')
 		{
 			/* Numeric value beginning with # is a new timestamp value */
-			uint64_t timestamp;
-			timestamp = strtoull(token->str + 1, NULL, 10);
-			
-			if (ctx->downsample > 1)
-				timestamp /= ctx->downsample;
-			
-			/* Skip < 0 => skip until first timestamp.
-			 * Skip = 0 => don't skip
-			 * Skip > 0 => skip until timestamp >= skip.
-			 */
-			if (ctx->skip < 0)
-			{
-				ctx->skip = timestamp;
-				prev_timestamp = timestamp;
-			}
-			else if (ctx->skip > 0 && timestamp < (uint64_t)ctx->skip)
-			{
-				prev_timestamp = ctx->skip;
-			}
-			else if (timestamp == prev_timestamp)
+			if (!parse_number(p + 1, q, &timestamp))
 			{
-				/* Ignore repeated timestamps (e.g. sigrok outputs these) */
+				sr_warn("Skipping unknown token '%.*s'.", (int)(q - p), p);
 			}
 			else
 			{
-				if (ctx->compress != 0 && timestamp - prev_timestamp > ctx->compress)
-				{
-					/* Compress long idle periods */
-					prev_timestamp = timestamp - ctx->compress;
-				}
-			
-				sr_dbg("New timestamp: %" PRIu64, timestamp);
-			
-				/* Generate samples from prev_timestamp up to timestamp - 1. */
-				send_samples(sdi, prev_values, timestamp - prev_timestamp);
-				prev_timestamp = timestamp;
+				/* Changes before the start set the initial values.
+				 * Repeated timestamps (e.g. sigrok outputs these)
+				 * are ignored. */
+				timestamp /= ctx->downsample;
+				sample = (timestamp > ctx->start) ? timestamp - ctx->start : 0;
+				sample = MIN(sample, ctx->total_samples - 1);
+				if (sample > ctx->now)
+					advance(ctx, cb_sdi, sample);
 			}
 		}
-		else if (token->str[0] == '$' && token->len > 1)
+		else if (*p == '$')
 		{
 			/* This is probably a $dumpvars, $comment or similar.
 			 * $dump* contain useful data, but other tags will be skipped until $end. */
-			if (g_strcmp0(token->str, "$dumpvars") == 0 ||
-			    g_strcmp0(token->str, "$dumpon") == 0 ||
-			    g_strcmp0(token->str, "$dumpoff") == 0 ||
-			    g_strcmp0(token->str, "$end") == 0)
-			{
-				/* Ignore, parse contents as normally. */
-			}
-			else
-			{
-				/* Skip until $end */
-				read_until(file, NULL, '$');
-			}
+			if (!is_dump_token(p, q) && !(q = skip_section(q, end)))
+				q = end;
 		}
-		else if (strchr("bBrR", token->str[0]) != NULL)
+		else if (strchr("bBrR", *p) != NULL)
 		{
 			/* A vector value. Skip it and also the following identifier. */
-			read_until(file, NULL, 'N');
-			read_until(file, NULL, 'W');
+			q = find_space(skip_space(q, end), end);
 		}
-		else if (strchr("01xXzZ", token->str[0]) != NULL)
+		else if (strchr("01xXzZ", *p) != NULL)
 		{
 			/* A new 1-bit sample value */
-			int i, bit;
-			GSList *l;
-			struct probe *probe;
-
-			bit = (token->str[0] == '1');
-		
-			g_string_erase(token, 0, 1);
-			if (token->len == 0)
+			id = p + 1;
+			if (id == q)
 			{
 				/* There was a space between value and identifier.
 				 * Read in the rest.
 				 */
-				read_until(file, NULL, 'N');
-				read_until(file, token, 'W');
+				id = skip_space(q, end);
+				q = find_space(id, end);
 			}
-			
-			for (i = 0, l = ctx->probes; i < ctx->probecount && l; i++, l = l->next)
-			{
-				probe = l->data;
 
-				if (g_strcmp0(token->str, probe->identifier) == 0)
-				{
-					sr_dbg("Probe %d new value %d.", i, bit);
-				
-					/* Found our probe */
-					if (bit)
-						prev_values |= (1 << i);
-					else
-						prev_values &= ~(1 << i);
-					
-					break;
-				}
-			}
-			
-			if (i == ctx->probecount)
-			{
-				sr_dbg("Did not find probe for identifier '%s'.", token->str);
-			}
+			if ((n = find_probe(ctx, id, q - id)) >= 0)
+				set_level(ctx, cb_sdi, &ctx->channels[n], *p == '1');
+			else
+				sr_dbg("Did not find probe for identifier '%.*s'.", (int)(q - id), id);
 		}
 		else
 		{
-			sr_warn("Skipping unknown token '%s'.", token->str);
+			sr_warn("Skipping unknown token '%.*s'.", (int)(q - p), p);
 		}
-		
-		g_string_truncate(token, 0);
+
+		p = q;
 	}
-	
-	g_string_free(token, TRUE);
+
+	ctx->pos = p;
 }
 
-static int loadfile(struct sr_input *in, const char *filename)
+static int receive(struct sr_input *in, int revents,
+		const struct sr_dev_inst *cb_sdi)
 {
+	struct context *ctx = in->internal;
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_meta meta;
-	struct sr_config *src;
-	FILE *file;
-	struct context *ctx;
-	uint64_t samplerate;
+	const char *limit;
+	double mbytes, seconds;
 
-	ctx = in->internal;
-    packet.status = SR_PKT_OK;
+	packet.type = SR_DF_END;
+	packet.status = SR_PKT_OK;
+	packet.payload = NULL;
 
-    if ((file = fopen(filename, "r")) == NULL)
-		return SR_ERR;
+	if (revents == -1)
+	{
+		/* The session was stopped. */
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
 
-	if (!parse_header(file, ctx))
+	if (!ctx->mapping && !start_load(in, ctx))
 	{
-		sr_err("VCD parsing failed");
-		fclose(file);
-		return SR_ERR;
+		packet.status = SR_PKT_SOURCE_ERROR;
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
 	}
 
-	/* Send header packet to the session bus. */
-	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	limit = (ctx->end - ctx->pos > RECEIVE_BYTES) ? ctx->pos + RECEIVE_BYTES : ctx->end;
+	parse_contents(ctx, cb_sdi, limit);
+	if (ctx->pos < ctx->end)
+		return TRUE;
 
-	/* Send metadata about the SR_DF_LOGIC packets to come. */
-	packet.type = SR_DF_META;
-	packet.payload = &meta;
-	samplerate = ctx->samplerate / ctx->downsample;
-	src = sr_config_new(SR_CONF_SAMPLERATE, g_variant_new_uint64(samplerate));
-	meta.config = g_slist_append(NULL, src);
-	sr_session_send(in->sdi, &packet);
-	sr_config_free(src);
-
-	/* Parse the contents of the VCD file */
-	parse_contents(file, in->sdi, ctx);
-	
-	/* Send end packet to the session bus. */
-	packet.type = SR_DF_END;
-	sr_session_send(in->sdi, &packet);
+	finish(ctx, cb_sdi);
+	sr_session_send(cb_sdi, &packet);
 
-	fclose(file);
-	release_context(ctx);
-	in->internal = NULL;
+	mbytes = g_mapped_file_get_length(ctx->mapping) / (1024.0 * 1024.0);
+	seconds = (g_get_monotonic_time() - ctx->start_time) / (double)G_USEC_PER_SEC;
+	sr_info("Loaded %.1f MB in %.2f s, %.1f MB/s.", mbytes, seconds,
+		seconds > 0 ? mbytes / seconds : 0);
+
+	end_load(ctx);
+	return FALSE;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	(void)filename;
+
+	/* Frontends which run the session have the file loaded from the
+	 * session loop, see receive(). */
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	while (receive(in, 0, in->sdi))
+		;
 
 	return SR_OK;
 }
@@ -608,4 +1023,6 @@ SR_PRIV struct sr_input_format input_vcd = {
 	.format_match = format_match,
 	.init = init,
 	.loadfile = loadfile,
+	.receive = receive,
+	.cleanup = cleanup,
 };
@@ -19,11 +19,13 @@
 
 #include "libsigrok.h"
 #include "libsigrok-internal.h"
+#include <string.h>
+#include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* Message logging helpers with subsystem-specific prefix string. */
 #define LOG_PREFIX "input/wav: "
@@ -34,173 +36,541 @@
 #define sr_warn(s, args...) sr_warn(LOG_PREFIX s, ## args)
 #define sr_err(s, args...) sr_err(LOG_PREFIX s, ## args)
 
-#define CHUNK_SIZE 4096
+#define WAVE_FORMAT_PCM           0x0001
+#define WAVE_FORMAT_IEEE_FLOAT    0x0003
+#define WAVE_FORMAT_EXTENSIBLE    0xFFFE
+
+/* frames converted and sent per receive() call */
+#define BATCH_FRAMES              (1024 * 1024)
+
+/*
+ * The file is mapped, and its chunks walked up to the data chunk, in
+ * RIFF files or in RF64/BW64 ones, whose ds64 chunk has the 64-bit size
+ * of the data. The samples are sent as 8-bit codes of the analog mode,
+ * with 128 at zero and full scale from 1 to 255, inverted as the
+ * hardware codes are: the first channels are converted in batches,
+ * straight into the frontend's storage when it provides buffers.
+ */
+
+enum sample_type {
+	SAMPLE_U8,
+	SAMPLE_S16,
+	SAMPLE_S24,
+	SAMPLE_S32,
+	SAMPLE_F32,
+	SAMPLE_F64,
+};
 
 struct context {
 	uint64_t samplerate;
-	int samplesize;
 	int num_channels;
+	/* channels sent, the first num_probes of the file */
+	int num_probes;
+	enum sample_type type;
+	int sample_bytes;
+	int block_align;
+	gchar *filename;
+	uint64_t data_offset;
+	uint64_t num_frames;
+
+	/* state of a load, see receive() */
+	GMappedFile *mapping;
+	const uint8_t *data;
+	uint8_t *buf;
+	uint64_t next_frame;
+	gint64 start_time;
 };
 
-static int get_wav_header(const char *filename, char *buf)
+static uint16_t read_u16(const uint8_t *p)
 {
-	struct stat st;
-	int fd, l;
+	return p[0] | (p[1] << 8);
+}
 
-	l = strlen(filename);
-	if (l <= 4 || strcasecmp(filename + l - 4, ".wav"))
-		return SR_ERR;
+static uint32_t read_u32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_u64(const uint8_t *p)
+{
+	return read_u32(p) | ((uint64_t)read_u32(p + 4) << 32);
+}
 
-	if (stat(filename, &st) == -1)
+/*
+ * Walk the chunks of a mapped file up to its data, filling in the
+ * format of ctx. Returns SR_OK if the file holds samples we can load.
+ */
+static int parse_header(struct context *ctx, const uint8_t *buf, uint64_t len)
+{
+	uint64_t pos, size = 0, ds64_size;
+	uint32_t chunk_size;
+	uint16_t tag, bits;
+	gboolean rf64, have_fmt, have_ds64;
+
+	if (len < 12 || memcmp(buf + 8, "WAVE", 4))
 		return SR_ERR;
-	if (st.st_size <= 45)
-		/* Minimum size of header + 1 8-bit mono PCM sample. */
+	if (!memcmp(buf, "RIFF", 4))
+		rf64 = FALSE;
+	else if (!memcmp(buf, "RF64", 4) || !memcmp(buf, "BW64", 4))
+		rf64 = TRUE;
+	else
+		return SR_ERR;
+
+	tag = bits = 0;
+	ds64_size = 0;
+	have_fmt = have_ds64 = FALSE;
+	for (pos = 12; pos + 8 <= len; pos += 8 + size + (size & 1)) {
+		chunk_size = read_u32(buf + pos + 4);
+		size = chunk_size;
+
+		if (!memcmp(buf + pos, "ds64", 4)) {
+			if (!rf64 || size < 24 || pos + 8 + 24 > len)
+				return SR_ERR;
+			ds64_size = read_u64(buf + pos + 8 + 8);
+			have_ds64 = TRUE;
+		} else if (!memcmp(buf + pos, "fmt ", 4)) {
+			if (size < 16 || pos + 8 + size > len)
+				return SR_ERR;
+			tag = read_u16(buf + pos + 8);
+			ctx->num_channels = read_u16(buf + pos + 10);
+			ctx->samplerate = read_u32(buf + pos + 12);
+			ctx->block_align = read_u16(buf + pos + 20);
+			bits = read_u16(buf + pos + 22);
+			/* the subformat GUID starts with the format tag */
+			if (tag == WAVE_FORMAT_EXTENSIBLE && size >= 40)
+				tag = read_u16(buf + pos + 8 + 24);
+			have_fmt = TRUE;
+		} else if (!memcmp(buf + pos, "data", 4)) {
+			if (!have_fmt)
+				return SR_ERR;
+			ctx->data_offset = pos + 8;
+			if (chunk_size == 0xFFFFFFFF)
+				/* RF64 size, or that of a file still being written */
+				size = have_ds64 ? ds64_size : len - ctx->data_offset;
+			if (size > len - ctx->data_offset)
+				size = len - ctx->data_offset;
+			break;
+		}
+	}
+	if (!ctx->data_offset)
 		return SR_ERR;
 
-	if ((fd = open(filename, O_RDONLY)) == -1)
+	if (tag == WAVE_FORMAT_PCM && bits == 8)
+		ctx->type = SAMPLE_U8;
+	else if (tag == WAVE_FORMAT_PCM && bits == 16)
+		ctx->type = SAMPLE_S16;
+	else if (tag == WAVE_FORMAT_PCM && bits == 24)
+		ctx->type = SAMPLE_S24;
+	else if (tag == WAVE_FORMAT_PCM && bits == 32)
+		ctx->type = SAMPLE_S32;
+	else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 32)
+		ctx->type = SAMPLE_F32;
+	else if (tag == WAVE_FORMAT_IEEE_FLOAT && bits == 64)
+		ctx->type = SAMPLE_F64;
+	else
 		return SR_ERR;
 
-	l = read(fd, buf, 40);
-	close(fd);
-	if (l != 40)
+	ctx->sample_bytes = bits / 8;
+	if (ctx->num_channels == 0 || ctx->samplerate == 0 ||
+	    ctx->block_align != ctx->num_channels * ctx->sample_bytes)
 		return SR_ERR;
+	ctx->num_frames = size / ctx->block_align;
 
 	return SR_OK;
 }
 
-static int format_match(const char *filename)
+/* Map a file and read its header into ctx. */
+static int read_header(struct context *ctx, const char *filename)
 {
-	char buf[40];
+	GMappedFile *mapping;
+	struct stat st;
+	int ret;
 
-	if (get_wav_header(filename, buf) != SR_OK)
-		return FALSE;
+	if (stat(filename, &st) == -1 || st.st_size < 12)
+		return SR_ERR;
+	if (!(mapping = g_mapped_file_new(filename, FALSE, NULL)))
+		return SR_ERR;
+	ret = parse_header(ctx,
+		(const uint8_t *)g_mapped_file_get_contents(mapping),
+		g_mapped_file_get_length(mapping));
+	g_mapped_file_unref(mapping);
 
-	if (strncmp(buf, "RIFF", 4))
-		return FALSE;
-	if (strncmp(buf + 8, "WAVE", 4))
-		return FALSE;
-	if (strncmp(buf + 12, "fmt ", 4))
-		return FALSE;
-	if (GUINT16_FROM_LE(*(uint16_t *)(buf + 20)) != 1)
-		/* Not PCM. */
-		return FALSE;
-	if (strncmp(buf + 36, "data", 4))
-		return FALSE;
+	return ret;
+}
 
-	return TRUE;
+static int format_match(const char *filename)
+{
+	struct context ctx;
+
+	memset(&ctx, 0, sizeof(ctx));
+
+	return read_header(&ctx, filename) == SR_OK;
 }
 
 static int init(struct sr_input *in, const char *filename)
 {
 	struct sr_channel *probe;
 	struct context *ctx;
-	char buf[40], probename[8];
+	char name[SR_MAX_PROBENAME_LEN + 1];
 	int i;
 
-	if (get_wav_header(filename, buf) != SR_OK)
-		return SR_ERR;
-
-	if (!(ctx = g_try_malloc0(sizeof(struct context))))
+	if (!(ctx = g_try_malloc0(sizeof(*ctx)))) {
+		sr_err("Input format context malloc failed.");
 		return SR_ERR_MALLOC;
+	}
 
-	/* Create a virtual device. */
-	in->sdi = sr_dev_inst_new(LOGIC, 0, SR_ST_ACTIVE, NULL, NULL, NULL);
-	in->sdi->priv = ctx;
-
-   	ctx->samplerate = GUINT32_FROM_LE(*(uint32_t *)(buf + 24));
-	ctx->samplesize = GUINT16_FROM_LE(*(uint16_t *)(buf + 34)) / 8;
-	if (ctx->samplesize != 1 && ctx->samplesize != 2 && ctx->samplesize != 4) {
-		sr_err("only 8, 16 or 32 bits per sample supported.");
+	if (read_header(ctx, filename) != SR_OK) {
+		sr_err("'%s' is not a WAV file of PCM or float samples.", filename);
+		g_free(ctx);
+		return SR_ERR;
+	}
+	if (ctx->num_frames == 0) {
+		sr_err("No samples to load from '%s'.", filename);
+		g_free(ctx);
 		return SR_ERR;
 	}
 
-	if ((ctx->num_channels = GUINT16_FROM_LE(*(uint16_t *)(buf + 22))) > 20) {
-		sr_err("%d channels seems crazy.", ctx->num_channels);
+	ctx->num_probes = MIN(ctx->num_channels, DS_MAX_ANALOG_PROBES_NUM);
+	if (ctx->num_probes < ctx->num_channels)
+		sr_warn("Only the first %d of %d channels are loaded.",
+			ctx->num_probes, ctx->num_channels);
+	ctx->filename = g_strdup(filename);
+
+	/* Create a session device, loaded through receive(). */
+	in->internal = ctx;
+	if (!(in->sdi = sr_input_dev_inst_new(in, ANALOG, filename))) {
+		in->internal = NULL;
+		g_free(ctx->filename);
+		g_free(ctx);
 		return SR_ERR;
 	}
 
-	for (i = 0; i < ctx->num_channels; i++) {
-		snprintf(probename, 8, "CH%d", i + 1);
-		if (!(probe = sr_channel_new(0, SR_CHANNEL_ANALOG, TRUE, probename)))
-			return SR_ERR;
+	for (i = 0; i < ctx->num_probes; i++) {
+		snprintf(name, SR_MAX_PROBENAME_LEN, "CH%d", i + 1);
+		if (!(probe = sr_channel_new(i, SR_CHANNEL_ANALOG, TRUE, name)))
+			return SR_ERR_MALLOC;
+		/* full scale of the file over the whole height */
+		probe->bits = 8;
+		probe->vdiv = 1000;
+		probe->vfactor = 1;
+		probe->coupling = SR_DC_COUPLING;
+		probe->hw_offset = 1 << (probe->bits - 1);
+		probe->offset = probe->hw_offset;
+		probe->trig_value = probe->hw_offset;
+		probe->map_default = FALSE;
+		probe->map_unit = "V";
+		probe->map_min = -1;
+		probe->map_max = 1;
 		in->sdi->channels = g_slist_append(in->sdi->channels, probe);
 	}
 
+	in->sdi->driver->config_set(SR_CONF_SAMPLERATE,
+		g_variant_new_uint64(ctx->samplerate), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_LIMIT_SAMPLES,
+		g_variant_new_uint64(ctx->num_frames), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_CAPTURE_NUM_PROBES,
+		g_variant_new_uint64(ctx->num_probes), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_UNIT_BITS,
+		g_variant_new_byte(8), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_REF_MIN,
+		g_variant_new_uint32(1), in->sdi, NULL, NULL);
+	in->sdi->driver->config_set(SR_CONF_REF_MAX,
+		g_variant_new_uint32(255), in->sdi, NULL, NULL);
+
 	return SR_OK;
 }
 
-static int loadfile(struct sr_input *in, const char *filename)
+/* The code of a sample whose top byte, as signed, is h. */
+static uint8_t code_of(int h)
+{
+	h = 128 - h;
+
+	return h < 0 ? 0 : h > 255 ? 255 : h;
+}
+
+static uint8_t code_of_double(double v)
+{
+	v = 128 - v * 128;
+
+	/* false for NaN as well */
+	if (!(v >= 0))
+		return 0;
+
+	/* rounded as the vector conversion does */
+	return v > 255 ? 255 : lrint(v);
+}
+
+/* In single precision, as the vector loop: 128 - v * 128 may round to
+ * a half code in float but not in double. */
+static uint8_t code_of_float(float v)
+{
+	v = 128 - v * 128;
+
+	if (!(v >= 0))
+		return 0;
+
+	return v > 255 ? 255 : lrintf(v);
+}
+
+/* Convert n consecutive samples of the given type. */
+static void convert_run(enum sample_type type, const uint8_t *src,
+		uint8_t *dst, uint64_t n)
+{
+	uint64_t i = 0;
+	float f;
+	double d;
+
+#ifdef __SSE2__
+	const __m128i mid = _mm_set1_epi16(128);
+	const __m128 fmid = _mm_set1_ps(128);
+	const __m128 fmax = _mm_set1_ps(255);
+	__m128i a, b, c, e;
+	__m128 s, t, u, v;
+
+	switch (type) {
+	case SAMPLE_U8:
+		/* 256 - u, saturated */
+		for (; i + 16 <= n; i += 16) {
+			a = _mm_loadu_si128((const __m128i *)(src + i));
+			a = _mm_xor_si128(a, _mm_set1_epi8(-1));
+			a = _mm_adds_epu8(a, _mm_set1_epi8(1));
+			_mm_storeu_si128((__m128i *)(dst + i), a);
+		}
+		break;
+	case SAMPLE_S16:
+		for (; i + 16 <= n; i += 16) {
+			a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+			b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 16));
+			a = _mm_sub_epi16(mid, _mm_srai_epi16(a, 8));
+			b = _mm_sub_epi16(mid, _mm_srai_epi16(b, 8));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+		}
+		break;
+	case SAMPLE_S32:
+		for (; i + 16 <= n; i += 16) {
+			a = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i)), 24);
+			b = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 16)), 24);
+			c = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 32)), 24);
+			e = _mm_srai_epi32(_mm_loadu_si128((const __m128i *)(src + 4 * i + 48)), 24);
+			a = _mm_sub_epi16(mid, _mm_packs_epi32(a, b));
+			c = _mm_sub_epi16(mid, _mm_packs_epi32(c, e));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, c));
+		}
+		break;
+	case SAMPLE_F32:
+		/* 128 - 128 v, clamped before rounding; max_ps takes 0 over NaN */
+		for (; i + 16 <= n; i += 16) {
+			s = _mm_loadu_ps((const float *)(src + 4 * i));
+			t = _mm_loadu_ps((const float *)(src + 4 * i + 16));
+			u = _mm_loadu_ps((const float *)(src + 4 * i + 32));
+			v = _mm_loadu_ps((const float *)(src + 4 * i + 48));
+			s = _mm_min_ps(_mm_max_ps(_mm_sub_ps(fmid, _mm_mul_ps(s, fmid)), _mm_setzero_ps()), fmax);
+			t = _mm_min_ps(_mm_max_ps(_mm_sub_ps(fmid, _mm_mul_ps(t, fmid)), _mm_setzero_ps()), fmax);
+			u = _mm_min_ps(_mm_max_ps(_mm_sub_ps(fmid, _mm_mul_ps(u, fmid)), _mm_setzero_ps()), fmax);
+			v = _mm_min_ps(_mm_max_ps(_mm_sub_ps(fmid, _mm_mul_ps(v, fmid)), _mm_setzero_ps()), fmax);
+			a = _mm_packs_epi32(_mm_cvtps_epi32(s), _mm_cvtps_epi32(t));
+			c = _mm_packs_epi32(_mm_cvtps_epi32(u), _mm_cvtps_epi32(v));
+			_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, c));
+		}
+		break;
+	default:
+		break;
+	}
+#endif
+
+	switch (type) {
+	case SAMPLE_U8:
+		for (; i < n; i++)
+			dst[i] = code_of(src[i] - 128);
+		break;
+	case SAMPLE_S16:
+		for (; i < n; i++)
+			dst[i] = code_of((int8_t)src[2 * i + 1]);
+		break;
+	case SAMPLE_S24:
+		for (; i < n; i++)
+			dst[i] = code_of((int8_t)src[3 * i + 2]);
+		break;
+	case SAMPLE_S32:
+		for (; i < n; i++)
+			dst[i] = code_of((int8_t)src[4 * i + 3]);
+		break;
+	case SAMPLE_F32:
+		for (; i < n; i++) {
+			memcpy(&f, src + 4 * i, sizeof(f));
+			dst[i] = code_of_float(f);
+		}
+		break;
+	case SAMPLE_F64:
+		for (; i < n; i++) {
+			memcpy(&d, src + 8 * i, sizeof(d));
+			dst[i] = code_of_double(d);
+		}
+		break;
+	}
+}
+
+/* Convert frames, from the first one, to the samples of the probes. */
+static void convert_frames(const struct context *ctx, uint64_t first,
+		uint64_t frames, uint8_t *dst)
+{
+	const uint8_t *src = ctx->data + ctx->data_offset + first * ctx->block_align;
+	uint64_t f;
+
+	if (ctx->num_probes == ctx->num_channels) {
+		convert_run(ctx->type, src, dst, frames * ctx->num_channels);
+		return;
+	}
+
+	for (f = 0; f < frames; f++)
+		convert_run(ctx->type, src + f * ctx->block_align,
+			dst + f * ctx->num_probes, ctx->num_probes);
+}
+
+static void end_load(struct context *ctx)
+{
+	g_free(ctx->buf);
+	ctx->buf = NULL;
+	if (ctx->mapping)
+		g_mapped_file_unref(ctx->mapping);
+	ctx->mapping = NULL;
+	ctx->data = NULL;
+}
+
+static gboolean start_load(struct context *ctx)
+{
+	GError *error = NULL;
+
+	ctx->start_time = g_get_monotonic_time();
+	ctx->next_frame = 0;
+	if (!(ctx->mapping = g_mapped_file_new(ctx->filename, FALSE, &error))) {
+		sr_err("Failed to map '%s': %s.", ctx->filename, error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+	if (g_mapped_file_get_length(ctx->mapping) <
+	    ctx->data_offset + ctx->num_frames * ctx->block_align) {
+		sr_err("File '%s' was truncated.", ctx->filename);
+		return FALSE;
+	}
+	ctx->data = (const uint8_t *)g_mapped_file_get_contents(ctx->mapping);
+
+	return TRUE;
+}
+
+/* Convert and send the next batch of frames. */
+static gboolean send_batch(struct context *ctx, const struct sr_dev_inst *cb_sdi)
 {
 	struct sr_datafeed_packet packet;
-	struct sr_datafeed_meta meta;
 	struct sr_datafeed_analog analog;
-	struct sr_config *src;
-	struct context *ctx;
-	float fdata[CHUNK_SIZE];
-	uint64_t sample;
-	int num_samples, chunk_samples, s, c, fd, l;
-	char buf[CHUNK_SIZE];
+	const uint64_t frames = MIN(ctx->num_frames - ctx->next_frame, BATCH_FRAMES);
+	const size_t size = frames * ctx->num_probes;
+	uint8_t *buf;
+
+	/* the batch lands in the frontend's storage if it has room */
+	if (!(buf = sr_session_buffer_alloc(size))) {
+		if (!ctx->buf &&
+		    !(ctx->buf = g_try_malloc(BATCH_FRAMES * ctx->num_probes))) {
+			sr_err("%s: batch buffer malloc failed", __func__);
+			return FALSE;
+		}
+		buf = ctx->buf;
+	}
+	convert_frames(ctx, ctx->next_frame, frames, buf);
+
+	packet.type = SR_DF_ANALOG;
+	packet.status = SR_PKT_OK;
+	packet.payload = &analog;
+	analog.probes = cb_sdi->channels;
+	analog.num_samples = frames;
+	analog.unit_bits = 8;
+	analog.unit_pitch = 0;
+	analog.mq = SR_MQ_VOLTAGE;
+	analog.unit = SR_UNIT_VOLT;
+	analog.mqflags = SR_MQFLAG_AC;
+	analog.data = buf;
+	sr_session_send(cb_sdi, &packet);
+	if (buf != ctx->buf)
+		sr_session_buffer_release(buf);
+
+	ctx->next_frame += frames;
+
+	return TRUE;
+}
 
-	ctx = in->sdi->priv;
-    packet.status = SR_PKT_OK;
+static int receive(struct sr_input *in, int revents,
+		const struct sr_dev_inst *cb_sdi)
+{
+	struct context *ctx = in->internal;
+	struct sr_datafeed_packet packet;
+	double mbytes, seconds;
 
-	/* Send header packet to the session bus. */
-	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	packet.type = SR_DF_END;
+	packet.status = SR_PKT_OK;
+	packet.payload = NULL;
 
-	packet.type = SR_DF_META;
-	packet.payload = &meta;
-	src = sr_config_new(SR_CONF_SAMPLERATE,
-			g_variant_new_uint64(ctx->samplerate));
-	meta.config = g_slist_append(NULL, src);
-	sr_session_send(in->sdi, &packet);
-	sr_config_free(src);
+	if (revents == -1) {
+		/* The session was stopped. */
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
 
-	if ((fd = open(filename, O_RDONLY)) == -1)
-		return SR_ERR;
+	if (!ctx->mapping && !start_load(ctx)) {
+		packet.status = SR_PKT_SOURCE_ERROR;
+		sr_session_send(cb_sdi, &packet);
+		end_load(ctx);
+		return FALSE;
+	}
 
-	lseek(fd, 40, SEEK_SET);
-	l = read(fd, buf, 4);
-	num_samples = GUINT32_FROM_LE((uint32_t)*(buf));
-	num_samples /= ctx->samplesize / ctx->num_channels;
-	while (TRUE) {
-		if ((l = read(fd, buf, CHUNK_SIZE)) < 1)
-			break;
-		chunk_samples = l / ctx->samplesize / ctx->num_channels;
-		for (s = 0; s < chunk_samples; s++) {
-			for (c = 0; c < ctx->num_channels; c++) {
-				sample = 0;
-				memcpy(&sample, buf + s * ctx->samplesize + c, ctx->samplesize);
-				switch (ctx->samplesize) {
-				case 1:
-					/* 8-bit PCM samples are unsigned. */
-					fdata[s + c] = (uint8_t)sample / 255.0;
-					break;
-				case 2:
-					fdata[s + c] = GINT16_FROM_LE(sample) / 32767.0;
-					break;
-				case 4:
-					fdata[s + c] = GINT32_FROM_LE(sample) / 65535.0;
-					break;
-				}
-			}
+	if (ctx->next_frame < ctx->num_frames) {
+		if (!send_batch(ctx, cb_sdi)) {
+			packet.status = SR_PKT_SOURCE_ERROR;
+			sr_session_send(cb_sdi, &packet);
+			end_load(ctx);
+			return FALSE;
 		}
-		packet.type = SR_DF_ANALOG;
-		packet.payload = &analog;
-		analog.probes = in->sdi->channels;
-		analog.num_samples = chunk_samples;
-		analog.mq = 0;
-		analog.unit = 0;
-		analog.data = fdata;
-		sr_session_send(in->sdi, &packet);
+		if (ctx->next_frame < ctx->num_frames)
+			return TRUE;
 	}
 
-	close(fd);
-	packet.type = SR_DF_END;
-	sr_session_send(in->sdi, &packet);
+	sr_session_send(cb_sdi, &packet);
+
+	mbytes = ctx->num_frames * ctx->block_align / (1024.0 * 1024.0);
+	seconds = (g_get_monotonic_time() - ctx->start_time) / (double)G_USEC_PER_SEC;
+	sr_info("Loaded %.1f MB in %.2f s, %.1f MB/s.", mbytes, seconds,
+		seconds > 0 ? mbytes / seconds : 0);
+
+	end_load(ctx);
+	return FALSE;
+}
+
+static int loadfile(struct sr_input *in, const char *filename)
+{
+	(void)filename;
+
+	/* Frontends which run the session have the file loaded from the
+	 * session loop, see receive(). */
+	std_session_send_df_header(in->sdi, LOG_PREFIX);
+	while (receive(in, 0, in->sdi))
+		;
 
 	return SR_OK;
 }
 
+static int cleanup(struct sr_input *in)
+{
+	struct context *ctx = in->internal;
+
+	if (ctx) {
+		end_load(ctx);
+		g_free(ctx->filename);
+		g_free(ctx);
+	}
+	in->internal = NULL;
+
+	return SR_OK;
+}
 
 SR_PRIV struct sr_input_format input_wav = {
 	.id = "wav",
@@ -208,5 +578,6 @@ SR_PRIV struct sr_input_format input_wav = {
 	.format_match = format_match,
 	.init = init,
 	.loadfile = loadfile,
+	.receive = receive,
+	.cleanup = cleanup,
 };
-
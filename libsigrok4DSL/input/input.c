@@ -52,6 +52,7 @@
 /** @cond PRIVATE */
 
 extern SR_PRIV struct sr_input_format input_binary;
+extern SR_PRIV struct sr_input_format input_srzip;
 extern SR_PRIV struct sr_input_format input_vcd;
 extern SR_PRIV struct sr_input_format input_wav;
 /* @endcond */
@@ -59,6 +60,7 @@ extern SR_PRIV struct sr_input_format input_wav;
 static struct sr_input_format *input_module_list[] = {
 	&input_vcd,
 	&input_wav,
+	&input_srzip,
 	/* This one has to be last, because it will take any input. */
 	&input_binary,
 	NULL,
@@ -0,0 +1,209 @@
+/*
+ * This file is part of the libsigrok project.
+ *
+ * Copyright (C) 2013 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libsigrok.h"
+#include "libsigrok-internal.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * @file
+ *
+ * Leaves of LA_LEAF_DATA packets, for the input modules which load
+ * blocks of interleaved samples.
+ */
+
+/* words of the samples of a leaf, and of the leaf with its mipmap */
+#define LEAF_WORDS            (LA_LEAF_SAMPLES / 64)
+#define LEAF_SPACE_WORDS      (LA_LEAF_SPACE / 8)
+
+/* Transpose the bits of an 8x8 matrix, a byte per row. */
+static uint64_t transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+	x = x ^ t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+	x = x ^ t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+	x = x ^ t ^ (t << 28);
+
+	return x;
+}
+
+#ifdef __SSE2__
+/* Byte g of 16 samples. */
+static __m128i gather16(const uint8_t *src, int unitsize, int g)
+{
+	const __m128i lo = _mm_set1_epi32(0xFF);
+	__m128i a, b, c, d;
+	uint8_t bytes[16];
+	int i;
+
+	switch (unitsize) {
+	case 1:
+		return _mm_loadu_si128((const __m128i *)src);
+	case 2:
+		a = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)src), 8 * g);
+		b = _mm_srli_epi16(_mm_loadu_si128((const __m128i *)(src + 16)), 8 * g);
+		return _mm_packus_epi16(_mm_and_si128(a, _mm_set1_epi16(0xFF)),
+					_mm_and_si128(b, _mm_set1_epi16(0xFF)));
+	case 4:
+		a = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i *)src), 8 * g), lo);
+		b = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 16)), 8 * g), lo);
+		c = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 32)), 8 * g), lo);
+		d = _mm_and_si128(_mm_srli_epi32(_mm_loadu_si128((const __m128i *)(src + 48)), 8 * g), lo);
+		return _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+	default:
+		for (i = 0; i < 16; i++)
+			bytes[i] = src[i * unitsize + g];
+		return _mm_loadu_si128((const __m128i *)bytes);
+	}
+}
+#endif
+
+/**
+ * Split interleaved samples into the leaves of a block: unitsize bytes
+ * per sample, with channel k in bit k. The leaf of a channel is at
+ * leaves + orders[k] * LA_LEAF_SPACE / 8, channels with an order below
+ * 0 are skipped, and so are the bytes with none of them. Only the
+ * sample bits of the leaves are written.
+ *
+ * @param leaves The leaves of the block.
+ * @param src The first sample.
+ * @param unitsize Bytes per sample.
+ * @param num_probes Channels in the samples.
+ * @param orders Leaf of each channel.
+ * @param samples Samples to split, up to LA_LEAF_SAMPLES.
+ */
+SR_PRIV void sr_leaf_split(uint64_t *leaves, const uint8_t *src, int unitsize,
+		int num_probes, const int *orders, uint64_t samples)
+{
+	uint8_t *dst;
+	uint64_t s = 0, m;
+	int g, c, i, n, order;
+	int first = unitsize, end = 0;
+#ifdef __SSE2__
+	__m128i v;
+	uint16_t bits;
+#endif
+
+	/* the bytes with a channel to split */
+	for (c = 0; c < num_probes && c < unitsize * 8; c++) {
+		if (orders[c] >= 0) {
+			first = MIN(first, c / 8);
+			end = c / 8 + 1;
+		}
+	}
+
+#ifdef __SSE2__
+
+	/* 16 samples of 8 channels at a time, a channel per sign bit */
+	for (; s + 16 <= samples; s += 16) {
+		for (g = first; g < end; g++) {
+			v = gather16(src + s * unitsize, unitsize, g);
+			for (c = 7; c >= 0; c--) {
+				if (g * 8 + c < num_probes &&
+				    (order = orders[g * 8 + c]) >= 0) {
+					bits = _mm_movemask_epi8(v);
+					dst = (uint8_t *)(leaves + order * LEAF_SPACE_WORDS);
+					memcpy(dst + s / 8, &bits, sizeof(bits));
+				}
+				v = _mm_add_epi8(v, v);
+			}
+		}
+	}
+#endif
+
+	/* 8 samples of 8 channels at a time */
+	for (; s < samples; s += 8) {
+		n = (samples - s < 8) ? samples - s : 8;
+		for (g = first; g < end; g++) {
+			m = 0;
+			if (unitsize == 1 && n == 8)
+				memcpy(&m, src + s, 8);
+			else
+				for (i = 0; i < n; i++)
+					m |= (uint64_t)src[(s + i) * unitsize + g] << (8 * i);
+			m = transpose8(m);
+			for (c = 0; c < 8 && g * 8 + c < num_probes; c++) {
+				if ((order = orders[g * 8 + c]) < 0)
+					continue;
+				dst = (uint8_t *)(leaves + order * LEAF_SPACE_WORDS);
+				dst[s / 8] = m >> (8 * c);
+			}
+		}
+	}
+}
+
+/*
+ * The mipmap of a leaf, as LogicSnapshot builds it: a bit per word of
+ * samples, set if it has an edge from the sample before, then a bit per
+ * word of each level, set if it is not 0.
+ */
+static void build_mipmap(uint64_t *leaf, uint64_t words, uint64_t last)
+{
+	uint64_t *const level1 = leaf + LEAF_WORDS;
+	uint64_t i;
+
+	memset(level1, 0, (LEAF_SPACE_WORDS - LEAF_WORDS) * 8);
+	for (i = 0; i < words; i++) {
+		level1[i / 64] |= (uint64_t)((leaf[i] ^ last) != 0) << (i % 64);
+		last = (leaf[i] >> 63) ? ~0ULL : 0ULL;
+	}
+	for (i = LEAF_WORDS; i < LEAF_SPACE_WORDS - 1; i++)
+		leaf[LEAF_WORDS + LEAF_WORDS / 64 + (i - LEAF_WORDS) / 64] |=
+			(uint64_t)(leaf[i] != 0) << (i % 64);
+}
+
+/**
+ * Complete a leaf whose sample bits are split: the samples after the
+ * last one hold its value, up to the end of its word, and the mipmap is
+ * built.
+ *
+ * @param leaf The leaf.
+ * @param samples Samples of the leaf, up to LA_LEAF_SAMPLES.
+ * @param last The sample before the leaf.
+ * @param edges Set if the leaf has edges, it is constant otherwise.
+ * @param value Set to the last sample.
+ */
+SR_PRIV void sr_leaf_finish(uint64_t *leaf, uint64_t samples, gboolean last,
+		gboolean *edges, gboolean *value)
+{
+	const uint64_t words = (samples + 63) / 64;
+	uint64_t tail;
+
+	memset((uint8_t *)(leaf + words), 0, (LEAF_WORDS - words) * 8);
+
+	/* the last word of a partial block holds its last sample */
+	if (samples % 64) {
+		tail = ~0ULL << (samples % 64);
+		if ((leaf[words - 1] >> (samples % 64 - 1)) & 1)
+			leaf[words - 1] |= tail;
+		else
+			leaf[words - 1] &= ~tail;
+	}
+
+	build_mipmap(leaf, words, last ? ~0ULL : 0ULL);
+	*edges = leaf[LEAF_SPACE_WORDS - 1] != 0;
+	*value = leaf[words - 1] >> 63;
+}
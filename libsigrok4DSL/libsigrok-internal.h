@@ -113,11 +113,25 @@ SR_PRIV int sr_source_remove(int fd);
 SR_PRIV int sr_source_add(int fd, int events, int timeout,
         sr_receive_data_callback_t cb, void *cb_data);
 
+/*--- input/leaf.c ----------------------------------------------------------*/
+
+SR_PRIV void sr_leaf_split(uint64_t *leaves, const uint8_t *src, int unitsize,
+		int num_probes, const int *orders, uint64_t samples);
+SR_PRIV void sr_leaf_finish(uint64_t *leaf, uint64_t samples, gboolean last,
+		gboolean *edges, gboolean *value);
+
 /*--- session.c -------------------------------------------------------------*/
 
 SR_PRIV int sr_session_send(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet);
 SR_PRIV int sr_session_stop_sync(void);
+SR_PRIV void *sr_session_buffer_alloc(size_t size);
+SR_PRIV gboolean sr_session_buffer_release(void *buf);
+
+/*--- session_driver.c ------------------------------------------------------*/
+
+SR_PRIV struct sr_dev_inst *sr_input_dev_inst_new(struct sr_input *in,
+		int mode, const char *filename);
 
 /*--- std.c -----------------------------------------------------------------*/
 
@@ -200,6 +200,8 @@ enum {
 	SR_DF_FRAME_BEGIN,
 	SR_DF_FRAME_END,
     SR_DF_OVERFLOW,
+    /** logic samples given by their changes, see sr_datafeed_changes */
+    SR_DF_LOGIC_CHANGES,
 };
 
 /** Values for sr_datafeed_analog.mq. */
@@ -360,6 +362,42 @@ struct sr_datafeed_meta {
 enum LA_DATA_FORMAT {
     LA_CROSS_DATA,
     LA_SPLIT_DATA,
+    /** one block of one channel, see struct sr_datafeed_leaf */
+    LA_LEAF_DATA,
+};
+
+struct sr_session_reader;
+
+/** Samples of the blocks of LA_LEAF_DATA packets */
+#define LA_LEAF_SAMPLES (1ULL << 24)
+/** Bytes of a leaf: the samples, then a bit per 64 bits of each level */
+#define LA_LEAF_SPACE ((LA_LEAF_SAMPLES + LA_LEAF_SAMPLES / 64 + \
+                        LA_LEAF_SAMPLES / 4096 + LA_LEAF_SAMPLES / 262144) / 8)
+
+/**
+ * Payload (sr_datafeed_logic.data) of LA_LEAF_DATA packets.
+ * A leaf is a block of samples followed by its mipmap levels, as
+ * the session file version 3 stores them.
+ *
+ * When a session file is loaded lazily, only the block index is sent:
+ * leaf is NULL, and blocks with edges are read from the reader when
+ * they are needed.
+ *
+ * A leaf without mapping is a buffer of the sender, only valid while
+ * the packet is sent: it is copied by the receiver. A mapped leaf is
+ * aligned to 8 bytes, and used in place.
+ */
+struct sr_datafeed_leaf {
+    /** The leaf, or NULL for a block without edges or not loaded */
+    const void *leaf;
+    /** Level of a block without edges, last sample of a block with edges */
+    gboolean value;
+    /** The block has edges */
+    gboolean edges;
+    /** The leaf is mapped from this file, ref it to keep the leaf */
+    GMappedFile *mapping;
+    /** Blocks not loaded are read from here, ref it to keep it */
+    struct sr_session_reader *reader;
 };
 
 struct sr_datafeed_logic {
@@ -375,6 +413,24 @@ struct sr_datafeed_logic {
 	void *data;
 };
 
+/**
+ * Payload of SR_DF_LOGIC_CHANGES packets, for output modules which
+ * only write the samples that differ from the one before (VCD, logic
+ * CSV). The sample at each index holds until the next one: the stream
+ * starts with a change at index 0.
+ */
+struct sr_datafeed_changes {
+    /** Number of changes in this packet */
+    uint64_t num_changes;
+    /** Sample index of each change, ascending */
+    const uint64_t *index;
+    /** The sample at each change, unitsize bytes each */
+    const uint8_t *data;
+    uint16_t unitsize;
+    /** Samples of the stream, up to the end of this packet */
+    uint64_t num_samples;
+};
+
 struct sr_datafeed_dso {
     /** The probes for which data is included in this packet. */
     GSList *probes;
@@ -481,6 +537,36 @@ struct sr_input_format {
      * @return SR_OK upon succcess, a negative error code upon failure.
 	 */
 	int (*loadfile) (struct sr_input *in, const char *filename);
+
+	/**
+	 * Load the file a part at a time (optional).
+	 *
+	 * Modules with this callback create their device with
+	 * sr_input_dev_inst_new() in init(). The frontend then starts and
+	 * runs the session like for any other device, and the session
+	 * loop calls this until it returns FALSE, so that loading can be
+	 * stopped like an acquisition. The SR_DF_HEADER packet is sent by
+	 * the device, SR_DF_END by the module.
+	 *
+	 * @param in The input, as set up by init().
+	 * @param revents -1 once the session is stopped, 0 otherwise.
+	 * @param cb_sdi The device to send datafeed packets for.
+	 *
+	 * @return TRUE while there is more to load, FALSE once SR_DF_END
+	 *         was sent.
+	 */
+	int (*receive) (struct sr_input *in, int revents,
+			const struct sr_dev_inst *cb_sdi);
+
+	/**
+	 * Release what init() set up (optional). Called when the device
+	 * of the input is closed.
+	 *
+	 * @param in The input, as set up by init().
+	 *
+	 * @return SR_OK upon success, a negative error code upon failure.
+	 */
+	int (*cleanup) (struct sr_input *in);
 };
 
 /** Output (file) format struct. */
@@ -1073,6 +1159,16 @@ enum {
 	/** The device has internal storage, into which data is logged. This
 	 * starts or stops the internal logging. */
 	SR_CONF_DATALOG,
+
+    /*--- Keys added later, appended to keep the values above -----------*/
+
+    /** USB transfer ring (slots / high-water mark / payloads dropped) */
+    SR_CONF_RING_SIZE,
+    SR_CONF_RING_HWM,
+    SR_CONF_RING_OVERRUN,
+
+    /** Load logic blocks of a session file on demand, if it has a block index */
+    SR_CONF_LAZY_LOAD,
 };
 
 struct sr_dev_inst {
@@ -1146,6 +1242,14 @@ enum {
     SR_BUF_UPLOAD = 1,
 };
 
+/** Compression of the data chunks in session files. */
+enum {
+    /** Stored as is */
+    SR_COMPRESS_STORE = 0,
+    /** Deflate, level 1 (fastest) to 9 (smallest) */
+    SR_COMPRESS_DEFLATE = 1,
+};
+
 /** Device threshold level. */
 enum {
     /** 1.8/2.5/3.3 level */
@@ -1244,6 +1348,14 @@ struct sr_session {
 	 */
     GMutex stop_mutex;
 	gboolean abort_session;
+
+	/*
+	 * Optional provider of acquisition buffers, so drivers can transfer
+	 * straight into the frontend's sample storage.
+	 */
+	void *(*buffer_alloc)(size_t size, void *cb_data);
+	gboolean (*buffer_release)(void *buf, void *cb_data);
+	void *buffer_cb_data;
 };
 
 enum {
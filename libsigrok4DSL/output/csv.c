@@ -22,11 +22,15 @@
 #include "libsigrok-internal.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <glib.h>
 #include "config.h" /* Needed for PACKAGE_STRING and others. */
 
 #define LOG_PREFIX "output/csv"
 
+/* Longest column written by format_value() and format_time(). */
+#define VALUE_MAX 32
+
 struct context {
 	unsigned int num_enabled_channels;
 	uint64_t samplerate;
@@ -190,11 +194,113 @@ static GString *gen_header(const struct sr_output *o)
 	return header;
 }
 
+/*
+ * Write a value as printf("%0.5f") would, without printf: the DSO and
+ * analog rows have a value per channel and sample.
+ */
+static char *format_value(char *s, double value)
+{
+	char digits[24];
+	double scaled, rest;
+	uint64_t fixed, ip;
+	int n, i;
+
+	/*
+	 * Ties are left to printf, the product may have been rounded. So
+	 * are products of 2^52 and more, which have no fraction left.
+	 */
+	scaled = fabs(value) * 100000.0;
+	rest = scaled - floor(scaled);
+	if (!isfinite(value) || scaled >= 4503599627370496.0 || rest == 0.5)
+		return s + MIN(snprintf(s, VALUE_MAX, "%0.5f", value), VALUE_MAX - 1);
+
+	if (signbit(value))
+		*s++ = '-';
+	fixed = (uint64_t)scaled + (rest > 0.5);
+	ip = fixed / 100000;
+	n = 0;
+	do {
+		digits[n++] = '0' + ip % 10;
+		ip /= 10;
+	} while (ip);
+	while (n)
+		*s++ = digits[--n];
+	*s++ = '.';
+	fixed %= 100000;
+	for (i = 4; i >= 0; i--) {
+		s[i] = '0' + fixed % 10;
+		fixed /= 10;
+	}
+	return s + 5;
+}
+
+/*
+ * Write a time as printf("%0.10g") would: ten significant digits, and
+ * no trailing zeros. The logic rows have a time each: the times printf
+ * writes without an exponent are written here, and ties are left to
+ * printf, as in format_value().
+ */
+static char *format_time(char *s, double value)
+{
+	static const uint64_t pow10[] = {
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+		10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+		100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+	};
+	char digits[24];
+	double scaled, rest;
+	uint64_t fixed, ip;
+	int d, n, i;
+
+	if (value == 0) {
+		*s++ = '0';
+		return s;
+	}
+	if (!(value >= 1e-4 && value < 1e10))
+		return s + MIN(snprintf(s, VALUE_MAX, "%0.10g", value), VALUE_MAX - 1);
+
+	/* decimals of the ten digits, log10() may be one off */
+	d = 9 - (int)floor(log10(value));
+	d = MIN(MAX(d, 0), 13);
+	scaled = value * pow10[d];
+	if (scaled >= 1e10 && d > 0)
+		scaled = value * pow10[--d];
+	else if (scaled < 1e9 && d < 13)
+		scaled = value * pow10[++d];
+	rest = scaled - floor(scaled);
+	fixed = (uint64_t)scaled + (rest > 0.5);
+	if (scaled < 1e9 || fixed >= pow10[10] || fabs(rest - 0.5) < 1e-3)
+		return s + MIN(snprintf(s, VALUE_MAX, "%0.10g", value), VALUE_MAX - 1);
+
+	ip = fixed / pow10[d];
+	fixed %= pow10[d];
+	while (d > 0 && fixed % 10 == 0) {
+		fixed /= 10;
+		d--;
+	}
+	n = 0;
+	do {
+		digits[n++] = '0' + ip % 10;
+		ip /= 10;
+	} while (ip);
+	while (n)
+		*s++ = digits[--n];
+	if (d == 0)
+		return s;
+	*s++ = '.';
+	for (i = d - 1; i >= 0; i--) {
+		s[i] = '0' + fixed % 10;
+		fixed /= 10;
+	}
+	return s + d;
+}
+
 static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
 		GString **out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_changes *changes;
     const struct sr_datafeed_dso *dso;
     const struct sr_datafeed_analog *analog;
 	const struct sr_config *src;
@@ -203,6 +309,9 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 	int idx;
 	uint64_t i, j;
     unsigned char *p, c;
+    const uint8_t *sample;
+    char *s;
+    gsize start;
 
 	*out = NULL;
 	if (!o || !o->sdi)
@@ -238,7 +347,10 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
             ctx->index++;
             if (ctx->index > 1 && (*(uint64_t *)(logic->data + i) & ctx->mask) == ctx->pre_data)
                 continue;
-            g_string_append_printf(*out, "%0.10g", (ctx->index-1)*1.0/ctx->samplerate);
+            g_string_set_size(*out, (*out)->len + VALUE_MAX);
+            s = format_time((*out)->str + (*out)->len - VALUE_MAX,
+                            (ctx->index-1)*1.0/ctx->samplerate);
+            g_string_truncate(*out, s - (*out)->str);
             for (j = 0; j < ctx->num_enabled_channels; j++) {
                 //idx = ctx->channel_index[j];
                 idx = j;
@@ -251,6 +363,42 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
             ctx->pre_data = (*(uint64_t *)(logic->data + i) & ctx->mask);
 		}
 		break;
+	case SR_DF_LOGIC_CHANGES:
+		changes = packet->payload;
+		if (!ctx->header_done) {
+			*out = gen_header(o);
+			ctx->header_done = TRUE;
+		} else {
+			*out = g_string_sized_new(512);
+		}
+
+		if (changes->num_changes == 0)
+			break;
+
+		/* A row per change, formatted in place as the logic rows. */
+		start = (*out)->len;
+		g_string_set_size(*out, start + (gsize)changes->num_changes *
+				  (VALUE_MAX + 2 * ctx->num_enabled_channels + 1));
+		s = (*out)->str + start;
+		sample = changes->data;
+		for (i = 0; i < changes->num_changes; i++) {
+			sample = changes->data + i * changes->unitsize;
+			s = format_time(s, changes->index[i] * 1.0 / ctx->samplerate);
+			for (j = 0; j < ctx->num_enabled_channels; j++) {
+				*s++ = ctx->separator;
+				*s++ = ((sample[j / 8] >> (j % 8)) & 1) ? '1' : '0';
+			}
+			*s++ = '\n';
+		}
+		g_string_truncate(*out, s - (*out)->str);
+
+		/* Logic packets may follow, from the last change on. */
+		ctx->index = changes->num_samples;
+		ctx->pre_data = 0;
+		memcpy(&ctx->pre_data, sample,
+		       MIN(changes->unitsize, sizeof(ctx->pre_data)));
+		ctx->pre_data &= ctx->mask;
+		break;
      case SR_DF_DSO:
         dso = packet->payload;
         if (!ctx->header_done) {
@@ -260,20 +408,28 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
             *out = g_string_sized_new(512);
         }
 
+        if (ctx->num_enabled_channels == 0)
+            break;
+
+        /* Rows are formatted in place, the string is cut to size after. */
+        start = (*out)->len;
+        g_string_set_size(*out, start + (gsize)dso->num_samples *
+                          ctx->num_enabled_channels * (VALUE_MAX + 1));
+        s = (*out)->str + start;
         for (i = 0; i < (uint64_t)dso->num_samples; i++) {
             for (j = 0; j < ctx->num_enabled_channels; j++) {
                 idx = ctx->channel_index[j];
                 p = dso->data + i * ctx->num_enabled_channels + idx * ((ctx->num_enabled_channels > 1) ? 1 : 0);
-                g_string_append_printf(*out, "%0.5f", (ctx->channel_offset[j] - *p) *
-                                                       ctx->channel_scale[j] /
-                                                      (ctx->ref_max - ctx->ref_min));
-                g_string_append_c(*out, ctx->separator);
+                s = format_value(s, (ctx->channel_offset[j] - *p) *
+                                    ctx->channel_scale[j] /
+                                    (ctx->ref_max - ctx->ref_min));
+                *s++ = ctx->separator;
             }
 
-            /* Drop last separator. */
-            g_string_truncate(*out, (*out)->len - 1);
-            g_string_append_printf(*out, "\n");
+            /* Replace last separator. */
+            s[-1] = '\n';
         }
+        g_string_truncate(*out, s - (*out)->str);
         break;
     case SR_DF_ANALOG:
        analog = packet->payload;
@@ -284,20 +440,27 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
            *out = g_string_sized_new(512);
        }
 
+       if (ctx->num_enabled_channels == 0)
+           break;
+
+       start = (*out)->len;
+       g_string_set_size(*out, start + (gsize)analog->num_samples *
+                         ctx->num_enabled_channels * (VALUE_MAX + 1));
+       s = (*out)->str + start;
        for (i = 0; i < (uint64_t)analog->num_samples; i++) {
            for (j = 0; j < ctx->num_enabled_channels; j++) {
                idx = ctx->channel_index[j];
                p = analog->data + i * ctx->num_enabled_channels + idx * ((ctx->num_enabled_channels > 1) ? 1 : 0);
-               g_string_append_printf(*out, "%0.5f",  (ctx->channel_offset[j] - *p) *
-                                                      (ctx->channel_mmax[j] - ctx->channel_mmin[j]) /
-                                                      (ctx->ref_max - ctx->ref_min));
-               g_string_append_c(*out, ctx->separator);
+               s = format_value(s, (ctx->channel_offset[j] - *p) *
+                                   (ctx->channel_mmax[j] - ctx->channel_mmin[j]) /
+                                   (ctx->ref_max - ctx->ref_min));
+               *s++ = ctx->separator;
            }
 
-           /* Drop last separator. */
-           g_string_truncate(*out, (*out)->len - 1);
-           g_string_append_printf(*out, "\n");
+           /* Replace last separator. */
+           s[-1] = '\n';
        }
+       g_string_truncate(*out, s - (*out)->str);
        break;
 	}
 
@@ -23,11 +23,16 @@
 #include "libsigrok-internal.h"
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 #include <glib.h>
 #include "config.h" /* Needed for PACKAGE and others. */
 
 #define LOG_PREFIX "output/vcd"
 
+/* Identifiers of up to two printable characters, and a NUL. */
+#define ID_SIZE 3
+#define MAX_CHANNELS (94 + 94 * 94)
+
 struct context {
 	int num_enabled_channels;
 	GArray *channelindices;
@@ -35,10 +40,27 @@ struct context {
 	gboolean header_done;
 	int period;
 	int *channel_index;
+	/* the identifier of each enabled channel, ID_SIZE bytes each */
+	char *ids;
 	uint64_t samplerate;
 	uint64_t samplecount;
 };
 
+/*
+ * The first 94 channels are identified by one printable character, the
+ * next ones by two: a bijective base 94 number.
+ */
+static void gen_identifier(char *s, int p)
+{
+	for (;;) {
+		*s++ = '!' + p % 94;
+		p /= 94;
+		if (p-- == 0)
+			break;
+	}
+	*s = '\0';
+}
+
 static int init(struct sr_output *o, GHashTable *options)
 {
 	struct context *ctx;
@@ -57,8 +79,8 @@ static int init(struct sr_output *o, GHashTable *options)
 			continue;
 		num_enabled_channels++;
 	}
-	if (num_enabled_channels > 94) {
-		sr_err("VCD only supports 94 channels.");
+	if (num_enabled_channels > MAX_CHANNELS) {
+		sr_err("VCD only supports %d channels.", MAX_CHANNELS);
 		return SR_ERR;
 	}
 
@@ -66,6 +88,7 @@ static int init(struct sr_output *o, GHashTable *options)
 	o->priv = ctx;
 	ctx->num_enabled_channels = num_enabled_channels;
 	ctx->channel_index = g_malloc(sizeof(int) * ctx->num_enabled_channels);
+	ctx->ids = g_malloc(ID_SIZE * ctx->num_enabled_channels);
 
 	/* Once more to map the enabled channels. */
 	for (i = 0, l = o->sdi->channels; l; l = l->next) {
@@ -74,6 +97,7 @@ static int init(struct sr_output *o, GHashTable *options)
 			continue;
 		if (!ch->enabled)
 			continue;
+		gen_identifier(ctx->ids + i * ID_SIZE, i);
 		ctx->channel_index[i++] = ch->index;
 	}
 
@@ -147,8 +171,8 @@ static GString *gen_header(const struct sr_output *o)
 			continue;
 		if (!ch->enabled)
 			continue;
-		g_string_append_printf(header, "$var wire 1 %c %s $end\n",
-                (char)('!' + p), ch->name);
+		g_string_append_printf(header, "$var wire 1 %s %s $end\n",
+                ctx->ids + p * ID_SIZE, ch->name);
         p++;
 	}
 
@@ -157,17 +181,47 @@ static GString *gen_header(const struct sr_output *o)
 	return header;
 }
 
+/*
+ * Append a timestamp as printf("#%.0f") would. A line has one, written
+ * here unless the time is a tie, which printf rounds to even.
+ */
+static void append_timestamp(GString *out, double t)
+{
+	char digits[24];
+	double rest;
+	uint64_t v;
+	int n;
+
+	rest = t - floor(t);
+	if (!(t >= 0 && t < 9007199254740992.0) || rest == 0.5) {
+		g_string_append_printf(out, "#%.0f", t);
+		return;
+	}
+
+	v = (uint64_t)t + (rest > 0.5);
+	n = sizeof(digits);
+	do {
+		digits[--n] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	digits[--n] = '#';
+	g_string_append_len(out, digits + n, sizeof(digits) - n);
+}
+
 static int receive(const struct sr_output *o, const struct sr_datafeed_packet *packet,
 		GString **out)
 {
 	const struct sr_datafeed_meta *meta;
 	const struct sr_datafeed_logic *logic;
+	const struct sr_datafeed_changes *changes;
 	const struct sr_config *src;
 	GSList *l;
 	struct context *ctx;
-	unsigned int i;
+	unsigned int i, b;
+	uint64_t k;
 	int p, curbit, prevbit, index;
-	uint8_t *sample;
+	uint8_t *sample, diff;
+	const uint8_t *change;
 	gboolean timestamp_written;
 
 	*out = NULL;
@@ -219,14 +273,14 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 
 				/* Output timestamp of subsequent signal changes. */
 				if (!timestamp_written)
-					g_string_append_printf(*out, "#%.0f",
+					append_timestamp(*out,
 						(double)ctx->samplecount /
 							ctx->samplerate * ctx->period);
 
 				/* Output which signal changed to which value. */
 				g_string_append_c(*out, ' ');
 				g_string_append_c(*out, '0' + curbit);
-				g_string_append_c(*out, '!' + p);
+				g_string_append(*out, ctx->ids + p * ID_SIZE);
 
 				timestamp_written = TRUE;
 			}
@@ -238,6 +292,55 @@ static int receive(const struct sr_output *o, const struct sr_datafeed_packet *p
 			memcpy(ctx->prevsample, sample, logic->unitsize);
 		}
 		break;
+	case SR_DF_LOGIC_CHANGES:
+		changes = packet->payload;
+
+		if (!ctx->header_done) {
+			*out = gen_header(o);
+			ctx->header_done = TRUE;
+		} else {
+			*out = g_string_sized_new(512);
+		}
+
+		if (!ctx->prevsample)
+			ctx->prevsample = g_malloc0(changes->unitsize);
+
+		for (k = 0; k < changes->num_changes; k++) {
+			change = changes->data + k * changes->unitsize;
+			timestamp_written = FALSE;
+
+			/* The channels which changed, all of them at first. */
+			for (b = 0; b < changes->unitsize; b++) {
+				diff = change[b] ^ ctx->prevsample[b];
+				if (k == 0 && ctx->samplecount == 0)
+					diff = 0xff;
+				for (i = 0; diff; i++, diff >>= 1) {
+					p = b * 8 + i;
+					if (p >= ctx->num_enabled_channels)
+						break;
+					if (!(diff & 1))
+						continue;
+
+					if (!timestamp_written)
+						append_timestamp(*out,
+							(double)changes->index[k] /
+								ctx->samplerate * ctx->period);
+
+					g_string_append_c(*out, ' ');
+					g_string_append_c(*out, '0' + ((change[b] >> i) & 1));
+					g_string_append(*out, ctx->ids + p * ID_SIZE);
+
+					timestamp_written = TRUE;
+				}
+			}
+
+			if (timestamp_written)
+				g_string_append_c(*out, '\n');
+
+			memcpy(ctx->prevsample, change, changes->unitsize);
+		}
+		ctx->samplecount = changes->num_samples;
+		break;
 	case SR_DF_END:
 		/* Write final timestamp as length indicator. */
 		*out = g_string_sized_new(512);
@@ -259,6 +362,7 @@ static int cleanup(struct sr_output *o)
 	ctx = o->priv;
 	g_free(ctx->prevsample);
 	g_free(ctx->channel_index);
+	g_free(ctx->ids);
 	g_free(ctx);
 
 	return SR_OK;
@@ -86,6 +86,8 @@ SR_API void sr_config_free(struct sr_config *src);
 
 typedef void (*sr_datafeed_callback_t)(const struct sr_dev_inst *sdi,
 		const struct sr_datafeed_packet *packet, void *cb_data);
+typedef void *(*sr_buffer_alloc_callback_t)(size_t size, void *cb_data);
+typedef gboolean (*sr_buffer_release_callback_t)(void *buf, void *cb_data);
 
 /* Session setup */
 SR_API int sr_session_load(const char *filename);
@@ -99,6 +101,8 @@ SR_API int sr_session_dev_list(GSList **devlist);
 SR_API int sr_session_datafeed_callback_remove_all(void);
 SR_API int sr_session_datafeed_callback_add(sr_datafeed_callback_t cb,
 		void *cb_data);
+SR_API int sr_session_buffer_provider_set(sr_buffer_alloc_callback_t alloc,
+		sr_buffer_release_callback_t release, void *cb_data);
 
 /* Session control */
 SR_API int sr_session_start(void);
@@ -107,6 +111,56 @@ SR_API int sr_session_stop(void);
 SR_API int sr_session_save_init(const char *filename, const char *metafile, const char *decfile, const char *sesfile);
 SR_API int sr_session_append(const char *filename, const unsigned char *buf,
         uint64_t size, int chunk_num, int index, int type, int version);
+
+/* Streaming session writer */
+struct sr_session_writer;
+typedef void (*sr_session_progress_callback_t)(double progress, void *cb_data);
+SR_API struct sr_session_writer *sr_session_writer_new(const char *filename,
+        const char *metafile, const char *decfile, const char *sesfile);
+SR_API int sr_session_writer_add(struct sr_session_writer *writer,
+        const char *name, const unsigned char *buf, uint64_t size,
+        gboolean take_buf);
+SR_API int sr_session_writer_append(struct sr_session_writer *writer,
+        const unsigned char *buf, uint64_t size, int chunk_num, int index,
+        int type, int version, gboolean take_buf);
+SR_API const char *sr_session_codec_name(int codec);
+SR_API int sr_session_codec_parse(const char *name);
+SR_API void sr_session_writer_set_compression(struct sr_session_writer *writer,
+        int codec, int level);
+SR_API int sr_session_deflate(const unsigned char *buf, uint64_t size, int level,
+        unsigned char **out, uint64_t *out_size, uint32_t *crc);
+SR_API int sr_session_inflate(const unsigned char *buf, uint64_t size,
+        unsigned char *out, uint64_t out_max, uint64_t *out_size);
+SR_API int sr_session_writer_close(struct sr_session_writer *writer,
+        sr_session_progress_callback_t cb, void *cb_data);
+SR_API void sr_session_writer_discard(struct sr_session_writer *writer);
+
+/* Session file reader */
+SR_API struct sr_session_reader *sr_session_reader_new(const char *filename,
+        int version);
+SR_API struct sr_session_reader *sr_session_reader_ref(
+        struct sr_session_reader *reader);
+SR_API void sr_session_reader_unref(struct sr_session_reader *reader);
+SR_API int sr_session_reader_size(struct sr_session_reader *reader,
+        int chunk_num, int index, int type, uint64_t *size);
+SR_API int sr_session_reader_read(struct sr_session_reader *reader,
+        int chunk_num, int index, int type, void *buf, uint64_t size,
+        uint64_t *read);
+
+/* Session file recorder */
+struct sr_session_recorder;
+SR_API struct sr_session_recorder *sr_session_recorder_new(const char *filename);
+SR_API int sr_session_recorder_add(struct sr_session_recorder *rec,
+        const char *name, const unsigned char *buf, uint64_t size);
+SR_API int sr_session_recorder_append(struct sr_session_recorder *rec,
+        const unsigned char *buf, uint64_t size, int chunk_num, int index,
+        int type, int version);
+SR_API int sr_session_recorder_append_deflated(struct sr_session_recorder *rec,
+        unsigned char *buf, uint64_t comp_size, uint64_t size, uint32_t crc,
+        int chunk_num, int index, int type, int version);
+SR_API int sr_session_recorder_sync(struct sr_session_recorder *rec);
+SR_API int sr_session_recorder_close(struct sr_session_recorder *rec);
+
 SR_API int sr_session_source_add(int fd, int events, int timeout,
 		sr_receive_data_callback_t cb, const struct sr_dev_inst *sdi);
 SR_API int sr_session_source_add_pollfd(GPollFD *pollfd, int timeout,
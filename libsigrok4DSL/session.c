@@ -283,6 +283,71 @@ SR_API int sr_session_datafeed_callback_add(sr_datafeed_callback_t cb, void *cb_
 	return SR_OK;
 }
 
+/**
+ * Install a provider for acquisition buffers in the current session.
+ *
+ * Drivers that support it will ask the provider for the memory their
+ * transfers land in, so a payload can already sit in the frontend's
+ * storage when it is sent. Pass NULL callbacks to remove the provider.
+ *
+ * @param alloc Returns a buffer of the requested size, or NULL to decline.
+ * @param release Takes back a buffer; returns FALSE if it was not one of
+ *                the provider's buffers.
+ * @param cb_data Opaque pointer passed in by the caller.
+ *
+ * @return SR_OK upon success, SR_ERR_BUG if no session exists.
+ */
+SR_API int sr_session_buffer_provider_set(sr_buffer_alloc_callback_t alloc,
+		sr_buffer_release_callback_t release, void *cb_data)
+{
+	if (!session) {
+		sr_err("%s: session was NULL", __func__);
+		return SR_ERR_BUG;
+	}
+
+	if (!alloc != !release) {
+		sr_err("%s: alloc and release must be set together", __func__);
+		return SR_ERR_ARG;
+	}
+
+	session->buffer_alloc = alloc;
+	session->buffer_release = release;
+	session->buffer_cb_data = cb_data;
+
+	return SR_OK;
+}
+
+/**
+ * Get an acquisition buffer from the session's buffer provider.
+ *
+ * @return The buffer, or NULL if there is no provider or it declined.
+ *
+ * @private
+ */
+SR_PRIV void *sr_session_buffer_alloc(size_t size)
+{
+	if (!session || !session->buffer_alloc)
+		return NULL;
+
+	return session->buffer_alloc(size, session->buffer_cb_data);
+}
+
+/**
+ * Hand a buffer back to the session's buffer provider.
+ *
+ * @return TRUE if the provider took it back, FALSE if the buffer is
+ *         still owned by the caller.
+ *
+ * @private
+ */
+SR_PRIV gboolean sr_session_buffer_release(void *buf)
+{
+	if (!buf || !session || !session->buffer_release)
+		return FALSE;
+
+	return session->buffer_release(buf, session->buffer_cb_data);
+}
+
 /**
  * Call every device in the session's callback.
  *
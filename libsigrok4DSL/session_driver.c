@@ -92,6 +92,54 @@ struct session_vdev {
     uint32_t ref_max;
     uint8_t max_height;
     struct sr_status mstatus;
+
+    /* version 3: leaves are used in place from the mapped file */
+    GMappedFile *mapping;
+    GHashTable *entries;
+    /* version 2, loaded lazily: blocks are read by the receiver */
+    gboolean lazy;
+    struct sr_session_reader *reader;
+    uint8_t *index_buf;
+    /* block index, in the mapping or in index_buf */
+    const uint8_t *index;
+    uint64_t leaf_samples;
+    uint64_t leaf_size;
+    uint64_t index_channels;
+
+    /* version 2, loaded at once: blocks are decompressed on a pool */
+    GThreadPool *pool;
+    GMutex pool_mutex;
+    GCond pool_cond;
+    struct block_job *jobs;
+    int *next_block;
+    int jobs_queued;
+    int jobs_pending;
+    int jobs_left;
+    int pool_limit;
+
+    /* a file of another format, loaded by its input module */
+    struct sr_input *input;
+};
+
+/*
+ * One block of one channel, decompressed by the pool. Jobs are queued
+ * block after block across all channels, so that every channel makes
+ * progress, but each channel is sent in block order.
+ */
+struct block_job {
+    int channel;
+    int block;
+    int probe_index;
+    void *buf;
+    uint64_t size;
+    int ret;
+    gboolean done;
+};
+
+/* A stored (uncompressed) entry of the mapped session file. */
+struct map_entry {
+    const uint8_t *data;
+    uint64_t size;
 };
 
 static GSList *dev_insts = NULL;
@@ -160,8 +208,483 @@ static int trans_data(struct sr_dev_inst *sdi)
     return SR_OK;
 }
 
+static uint16_t rd16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return rd16(p) | ((uint32_t)rd16(p + 2) << 16);
+}
+
+static uint64_t rd64(const uint8_t *p)
+{
+    return rd32(p) | ((uint64_t)rd32(p + 4) << 32);
+}
+
+/*
+ * List the stored entries of a mapped zip file, by walking its central
+ * directory. libzip can only copy entries out, so this is done by hand.
+ */
+static GHashTable *map_entries(const uint8_t *base, uint64_t len)
+{
+    const uint8_t *p, *end, *eocd = NULL;
+    const uint8_t *extra, *extra_end, *f, *fend;
+    uint64_t cd_offset, cd_size, count, i, pos, loc;
+    uint64_t size, comp_size, local, data;
+    uint16_t method, name_len, extra_len, comment_len, id;
+    struct map_entry *entry;
+    GHashTable *entries;
+
+    if (len < 22)
+        return NULL;
+
+    /* end of central directory record, followed by up to 64k of comment */
+    for (pos = len - 22; ; pos--) {
+        if (rd32(base + pos) == 0x06054b50) {
+            eocd = base + pos;
+            break;
+        }
+        if (pos == 0 || len - pos > 22 + 0xffff)
+            break;
+    }
+    if (!eocd)
+        return NULL;
+
+    count = rd16(eocd + 10);
+    cd_size = rd32(eocd + 12);
+    cd_offset = rd32(eocd + 16);
+    /* zip64, the locator is right before the record */
+    if ((count == 0xffff || cd_size == 0xffffffff || cd_offset == 0xffffffff) &&
+        eocd - base >= 20 && rd32(eocd - 20) == 0x07064b50) {
+        loc = rd64(eocd - 20 + 8);
+        if (loc > len - 56 || rd32(base + loc) != 0x06064b50)
+            return NULL;
+        count = rd64(base + loc + 32);
+        cd_size = rd64(base + loc + 40);
+        cd_offset = rd64(base + loc + 48);
+    }
+    if (cd_offset > len || cd_size > len - cd_offset)
+        return NULL;
+
+    entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    p = base + cd_offset;
+    end = p + cd_size;
+    for (i = 0; i < count && end - p >= 46 && rd32(p) == 0x02014b50; i++) {
+        method = rd16(p + 10);
+        comp_size = rd32(p + 20);
+        size = rd32(p + 24);
+        name_len = rd16(p + 28);
+        extra_len = rd16(p + 30);
+        comment_len = rd16(p + 32);
+        local = rd32(p + 42);
+        if (end - p < 46 + name_len + extra_len + comment_len)
+            break;
+
+        /* zip64 extended information, holds the fields saturated above */
+        extra = p + 46 + name_len;
+        extra_end = extra + extra_len;
+        while (extra_end - extra >= 4) {
+            id = rd16(extra);
+            f = extra + 4;
+            fend = f + rd16(extra + 2);
+            if (fend > extra_end)
+                break;
+            if (id == 0x0001) {
+                if (size == 0xffffffff && fend - f >= 8) {
+                    size = rd64(f);
+                    f += 8;
+                }
+                if (comp_size == 0xffffffff && fend - f >= 8) {
+                    comp_size = rd64(f);
+                    f += 8;
+                }
+                if (local == 0xffffffff && fend - f >= 8)
+                    local = rd64(f);
+            }
+            extra = fend;
+        }
+
+        /* only stored entries can be used in place */
+        if (method == 0 && comp_size == size && local <= len - 30 &&
+            rd32(base + local) == 0x04034b50) {
+            data = local + 30 + rd16(base + local + 26) + rd16(base + local + 28);
+            if (data <= len && size <= len - data) {
+                entry = g_new(struct map_entry, 1);
+                entry->data = base + data;
+                entry->size = size;
+                g_hash_table_insert(entries,
+                        g_strndup((const char *)p + 46, name_len), entry);
+            }
+        }
+        p += 46 + name_len + extra_len + comment_len;
+    }
+
+    return entries;
+}
+
+/*
+ * Check the block "index" of a session file:
+ *   uint64 samples per leaf, uint64 leaf size (samples and mipmap),
+ *   uint64 channels, uint64 blocks, then for each channel:
+ *   uint64 probe index, one bit per block set for blocks with edges,
+ *   one bit per block for the last sample of the block.
+ * All little-endian. Version 3 stores a leaf for each block with edges,
+ * in host byte order. The leaf geometry must be the one of LA_LEAF_DATA.
+ */
+static int index_check(struct session_vdev *vdev, const uint8_t *index,
+        uint64_t size)
+{
+    uint64_t words;
+
+    if (size < 32)
+        return SR_ERR;
+
+    vdev->leaf_samples = rd64(index);
+    vdev->leaf_size = rd64(index + 8);
+    vdev->index_channels = rd64(index + 16);
+    words = (rd64(index + 24) + 63) / 64;
+    if (vdev->leaf_samples != LA_LEAF_SAMPLES ||
+        vdev->leaf_size != LA_LEAF_SPACE ||
+        rd64(index + 24) != (uint64_t)vdev->num_blocks ||
+        size != 32 + vdev->index_channels * (2 * words + 1) * 8)
+        return SR_ERR;
+
+    vdev->index = index;
+    return SR_OK;
+}
+
+/* Map a version 3 file, and check its "index". */
+static int map_open(struct session_vdev *vdev)
+{
+    GError *error = NULL;
+    const struct map_entry *index;
+
+    if (!(vdev->mapping = g_mapped_file_new(vdev->sessionfile, FALSE, &error))) {
+        sr_err("Failed to map session file '%s': %s.",
+               vdev->sessionfile, error->message);
+        g_error_free(error);
+        return SR_ERR;
+    }
+
+    vdev->entries = map_entries(
+            (const uint8_t *)g_mapped_file_get_contents(vdev->mapping),
+            g_mapped_file_get_length(vdev->mapping));
+    if (!vdev->entries ||
+        !(index = g_hash_table_lookup(vdev->entries, "index"))) {
+        sr_err("No block index in session file '%s'.", vdev->sessionfile);
+        return SR_ERR;
+    }
+    if (index_check(vdev, index->data, index->size) != SR_OK) {
+        sr_err("Invalid block index in session file '%s'.", vdev->sessionfile);
+        return SR_ERR;
+    }
+
+    return SR_OK;
+}
+
+/*
+ * Read the "index" of a version 2 file, its blocks are then read by the
+ * receiver when needed. Files saved without an index are loaded as usual.
+ */
+static int lazy_open(struct session_vdev *vdev)
+{
+    struct zip_stat zs;
+    struct zip_file *zf;
+
+    if (zip_stat(vdev->archive, "index", 0, &zs) == -1 ||
+        !(vdev->index_buf = g_try_malloc(zs.size + 1)))
+        return SR_ERR;
+
+    if (!(zf = zip_fopen_index(vdev->archive, zs.index, 0)))
+        return SR_ERR;
+    if (zip_fread(zf, vdev->index_buf, zs.size) != (zip_int64_t)zs.size) {
+        zip_fclose(zf);
+        return SR_ERR;
+    }
+    zip_fclose(zf);
+
+    if (index_check(vdev, vdev->index_buf, zs.size) != SR_OK) {
+        sr_err("Invalid block index in session file '%s'.", vdev->sessionfile);
+        return SR_ERR;
+    }
+    if (!(vdev->reader = sr_session_reader_new(vdev->sessionfile, vdev->version)))
+        return SR_ERR;
+
+    return SR_OK;
+}
+
+static void index_close(struct session_vdev *vdev)
+{
+    if (vdev->entries)
+        g_hash_table_destroy(vdev->entries);
+    vdev->entries = NULL;
+    /* leaves and lazy blocks still in use hold their own reference */
+    if (vdev->mapping)
+        g_mapped_file_unref(vdev->mapping);
+    vdev->mapping = NULL;
+    sr_session_reader_unref(vdev->reader);
+    vdev->reader = NULL;
+    g_free(vdev->index_buf);
+    vdev->index_buf = NULL;
+    vdev->index = NULL;
+}
+
+/* The edge (0) or last sample (1) bit of a block. */
+static gboolean index_bit(const struct session_vdev *vdev,
+        int probe_index, int block, int field)
+{
+    const uint64_t words = (vdev->num_blocks + 63) / 64;
+    const uint8_t *p = vdev->index + 32;
+    uint64_t ch;
+
+    for (ch = 0; ch < vdev->index_channels; ch++, p += (2 * words + 1) * 8) {
+        if (rd64(p) == (uint64_t)probe_index)
+            return (rd64(p + 8 + (field * words + block / 64) * 8) >> (block % 64)) & 1;
+    }
+
+    return FALSE;
+}
+
+static void block_proc(gpointer data, gpointer user_data)
+{
+    struct block_job *job = data;
+    struct session_vdev *vdev = user_data;
+    uint64_t size = 0;
+
+    job->ret = sr_session_reader_size(vdev->reader, job->block,
+            job->probe_index, SR_CHANNEL_LOGIC, &size);
+    if (job->ret == SR_OK && !(job->buf = g_try_malloc(size ? size : 1)))
+        job->ret = SR_ERR_MALLOC;
+    if (job->ret == SR_OK)
+        job->ret = sr_session_reader_read(vdev->reader, job->block,
+                job->probe_index, SR_CHANNEL_LOGIC, job->buf, size, &job->size);
+
+    g_mutex_lock(&vdev->pool_mutex);
+    job->done = TRUE;
+    g_cond_signal(&vdev->pool_cond);
+    g_mutex_unlock(&vdev->pool_mutex);
+}
+
+/* Keep up to pool_limit decompressed blocks in flight. */
+static void pool_queue(struct session_vdev *vdev)
+{
+    const int total = vdev->num_probes * vdev->num_blocks;
+
+    while (vdev->jobs_pending < vdev->pool_limit && vdev->jobs_queued < total) {
+        g_thread_pool_push(vdev->pool, &vdev->jobs[vdev->jobs_queued], NULL);
+        vdev->jobs_queued++;
+        vdev->jobs_pending++;
+    }
+}
+
+/*
+ * Decompress the logic blocks of a version 2 file on a thread pool.
+ * The zip archive is only read by one thread at a time, but inflating
+ * the blocks, which is most of the work, runs in parallel.
+ */
+static int pool_open(struct session_vdev *vdev, const struct sr_dev_inst *sdi)
+{
+    struct block_job *job;
+    struct sr_channel *probe;
+    GError *error = NULL;
+    GSList *l;
+    int ch, block, threads;
+
+    if (!(vdev->next_block = g_try_new0(int, vdev->num_probes + 1)) ||
+        !(vdev->jobs = g_try_new0(struct block_job,
+                                  vdev->num_probes * vdev->num_blocks + 1))) {
+        sr_err("%s: jobs malloc failed", __func__);
+        g_free(vdev->next_block);
+        vdev->next_block = NULL;
+        return SR_ERR_MALLOC;
+    }
+    g_mutex_init(&vdev->pool_mutex);
+    g_cond_init(&vdev->pool_cond);
+    vdev->jobs_queued = 0;
+    vdev->jobs_pending = 0;
+    for (l = sdi->channels, ch = 0; l && ch < vdev->num_probes; l = l->next, ch++) {
+        probe = l->data;
+        for (block = 0; block < vdev->num_blocks; block++) {
+            job = &vdev->jobs[block * vdev->num_probes + ch];
+            job->channel = ch;
+            job->block = block;
+            job->probe_index = probe->index;
+        }
+    }
+
+    if (!(vdev->reader = sr_session_reader_new(vdev->sessionfile, vdev->version)))
+        return SR_ERR;
+
+#if GLIB_CHECK_VERSION(2, 36, 0)
+    threads = MAX(g_get_num_processors(), 1);
+#else
+    threads = 4;
+#endif
+    if (!(vdev->pool = g_thread_pool_new(block_proc, vdev, threads, FALSE, &error))) {
+        sr_err("Failed to create loader threads: %s.", error->message);
+        g_error_free(error);
+        return SR_ERR;
+    }
+    /* bounds the memory held by blocks waiting to be sent */
+    vdev->pool_limit = 2 * threads;
+    vdev->jobs_left = vdev->num_probes * vdev->num_blocks;
+    pool_queue(vdev);
+
+    return SR_OK;
+}
+
+static void pool_close(struct session_vdev *vdev)
+{
+    int i;
+
+    if (!vdev->jobs)
+        return;
+
+    /* drop queued jobs, wait for running ones */
+    if (vdev->pool)
+        g_thread_pool_free(vdev->pool, TRUE, TRUE);
+    vdev->pool = NULL;
+    for (i = 0; i < vdev->jobs_queued; i++)
+        g_free(vdev->jobs[i].buf);
+    g_free(vdev->jobs);
+    vdev->jobs = NULL;
+    g_free(vdev->next_block);
+    vdev->next_block = NULL;
+    g_mutex_clear(&vdev->pool_mutex);
+    g_cond_clear(&vdev->pool_cond);
+}
+
+/* The first decompressed block that is next in order for its channel. */
+static struct block_job *pool_ready(struct session_vdev *vdev)
+{
+    struct block_job *job;
+    int ch, i;
+
+    for (ch = 0; ch < vdev->num_probes; ch++) {
+        if (vdev->next_block[ch] >= vdev->num_blocks)
+            continue;
+        i = vdev->next_block[ch] * vdev->num_probes + ch;
+        job = &vdev->jobs[i];
+        if (i < vdev->jobs_queued && job->done)
+            return job;
+    }
+
+    return NULL;
+}
+
+/*
+ * Send one block decompressed by the pool, waiting shortly for one
+ * if none is ready yet.
+ */
+static int send_block(const struct sr_dev_inst *cb_sdi, struct session_vdev *vdev)
+{
+    struct sr_datafeed_packet packet;
+    struct sr_datafeed_logic logic;
+    struct block_job *job;
+    gint64 end_time;
+
+    g_mutex_lock(&vdev->pool_mutex);
+    end_time = g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND;
+    while (!(job = pool_ready(vdev)) &&
+           g_cond_wait_until(&vdev->pool_cond, &vdev->pool_mutex, end_time))
+        ;
+    g_mutex_unlock(&vdev->pool_mutex);
+
+    if (!job)
+        return SR_OK;
+    if (job->ret != SR_OK) {
+        sr_err("Failed to read block %d of channel %d in session file '%s'.",
+               job->block, job->probe_index, vdev->sessionfile);
+        return SR_ERR;
+    }
+
+    packet.type = SR_DF_LOGIC;
+    packet.status = SR_PKT_OK;
+    packet.payload = &logic;
+    logic.format = LA_SPLIT_DATA;
+    logic.index = job->probe_index;
+    logic.order = job->channel;
+    logic.length = job->size;
+    logic.data_error = 0;
+    logic.data = job->buf;
+    vdev->bytes_read += job->size;
+    sr_session_send(cb_sdi, &packet);
+
+    g_free(job->buf);
+    job->buf = NULL;
+    vdev->next_block[job->channel]++;
+    vdev->jobs_pending--;
+    if (--vdev->jobs_left == 0)
+        vdev->cur_channel = vdev->num_probes;
+    pool_queue(vdev);
+
+    return SR_OK;
+}
+
+/*
+ * Send the next block of a version 3 file without copying it, or only
+ * its index entry if the file is loaded lazily.
+ */
+static int send_leaf(const struct sr_dev_inst *cb_sdi,
+        struct sr_dev_inst *sdi, struct session_vdev *vdev)
+{
+    struct sr_datafeed_packet packet;
+    struct sr_datafeed_logic logic;
+    struct sr_datafeed_leaf leaf;
+    const struct map_entry *entry;
+    struct sr_channel *probe;
+    char file_name[32];
+    uint64_t samples;
+
+    probe = g_slist_nth_data(sdi->channels, vdev->cur_channel);
+    entry = NULL;
+    if (vdev->entries) {
+        snprintf(file_name, 31, "L-%d/%d", probe->index, vdev->cur_block);
+        entry = g_hash_table_lookup(vdev->entries, file_name);
+        if (entry && entry->size != vdev->leaf_size) {
+            sr_err("Invalid leaf '%s' in session file '%s'.",
+                   file_name, vdev->sessionfile);
+            return SR_ERR;
+        }
+    }
+
+    leaf.leaf = entry ? entry->data : NULL;
+    leaf.value = index_bit(vdev, probe->index, vdev->cur_block, 1);
+    leaf.edges = index_bit(vdev, probe->index, vdev->cur_block, 0);
+    /* leaves are used in place as uint64_t arrays, files written by
+     * other zip tools may not align them: those are copied */
+    leaf.mapping = ((uintptr_t)leaf.leaf % sizeof(uint64_t)) ? NULL : vdev->mapping;
+    leaf.reader = vdev->reader;
+
+    samples = vdev->total_samples - vdev->cur_block * vdev->leaf_samples;
+    samples = MIN(samples, vdev->leaf_samples);
+
+    packet.type = SR_DF_LOGIC;
+    packet.status = SR_PKT_OK;
+    packet.payload = &logic;
+    logic.format = LA_LEAF_DATA;
+    logic.index = probe->index;
+    logic.order = vdev->cur_channel;
+    logic.length = samples / 8;
+    logic.data_error = 0;
+    logic.data = &leaf;
+    vdev->bytes_read += logic.length;
+    sr_session_send(cb_sdi, &packet);
+
+    if (++vdev->cur_block == vdev->num_blocks) {
+        vdev->cur_block = 0;
+        vdev->cur_channel++;
+    }
+
+    return SR_OK;
+}
+
 static int file_close(struct session_vdev *vdev)
 {
+    pool_close(vdev);
+    index_close(vdev);
     int ret = zip_close(vdev->archive);
     if (ret  == -1) {
         sr_info("error close session file: %s", zip_strerror(vdev->archive));
@@ -201,7 +724,18 @@ static int receive_data(int fd, int revents, const struct sr_dev_inst *cb_sdi)
 
         assert(vdev->unit_bits > 0);
         assert(vdev->cur_channel >= 0);
-        if (vdev->cur_channel < vdev->num_probes) {
+        if ((vdev->index || vdev->pool) &&
+            vdev->cur_channel < vdev->num_probes) {
+            if ((vdev->pool ? send_block(cb_sdi, vdev) :
+                              send_leaf(cb_sdi, sdi, vdev)) != SR_OK) {
+                packet.type = SR_DF_END;
+                packet.status = SR_PKT_SOURCE_ERROR;
+                sr_session_send(cb_sdi, &packet);
+                sr_session_source_remove(-1);
+                file_close(vdev);
+                return FALSE;
+            }
+        } else if (vdev->cur_channel < vdev->num_probes) {
             if (vdev->version == 1) {
                 ret = zip_fread(vdev->capfile, vdev->buf, CHUNKSIZE);
             } else if (vdev->version == 2) {
@@ -309,6 +843,21 @@ static int receive_data(int fd, int revents, const struct sr_dev_inst *cb_sdi)
 	return TRUE;
 }
 
+/* Load the next part of an imported file, see sr_input_dev_inst_new(). */
+static int receive_input(int fd, int revents, const struct sr_dev_inst *cb_sdi)
+{
+    const struct session_vdev *vdev = cb_sdi->priv;
+    struct sr_input *in = vdev->input;
+
+    (void)fd;
+
+    if (in->format->receive(in, revents, cb_sdi))
+        return TRUE;
+
+    sr_session_source_remove(-1);
+    return FALSE;
+}
+
 /* driver callbacks */
 static int dev_clear(void);
 
@@ -379,6 +928,8 @@ static int dev_open(struct sr_dev_inst *sdi)
 static int dev_close(struct sr_dev_inst *sdi)
 {
     const struct session_vdev *const vdev = sdi->priv;
+    if (vdev->input && vdev->input->format->cleanup)
+        vdev->input->format->cleanup(vdev->input);
     g_free(vdev->sessionfile);
     g_free(vdev->capturefile);
     g_free(vdev->buf);
@@ -638,6 +1189,10 @@ static int config_set(int id, GVariant *data, struct sr_dev_inst *sdi,
         vdev->version = g_variant_get_int16(data);
         sr_info("Setting file version to '%d'.", vdev->version);
         break;
+    case SR_CONF_LAZY_LOAD:
+        vdev->lazy = g_variant_get_boolean(data);
+        sr_info("Setting lazy load to %d.", vdev->lazy);
+        break;
     case SR_CONF_LIMIT_SAMPLES:
         vdev->total_samples = g_variant_get_uint64(data);
         samplecounts[0] = vdev->total_samples;
@@ -898,6 +1453,14 @@ static int dev_acquisition_start(struct sr_dev_inst *sdi,
     vdev->enabled_probes = 0;
     packet.status = SR_PKT_OK;
 
+    if (vdev->input) {
+        sr_info("Importing %s as %s", vdev->sessionfile,
+                vdev->input->format->description);
+        std_session_send_df_header(sdi, LOG_PREFIX);
+        sr_session_source_add(-1, 0, 0, receive_input, sdi);
+        return SR_OK;
+    }
+
 	sr_info("Opening archive %s file %s", vdev->sessionfile,
 		vdev->capturefile);
 
@@ -921,6 +1484,32 @@ static int dev_acquisition_start(struct sr_dev_inst *sdi,
         }
         vdev->file_opened = TRUE;
         vdev->cur_channel = vdev->num_probes - 1;
+    } else if (vdev->version == 3) {
+        if (sdi->mode != LOGIC || map_open(vdev) != SR_OK) {
+            index_close(vdev);
+            zip_close(vdev->archive);
+            return SR_ERR;
+        }
+        vdev->cur_channel = 0;
+        vdev->cur_block = 0;
+    } else if (vdev->version == 2 && vdev->lazy && sdi->mode == LOGIC &&
+               zip_stat(vdev->archive, "index", 0, &zs) != -1) {
+        if (lazy_open(vdev) != SR_OK) {
+            index_close(vdev);
+            zip_close(vdev->archive);
+            return SR_ERR;
+        }
+        vdev->cur_channel = 0;
+        vdev->cur_block = 0;
+    } else if (vdev->version == 2 && sdi->mode == LOGIC) {
+        if (pool_open(vdev, sdi) != SR_OK) {
+            pool_close(vdev);
+            index_close(vdev);
+            zip_close(vdev->archive);
+            return SR_ERR;
+        }
+        vdev->cur_channel = vdev->jobs_left ? 0 : vdev->num_probes;
+        vdev->cur_block = 0;
     } else {
         if (sdi->mode == LOGIC)
             vdev->cur_channel = 0;
@@ -976,3 +1565,37 @@ SR_PRIV struct sr_dev_driver session_driver = {
     .dev_acquisition_stop = NULL,
     .priv = NULL,
 };
+
+/**
+ * Create the device of a file that an input module loads: a session
+ * device, so that frontends handle it like a loaded session file.
+ * The module sets the samplerate, sample count and channels on it.
+ *
+ * @param in The input, loaded through its receive() callback.
+ * @param mode The device mode, LOGIC or ANALOG.
+ * @param filename The file to load.
+ *
+ * @return The device, or NULL upon errors.
+ */
+SR_PRIV struct sr_dev_inst *sr_input_dev_inst_new(struct sr_input *in,
+        int mode, const char *filename)
+{
+    struct sr_dev_inst *sdi;
+    struct session_vdev *vdev;
+
+    assert(in->format->receive);
+
+    if (!(sdi = sr_dev_inst_new(mode, 0, SR_ST_ACTIVE, NULL, NULL, NULL)))
+        return NULL;
+    sdi->driver = &session_driver;
+    if (sr_dev_open(sdi) != SR_OK) {
+        sr_dev_inst_free(sdi);
+        return NULL;
+    }
+
+    vdev = sdi->priv;
+    vdev->input = in;
+    vdev->sessionfile = g_strdup(filename);
+
+    return sdi;
+}
@@ -22,7 +22,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <zip.h>
+#include <zlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -54,6 +56,77 @@
 extern struct sr_session *session;
 extern SR_PRIV struct sr_dev_driver session_driver;
 
+/* Per-entry compression methods need libzip 1.0, levels libzip 1.2. */
+#if defined(LIBZIP_VERSION_MAJOR) && LIBZIP_VERSION_MAJOR >= 1
+#define HAVE_ZIP_SET_COMPRESSION 1
+#endif
+
+/* Recordings grow past 2GB, also on 32-bit Windows. */
+#ifdef _WIN32
+#define fseeko _fseeki64
+#endif
+
+/* Progress reporting while the archive is written needs libzip 1.3. */
+#if defined(LIBZIP_VERSION_MAJOR) && defined(LIBZIP_VERSION_MINOR) && \
+    (LIBZIP_VERSION_MAJOR > 1 || (LIBZIP_VERSION_MAJOR == 1 && LIBZIP_VERSION_MINOR >= 3))
+#define HAVE_ZIP_PROGRESS 1
+#endif
+
+struct sr_session_writer {
+	struct zip *archive;
+	char *filename;
+	char *metafile;
+	char *decfile;
+	int codec;
+	int level;
+	sr_session_progress_callback_t progress_cb;
+	void *progress_data;
+};
+
+/* Shared, reference counted read access to the data of a session file. */
+struct sr_session_reader {
+	struct zip *archive;
+	int version;
+	GMutex mutex;
+	gint refs;
+};
+
+/* An entry of a session file that is being recorded. */
+struct recorder_entry {
+	char *name;
+	uint16_t method;
+	uint32_t crc;
+	uint64_t comp_size;
+	uint64_t size;
+	/* of the local header */
+	uint64_t offset;
+};
+
+/*
+ * A session file written while the capture goes on, or saved chunk by
+ * chunk. libzip only writes an archive when it is closed, holding all
+ * of it until then, so the zip structure is written here: entries,
+ * also the ones added again, are appended, and every sync writes a
+ * central directory for all of them after the last entry. The next
+ * entry is written over that directory, so there is a single one
+ * whatever the number of syncs, and the file only ever grows: each
+ * directory is at least as large as the one before. The file is valid
+ * after each sync; entries added after it invalidate it until the next
+ * one, though their local headers carry the sizes, so that a zip
+ * repair tool still recovers them. Always zip64, recordings are large.
+ */
+struct sr_session_recorder {
+	FILE *file;
+	uint16_t dos_time;
+	uint16_t dos_date;
+	/* end of the entries, where the next entry or directory goes */
+	uint64_t end;
+	GArray *entries;
+	/* entry name -> position in entries + 1 */
+	GHashTable *names;
+	gboolean failed;
+};
+
 /** @private */
 SR_PRIV int sr_sessionfile_check(const char *filename)
 {
@@ -169,11 +242,29 @@ SR_API int sr_session_load(const char *filename)
 		return SR_ERR;
 	}
 
+	/* chunks are decompressed by libzip, per entry: reject unknown
+	 * codecs before anything is set up for the file */
+	sections = g_key_file_get_groups(kf, NULL);
+	for (i = 0; sections[i]; i++) {
+        if (strncmp(sections[i], "header", 6))
+            continue;
+        val = g_key_file_get_string(kf, sections[i], "compression", NULL);
+        if (val && sr_session_codec_parse(val) < 0) {
+            sr_err("Unsupported session file compression: %s.", val);
+            g_free(val);
+            g_strfreev(sections);
+            g_key_file_free(kf);
+            g_free(metafile);
+            zip_discard(archive);
+            return SR_ERR;
+        }
+        g_free(val);
+	}
+
 	sr_session_new();
 
 	devcnt = 0;
 	capturefiles = g_ptr_array_new_with_free_func(g_free);
-	sections = g_key_file_get_groups(kf, NULL);
 	for (i = 0; sections[i]; i++) {
         if (!strcmp(sections[i], "version")) {
             keys = g_key_file_get_keys(kf, sections[i], NULL, NULL);
@@ -181,6 +272,10 @@ SR_API int sr_session_load(const char *filename)
                 val = g_key_file_get_string(kf, sections[i], keys[j], NULL);
                 if (!strcmp(keys[j], "version")) {
                     version = strtoull(val, NULL, 10);
+                    if (version > 3) {
+                        sr_err("Cannot handle DSView data file version %d.", version);
+                        return SR_ERR;
+                    }
                 }
             }
         }
@@ -208,6 +303,8 @@ SR_API int sr_session_load(const char *filename)
 					g_ptr_array_add(capturefiles, val);
                     sdi->driver->config_set(SR_CONF_FILE_VERSION,
                             g_variant_new_int16(version), sdi, NULL, NULL);
+                } else if (!strcmp(keys[j], "compression")) {
+                    /* checked above */
 				} else if (!strcmp(keys[j], "samplerate")) {
 					sr_parse_sizestring(val, &tmp_u64);
 					sdi->driver->config_set(SR_CONF_SAMPLERATE,
@@ -276,7 +373,7 @@ SR_API int sr_session_load(const char *filename)
                     if (version == 1) {
                         sr_dev_probe_name_set(sdi, tmp_u64, val);
                         sr_dev_probe_enable(sdi, tmp_u64, TRUE);
-                    } else if (version == 2) {
+                    } else if (version >= 2) {
                         channel_type = (mode == DSO) ? SR_CHANNEL_DSO :
                                        (mode == ANALOG) ? SR_CHANNEL_ANALOG : SR_CHANNEL_LOGIC;
                         if (!(probe = sr_channel_new(tmp_u64, channel_type, TRUE,
@@ -635,4 +732,908 @@ err:
     return SR_ERR;
 }
 
+/**
+ * Open a session file for writing.
+ *
+ * Unlike sr_session_save_init() followed by sr_session_append() per
+ * chunk, the archive stays open until sr_session_writer_close(), so
+ * the central directory is written once instead of once per chunk.
+ *
+ * The temporary metafile and decfile are read when the writer is
+ * closed, and removed afterwards.
+ *
+ * @param filename The name of the session file to create. Must not be NULL.
+ * @param metafile Header file. Must not be NULL.
+ * @param decfile Decoders file, or NULL.
+ * @param sesfile Session file, or NULL.
+ *
+ * @return The writer, or NULL upon errors.
+ */
+SR_API struct sr_session_writer *sr_session_writer_new(const char *filename,
+        const char *metafile, const char *decfile, const char *sesfile)
+{
+    struct sr_session_writer *writer;
+    struct zip_source *src;
+    int ret;
+
+    if (!filename || !metafile) {
+        sr_err("%s: filename was NULL", __func__);
+        return NULL;
+    }
+
+    if (!(writer = g_try_malloc0(sizeof(struct sr_session_writer)))) {
+        sr_err("%s: writer malloc failed", __func__);
+        return NULL;
+    }
+    writer->filename = g_strdup(filename);
+    writer->metafile = g_strdup(metafile);
+    writer->decfile = g_strdup(decfile);
+    writer->codec = SR_COMPRESS_DEFLATE;
+    writer->level = 6;
+
+    /* Quietly delete it first, libzip wants replace ops otherwise. */
+    unlink(filename);
+    if (!(writer->archive = zip_open(filename, ZIP_CREATE, &ret)))
+        goto err;
+
+    if (!(src = zip_source_file(writer->archive, metafile, 0, -1)) ||
+        zip_add(writer->archive, "header", src) == -1)
+        goto err;
+
+    if (decfile != NULL &&
+        (!(src = zip_source_file(writer->archive, decfile, 0, -1)) ||
+         zip_add(writer->archive, "decoders", src) == -1))
+        goto err;
+
+    if (sesfile != NULL &&
+        (!(src = zip_source_file(writer->archive, sesfile, 0, -1)) ||
+         zip_add(writer->archive, "session", src) == -1))
+        goto err;
+
+    return writer;
+
+err:
+    sr_session_writer_discard(writer);
+    return NULL;
+}
+
+/**
+ * Get the name of a session file codec, as recorded in the "header".
+ *
+ * @return The name, or NULL for an unknown codec.
+ */
+SR_API const char *sr_session_codec_name(int codec)
+{
+    switch (codec) {
+    case SR_COMPRESS_STORE:
+        return "store";
+    case SR_COMPRESS_DEFLATE:
+        return "deflate";
+    default:
+        return NULL;
+    }
+}
+
+/**
+ * Parse a codec name recorded in a session file "header".
+ *
+ * @return The codec, or -1 if it is not supported.
+ */
+SR_API int sr_session_codec_parse(const char *name)
+{
+    if (!name)
+        return -1;
+    if (!strcmp(name, "store"))
+        return SR_COMPRESS_STORE;
+    if (!strcmp(name, "deflate"))
+        return SR_COMPRESS_DEFLATE;
+    return -1;
+}
+
+/**
+ * Select how data chunks added with sr_session_writer_append() are
+ * compressed. The default is deflate at level 6, zlib's own default;
+ * level 9 saves a few percent more at several times the cost.
+ *
+ * @param codec SR_COMPRESS_STORE or SR_COMPRESS_DEFLATE.
+ * @param level Deflate level, 1 to 9.
+ */
+SR_API void sr_session_writer_set_compression(struct sr_session_writer *writer,
+        int codec, int level)
+{
+    if (!writer || !sr_session_codec_name(codec))
+        return;
+
+    writer->codec = codec;
+    writer->level = MAX(1, MIN(level, 9));
+}
+
+static void writer_chunk_name(char *chunk_name, int chunk_num, int index,
+        int type, int version)
+{
+    const char *type_name;
+
+    if (version >= 2) {
+        type_name = (type == SR_CHANNEL_LOGIC) ? "L" :
+                    (type == SR_CHANNEL_DSO) ? "O" :
+                    (type == SR_CHANNEL_ANALOG) ? "A" : "U";
+        snprintf(chunk_name, 15, "%s-%d/%d", type_name, index, chunk_num);
+    } else {
+        snprintf(chunk_name, 15, "data");
+    }
+}
+
+/**
+ * Add an entry to a session file opened with sr_session_writer_new().
+ *
+ * Nothing is compressed or written yet: the buffer is referenced until
+ * the writer is closed, so it must stay valid until then. With take_buf
+ * set, the writer owns it and frees it with free().
+ *
+ * The entry is compressed as selected with
+ * sr_session_writer_set_compression().
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR Other errors
+ */
+SR_API int sr_session_writer_add(struct sr_session_writer *writer,
+        const char *name, const unsigned char *buf, uint64_t size,
+        gboolean take_buf)
+{
+    struct zip_source *src;
+    zip_int64_t idx;
+
+    if (!writer || !writer->archive || !name || !buf)
+        return SR_ERR_ARG;
+
+    if (!(src = zip_source_buffer(writer->archive, buf, size, take_buf)))
+        return SR_ERR;
+    if ((idx = zip_file_add(writer->archive, name, src, ZIP_FL_OVERWRITE)) == -1) {
+        sr_info("error adding %s: %s", name, zip_strerror(writer->archive));
+        zip_source_free(src);
+        return SR_ERR;
+    }
+
+#ifdef HAVE_ZIP_SET_COMPRESSION
+    /* older libzip always deflates with its default level */
+    if (zip_set_file_compression(writer->archive, idx,
+            writer->codec == SR_COMPRESS_STORE ? ZIP_CM_STORE : ZIP_CM_DEFLATE,
+            writer->level) == -1)
+        sr_info("error setting compression of %s: %s", name,
+                zip_strerror(writer->archive));
+#else
+    (void)idx;
+#endif
+
+    return SR_OK;
+}
+
+/**
+ * Add a data chunk to a session file opened with sr_session_writer_new(),
+ * see sr_session_writer_add().
+ */
+SR_API int sr_session_writer_append(struct sr_session_writer *writer,
+        const unsigned char *buf, uint64_t size, int chunk_num, int index,
+        int type, int version, gboolean take_buf)
+{
+    char chunk_name[16];
+
+    writer_chunk_name(chunk_name, chunk_num, index, type, version);
+
+    return sr_session_writer_add(writer, chunk_name, buf, size, take_buf);
+}
+
+/**
+ * Compress a data chunk the way the zip "deflate" method stores it.
+ *
+ * Does not touch any session state, so chunks can be compressed on
+ * several threads at once, and added with
+ * sr_session_recorder_append_deflated() afterwards.
+ *
+ * @param level zlib compression level, 0 to 9.
+ * @param out Set to the compressed data, to be freed with g_free().
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_MALLOC Out of memory
+ * @retval SR_ERR Other errors
+ */
+SR_API int sr_session_deflate(const unsigned char *buf, uint64_t size, int level,
+        unsigned char **out, uint64_t *out_size, uint32_t *crc)
+{
+    z_stream strm;
+    uint64_t left, bound;
+    uLong sum;
+    uInt step;
+    int ret;
+
+    if (!buf || !out || !out_size || !crc)
+        return SR_ERR_ARG;
+
+    memset(&strm, 0, sizeof(strm));
+    /* negative window bits: raw deflate stream, as zip expects */
+    if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return SR_ERR;
+
+    bound = deflateBound(&strm, size > UINT32_MAX ? UINT32_MAX : size);
+    if (size > UINT32_MAX)
+        bound += size;
+    if (!(*out = g_try_malloc(bound))) {
+        deflateEnd(&strm);
+        return SR_ERR_MALLOC;
+    }
+
+    sum = crc32(0L, Z_NULL, 0);
+    strm.next_in = (Bytef *)buf;
+    strm.next_out = *out;
+    left = size;
+    do {
+        step = left > UINT32_MAX ? UINT32_MAX : (uInt)left;
+        sum = crc32(sum, strm.next_in, step);
+        strm.avail_in = step;
+        strm.avail_out = (bound - strm.total_out) > UINT32_MAX ?
+                         UINT32_MAX : (uInt)(bound - strm.total_out);
+        left -= step;
+        ret = deflate(&strm, left ? Z_NO_FLUSH : Z_FINISH);
+    } while (left && ret == Z_OK);
+    *out_size = strm.total_out;
+    deflateEnd(&strm);
+
+    if (ret != Z_STREAM_END) {
+        g_free(*out);
+        *out = NULL;
+        return SR_ERR;
+    }
+
+    *crc = sum;
+    return SR_OK;
+}
+
+/**
+ * Inflate a raw deflate stream, e.g. a compressed zip entry.
+ *
+ * @param buf The compressed data.
+ * @param out Filled with up to size bytes of decompressed data.
+ * @param out_size Set to the number of bytes decompressed.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR The stream is corrupt
+ */
+SR_API int sr_session_inflate(const unsigned char *buf, uint64_t size,
+        unsigned char *out, uint64_t out_max, uint64_t *out_size)
+{
+    z_stream strm;
+    uint64_t left;
+    uInt step;
+    int ret;
+
+    if (!buf || !out || !out_size)
+        return SR_ERR_ARG;
+
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK)
+        return SR_ERR;
+
+    strm.next_in = (Bytef *)buf;
+    strm.next_out = out;
+    left = size;
+    do {
+        if (!strm.avail_in) {
+            step = left > UINT32_MAX ? UINT32_MAX : (uInt)left;
+            strm.avail_in = step;
+            left -= step;
+        }
+        strm.avail_out = (out_max - strm.total_out) > UINT32_MAX ?
+                         UINT32_MAX : (uInt)(out_max - strm.total_out);
+        ret = inflate(&strm, Z_NO_FLUSH);
+    } while (ret == Z_OK && strm.total_out < out_max &&
+             (strm.avail_in || left));
+    *out_size = strm.total_out;
+    inflateEnd(&strm);
+
+    /* a truncated output buffer is not an error, like zip_fread() */
+    if (ret != Z_STREAM_END &&
+        !((ret == Z_OK || ret == Z_BUF_ERROR) && *out_size == out_max))
+        return SR_ERR;
+
+    return SR_OK;
+}
+
+#ifdef HAVE_ZIP_PROGRESS
+static void writer_progress(struct zip *archive, double progress, void *ud)
+{
+    struct sr_session_writer *writer = ud;
+
+    (void)archive;
+
+    writer->progress_cb(progress, writer->progress_data);
+}
+#endif
+
+/**
+ * Compress and write all chunks, then free the writer.
+ *
+ * @param cb Called with the progress (0..1) while writing, may be NULL.
+ *           Only called with libzip 1.3 or later.
+ * @param cb_data Opaque pointer passed to cb.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR The file could not be written, and has been removed.
+ */
+SR_API int sr_session_writer_close(struct sr_session_writer *writer,
+        sr_session_progress_callback_t cb, void *cb_data)
+{
+    int ret = SR_OK;
+
+    if (!writer)
+        return SR_ERR_ARG;
+
+    writer->progress_cb = cb;
+    writer->progress_data = cb_data;
+#ifdef HAVE_ZIP_PROGRESS
+    if (cb)
+        zip_register_progress_callback_with_state(writer->archive, 0.01,
+                writer_progress, NULL, writer);
+#endif
+
+    if (zip_close(writer->archive) == -1) {
+        sr_info("error saving session file: %s", zip_strerror(writer->archive));
+        ret = SR_ERR;
+    } else {
+        writer->archive = NULL;
+    }
+
+    /* Removes the file on failure, the temporary files in any case. */
+    sr_session_writer_discard(writer);
+
+    return ret;
+}
+
+/**
+ * Abandon a session file: nothing more is written, and the file is removed.
+ * Also frees a writer after sr_session_writer_close().
+ */
+SR_API void sr_session_writer_discard(struct sr_session_writer *writer)
+{
+    if (!writer)
+        return;
+
+    if (writer->archive) {
+        zip_discard(writer->archive);
+        unlink(writer->filename);
+    }
+    unlink(writer->metafile);
+    if (writer->decfile != NULL)
+        unlink(writer->decfile);
+
+    g_free(writer->filename);
+    g_free(writer->metafile);
+    g_free(writer->decfile);
+    g_free(writer);
+}
+
+/**
+ * Open a session file to read its data chunks on demand, e.g. blocks
+ * of a capture that is loaded lazily.
+ *
+ * @param version The file version, which selects how chunks are named.
+ *
+ * @return The reader, with one reference, or NULL upon errors.
+ */
+SR_API struct sr_session_reader *sr_session_reader_new(const char *filename,
+        int version)
+{
+    struct sr_session_reader *reader;
+    int ret;
+
+    if (!filename)
+        return NULL;
+
+    if (!(reader = g_try_malloc0(sizeof(struct sr_session_reader)))) {
+        sr_err("%s: reader malloc failed", __func__);
+        return NULL;
+    }
+    if (!(reader->archive = zip_open(filename, 0, &ret))) {
+        sr_err("Failed to open session file '%s': zip error %d.", filename, ret);
+        g_free(reader);
+        return NULL;
+    }
+    reader->version = version;
+    g_mutex_init(&reader->mutex);
+    reader->refs = 1;
+
+    return reader;
+}
+
+SR_API struct sr_session_reader *sr_session_reader_ref(
+        struct sr_session_reader *reader)
+{
+    if (reader)
+        g_atomic_int_inc(&reader->refs);
+    return reader;
+}
+
+SR_API void sr_session_reader_unref(struct sr_session_reader *reader)
+{
+    if (!reader || !g_atomic_int_dec_and_test(&reader->refs))
+        return;
+
+    zip_discard(reader->archive);
+    g_mutex_clear(&reader->mutex);
+    g_free(reader);
+}
+
+/**
+ * Get the uncompressed size of one data chunk of a session file.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR The chunk is missing
+ */
+SR_API int sr_session_reader_size(struct sr_session_reader *reader,
+        int chunk_num, int index, int type, uint64_t *size)
+{
+    struct zip_stat zs;
+    char chunk_name[16];
+    int ret;
+
+    if (!reader || !size)
+        return SR_ERR_ARG;
+
+    writer_chunk_name(chunk_name, chunk_num, index, type, reader->version);
+
+    g_mutex_lock(&reader->mutex);
+    ret = zip_stat(reader->archive, chunk_name, 0, &zs);
+    g_mutex_unlock(&reader->mutex);
+
+    if (ret == -1 || !(zs.valid & ZIP_STAT_SIZE)) {
+        sr_err("Failed to find '%s' in session file.", chunk_name);
+        return SR_ERR;
+    }
+
+    *size = zs.size;
+    return SR_OK;
+}
+
+/**
+ * Read (and decompress) one data chunk of a session file, as named by
+ * sr_session_writer_append(). Can be called from any thread. Access to
+ * the archive is serialized, but deflated chunks are only fetched raw
+ * under the lock and inflated afterwards, so several threads can
+ * decompress chunks in parallel.
+ *
+ * @param buf Filled with up to size bytes of the chunk.
+ * @param read Set to the number of bytes read, may be NULL.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR The chunk is missing or could not be read
+ */
+SR_API int sr_session_reader_read(struct sr_session_reader *reader,
+        int chunk_num, int index, int type, void *buf, uint64_t size,
+        uint64_t *read)
+{
+    struct zip_stat zs;
+    struct zip_file *zf = NULL;
+    char chunk_name[16];
+    unsigned char *raw = NULL;
+    zip_int64_t len = 0;
+    uint64_t done = 0;
+    uint64_t raw_size = 0;
+    int ret = SR_OK;
+
+    if (!reader || !buf)
+        return SR_ERR_ARG;
+
+    writer_chunk_name(chunk_name, chunk_num, index, type, reader->version);
+
+    /* a libzip archive can not be used by several threads */
+    g_mutex_lock(&reader->mutex);
+    if (zip_stat(reader->archive, chunk_name, 0, &zs) == -1) {
+        ret = SR_ERR;
+    } else if ((zs.valid & ZIP_STAT_COMP_METHOD) &&
+               (zs.valid & ZIP_STAT_COMP_SIZE) &&
+               zs.comp_method == ZIP_CM_DEFLATE) {
+        /* fetch the raw stream, inflate it outside the lock */
+        if (!(raw = g_try_malloc(zs.comp_size ? zs.comp_size : 1)))
+            ret = SR_ERR_MALLOC;
+        else if ((zf = zip_fopen_index(reader->archive, zs.index,
+                                       ZIP_FL_COMPRESSED))) {
+            while (raw_size < zs.comp_size &&
+                   (len = zip_fread(zf, raw + raw_size,
+                                    zs.comp_size - raw_size)) > 0)
+                raw_size += len;
+            zip_fclose(zf);
+        }
+    } else if ((zf = zip_fopen_index(reader->archive, zs.index, 0))) {
+        while (done < size &&
+               (len = zip_fread(zf, (uint8_t *)buf + done, size - done)) > 0)
+            done += len;
+        zip_fclose(zf);
+    }
+    g_mutex_unlock(&reader->mutex);
+
+    if (ret == SR_OK && (!zf || len < 0))
+        ret = SR_ERR;
+    if (ret == SR_OK && raw)
+        ret = sr_session_inflate(raw, raw_size, buf, size, &done);
+    g_free(raw);
+
+    /*
+     * The raw stream is not checked by libzip. Like zip_fread(), check
+     * the CRC once the entry is read up to its end.
+     */
+    if (ret == SR_OK && raw && (zs.valid & ZIP_STAT_CRC) &&
+        (zs.valid & ZIP_STAT_SIZE) && done == zs.size) {
+        uLong crc = crc32(0L, Z_NULL, 0);
+        uint64_t pos = 0;
+        uInt step;
+        while (pos < done) {
+            step = (done - pos) > UINT32_MAX ? UINT32_MAX : (uInt)(done - pos);
+            crc = crc32(crc, (const Bytef *)buf + pos, step);
+            pos += step;
+        }
+        if (crc != zs.crc) {
+            sr_err("CRC mismatch of '%s' in session file.", chunk_name);
+            ret = SR_ERR;
+        }
+    }
+
+    if (read)
+        *read = done;
+    if (ret != SR_OK)
+        sr_err("Failed to read '%s' from session file.", chunk_name);
+
+    return ret;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+static void put64(uint8_t *p, uint64_t v)
+{
+    put32(p, v & 0xffffffff);
+    put32(p + 4, v >> 32);
+}
+
+/**
+ * Create a session file to be written while a capture goes on. It is a
+ * valid session file after every sr_session_recorder_sync().
+ *
+ * @return The recorder, or NULL upon errors.
+ */
+SR_API struct sr_session_recorder *sr_session_recorder_new(const char *filename)
+{
+    struct sr_session_recorder *rec;
+    struct tm *tm;
+    time_t now;
+
+    if (!filename)
+        return NULL;
+
+    if (!(rec = g_try_malloc0(sizeof(struct sr_session_recorder)))) {
+        sr_err("%s: recorder malloc failed", __func__);
+        return NULL;
+    }
+    if (!(rec->file = g_fopen(filename, "wb"))) {
+        sr_err("Failed to create session file '%s': %s.",
+               filename, g_strerror(errno));
+        g_free(rec);
+        return NULL;
+    }
+    rec->entries = g_array_new(FALSE, FALSE, sizeof(struct recorder_entry));
+    rec->names = g_hash_table_new(g_str_hash, g_str_equal);
+
+    now = time(NULL);
+    tm = localtime(&now);
+    rec->dos_time = (tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2);
+    rec->dos_date = ((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday;
+
+    return rec;
+}
+
+static int recorder_write(struct sr_session_recorder *rec, uint64_t offset,
+        const void *buf, uint64_t size)
+{
+    if (rec->failed ||
+        fseeko(rec->file, offset, SEEK_SET) != 0 ||
+        (size && fwrite(buf, 1, size, rec->file) != size)) {
+        rec->failed = TRUE;
+        return SR_ERR;
+    }
+
+    return SR_OK;
+}
+
+/*
+ * Local header of an entry at offset, with the zip64 extra field, and
+ * padding so that the data is aligned to RECORDER_ALIGN: stored logic
+ * leaves are used in place, as arrays of uint64_t, from the mapped file.
+ */
+#define RECORDER_ALIGN 8
+#define RECORDER_PAD_ID 0xd935
+
+static uint64_t recorder_header_size(uint64_t offset, size_t name_len)
+{
+    const uint64_t size = 30 + name_len + 20;
+    uint64_t pad = (RECORDER_ALIGN - (offset + size) % RECORDER_ALIGN) % RECORDER_ALIGN;
+
+    /* the padding is an extra field of its own, with a 4 byte header */
+    if (pad != 0 && pad < 4)
+        pad += RECORDER_ALIGN;
+    return size + pad;
+}
+
+/*
+ * Append an entry. An entry that was written before is replaced, the
+ * next directory points to the new one.
+ */
+static int recorder_put(struct sr_session_recorder *rec, const char *name,
+        uint16_t method, const unsigned char *buf, uint64_t comp_size,
+        uint64_t size, uint32_t crc)
+{
+    struct recorder_entry entry, *e;
+    uint8_t header[30 + 255 + 20 + 4 + RECORDER_ALIGN];
+    const size_t name_len = strlen(name);
+    uint64_t header_size;
+    guint pos;
+
+    if (rec->failed)
+        return SR_ERR;
+    if (name_len > 255)
+        return SR_ERR_ARG;
+
+    pos = GPOINTER_TO_UINT(g_hash_table_lookup(rec->names, name));
+    if (pos == 0) {
+        memset(&entry, 0, sizeof(entry));
+        entry.name = g_strdup(name);
+        g_array_append_val(rec->entries, entry);
+        pos = rec->entries->len;
+        g_hash_table_insert(rec->names, entry.name, GUINT_TO_POINTER(pos));
+    }
+    e = &g_array_index(rec->entries, struct recorder_entry, pos - 1);
+    e->offset = rec->end;
+    header_size = recorder_header_size(e->offset, name_len);
+    rec->end += header_size + comp_size;
+    e->method = method;
+    e->crc = crc;
+    e->comp_size = comp_size;
+    e->size = size;
+
+    /* local header, the sizes are in the zip64 extra field */
+    put32(header, 0x04034b50);
+    put16(header + 4, 45);
+    put16(header + 6, 0);
+    put16(header + 8, method);
+    put16(header + 10, rec->dos_time);
+    put16(header + 12, rec->dos_date);
+    put32(header + 14, crc);
+    put32(header + 18, 0xffffffff);
+    put32(header + 22, 0xffffffff);
+    put16(header + 26, name_len);
+    put16(header + 28, header_size - 30 - name_len);
+    memcpy(header + 30, name, name_len);
+    put16(header + 30 + name_len, 0x0001);
+    put16(header + 30 + name_len + 2, 16);
+    put64(header + 30 + name_len + 4, size);
+    put64(header + 30 + name_len + 12, comp_size);
+    if (header_size > 30 + name_len + 20) {
+        put16(header + 30 + name_len + 20, RECORDER_PAD_ID);
+        put16(header + 30 + name_len + 22, header_size - (30 + name_len + 24));
+        memset(header + 30 + name_len + 24, 0, header_size - (30 + name_len + 24));
+    }
+
+    if (recorder_write(rec, e->offset, header, header_size) != SR_OK ||
+        recorder_write(rec, e->offset + header_size, buf, comp_size) != SR_OK) {
+        sr_err("Failed to write '%s' to session file: %s.",
+               name, g_strerror(errno));
+        return SR_ERR;
+    }
+
+    return SR_OK;
+}
+
+/**
+ * Add an uncompressed entry to a recorded session file. Adding an entry
+ * again replaces it from the next sync on, e.g. to update the "header"
+ * while recording.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR_ARG Invalid arguments
+ * @retval SR_ERR The file could not be written
+ */
+SR_API int sr_session_recorder_add(struct sr_session_recorder *rec,
+        const char *name, const unsigned char *buf, uint64_t size)
+{
+    if (!rec || !name || (!buf && size))
+        return SR_ERR_ARG;
+
+    return recorder_put(rec, name, ZIP_CM_STORE, buf, size, size,
+                        crc32(crc32(0L, Z_NULL, 0), buf, size));
+}
+
+/**
+ * Add an uncompressed data chunk to a recorded session file, named as
+ * by sr_session_append(). The chunk is written right away.
+ */
+SR_API int sr_session_recorder_append(struct sr_session_recorder *rec,
+        const unsigned char *buf, uint64_t size, int chunk_num, int index,
+        int type, int version)
+{
+    char chunk_name[16];
+
+    if (!rec || (!buf && size))
+        return SR_ERR_ARG;
+
+    writer_chunk_name(chunk_name, chunk_num, index, type, version);
+    return recorder_put(rec, chunk_name, ZIP_CM_STORE, buf, size, size,
+                        crc32(crc32(0L, Z_NULL, 0), buf, size));
+}
+
+/**
+ * Add a chunk compressed by sr_session_deflate() to a recorded session
+ * file. The chunk is written right away, and the buffer freed with
+ * g_free().
+ *
+ * @param size Size of the chunk before compression.
+ */
+SR_API int sr_session_recorder_append_deflated(struct sr_session_recorder *rec,
+        unsigned char *buf, uint64_t comp_size, uint64_t size, uint32_t crc,
+        int chunk_num, int index, int type, int version)
+{
+    char chunk_name[16];
+    int ret;
+
+    if (!rec || !buf) {
+        g_free(buf);
+        return SR_ERR_ARG;
+    }
+
+    writer_chunk_name(chunk_name, chunk_num, index, type, version);
+    ret = recorder_put(rec, chunk_name, ZIP_CM_DEFLATE, buf, comp_size,
+                       size, crc);
+    g_free(buf);
+
+    return ret;
+}
+
+/**
+ * Write a central directory after the entries of a recorded session
+ * file, which makes it a valid session file with all entries added so
+ * far. The next entry added replaces the directory.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR The file could not be written
+ */
+SR_API int sr_session_recorder_sync(struct sr_session_recorder *rec)
+{
+    struct recorder_entry *e;
+    uint64_t cd_size = 0;
+    uint8_t *buf, *p;
+    size_t name_len;
+    guint i;
+    int ret;
+
+    if (!rec)
+        return SR_ERR_ARG;
+    if (rec->failed)
+        return SR_ERR;
+
+    for (i = 0; i < rec->entries->len; i++) {
+        e = &g_array_index(rec->entries, struct recorder_entry, i);
+        cd_size += 46 + strlen(e->name) + 28;
+    }
+    if (!(buf = g_try_malloc(cd_size + 56 + 20 + 22)))
+        return SR_ERR_MALLOC;
+
+    p = buf;
+    for (i = 0; i < rec->entries->len; i++) {
+        e = &g_array_index(rec->entries, struct recorder_entry, i);
+        name_len = strlen(e->name);
+        put32(p, 0x02014b50);
+        put16(p + 4, 45);
+        put16(p + 6, 45);
+        put16(p + 8, 0);
+        put16(p + 10, e->method);
+        put16(p + 12, rec->dos_time);
+        put16(p + 14, rec->dos_date);
+        put32(p + 16, e->crc);
+        put32(p + 20, 0xffffffff);
+        put32(p + 24, 0xffffffff);
+        put16(p + 28, name_len);
+        put16(p + 30, 28);
+        put16(p + 32, 0);
+        put16(p + 34, 0);
+        put16(p + 36, 0);
+        put32(p + 38, 0);
+        put32(p + 42, 0xffffffff);
+        memcpy(p + 46, e->name, name_len);
+        p += 46 + name_len;
+        put16(p, 0x0001);
+        put16(p + 2, 24);
+        put64(p + 4, e->size);
+        put64(p + 12, e->comp_size);
+        put64(p + 20, e->offset);
+        p += 28;
+    }
+
+    /* zip64 end of central directory record, and its locator */
+    put32(p, 0x06064b50);
+    put64(p + 4, 44);
+    put16(p + 12, 45);
+    put16(p + 14, 45);
+    put32(p + 16, 0);
+    put32(p + 20, 0);
+    put64(p + 24, rec->entries->len);
+    put64(p + 32, rec->entries->len);
+    put64(p + 40, cd_size);
+    put64(p + 48, rec->end);
+    p += 56;
+    put32(p, 0x07064b50);
+    put32(p + 4, 0);
+    put64(p + 8, rec->end + cd_size);
+    put32(p + 16, 1);
+    p += 20;
+
+    /* end of central directory record, pointing to the zip64 one */
+    put32(p, 0x06054b50);
+    put16(p + 4, 0);
+    put16(p + 6, 0);
+    put16(p + 8, 0xffff);
+    put16(p + 10, 0xffff);
+    put32(p + 12, 0xffffffff);
+    put32(p + 16, 0xffffffff);
+    put16(p + 20, 0);
+    p += 22;
+
+    ret = recorder_write(rec, rec->end, buf, p - buf);
+    g_free(buf);
+    if (ret == SR_OK && fflush(rec->file) != 0) {
+        rec->failed = TRUE;
+        ret = SR_ERR;
+    }
+    if (ret != SR_OK)
+        sr_err("Failed to write session file directory: %s.", g_strerror(errno));
+
+    return ret;
+}
+
+/**
+ * Sync and close a recorded session file, and free the recorder.
+ *
+ * @retval SR_OK Success
+ * @retval SR_ERR The file could not be written completely.
+ */
+SR_API int sr_session_recorder_close(struct sr_session_recorder *rec)
+{
+    guint i;
+    int ret;
+
+    if (!rec)
+        return SR_ERR_ARG;
+
+    ret = sr_session_recorder_sync(rec);
+    if (fclose(rec->file) != 0)
+        ret = SR_ERR;
+
+    for (i = 0; i < rec->entries->len; i++)
+        g_free(g_array_index(rec->entries, struct recorder_entry, i).name);
+    g_array_free(rec->entries, TRUE);
+    g_hash_table_destroy(rec->names);
+    g_free(rec);
+
+    return ret;
+}
+
 /** @} */
@@ -0,0 +1,181 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Throughput and ratio of the session file codecs, on the blocks DSView
+ * saves: one channel of 16M logic samples, or 2MB of 8-bit DSO samples.
+ * The data is synthetic with a fixed seed, so runs are comparable.
+ *
+ *   make -C tests bench_codec && tests/bench_codec [repeats]
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../libsigrok.h"
+
+#define BLOCK_SAMPLES	(1 << 24)
+#define BLOCK_BYTES	(BLOCK_SAMPLES / 8)
+
+static uint32_t seed;
+
+static uint32_t next_random(void)
+{
+	/* xorshift32, the same on every platform */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void put_bit(uint8_t *buf, uint64_t i, int v)
+{
+	if (v)
+		buf[i >> 3] |= 1 << (i & 7);
+	else
+		buf[i >> 3] &= ~(1 << (i & 7));
+}
+
+/* A clock, 2 samples high and 2 low. */
+static void gen_clock(uint8_t *buf)
+{
+	uint64_t i;
+
+	for (i = 0; i < BLOCK_SAMPLES; i++)
+		put_bit(buf, i, (i / 2) & 1);
+}
+
+/* UART at 115200 baud sampled at 100MHz, random bytes and idle gaps. */
+static void gen_uart(uint8_t *buf)
+{
+	uint64_t i = 0;
+	int n, b, k, byte;
+
+	while (i < BLOCK_SAMPLES) {
+		n = next_random() % 20000;
+		for (k = 0; k < n && i < BLOCK_SAMPLES; k++)
+			put_bit(buf, i++, 1);
+		byte = (next_random() & 0xff) | 0x100;
+		/* start bit, 8 data bits, stop bit */
+		byte <<= 1;
+		for (b = 0; b < 10; b++)
+			for (k = 0; k < 868 && i < BLOCK_SAMPLES; k++)
+				put_bit(buf, i++, (byte >> b) & 1);
+	}
+}
+
+/* SPI data, 4 samples per bit, in bursts between idle gaps. */
+static void gen_spi(uint8_t *buf)
+{
+	uint64_t i = 0;
+	int n, k, s, v;
+
+	while (i < BLOCK_SAMPLES) {
+		n = (next_random() % 4096) * 8;
+		for (k = 0; k < n && i < BLOCK_SAMPLES; k++) {
+			v = next_random() & 1;
+			for (s = 0; s < 4 && i < BLOCK_SAMPLES; s++)
+				put_bit(buf, i++, v);
+		}
+		n = next_random() % 65536;
+		for (k = 0; k < n && i < BLOCK_SAMPLES; k++)
+			put_bit(buf, i++, 0);
+	}
+}
+
+/* A noisy sine, as 8-bit DSO samples. */
+static void gen_sine(uint8_t *buf)
+{
+	uint64_t i;
+
+	for (i = 0; i < BLOCK_BYTES; i++)
+		buf[i] = (uint8_t)(128 + 100 * sin(i * 2 * M_PI / 1000.0) +
+				   (int)(next_random() % 9) - 4);
+}
+
+static const struct {
+	const char *name;
+	void (*gen)(uint8_t *buf);
+} blocks[] = {
+	{"logic clock", gen_clock},
+	{"logic uart", gen_uart},
+	{"logic spi", gen_spi},
+	{"dso sine", gen_sine},
+};
+
+static const int levels[] = {1, 3, 6, 9};
+
+int main(int argc, char **argv)
+{
+	uint8_t *buf, *out, *comp;
+	uint64_t comp_size, out_size;
+	uint32_t crc;
+	gint64 start, deflate_us, inflate_us;
+	unsigned int b, l;
+	int r, repeats;
+
+	repeats = (argc > 1) ? atoi(argv[1]) : 3;
+	if (repeats < 1)
+		repeats = 1;
+
+	buf = g_malloc0(BLOCK_BYTES);
+	out = g_malloc(BLOCK_BYTES);
+
+	printf("%-12s %5s %8s %12s %12s\n", "block", "level",
+	       "ratio", "deflate MB/s", "inflate MB/s");
+	for (b = 0; b < G_N_ELEMENTS(blocks); b++) {
+		seed = 2463534242U;
+		blocks[b].gen(buf);
+		for (l = 0; l < G_N_ELEMENTS(levels); l++) {
+			comp = NULL;
+			deflate_us = inflate_us = 0;
+			for (r = 0; r < repeats; r++) {
+				g_free(comp);
+				start = g_get_monotonic_time();
+				if (sr_session_deflate(buf, BLOCK_BYTES, levels[l],
+						       &comp, &comp_size, &crc) != SR_OK) {
+					fprintf(stderr, "deflate failed\n");
+					return 1;
+				}
+				deflate_us += g_get_monotonic_time() - start;
+
+				start = g_get_monotonic_time();
+				if (sr_session_inflate(comp, comp_size, out,
+						       BLOCK_BYTES, &out_size) != SR_OK ||
+				    out_size != BLOCK_BYTES ||
+				    memcmp(buf, out, BLOCK_BYTES)) {
+					fprintf(stderr, "inflate failed\n");
+					return 1;
+				}
+				inflate_us += g_get_monotonic_time() - start;
+			}
+			printf("%-12s %5d %7.1fx %12.1f %12.1f\n", blocks[b].name,
+			       levels[l], (double)BLOCK_BYTES / comp_size,
+			       (double)BLOCK_BYTES * repeats / MAX(deflate_us, 1),
+			       (double)BLOCK_BYTES * repeats / MAX(inflate_us, 1));
+			g_free(comp);
+		}
+	}
+
+	g_free(buf);
+	g_free(out);
+
+	return 0;
+}
@@ -0,0 +1,342 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+/*
+ * Throughput of the logic exports to CSV and VCD: 16 channels of 16M
+ * samples sent as SR_DF_LOGIC packets, which the modules compare sample
+ * by sample, against the SR_DF_LOGIC_CHANGES packets DSView sends. The
+ * changes are found here from the bit planes a word at a time, as the
+ * lowest level of the mipmap DSView walks. The output is counted, not
+ * written.
+ *
+ *   make -C tests bench_export && tests/bench_export [repeats]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../libsigrok.h"
+
+#define NUM_SAMPLES	(1 << 24)
+#define NUM_CHANNELS	16
+#define UNITSIZE	2
+#define SAMPLERATE	SR_MHZ(100)
+/* samples of the packets of export_proc, and changes of export_changes */
+#define PACKET_SAMPLES	8192
+#define PACKET_CHANGES	8192
+
+static uint32_t seed;
+
+static uint32_t next_random(void)
+{
+	/* xorshift32, the same on every platform */
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void put_bit(uint16_t *samples, uint64_t i, int ch, int v)
+{
+	if (v)
+		samples[i] |= 1 << ch;
+	else
+		samples[i] &= ~(1 << ch);
+}
+
+/* UART at 115200 baud, random bytes and idle gaps. */
+static void gen_uart(uint16_t *samples, int ch)
+{
+	uint64_t i = 0;
+	int n, b, k, byte;
+
+	while (i < NUM_SAMPLES) {
+		n = next_random() % 20000;
+		for (k = 0; k < n && i < NUM_SAMPLES; k++)
+			put_bit(samples, i++, ch, 1);
+		byte = ((next_random() & 0xff) | 0x100) << 1;
+		for (b = 0; b < 10; b++)
+			for (k = 0; k < 868 && i < NUM_SAMPLES; k++)
+				put_bit(samples, i++, ch, (byte >> b) & 1);
+	}
+}
+
+/* A clock of 4 samples and 8 data lines, in bursts of SPI words. */
+static void gen_spi(uint16_t *samples, int ch)
+{
+	uint64_t i = 0;
+	int n, k, s, c, v;
+
+	while (i < NUM_SAMPLES) {
+		n = (next_random() % 512) * 8;
+		for (k = 0; k < n && i < NUM_SAMPLES; k++) {
+			v = next_random();
+			for (s = 0; s < 4 && i < NUM_SAMPLES; s++, i++) {
+				put_bit(samples, i, ch, s >= 2);
+				for (c = 1; c <= 8; c++)
+					put_bit(samples, i, ch + c, (v >> c) & 1);
+			}
+		}
+		n = next_random() % 65536;
+		for (k = 0; k < n && i < NUM_SAMPLES; k++, i++)
+			for (c = 0; c <= 8; c++)
+				put_bit(samples, i, ch + c, 0);
+	}
+}
+
+/* A clock of 1MHz. */
+static void gen_clock(uint16_t *samples, int ch)
+{
+	uint64_t i;
+
+	for (i = 0; i < NUM_SAMPLES; i++)
+		put_bit(samples, i, ch, (i / 50) & 1);
+}
+
+static void gen_uarts(uint16_t *samples)
+{
+	int ch;
+
+	for (ch = 0; ch < NUM_CHANNELS; ch++)
+		gen_uart(samples, ch);
+}
+
+static void gen_bus(uint16_t *samples)
+{
+	gen_spi(samples, 0);
+	gen_uart(samples, 9);
+	gen_uart(samples, 10);
+	gen_clock(samples, 11);
+}
+
+static const struct {
+	const char *name;
+	void (*gen)(uint16_t *samples);
+} streams[] = {
+	{"uart x16", gen_uarts},
+	{"spi bus", gen_bus},
+};
+
+static const struct sr_output_module *find_module(const char *id)
+{
+	const struct sr_output_module **m;
+
+	for (m = sr_output_list(); *m; m++)
+		if (!strcmp((*m)->id, id))
+			return *m;
+
+	return NULL;
+}
+
+static uint64_t send(const struct sr_output_module *mod, struct sr_output *o,
+		     uint16_t type, const void *payload)
+{
+	struct sr_datafeed_packet packet;
+	GString *out;
+	uint64_t len;
+
+	packet.type = type;
+	packet.status = SR_PKT_OK;
+	packet.payload = payload;
+	out = NULL;
+	mod->receive(o, &packet, &out);
+	if (!out)
+		return 0;
+	len = out->len;
+	g_string_free(out, TRUE);
+
+	return len;
+}
+
+/* The bit planes of the samples, a word of 64 samples at a time. */
+static uint64_t *gen_planes(const uint16_t *samples)
+{
+	uint64_t *planes;
+	uint64_t i;
+	int ch;
+
+	planes = g_malloc0(NUM_CHANNELS * (NUM_SAMPLES / 64) * sizeof(uint64_t));
+	for (ch = 0; ch < NUM_CHANNELS; ch++)
+		for (i = 0; i < NUM_SAMPLES; i++)
+			if ((samples[i] >> ch) & 1)
+				planes[ch * (NUM_SAMPLES / 64) + i / 64] |= 1ULL << (i % 64);
+
+	return planes;
+}
+
+/*
+ * Exports the samples, or the changes of their planes, and returns the
+ * bytes of the output. The changes are found as the stream is sent, in
+ * the time taken.
+ */
+static uint64_t export_stream(const char *id, const uint16_t *samples,
+			      const uint64_t *planes, gboolean changes)
+{
+	const struct sr_output_module *mod;
+	struct sr_channel ch[NUM_CHANNELS];
+	char names[NUM_CHANNELS][12];
+	struct sr_dev_inst sdi;
+	struct sr_output o;
+	struct sr_config samplerate;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_changes cp;
+	GHashTable *options;
+	uint64_t *index, bytes, i, w, tog, cur, prev;
+	uint16_t *data, sample;
+	unsigned int n;
+	int k;
+
+	mod = find_module(id);
+	memset(&sdi, 0, sizeof(sdi));
+	memset(ch, 0, sizeof(ch));
+	for (k = 0; k < NUM_CHANNELS; k++) {
+		snprintf(names[k], sizeof(names[k]), "D%d", k);
+		ch[k].index = k;
+		ch[k].type = SR_CHANNEL_LOGIC;
+		ch[k].enabled = TRUE;
+		ch[k].name = names[k];
+		sdi.channels = g_slist_append(sdi.channels, &ch[k]);
+	}
+	memset(&o, 0, sizeof(o));
+	o.module = mod;
+	o.sdi = &sdi;
+	options = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(options, "type",
+			    g_variant_ref_sink(g_variant_new_int16(SR_CHANNEL_LOGIC)));
+	mod->init(&o, options);
+
+	samplerate.key = SR_CONF_SAMPLERATE;
+	samplerate.data = g_variant_new_uint64(SAMPLERATE);
+	meta.config = g_slist_append(NULL, &samplerate);
+	bytes = send(mod, &o, SR_DF_META, &meta);
+
+	if (changes) {
+		index = g_new(uint64_t, PACKET_CHANGES);
+		data = g_new(uint16_t, PACKET_CHANGES);
+		cp.unitsize = UNITSIZE;
+		cp.index = index;
+		cp.data = (const uint8_t *)data;
+		n = 0;
+		for (w = 0; w < NUM_SAMPLES / 64; w++) {
+			/* the samples which differ from the one before */
+			tog = (w == 0);
+			for (k = 0; k < NUM_CHANNELS; k++) {
+				cur = planes[k * (NUM_SAMPLES / 64) + w];
+				prev = w ? planes[k * (NUM_SAMPLES / 64) + w - 1] >> 63 : cur & 1;
+				tog |= cur ^ ((cur << 1) | prev);
+			}
+			for (; tog; tog &= tog - 1) {
+				i = w * 64 + __builtin_ctzll(tog);
+				if (n == PACKET_CHANGES) {
+					cp.num_changes = n;
+					cp.num_samples = i;
+					bytes += send(mod, &o, SR_DF_LOGIC_CHANGES, &cp);
+					n = 0;
+				}
+				sample = 0;
+				for (k = 0; k < NUM_CHANNELS; k++)
+					sample |= ((planes[k * (NUM_SAMPLES / 64) + w] >>
+						    (i % 64)) & 1) << k;
+				index[n] = i;
+				data[n++] = sample;
+			}
+		}
+		cp.num_changes = n;
+		cp.num_samples = NUM_SAMPLES;
+		bytes += send(mod, &o, SR_DF_LOGIC_CHANGES, &cp);
+		g_free(index);
+		g_free(data);
+	} else {
+		memset(&logic, 0, sizeof(logic));
+		logic.unitsize = UNITSIZE;
+		/* the CSV module reads a sample as a word */
+		for (i = 0; i + PACKET_SAMPLES < NUM_SAMPLES; i += PACKET_SAMPLES) {
+			logic.length = PACKET_SAMPLES * UNITSIZE;
+			logic.data = (void *)(samples + i);
+			bytes += send(mod, &o, SR_DF_LOGIC, &logic);
+		}
+		logic.length = (NUM_SAMPLES - i) * UNITSIZE;
+		logic.data = (void *)(samples + i);
+		bytes += send(mod, &o, SR_DF_LOGIC, &logic);
+	}
+
+	mod->cleanup(&o);
+	g_slist_free(meta.config);
+	g_variant_unref(samplerate.data);
+	g_hash_table_destroy(options);
+	g_slist_free(sdi.channels);
+
+	return bytes;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *const formats[] = {"csv", "vcd"};
+	uint16_t *samples;
+	uint64_t *planes;
+	uint64_t bytes[2];
+	gint64 start, us[2];
+	unsigned int s, f;
+	int r, c, repeats;
+
+	repeats = (argc > 1) ? atoi(argv[1]) : 3;
+	if (repeats < 1)
+		repeats = 1;
+
+	/* and a word of slack, see export_stream() */
+	samples = g_malloc0((NUM_SAMPLES + 4) * UNITSIZE);
+
+	printf("%-10s %4s %10s %14s %14s %8s\n", "stream", "fmt", "output MB",
+	       "samples MB/s", "changes MB/s", "speedup");
+	for (s = 0; s < G_N_ELEMENTS(streams); s++) {
+		seed = 2463534242U;
+		memset(samples, 0, NUM_SAMPLES * UNITSIZE);
+		streams[s].gen(samples);
+		planes = gen_planes(samples);
+		for (f = 0; f < G_N_ELEMENTS(formats); f++) {
+			for (c = 0; c < 2; c++) {
+				us[c] = 0;
+				for (r = 0; r < repeats; r++) {
+					start = g_get_monotonic_time();
+					bytes[c] = export_stream(formats[f], samples,
+								 planes, c);
+					us[c] += g_get_monotonic_time() - start;
+				}
+			}
+			if (bytes[0] != bytes[1]) {
+				fprintf(stderr, "%s output of the changes differs\n",
+					formats[f]);
+				return 1;
+			}
+			printf("%-10s %4s %10.1f %14.1f %14.1f %7.1fx\n",
+			       streams[s].name, formats[f], bytes[0] / 1e6,
+			       (double)NUM_SAMPLES * UNITSIZE * repeats / MAX(us[0], 1),
+			       (double)NUM_SAMPLES * UNITSIZE * repeats / MAX(us[1], 1),
+			       (double)us[0] / MAX(us[1], 1));
+		}
+		g_free(planes);
+	}
+
+	g_free(samples);
+
+	return 0;
+}
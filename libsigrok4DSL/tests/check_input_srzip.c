@@ -0,0 +1,295 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+#define NUM_PROBES      12
+#define UNITSIZE        2
+/* saved without a name, so not loaded */
+#define UNNAMED_PROBE   10
+/* three blocks, the last one partial */
+#define TOTAL_SAMPLES   (2 * LA_LEAF_SAMPLES + 12345)
+
+static uint32_t hash_bit(uint64_t x)
+{
+	return ((uint32_t)x * 2654435761u) >> 31;
+}
+
+/*
+ * The probes of sample i: dense and sparse edges, constant levels, and
+ * edges right at the first or last sample of a block. The bits above
+ * the probes are set too, the loader must ignore them.
+ */
+static uint16_t sample_at(uint64_t i)
+{
+	const uint64_t L = LA_LEAF_SAMPLES;
+	uint16_t s = 0;
+
+	s |= (i & 1) << 0;
+	s |= ((i >> 10) & 1) << 1;
+	s |= hash_bit(i >> 3) << 2;
+	s |= 1 << 3;
+	s |= (i >= L && i < 2 * L) << 5;
+	s |= (i >= L - 1) << 6;
+	s |= (i == 2 * L) << 7;
+	s |= ((i / (L / 16)) & 1) << 8;
+	s |= hash_bit(i >> 7) << 9;
+	s |= ((i >> 2) & 1) << 10;
+	s |= (i == TOTAL_SAMPLES - 1) << 11;
+	s |= ((i >> 5) & 0xf) << 12;
+
+	return s;
+}
+
+/* The samples, and a partial one after them. */
+static uint8_t *make_samples(uint64_t *size)
+{
+	uint8_t *buf;
+	uint64_t i;
+	uint16_t s;
+
+	*size = TOTAL_SAMPLES * UNITSIZE + 1;
+	buf = g_malloc(*size);
+	for (i = 0; i < TOTAL_SAMPLES; i++) {
+		s = sample_at(i);
+		buf[i * UNITSIZE] = s;
+		buf[i * UNITSIZE + 1] = s >> 8;
+	}
+	buf[*size - 1] = 0xa5;
+
+	return buf;
+}
+
+static GString *make_metadata(void)
+{
+	GString *meta;
+	int i;
+
+	meta = g_string_new("[global]\nsigrok version=0.2.0\n\n[device 1]\n");
+	g_string_append(meta, "driver=demo\ncapturefile=logic-1\n");
+	g_string_append_printf(meta, "unitsize=%d\ntotal probes=%d\n",
+			       UNITSIZE, NUM_PROBES);
+	g_string_append(meta, "samplerate=12.5 MHz\n");
+	for (i = 0; i < NUM_PROBES; i++)
+		if (i != UNNAMED_PROBE)
+			g_string_append_printf(meta, "probe%d=D%d\n", i + 1, i);
+
+	return meta;
+}
+
+/* Chunks of a few sizes, most of them odd, so samples span chunks. */
+static uint64_t chunk_size(int k)
+{
+	return (k % 3 + 1) * LA_LEAF_SAMPLES / 4 + (k % 2 ? 1 : 7);
+}
+
+/* Blocks sent without data, per probe, of the whole capture. */
+static const int const_blocks[NUM_PROBES] = {
+	0, 0, 0, 3, 3, 1, 2, 2, 0, 0, -1, 2,
+};
+
+/*
+ * Load a session file and compare every sample of the loaded probes
+ * with the first total ones saved. The probes held at one level send
+ * all their blocks without data, and those with an edge at the first
+ * sample of a block send that one with its data.
+ */
+static void check_load(const char *filename, const uint8_t *samples,
+		       uint64_t total)
+{
+	struct srtest_capture cap;
+	const uint64_t blocks = (total + LA_LEAF_SAMPLES - 1) / LA_LEAF_SAMPLES;
+	const uint64_t bytes = total / 8;
+	uint8_t *expected;
+	uint64_t i;
+	int probe, order, ret;
+
+	ret = srtest_input_load("srzip", filename, NULL, &cap);
+	fail_unless(ret == SR_OK, "Failed to load %s: %d.", filename, ret);
+	fail_unless(cap.end_status == SR_PKT_OK, "Bad end packet.");
+	fail_unless(cap.samplerate == 12500000,
+		    "Samplerate %" PRIu64 ".", cap.samplerate);
+	fail_unless(cap.total_samples == total,
+		    "%" PRIu64 " samples, expected %" PRIu64 ".",
+		    cap.total_samples, total);
+	fail_unless(cap.num_probes == NUM_PROBES, "%d probes.", cap.num_probes);
+
+	expected = g_malloc((total + 7) / 8);
+	for (probe = 0, order = 0; probe < NUM_PROBES; probe++) {
+		if (probe == UNNAMED_PROBE)
+			continue;
+		memset(expected, 0, (total + 7) / 8);
+		for (i = 0; i < total; i++)
+			expected[i / 8] |= ((samples[i * UNITSIZE + probe / 8] >>
+					     (probe % 8)) & 1) << (i % 8);
+
+		fail_unless(cap.logic[order] &&
+			    cap.logic[order]->len >= (total + 7) / 8,
+			    "Probe %d: missing samples.", probe);
+		if (memcmp(cap.logic[order]->data, expected, bytes)) {
+			for (i = 0; i < bytes; i++)
+				if (cap.logic[order]->data[i] != expected[i])
+					break;
+			for (i *= 8; i < total; i++)
+				fail_unless(srtest_capture_level(&cap, order, i) ==
+					    ((expected[i / 8] >> (i % 8)) & 1),
+					    "Probe %d: wrong level at sample %" PRIu64 ".",
+					    probe, i);
+		}
+		for (i = bytes * 8; i < total; i++)
+			fail_unless(srtest_capture_level(&cap, order, i) ==
+				    ((expected[i / 8] >> (i % 8)) & 1),
+				    "Probe %d: wrong level at sample %" PRIu64 ".",
+				    probe, i);
+		if (probe == 3 || probe == 4)
+			fail_unless(cap.const_blocks[order] == (int)blocks,
+				    "Probe %d: %d blocks without data, expected %" PRIu64 ".",
+				    probe, cap.const_blocks[order], blocks);
+		if (total == TOTAL_SAMPLES)
+			fail_unless(cap.const_blocks[order] == const_blocks[probe],
+				    "Probe %d: %d blocks without data, expected %d.",
+				    probe, cap.const_blocks[order], const_blocks[probe]);
+		order++;
+	}
+	fail_unless(cap.logic[order] == NULL, "The unnamed probe was loaded.");
+
+	g_free(expected);
+	srtest_capture_free(&cap);
+}
+
+/* A capture saved by the session writer, deflated chunk by chunk. */
+START_TEST(test_writer)
+{
+	struct sr_session_writer *writer;
+	GString *meta;
+	gchar *filename, *metafile, name[32];
+	uint8_t *samples;
+	uint64_t size, offset, n;
+	int k, ret;
+
+	samples = make_samples(&size);
+	meta = make_metadata();
+	filename = g_build_filename(g_get_tmp_dir(), "check_srzip_writer.sr", NULL);
+	metafile = g_build_filename(g_get_tmp_dir(), "check_srzip_header", NULL);
+	fail_unless(g_file_set_contents(metafile, "[header]\n", -1, NULL),
+		    "Failed to write %s.", metafile);
+
+	writer = sr_session_writer_new(filename, metafile, NULL, NULL);
+	fail_unless(writer != NULL, "Failed to create %s.", filename);
+	ret = sr_session_writer_add(writer, "version", (const unsigned char *)"2",
+				    1, FALSE);
+	fail_unless(ret == SR_OK, "Failed to add the version: %d.", ret);
+	ret = sr_session_writer_add(writer, "metadata",
+				    (const unsigned char *)meta->str, meta->len, FALSE);
+	fail_unless(ret == SR_OK, "Failed to add the metadata: %d.", ret);
+	for (k = 0, offset = 0; offset < size; k++, offset += n) {
+		n = MIN(chunk_size(k), size - offset);
+		snprintf(name, sizeof(name), "logic-1-%d", k + 1);
+		ret = sr_session_writer_add(writer, name, samples + offset, n, FALSE);
+		fail_unless(ret == SR_OK, "Failed to add %s: %d.", name, ret);
+	}
+	ret = sr_session_writer_close(writer, NULL, NULL);
+	fail_unless(ret == SR_OK, "Failed to write %s: %d.", filename, ret);
+
+	check_load(filename, samples, TOTAL_SAMPLES);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_free(metafile);
+	g_string_free(meta, TRUE);
+	g_free(samples);
+}
+END_TEST
+
+/*
+ * A capture recorded chunk by chunk, with the metadata replaced at each
+ * sync: the file is loaded once while it is recorded, and once closed.
+ */
+START_TEST(test_recorder)
+{
+	struct sr_session_recorder *rec;
+	GString *meta;
+	gchar *filename, name[32];
+	uint8_t *samples;
+	uint64_t size, offset, n;
+	gboolean checked = FALSE;
+	int k, ret;
+
+	samples = make_samples(&size);
+	meta = make_metadata();
+	filename = g_build_filename(g_get_tmp_dir(), "check_srzip_recorder.sr", NULL);
+
+	rec = sr_session_recorder_new(filename);
+	fail_unless(rec != NULL, "Failed to create %s.", filename);
+	ret = sr_session_recorder_add(rec, "version", (const unsigned char *)"2", 1);
+	fail_unless(ret == SR_OK, "Failed to add the version: %d.", ret);
+	for (k = 0, offset = 0; offset < size; k++, offset += n) {
+		n = MIN(chunk_size(k), size - offset);
+		snprintf(name, sizeof(name), "logic-1-%d", k + 1);
+		ret = sr_session_recorder_add(rec, name, samples + offset, n);
+		fail_unless(ret == SR_OK, "Failed to add %s: %d.", name, ret);
+		if (k % 3 != 2)
+			continue;
+
+		ret = sr_session_recorder_add(rec, "metadata",
+					      (const unsigned char *)meta->str, meta->len);
+		fail_unless(ret == SR_OK, "Failed to add the metadata: %d.", ret);
+		ret = sr_session_recorder_sync(rec);
+		fail_unless(ret == SR_OK, "Sync %d failed: %d.", k / 3, ret);
+		if (!checked && offset + n > LA_LEAF_SAMPLES * UNITSIZE) {
+			check_load(filename, samples, (offset + n) / UNITSIZE);
+			checked = TRUE;
+		}
+	}
+	ret = sr_session_recorder_add(rec, "metadata",
+				      (const unsigned char *)meta->str, meta->len);
+	fail_unless(ret == SR_OK, "Failed to add the metadata: %d.", ret);
+	ret = sr_session_recorder_close(rec);
+	fail_unless(ret == SR_OK, "Failed to close the recorder: %d.", ret);
+	fail_unless(checked, "No sync past the first block.");
+
+	check_load(filename, samples, TOTAL_SAMPLES);
+
+	g_unlink(filename);
+	g_free(filename);
+	g_string_free(meta, TRUE);
+	g_free(samples);
+}
+END_TEST
+
+Suite *suite_input_srzip(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input_srzip");
+
+	tc = tcase_create("load");
+	tcase_set_timeout(tc, 120);
+	tcase_add_test(tc, test_writer);
+	tcase_add_test(tc, test_recorder);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,470 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+/* samples of a LA_SPLIT_DATA packet of the importer */
+#define CHUNK_SAMPLES (32 * 1024)
+
+struct change {
+	uint64_t time;
+	int probe;
+	gboolean level;
+	/* position in the file, among the changes of the same time */
+	int seq;
+};
+
+static void add_change(GArray *changes, uint64_t time, int probe, gboolean level)
+{
+	struct change c;
+
+	c.time = time;
+	c.probe = probe;
+	c.level = level;
+	c.seq = changes->len;
+	g_array_append_val(changes, c);
+}
+
+static gint compare_changes(gconstpointer a, gconstpointer b)
+{
+	const struct change *ca = a, *cb = b;
+
+	if (ca->time != cb->time)
+		return ca->time < cb->time ? -1 : 1;
+
+	return ca->seq - cb->seq;
+}
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+
+	return *seed;
+}
+
+static gchar *write_file(const char *name, const char *data, gsize size)
+{
+	gchar *filename;
+
+	filename = g_build_filename(g_get_tmp_dir(), name, NULL);
+	fail_unless(g_file_set_contents(filename, data, size, NULL),
+		    "Failed to write %s.", filename);
+
+	return filename;
+}
+
+/*
+ * A VCD file of the changes, sorted by time. Values are written in the
+ * forms simulators use: with or without a space before the identifier,
+ * x and z for low levels, along with vectors and comments to skip.
+ */
+static GString *write_vcd(const char *timescale, char **ids, int num_probes,
+			  GArray *changes)
+{
+	const struct change *c;
+	GString *vcd;
+	guint i;
+	int k;
+
+	vcd = g_string_new("$date today $end\n$version check $end\n");
+	g_string_append_printf(vcd, "$timescale %s $end\n$scope module top $end\n",
+			       timescale);
+	for (k = 0; k < num_probes; k++)
+		g_string_append_printf(vcd, "$var wire 1 %s p%d $end\n", ids[k], k);
+	g_string_append(vcd, "$var reg 8 % bus $end\n");
+	g_string_append(vcd, "$upscope $end\n$enddefinitions $end\n");
+
+	g_array_sort(changes, compare_changes);
+	for (i = 0; i < changes->len; i++) {
+		c = &g_array_index(changes, struct change, i);
+		if (i == 0 || c->time != g_array_index(changes, struct change, i - 1).time)
+			g_string_append_printf(vcd, "#%" PRIu64 "\n", c->time);
+		if (i == 0)
+			g_string_append(vcd, "$dumpvars\n");
+		switch (i % 5) {
+		case 0:
+			g_string_append_printf(vcd, "%c%s\n", c->level ? '1' : '0', ids[c->probe]);
+			break;
+		case 1:
+			g_string_append_printf(vcd, "%c %s\n", c->level ? '1' : 'x', ids[c->probe]);
+			break;
+		case 2:
+			g_string_append_printf(vcd, "%c%s\tb1010 %%\n", c->level ? '1' : 'Z', ids[c->probe]);
+			break;
+		case 3:
+			g_string_append_printf(vcd, "$comment %c%s $end %c%s ",
+					       c->level ? '0' : '1', ids[c->probe],
+					       c->level ? '1' : 'z', ids[c->probe]);
+			break;
+		default:
+			g_string_append_printf(vcd, "\r\n%c%s\r\n", c->level ? '1' : '0', ids[c->probe]);
+			break;
+		}
+		if (i == 0)
+			g_string_append(vcd, " $end\n");
+	}
+	g_string_append(vcd, "\n");
+
+	return vcd;
+}
+
+/*
+ * Compare each sample of the channels loaded with the levels the changes
+ * set, read with the given downsampling: a change at a time sets the
+ * level from its sample on, the last one of a sample wins.
+ */
+static void check_samples(const struct srtest_capture *cap, GArray *changes,
+			  int num_probes, uint64_t downsample)
+{
+	const struct change *c;
+	uint8_t **expected;
+	gboolean *levels;
+	uint64_t start, total, bytes, s, b;
+	uint8_t diff;
+	guint i;
+	int k;
+
+	start = g_array_index(changes, struct change, 0).time / downsample;
+	total = g_array_index(changes, struct change, changes->len - 1).time /
+		downsample - start + 1;
+	bytes = (total + 7) / 8;
+	fail_unless(cap->total_samples == total,
+		    "%" PRIu64 " samples, expected %" PRIu64 ".",
+		    cap->total_samples, total);
+	fail_unless(cap->num_probes == num_probes,
+		    "%d probes, expected %d.", cap->num_probes, num_probes);
+	fail_unless(cap->ends == 1 && cap->end_status == SR_PKT_OK);
+
+	levels = g_new0(gboolean, num_probes);
+	expected = g_new0(uint8_t *, num_probes);
+	for (k = 0; k < num_probes; k++)
+		expected[k] = g_malloc0(bytes);
+	for (s = 0, i = 0; s < total; s++) {
+		for (; i < changes->len; i++) {
+			c = &g_array_index(changes, struct change, i);
+			if (c->time / downsample - start > s)
+				break;
+			levels[c->probe] = c->level;
+		}
+		for (k = 0; k < num_probes; k++)
+			expected[k][s / 8] |= levels[k] << (s % 8);
+	}
+
+	for (k = 0; k < num_probes; k++) {
+		fail_unless(cap->logic[k] && cap->logic[k]->len == bytes,
+			    "Channel %d: %u bytes, expected %" PRIu64 ".",
+			    k, cap->logic[k] ? cap->logic[k]->len : 0, bytes);
+		for (b = 0; b < bytes; b++) {
+			diff = cap->logic[k]->data[b] ^ expected[k][b];
+			if (b == bytes - 1 && total % 8)
+				diff &= (1 << (total % 8)) - 1;
+			if (diff)
+				break;
+		}
+		fail_unless(b == bytes, "Channel %d differs at sample %" PRIu64 ".",
+			    k, b * 8 + __builtin_ctz(diff));
+		g_free(expected[k]);
+	}
+
+	g_free(expected);
+	g_free(levels);
+}
+
+static void check_vcd(const char *timescale, char **ids, int num_probes,
+		      GArray *changes, const char *downsample,
+		      struct srtest_capture *cap)
+{
+	const char *options[] = { "downsample", downsample, NULL };
+	GString *vcd;
+	gchar *filename;
+	int ret;
+
+	vcd = write_vcd(timescale, ids, num_probes, changes);
+	filename = write_file("check_input.vcd", vcd->str, vcd->len);
+	ret = srtest_input_load("vcd", filename, options, cap);
+	fail_unless(ret == SR_OK, "Failed to load the VCD file: %d.", ret);
+	check_samples(cap, changes, num_probes, strtoull(downsample, NULL, 10));
+
+	g_unlink(filename);
+	g_free(filename);
+	g_string_free(vcd, TRUE);
+}
+
+/*
+ * Runs across chunks and leaves: a channel toggling around chunk and
+ * leaf boundaries, one that never changes, and two that only change in
+ * some of the blocks. Blocks without changes are sent as their level.
+ */
+START_TEST(test_leaf_runs)
+{
+	char *ids[] = { "!", "\"", "#", "~", NULL };
+	const uint64_t t0 = 1000, leaf = LA_LEAF_SAMPLES;
+	const uint64_t edges[] = {
+		1, 2, 3, 10, CHUNK_SAMPLES - 1, CHUNK_SAMPLES, CHUNK_SAMPLES + 1,
+		3 * CHUNK_SAMPLES + 17, leaf - 1, leaf, leaf + 5,
+		leaf + CHUNK_SAMPLES, 2 * leaf + 100,
+	};
+	struct srtest_capture cap;
+	GArray *changes;
+	guint i;
+
+	changes = g_array_new(FALSE, FALSE, sizeof(struct change));
+	add_change(changes, t0, 0, FALSE);
+	add_change(changes, t0, 1, TRUE);
+	add_change(changes, t0, 2, FALSE);
+	add_change(changes, t0, 3, TRUE);
+	for (i = 0; i < G_N_ELEMENTS(edges); i++)
+		add_change(changes, t0 + edges[i], 0, i % 2 == 0);
+	/* set again to its level, this is not an edge */
+	add_change(changes, t0 + 5, 1, TRUE);
+	add_change(changes, t0 + leaf + 77777, 2, TRUE);
+	add_change(changes, t0 + leaf + 77778, 2, FALSE);
+	add_change(changes, t0 + 2 * leaf - 1, 2, TRUE);
+	add_change(changes, t0 + 2 * leaf + 12, 3, FALSE);
+	add_change(changes, t0 + 2 * leaf + 13, 3, TRUE);
+	add_change(changes, t0 + 2 * leaf + 12345, 3, FALSE);
+
+	check_vcd("1 ns", ids, 4, changes, "1", &cap);
+	fail_unless(cap.samplerate == SR_GHZ(1));
+	fail_unless(cap.const_blocks[0] == 0, "%d", cap.const_blocks[0]);
+	fail_unless(cap.const_blocks[1] == 3, "%d", cap.const_blocks[1]);
+	fail_unless(cap.const_blocks[2] == 2, "%d", cap.const_blocks[2]);
+	fail_unless(cap.const_blocks[3] == 2, "%d", cap.const_blocks[3]);
+
+	srtest_capture_free(&cap);
+	g_array_free(changes, TRUE);
+}
+END_TEST
+
+/*
+ * Stretches without any change, over whole blocks: they are skipped, and
+ * the blocks sent as the levels of the channels.
+ */
+START_TEST(test_idle_blocks)
+{
+	char *ids[] = { "0", "1", NULL };
+	const uint64_t leaf = LA_LEAF_SAMPLES;
+	struct srtest_capture cap;
+	GArray *changes;
+
+	changes = g_array_new(FALSE, FALSE, sizeof(struct change));
+	add_change(changes, 0, 0, TRUE);
+	add_change(changes, 0, 1, FALSE);
+	add_change(changes, 2 * leaf + 10, 1, TRUE);
+	add_change(changes, 3 * leaf, 0, FALSE);
+	add_change(changes, 4 * leaf - 1, 1, FALSE);
+
+	check_vcd("1 us", ids, 2, changes, "1", &cap);
+	fail_unless(cap.samplerate == SR_MHZ(1));
+	fail_unless(cap.const_blocks[0] == 4, "%d", cap.const_blocks[0]);
+	fail_unless(cap.const_blocks[1] == 2, "%d", cap.const_blocks[1]);
+
+	srtest_capture_free(&cap);
+	g_array_free(changes, TRUE);
+}
+END_TEST
+
+/*
+ * More channels than single characters: identifiers of up to two
+ * characters are looked up in a table, longer ones in a hash table,
+ * those of 64 characters and more with a key of their own.
+ */
+START_TEST(test_identifiers)
+{
+	static const int lengths[] = { 1, 2, 3, 4, 62, 63, 64, 65, 100 };
+	const int num_probes = 160;
+	struct srtest_capture cap;
+	GArray *changes;
+	char **ids;
+	uint32_t seed = 88172645;
+	uint64_t time;
+	int k, len, c, n;
+
+	ids = g_new0(char *, num_probes + 1);
+	for (k = 0; k < num_probes; k++) {
+		len = MAX(lengths[k % G_N_ELEMENTS(lengths)], k < 90 ? 1 : 2);
+		ids[k] = g_malloc(len + 1);
+		/* the last characters tell the probes apart, no '$' makes
+		 * an identifier look like a "$end" */
+		for (c = 0, n = k; c < len; c++, n /= 90)
+			ids[k][len - 1 - c] = '%' + (c < 2 ? n % 90 : (k * 7 + c) % 90);
+		ids[k][len] = '\0';
+	}
+
+	changes = g_array_new(FALSE, FALSE, sizeof(struct change));
+	time = 0;
+	for (k = 0; k < num_probes; k++)
+		add_change(changes, time, k, k % 3 == 0);
+	for (n = 0; n < 20000; n++) {
+		time += next_random(&seed) % 24;
+		for (c = next_random(&seed) % 3; c >= 0; c--)
+			add_change(changes, time, next_random(&seed) % num_probes,
+				   next_random(&seed) % 2);
+	}
+
+	check_vcd("10 ns", ids, num_probes, changes, "1", &cap);
+	fail_unless(cap.samplerate == SR_MHZ(100));
+
+	srtest_capture_free(&cap);
+	g_array_free(changes, TRUE);
+	g_strfreev(ids);
+}
+END_TEST
+
+/*
+ * Downsampled timestamps: they are divided, the samples start at the
+ * first one, and several changes can land on the same sample.
+ */
+START_TEST(test_downsample)
+{
+	static const char *const factors[] = { "2", "3", "7", "1000" };
+	char *ids[] = { "a", "bb", "ccc", NULL };
+	struct srtest_capture cap;
+	GArray *changes;
+	uint32_t seed = 521288629;
+	uint64_t time;
+	guint i;
+	int n;
+
+	for (i = 0; i < G_N_ELEMENTS(factors); i++) {
+		changes = g_array_new(FALSE, FALSE, sizeof(struct change));
+		time = 1001;
+		add_change(changes, time, 0, TRUE);
+		for (n = 0; n < 50000; n++) {
+			time += next_random(&seed) % 5;
+			add_change(changes, time, next_random(&seed) % 3,
+				   next_random(&seed) % 2);
+		}
+
+		check_vcd("100 ps", ids, 3, changes, factors[i], &cap);
+		fail_unless(cap.samplerate ==
+			    SR_GHZ(10) / strtoull(factors[i], NULL, 10),
+			    "Downsample %s: samplerate %" PRIu64 ".",
+			    factors[i], cap.samplerate);
+
+		srtest_capture_free(&cap);
+		g_array_free(changes, TRUE);
+	}
+}
+END_TEST
+
+#define SHORT_HEADER "$var wire 1 ! a $end $enddefinitions $end"
+
+/* Load a file of the given bytes, to be rejected or of one channel. */
+static int load_short(const char *data, struct srtest_capture *cap)
+{
+	gchar *filename;
+	int ret;
+
+	filename = write_file("check_input_short.vcd", data, strlen(data));
+	ret = srtest_input_load("vcd", filename, NULL, cap);
+	g_unlink(filename);
+	g_free(filename);
+
+	return ret;
+}
+
+static void check_short(const char *data, uint64_t total, gboolean level)
+{
+	struct srtest_capture cap;
+	uint64_t s;
+	int ret;
+
+	ret = load_short(data, &cap);
+	fail_unless(ret == SR_OK, "Failed to load '%s': %d.", data, ret);
+	fail_unless(cap.total_samples == total,
+		    "'%s': %" PRIu64 " samples, expected %" PRIu64 ".",
+		    data, cap.total_samples, total);
+	for (s = 0; s < total; s++)
+		fail_unless(srtest_capture_level(&cap, 0, s) == level,
+			    "'%s': wrong level at sample %" PRIu64 ".", data, s);
+	srtest_capture_free(&cap);
+}
+
+/*
+ * Files shorter than the 16 bytes the scanner reads at once, and files
+ * which end in the middle of a token or a section.
+ */
+START_TEST(test_short_input)
+{
+	static const char *const rejected[] = {
+		"", " ", "$", "$end", "$enddefinitions", "#1 1!",
+		"$date x $end", SHORT_HEADER, SHORT_HEADER " 1!",
+		SHORT_HEADER " #", SHORT_HEADER " #x1",
+	};
+	struct srtest_capture cap;
+	GString *data;
+	guint i, n;
+
+	for (i = 0; i < G_N_ELEMENTS(rejected); i++)
+		fail_unless(load_short(rejected[i], &cap) != SR_OK,
+			    "'%s' was loaded.", rejected[i]);
+
+	check_short(SHORT_HEADER "#3", 1, FALSE);
+	check_short(SHORT_HEADER "\n#3 1!", 1, TRUE);
+	check_short(SHORT_HEADER " 1! #3 #7", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #7 0", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #7 0 ", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #7 b1", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #7 1!!", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #5 $comment #7 0!", 5, TRUE);
+	check_short(SHORT_HEADER " #3 1! #5 $dumpoff", 3, TRUE);
+
+	/* a last token, or white-space, of each length around the blocks */
+	for (i = 1; i <= 48; i++) {
+		data = g_string_new(SHORT_HEADER " #3 1! #7 0");
+		for (n = 0; n < i; n++)
+			g_string_append_c(data, 'a' + n % 26);
+		check_short(data->str, 5, TRUE);
+		g_string_assign(data, SHORT_HEADER " #3 1! #7 1!");
+		for (n = 0; n < i; n++)
+			g_string_append_c(data, n % 2 ? ' ' : '\n');
+		check_short(data->str, 5, TRUE);
+		g_string_free(data, TRUE);
+	}
+	/* the last timestamp ends the samples, later ones are cut */
+	check_short(SHORT_HEADER " #3 1! #4 0! #5 1! #4", 2, TRUE);
+}
+END_TEST
+
+Suite *suite_input_vcd(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input_vcd");
+
+	tc = tcase_create("load");
+	tcase_set_timeout(tc, 60);
+	tcase_add_test(tc, test_leaf_runs);
+	tcase_add_test(tc, test_idle_blocks);
+	tcase_add_test(tc, test_identifiers);
+	tcase_add_test(tc, test_downsample);
+	tcase_add_test(tc, test_short_input);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
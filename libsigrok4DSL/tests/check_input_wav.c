@@ -0,0 +1,469 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include <math.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+#define WAVE_FORMAT_PCM           0x0001
+#define WAVE_FORMAT_IEEE_FLOAT    0x0003
+#define WAVE_FORMAT_EXTENSIBLE    0xFFFE
+
+/* frames of a packet of the importer */
+#define BATCH_FRAMES              (1024 * 1024)
+
+struct wav_format {
+	uint16_t tag;
+	int bits;
+	int channels;
+	gboolean extensible;
+};
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+
+	return *seed;
+}
+
+static void put_u16(GByteArray *b, uint16_t v)
+{
+	const uint8_t d[] = { v, v >> 8 };
+
+	g_byte_array_append(b, d, sizeof(d));
+}
+
+static void put_u32(GByteArray *b, uint32_t v)
+{
+	const uint8_t d[] = { v, v >> 8, v >> 16, v >> 24 };
+
+	g_byte_array_append(b, d, sizeof(d));
+}
+
+static void put_u64(GByteArray *b, uint64_t v)
+{
+	put_u32(b, v);
+	put_u32(b, v >> 32);
+}
+
+/* A chunk and its pad byte; size is what the header states. */
+static void put_chunk(GByteArray *b, const char *id, const void *data,
+		      guint len, uint32_t size)
+{
+	g_byte_array_append(b, (const guint8 *)id, 4);
+	put_u32(b, size);
+	g_byte_array_append(b, data, len);
+	if (len & 1)
+		g_byte_array_append(b, (const guint8 *)"", 1);
+}
+
+static void put_fmt(GByteArray *b, const struct wav_format *fmt)
+{
+	static const uint8_t guid_tail[] = {
+		0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00,
+		0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+	};
+	const int align = fmt->channels * fmt->bits / 8;
+
+	g_byte_array_append(b, (const guint8 *)"fmt ", 4);
+	put_u32(b, fmt->extensible ? 40 : 16);
+	put_u16(b, fmt->extensible ? WAVE_FORMAT_EXTENSIBLE : fmt->tag);
+	put_u16(b, fmt->channels);
+	put_u32(b, 48000);
+	put_u32(b, 48000 * align);
+	put_u16(b, align);
+	put_u16(b, fmt->bits);
+	if (fmt->extensible) {
+		put_u16(b, 22);
+		put_u16(b, fmt->bits);
+		put_u32(b, 0);
+		put_u16(b, fmt->tag);
+		g_byte_array_append(b, guid_tail, sizeof(guid_tail));
+	}
+}
+
+/* Patch the RIFF size once the file is complete. */
+static void end_riff(GByteArray *b)
+{
+	const uint32_t size = b->len - 8;
+
+	b->data[4] = size;
+	b->data[5] = size >> 8;
+	b->data[6] = size >> 16;
+	b->data[7] = size >> 24;
+}
+
+static GByteArray *plain_wav(const struct wav_format *fmt,
+			     const uint8_t *samples, guint size)
+{
+	GByteArray *b;
+
+	b = g_byte_array_new();
+	g_byte_array_append(b, (const guint8 *)"RIFF\0\0\0\0WAVE", 12);
+	put_fmt(b, fmt);
+	put_chunk(b, "data", samples, size, size);
+	end_riff(b);
+
+	return b;
+}
+
+/*
+ * Samples of the format: random ones, after all values of the top byte
+ * for integers, or after values around the clamping and rounding limits
+ * for floats. The special values are repeated at the end, so that the
+ * vector loops and the scalar tails both convert them.
+ */
+static uint8_t *make_samples(const struct wav_format *fmt, guint n,
+			     uint32_t seed)
+{
+	static const float specials[] = {
+		/* 128 - 128 v, in float, is a half code only once rounded */
+		(0.5f + 1.0f / (1 << 20)) / 128, (0.5f - 1.0f / (1 << 21)) / 128,
+		NAN, 127.5f / 128, -127.5f / 128, 126.5f / 128, 1.0f / 256,
+		1e30f, -1e30f, INFINITY, -INFINITY, 1.5f, -1.5f, 1, -1,
+		0, -0.0f, 0.5f, -0.5f, -NAN, 1e-40f, -1e-40f,
+	};
+	const int bytes = fmt->bits / 8;
+	const guint nspecial = G_N_ELEMENTS(specials);
+	uint8_t *s;
+	guint i, k;
+	double d;
+	float f;
+
+	s = g_malloc(n * bytes);
+	for (i = 0; i < n * bytes; i++)
+		s[i] = next_random(&seed);
+
+	for (i = 0; i < n; i++) {
+		if (fmt->tag == WAVE_FORMAT_PCM) {
+			if (i < 256)
+				s[i * bytes + bytes - 1] = i;
+			continue;
+		}
+		/* random floats in [-1.25, 1.25] */
+		k = i < nspecial ? i : n - i <= nspecial ? n - i - 1 : nspecial;
+		f = k < nspecial ? specials[k] :
+		    (next_random(&seed) % 20001 - 10000) / 8000.0f;
+		if (fmt->bits == 32) {
+			memcpy(s + i * 4, &f, 4);
+		} else {
+			d = k < nspecial ? f : f + (next_random(&seed) % 1000) * 1e-9;
+			memcpy(s + i * 8, &d, 8);
+		}
+	}
+
+	return s;
+}
+
+/* The code of one sample: 128 at zero, inverted, from 1 to 255. */
+static uint8_t reference_code(const struct wav_format *fmt, const uint8_t *p)
+{
+	const int bytes = fmt->bits / 8;
+	double d;
+	float f;
+	int h;
+
+	if (fmt->tag == WAVE_FORMAT_PCM) {
+		/* the signed top byte of the sample */
+		h = bytes == 1 ? p[0] - 128 : (int8_t)p[bytes - 1];
+		h = 128 - h;
+		return h > 255 ? 255 : h;
+	}
+
+	if (bytes == 4) {
+		memcpy(&f, p, 4);
+		f = 128 - f * 128;
+		return isnan(f) || f < 0 ? 0 : f > 255 ? 255 : lrintf(f);
+	}
+	memcpy(&d, p, 8);
+	d = 128 - d * 128;
+
+	return isnan(d) || d < 0 ? 0 : d > 255 ? 255 : lrint(d);
+}
+
+/* Load a file and check every sent code of the first channels. */
+static void check_loaded(const char *name, const GByteArray *file,
+			 const struct wav_format *fmt, const uint8_t *samples,
+			 guint frames)
+{
+	struct srtest_capture cap;
+	gchar *filename;
+	const int bytes = fmt->bits / 8;
+	const int probes = MIN(fmt->channels, DS_MAX_ANALOG_PROBES_NUM);
+	uint8_t expected;
+	guint f;
+	int ch, ret;
+
+	filename = g_build_filename(g_get_tmp_dir(), name, NULL);
+	fail_unless(g_file_set_contents(filename, (const gchar *)file->data,
+					file->len, NULL),
+		    "Failed to write %s.", filename);
+	ret = srtest_input_load("wav", filename, NULL, &cap);
+	g_unlink(filename);
+	g_free(filename);
+
+	fail_unless(ret == SR_OK, "%s: load failed: %d.", name, ret);
+	fail_unless(cap.end_status == SR_PKT_OK, "%s: bad end packet.", name);
+	fail_unless(cap.samplerate == 48000, "%s: wrong samplerate.", name);
+	fail_unless(cap.total_samples == frames,
+		    "%s: %" PRIu64 " samples, expected %u.",
+		    name, cap.total_samples, frames);
+	fail_unless(cap.num_probes == probes, "%s: %d probes, expected %d.",
+		    name, cap.num_probes, probes);
+	fail_unless(cap.analog && cap.analog->len == frames * probes,
+		    "%s: wrong amount of data.", name);
+
+	for (f = 0; f < frames; f++) {
+		for (ch = 0; ch < probes; ch++) {
+			expected = reference_code(fmt,
+				samples + (f * fmt->channels + ch) * bytes);
+			fail_unless(cap.analog->data[f * probes + ch] == expected,
+				    "%s: frame %u, channel %d: code %d, expected %d.",
+				    name, f, ch, cap.analog->data[f * probes + ch],
+				    expected);
+		}
+	}
+	srtest_capture_free(&cap);
+}
+
+static void check_format(const struct wav_format *fmt, guint frames,
+			 uint32_t seed)
+{
+	GByteArray *file;
+	uint8_t *samples;
+	gchar *name;
+
+	name = g_strdup_printf("check_input_wav_%d_%d_%d_%u.wav", fmt->tag,
+			       fmt->bits, fmt->channels, frames);
+	samples = make_samples(fmt, frames * fmt->channels, seed);
+	file = plain_wav(fmt, samples, frames * fmt->channels * fmt->bits / 8);
+	check_loaded(name, file, fmt, samples, frames);
+	g_byte_array_free(file, TRUE);
+	g_free(samples);
+	g_free(name);
+}
+
+/*
+ * Each sample format, in runs converted by the vector loops with tails
+ * of every length left to the scalar ones, and with more channels than
+ * are loaded, which are converted frame by frame.
+ */
+START_TEST(test_formats)
+{
+	static const struct wav_format formats[] = {
+		{ WAVE_FORMAT_PCM, 8, 1, FALSE },
+		{ WAVE_FORMAT_PCM, 16, 1, FALSE },
+		{ WAVE_FORMAT_PCM, 24, 1, FALSE },
+		{ WAVE_FORMAT_PCM, 32, 1, FALSE },
+		{ WAVE_FORMAT_IEEE_FLOAT, 32, 1, FALSE },
+		{ WAVE_FORMAT_IEEE_FLOAT, 64, 1, FALSE },
+		{ WAVE_FORMAT_PCM, 8, 3, FALSE },
+		{ WAVE_FORMAT_PCM, 16, 2, TRUE },
+		{ WAVE_FORMAT_PCM, 24, 4, TRUE },
+		{ WAVE_FORMAT_IEEE_FLOAT, 32, 2, TRUE },
+		{ WAVE_FORMAT_PCM, 16, 6, FALSE },
+		{ WAVE_FORMAT_IEEE_FLOAT, 32, 5, FALSE },
+	};
+	static const guint frames[] = { 1, 15, 16, 17, 300, 1031 };
+	uint32_t seed = 1;
+	guint i, j;
+
+	for (i = 0; i < G_N_ELEMENTS(formats); i++)
+		for (j = 0; j < G_N_ELEMENTS(frames); j++)
+			check_format(&formats[i], frames[j], seed++);
+}
+END_TEST
+
+/* Files of more frames than a packet holds. */
+START_TEST(test_batches)
+{
+	static const struct wav_format u8 = { WAVE_FORMAT_PCM, 8, 1, FALSE };
+	static const struct wav_format s16 = { WAVE_FORMAT_PCM, 16, 2, FALSE };
+
+	check_format(&u8, BATCH_FRAMES + 17, 7);
+	check_format(&s16, 2 * BATCH_FRAMES, 8);
+}
+END_TEST
+
+/*
+ * Chunks the importer skips, of odd sizes and with their pad bytes,
+ * before, between and after the format and the data.
+ */
+START_TEST(test_riff_chunks)
+{
+	static const struct wav_format fmt = { WAVE_FORMAT_PCM, 8, 1, FALSE };
+	const guint frames = 1001;
+	GByteArray *file;
+	uint8_t *samples;
+
+	samples = make_samples(&fmt, frames, 3);
+	file = g_byte_array_new();
+	g_byte_array_append(file, (const guint8 *)"RIFF\0\0\0\0WAVE", 12);
+	put_chunk(file, "LIST", "INFOabc", 7, 7);
+	put_chunk(file, "JUNK", "", 0, 0);
+	put_fmt(file, &fmt);
+	put_chunk(file, "fact", "\x01\x02\x03\x04\x05", 5, 5);
+	put_chunk(file, "data", samples, frames, frames);
+	put_chunk(file, "id3 ", "xyz", 3, 3);
+	end_riff(file);
+	check_loaded("check_input_wav_chunks.wav", file, &fmt, samples, frames);
+	g_byte_array_free(file, TRUE);
+
+	/* a data size beyond the end of the file, as while recording */
+	file = g_byte_array_new();
+	g_byte_array_append(file, (const guint8 *)"RIFF\0\0\0\0WAVE", 12);
+	put_fmt(file, &fmt);
+	put_chunk(file, "data", samples, frames - 1, 4 * frames);
+	end_riff(file);
+	check_loaded("check_input_wav_cut.wav", file, &fmt, samples, frames - 1);
+	g_byte_array_free(file, TRUE);
+
+	g_free(samples);
+}
+END_TEST
+
+/*
+ * RF64 and BW64 files, whose data size of 0xFFFFFFFF is replaced by
+ * that of the ds64 chunk: chunks follow the data, so the size is only
+ * right if taken from ds64.
+ */
+START_TEST(test_rf64)
+{
+	static const struct wav_format fmt = { WAVE_FORMAT_PCM, 24, 2, FALSE };
+	static const char *const ids[] = { "RF64", "BW64" };
+	const guint frames = 777;
+	const guint size = frames * 2 * 3;
+	GByteArray *file, *ds64;
+	uint8_t *samples;
+	guint i;
+
+	samples = make_samples(&fmt, frames * 2, 5);
+	for (i = 0; i < G_N_ELEMENTS(ids); i++) {
+		ds64 = g_byte_array_new();
+		put_u64(ds64, 0);
+		put_u64(ds64, size);
+		put_u64(ds64, frames);
+		put_u32(ds64, 0);
+
+		file = g_byte_array_new();
+		g_byte_array_append(file, (const guint8 *)ids[i], 4);
+		put_u32(file, 0xFFFFFFFF);
+		g_byte_array_append(file, (const guint8 *)"WAVE", 4);
+		put_chunk(file, "ds64", ds64->data, ds64->len, ds64->len);
+		put_chunk(file, "bext", "odd", 3, 3);
+		put_fmt(file, &fmt);
+		put_chunk(file, "data", samples, size, 0xFFFFFFFF);
+		put_chunk(file, "axml", "<a/>", 4, 4);
+		check_loaded("check_input_wav_rf64.wav", file, &fmt, samples, frames);
+		g_byte_array_free(file, TRUE);
+		g_byte_array_free(ds64, TRUE);
+	}
+	g_free(samples);
+}
+END_TEST
+
+static int load_bytes(const GByteArray *file)
+{
+	struct srtest_capture cap;
+	gchar *filename;
+	int ret;
+
+	filename = g_build_filename(g_get_tmp_dir(), "check_input_wav_bad.wav", NULL);
+	fail_unless(g_file_set_contents(filename, (const gchar *)file->data,
+					file->len, NULL),
+		    "Failed to write %s.", filename);
+	ret = srtest_input_load("wav", filename, NULL, &cap);
+	g_unlink(filename);
+	g_free(filename);
+	srtest_capture_free(&cap);
+
+	return ret;
+}
+
+/* Headers the importer must refuse rather than misread. */
+START_TEST(test_rejected)
+{
+	static const struct wav_format fmt = { WAVE_FORMAT_PCM, 16, 1, FALSE };
+	static const struct wav_format bits12 = { WAVE_FORMAT_PCM, 12, 1, FALSE };
+	static const struct wav_format alaw = { 6, 8, 1, FALSE };
+	const uint8_t samples[8] = { 0 };
+	GByteArray *file;
+
+	/* ds64 in a RIFF file */
+	file = g_byte_array_new();
+	g_byte_array_append(file, (const guint8 *)"RIFF\0\0\0\0WAVE", 12);
+	put_chunk(file, "ds64", samples, 8, 28);
+	put_fmt(file, &fmt);
+	put_chunk(file, "data", samples, 8, 8);
+	fail_unless(load_bytes(file) != SR_OK, "ds64 in RIFF was loaded.");
+	g_byte_array_free(file, TRUE);
+
+	/* data before the format */
+	file = g_byte_array_new();
+	g_byte_array_append(file, (const guint8 *)"RIFF\0\0\0\0WAVE", 12);
+	put_chunk(file, "data", samples, 8, 8);
+	put_fmt(file, &fmt);
+	fail_unless(load_bytes(file) != SR_OK, "data before fmt was loaded.");
+	g_byte_array_free(file, TRUE);
+
+	/* no frames */
+	file = plain_wav(&fmt, samples, 1);
+	fail_unless(load_bytes(file) != SR_OK, "An empty file was loaded.");
+	g_byte_array_free(file, TRUE);
+
+	/* unsupported samples */
+	file = plain_wav(&bits12, samples, 8);
+	fail_unless(load_bytes(file) != SR_OK, "12-bit samples were loaded.");
+	g_byte_array_free(file, TRUE);
+	file = plain_wav(&alaw, samples, 8);
+	fail_unless(load_bytes(file) != SR_OK, "A-law samples were loaded.");
+	g_byte_array_free(file, TRUE);
+
+	/* a truncated chunk header */
+	file = plain_wav(&fmt, samples, 8);
+	g_byte_array_set_size(file, 12 + 8 + 10);
+	fail_unless(load_bytes(file) != SR_OK, "A truncated fmt was loaded.");
+	g_byte_array_free(file, TRUE);
+}
+END_TEST
+
+Suite *suite_input_wav(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("input_wav");
+
+	tc = tcase_create("load");
+	tcase_set_timeout(tc, 60);
+	tcase_add_test(tc, test_formats);
+	tcase_add_test(tc, test_batches);
+	tcase_add_test(tc, test_riff_chunks);
+	tcase_add_test(tc, test_rf64);
+	tcase_add_test(tc, test_rejected);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
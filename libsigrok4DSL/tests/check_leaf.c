@@ -0,0 +1,312 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include "../libsigrok.h"
+
+/*
+ * The leaf kernels are private to the library, they are built into
+ * the tests from their source.
+ */
+#include "../input/leaf.c"
+
+#define GUARD 16
+
+static uint32_t seed;
+
+static uint32_t next_random(void)
+{
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static uint64_t random_word(void)
+{
+	return ((uint64_t)next_random() << 32) | next_random();
+}
+
+static gboolean leaf_bit(const uint64_t *leaf, uint64_t s)
+{
+	return (leaf[s / 64] >> (s % 64)) & 1;
+}
+
+/*
+ * Split samples of unitsize bytes, of which num_probes are channels,
+ * for the channels from first to first + count - 1, as the jobs of
+ * in_binary do: channel k goes to leaf k - first, the others are
+ * skipped. Each sample bit must be the one of the source, and the
+ * bytes after the samples must not be written.
+ */
+static void check_split(int unitsize, int num_probes, int first, int count,
+			uint64_t samples)
+{
+	uint8_t *src;
+	uint64_t *leaves;
+	int *orders;
+	uint64_t s, i;
+	int k, order;
+	const uint64_t bytes = (samples + 7) / 8;
+
+	src = g_malloc(samples * unitsize + 1);
+	for (i = 0; i < samples * unitsize; i++)
+		src[i] = next_random();
+	orders = g_new(int, num_probes);
+	for (k = 0; k < num_probes; k++)
+		orders[k] = (k >= first && k < first + count) ? k - first : -1;
+	leaves = g_malloc((uint64_t)count * LA_LEAF_SPACE);
+	for (k = 0; k < count; k++)
+		memset(leaves + k * LEAF_SPACE_WORDS, 0xa5, bytes + GUARD);
+
+	sr_leaf_split(leaves, src, unitsize, num_probes, orders, samples);
+
+	for (k = 0; k < num_probes; k++) {
+		if ((order = orders[k]) < 0)
+			continue;
+		for (s = 0; s < samples; s++) {
+			fail_unless(leaf_bit(leaves + order * LEAF_SPACE_WORDS, s) ==
+				    ((src[s * unitsize + k / 8] >> (k % 8)) & 1),
+				    "unitsize %d, %d of %d channels: channel %d, "
+				    "sample %" PRIu64 " of %" PRIu64 ".",
+				    unitsize, count, num_probes, k, s, samples);
+		}
+		for (i = bytes; i < bytes + GUARD; i++)
+			fail_unless(((uint8_t *)(leaves + order * LEAF_SPACE_WORDS))[i] == 0xa5,
+				    "unitsize %d: channel %d written past %" PRIu64 " samples.",
+				    unitsize, k, samples);
+	}
+
+	g_free(leaves);
+	g_free(orders);
+	g_free(src);
+}
+
+/* Sample counts around the 8 and 16 samples the kernels work on. */
+static const uint64_t split_counts[] = {
+	1, 7, 8, 9, 15, 16, 17, 31, 32, 33, 1000, 4096 + 13,
+};
+
+START_TEST(test_split)
+{
+	const int unitsizes[] = {1, 2, 3, 4, 8};
+	unsigned int u, n;
+	int unitsize;
+
+	seed = 2463534242U;
+	for (u = 0; u < G_N_ELEMENTS(unitsizes); u++) {
+		unitsize = unitsizes[u];
+		for (n = 0; n < G_N_ELEMENTS(split_counts); n++) {
+			check_split(unitsize, unitsize * 8, 0, unitsize * 8,
+				    split_counts[n]);
+			/* a partial last byte of channels */
+			check_split(unitsize, unitsize * 8 - 3, 0, unitsize * 8 - 3,
+				    split_counts[n]);
+		}
+	}
+}
+END_TEST
+
+/*
+ * Channels split in parts that do not divide their number, and parts
+ * starting and ending within a byte of the samples.
+ */
+START_TEST(test_split_parts)
+{
+	const int probes[] = {13, 37, 64};
+	const int parts[] = {5, 8, 16};
+	unsigned int p, c;
+	int num_probes, unitsize, first;
+
+	seed = 88172645U;
+	for (p = 0; p < G_N_ELEMENTS(probes); p++) {
+		num_probes = probes[p];
+		unitsize = (num_probes + 7) / 8;
+		for (c = 0; c < G_N_ELEMENTS(parts); c++) {
+			for (first = 0; first < num_probes; first += parts[c])
+				check_split(unitsize, num_probes, first,
+					    MIN(parts[c], num_probes - first), 1000 + 9);
+		}
+	}
+}
+END_TEST
+
+/*
+ * The leaf and its mipmap, one sample and one bit at a time: the
+ * samples after the last one hold its value to the end of its word,
+ * the words after it are 0. Level 1 has a bit per word of samples, set
+ * if a sample of the word differs from the one before, each level after
+ * it a bit per word of the level below, set if the word is not 0.
+ */
+static void reference_finish(const uint64_t *in, uint64_t samples,
+			     gboolean last, uint64_t *ref)
+{
+	const uint64_t words = (samples + 63) / 64;
+	uint64_t s, i, off, n;
+	gboolean prev, bit;
+
+	memset(ref, 0, LA_LEAF_SPACE);
+	prev = last;
+	for (s = 0; s < words * 64; s++) {
+		bit = leaf_bit(in, MIN(s, samples - 1));
+		if (bit)
+			ref[s / 64] |= 1ULL << (s % 64);
+		if (bit != prev)
+			ref[LEAF_WORDS + s / 4096] |= 1ULL << ((s / 64) % 64);
+		prev = bit;
+	}
+
+	for (off = LEAF_WORDS, n = LEAF_WORDS / 64; n > 1; off += n, n /= 64)
+		for (i = 0; i < n; i++)
+			if (ref[off + i])
+				ref[off + n + i / 64] |= 1ULL << (i % 64);
+	fail_unless(off == LEAF_SPACE_WORDS - 1);
+}
+
+/*
+ * Finish a leaf of samples samples after a sample at last, whose words
+ * are random, 0, all 1, a single edge or the level before, as mode(i)
+ * tells. The words after the samples hold garbage, which must be
+ * cleared.
+ */
+static void check_finish(uint64_t samples, gboolean last, int (*mode)(uint64_t))
+{
+	uint64_t *leaf, *in, *ref;
+	uint64_t i, prev;
+	gboolean edges, value;
+
+	leaf = g_malloc(LA_LEAF_SPACE);
+	in = g_malloc(LA_LEAF_SPACE);
+	ref = g_malloc(LA_LEAF_SPACE);
+
+	prev = last ? ~0ULL : 0;
+	for (i = 0; i < LEAF_SPACE_WORDS; i++) {
+		switch (mode(i)) {
+		case 0:
+			in[i] = random_word();
+			break;
+		case 1:
+			in[i] = 0;
+			break;
+		case 2:
+			in[i] = ~0ULL;
+			break;
+		case 3:
+			in[i] = prev ^ (~0ULL << (next_random() % 64));
+			break;
+		default:
+			in[i] = prev;
+		}
+		prev = (in[i] >> 63) ? ~0ULL : 0;
+	}
+	memcpy(leaf, in, LA_LEAF_SPACE);
+
+	sr_leaf_finish(leaf, samples, last, &edges, &value);
+	reference_finish(in, samples, last, ref);
+
+	for (i = 0; i < LEAF_SPACE_WORDS; i++)
+		fail_unless(leaf[i] == ref[i],
+			    "%" PRIu64 " samples: word %" PRIu64 " is %016" PRIx64
+			    ", expected %016" PRIx64 ".", samples, i, leaf[i], ref[i]);
+	fail_unless(edges == (ref[LEAF_SPACE_WORDS - 1] != 0));
+	fail_unless(value == leaf_bit(in, samples - 1));
+
+	g_free(ref);
+	g_free(in);
+	g_free(leaf);
+}
+
+static int mode_mixed(uint64_t i)
+{
+	/* runs of each mode, for level 1 words of 0 and of edges */
+	return (i * 0x9e3779b1U >> 7) % 5;
+}
+
+static int mode_random(uint64_t i)
+{
+	(void)i;
+	return 0;
+}
+
+static int mode_zero(uint64_t i)
+{
+	(void)i;
+	return 1;
+}
+
+static int mode_one(uint64_t i)
+{
+	(void)i;
+	return 2;
+}
+
+START_TEST(test_finish)
+{
+	const uint64_t counts[] = {
+		1, 63, 64, 65, 4096, 4096 * 64 + 1,
+		LA_LEAF_SAMPLES / 2 + 37, LA_LEAF_SAMPLES - 1, LA_LEAF_SAMPLES,
+	};
+	unsigned int n;
+
+	seed = 3735928559U;
+	for (n = 0; n < G_N_ELEMENTS(counts); n++) {
+		check_finish(counts[n], FALSE, mode_mixed);
+		check_finish(counts[n], TRUE, mode_mixed);
+		check_finish(counts[n], FALSE, mode_random);
+	}
+}
+END_TEST
+
+/* Constant leaves, with and without an edge from the sample before. */
+START_TEST(test_finish_constant)
+{
+	const uint64_t counts[] = {1, 100, LA_LEAF_SAMPLES};
+	unsigned int n;
+
+	for (n = 0; n < G_N_ELEMENTS(counts); n++) {
+		check_finish(counts[n], FALSE, mode_zero);
+		check_finish(counts[n], TRUE, mode_zero);
+		check_finish(counts[n], FALSE, mode_one);
+		check_finish(counts[n], TRUE, mode_one);
+	}
+}
+END_TEST
+
+Suite *suite_leaf(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("leaf");
+
+	tc = tcase_create("split");
+	tcase_add_test(tc, test_split);
+	tcase_add_test(tc, test_split_parts);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("finish");
+	tcase_set_timeout(tc, 60);
+	tcase_add_test(tc, test_finish);
+	tcase_add_test(tc, test_finish_constant);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -25,6 +25,13 @@
 Suite *suite_core(void);
 Suite *suite_strutil(void);
 Suite *suite_driver_all(void);
+Suite *suite_output_csv(void);
+Suite *suite_output_vcd(void);
+Suite *suite_session_file(void);
+Suite *suite_leaf(void);
+Suite *suite_input_vcd(void);
+Suite *suite_input_wav(void);
+Suite *suite_input_srzip(void);
 
 int main(void)
 {
@@ -39,6 +46,13 @@ int main(void)
 	srunner_add_suite(srunner, suite_core());
 	srunner_add_suite(srunner, suite_strutil());
 	srunner_add_suite(srunner, suite_driver_all());
+	srunner_add_suite(srunner, suite_output_csv());
+	srunner_add_suite(srunner, suite_output_vcd());
+	srunner_add_suite(srunner, suite_session_file());
+	srunner_add_suite(srunner, suite_leaf());
+	srunner_add_suite(srunner, suite_input_vcd());
+	srunner_add_suite(srunner, suite_input_wav());
+	srunner_add_suite(srunner, suite_input_srzip());
 
 	srunner_run_all(srunner, CK_VERBOSE);
 	ret = srunner_ntests_failed(srunner);
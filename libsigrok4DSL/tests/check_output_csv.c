@@ -0,0 +1,463 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <stdio.h>
+#include <string.h>
+#include "../libsigrok.h"
+
+#define OFFSET 128
+
+static const struct sr_output_module *csv_module(void)
+{
+	const struct sr_output_module **m;
+
+	for (m = sr_output_list(); *m; m++)
+		if (!strcmp((*m)->id, "csv"))
+			return *m;
+
+	return NULL;
+}
+
+/*
+ * Feed the samples 0..255 of one analog channel to the CSV output. The
+ * values are (OFFSET - sample) * range, each row must be what
+ * printf("%0.5f") makes of it.
+ */
+static void check_range(double range)
+{
+	const struct sr_output_module *mod;
+	struct sr_channel ch;
+	struct sr_dev_inst sdi;
+	struct sr_output o;
+	struct sr_config ref_min, ref_max;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_analog analog;
+	struct sr_datafeed_packet packet;
+	GHashTable *options;
+	GString *out;
+	uint8_t data[256];
+	char expected[64];
+	char **lines, **row;
+	int i;
+
+	mod = csv_module();
+	fail_unless(mod != NULL, "No CSV output module.");
+
+	memset(&ch, 0, sizeof(ch));
+	ch.type = SR_CHANNEL_ANALOG;
+	ch.enabled = TRUE;
+	ch.name = "CH0";
+	ch.hw_offset = OFFSET;
+	ch.map_unit = "V";
+	ch.map_min = 0;
+	ch.map_max = range;
+
+	memset(&sdi, 0, sizeof(sdi));
+	sdi.channels = g_slist_append(NULL, &ch);
+
+	memset(&o, 0, sizeof(o));
+	o.module = mod;
+	o.sdi = &sdi;
+	options = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(options, "type",
+			    g_variant_ref_sink(g_variant_new_int16(SR_CHANNEL_ANALOG)));
+	fail_unless(mod->init(&o, options) == SR_OK);
+
+	/* reference levels 0 and 1, so that the values are not divided */
+	ref_min.key = SR_CONF_REF_MIN;
+	ref_min.data = g_variant_new_uint32(0);
+	ref_max.key = SR_CONF_REF_MAX;
+	ref_max.data = g_variant_new_uint32(1);
+	meta.config = g_slist_append(g_slist_append(NULL, &ref_min), &ref_max);
+	packet.type = SR_DF_META;
+	packet.status = SR_PKT_OK;
+	packet.payload = &meta;
+	out = NULL;
+	fail_unless(mod->receive(&o, &packet, &out) == SR_OK);
+	if (out)
+		g_string_free(out, TRUE);
+
+	for (i = 0; i < 256; i++)
+		data[i] = i;
+	memset(&analog, 0, sizeof(analog));
+	analog.num_samples = 256;
+	analog.unit_bits = 8;
+	analog.data = data;
+	packet.type = SR_DF_ANALOG;
+	packet.payload = &analog;
+	out = NULL;
+	fail_unless(mod->receive(&o, &packet, &out) == SR_OK);
+	fail_unless(out != NULL);
+
+	/* the comments and the column names come first */
+	lines = g_strsplit(out->str, "\n", -1);
+	for (row = lines; *row && **row == ';'; row++)
+		;
+	fail_unless(*row != NULL);
+	row++;
+	for (i = 0; i < 256; i++, row++) {
+		snprintf(expected, sizeof(expected), "%0.5f",
+			 (OFFSET - i) * (range - 0.0) / (1 - 0));
+		fail_unless(*row != NULL, "Missing row %d for range %.17g.",
+			    i, range);
+		fail_unless(!strcmp(*row, expected),
+			    "Invalid value for %.17g: %s, expected %s.",
+			    (OFFSET - i) * range, *row, expected);
+	}
+
+	g_strfreev(lines);
+	g_string_free(out, TRUE);
+	mod->cleanup(&o);
+	g_slist_free(meta.config);
+	g_variant_unref(ref_min.data);
+	g_variant_unref(ref_max.data);
+	g_hash_table_destroy(options);
+	g_slist_free(sdi.channels);
+}
+
+/* Ranges whose values round to the nearest digit. */
+START_TEST(test_values)
+{
+	check_range(1.0);
+	check_range(0.1);
+	check_range(0.001);
+	check_range(3.3 / 256);
+	check_range(5.0 / 255);
+	check_range(1e-6);
+	check_range(123456.789);
+	check_range(-0.3);
+}
+END_TEST
+
+/*
+ * Ranges with values halfway between two digits, as far as the product
+ * with 100000 tells: 0.000005, 1.000015, and so on.
+ */
+START_TEST(test_ties)
+{
+	check_range(0.000005);
+	check_range(0.000015);
+	check_range(0.0000125);
+	check_range(0.0000025);
+	check_range(1.000005);
+	check_range(0.123455);
+	check_range(2.5e-6);
+	check_range(7.5e-6);
+}
+END_TEST
+
+/* Values of 2^52 / 100000 and more, the product has no fraction left. */
+START_TEST(test_large)
+{
+	check_range(1e9);
+	check_range(351843720.88832);
+	check_range(1e12 + 0.5);
+	check_range(1e16);
+}
+END_TEST
+
+/* Ranges from a fixed seed, over many orders of magnitude. */
+START_TEST(test_random)
+{
+	uint32_t seed = 2463534242U;
+	double range;
+	int i, e;
+
+	for (i = 0; i < 200; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		range = (double)seed / 4294967296.0;
+		for (e = i % 16; e > 0; e--)
+			range *= (i % 2) ? 10.0 : 0.1;
+		check_range(range);
+	}
+}
+END_TEST
+
+#define NUM_CHANNELS 12
+#define NUM_SAMPLES 5000
+
+/*
+ * The logic CSV output of NUM_SAMPLES samples of NUM_CHANNELS channels,
+ * at samplerate, without its header. The first num_changes changes are
+ * sent in
+ * SR_DF_LOGIC_CHANGES packets of per_packet changes, the samples from
+ * the last of them on in a SR_DF_LOGIC packet, if there are samples.
+ */
+static GString *export_logic(uint64_t rate, const uint8_t *samples,
+			     const uint64_t *index, const uint8_t *changes,
+			     unsigned int num_changes, unsigned int per_packet)
+{
+	const struct sr_output_module *mod;
+	struct sr_channel ch[NUM_CHANNELS];
+	char names[NUM_CHANNELS][12];
+	struct sr_dev_inst sdi;
+	struct sr_output o;
+	struct sr_config samplerate;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_changes cp;
+	struct sr_datafeed_packet packet;
+	GHashTable *options;
+	GString *csv, *out;
+	uint64_t from;
+	unsigned int i, n;
+	const char *rows;
+	int k;
+
+	mod = csv_module();
+	fail_unless(mod != NULL, "No CSV output module.");
+
+	memset(&sdi, 0, sizeof(sdi));
+	memset(ch, 0, sizeof(ch));
+	for (k = 0; k < NUM_CHANNELS; k++) {
+		snprintf(names[k], sizeof(names[k]), "D%d", k);
+		ch[k].index = k;
+		ch[k].type = SR_CHANNEL_LOGIC;
+		ch[k].enabled = TRUE;
+		ch[k].name = names[k];
+		sdi.channels = g_slist_append(sdi.channels, &ch[k]);
+	}
+
+	memset(&o, 0, sizeof(o));
+	o.module = mod;
+	o.sdi = &sdi;
+	options = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+					(GDestroyNotify)g_variant_unref);
+	g_hash_table_insert(options, "type",
+			    g_variant_ref_sink(g_variant_new_int16(SR_CHANNEL_LOGIC)));
+	fail_unless(mod->init(&o, options) == SR_OK, "Failed to init the CSV output.");
+
+	csv = g_string_new(NULL);
+	samplerate.key = SR_CONF_SAMPLERATE;
+	samplerate.data = g_variant_new_uint64(rate);
+	meta.config = g_slist_append(NULL, &samplerate);
+	packet.type = SR_DF_META;
+	packet.status = SR_PKT_OK;
+	packet.payload = &meta;
+	out = NULL;
+	fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+		    "Failed to send the samplerate.");
+	if (out)
+		g_string_free(out, TRUE);
+
+	packet.type = SR_DF_LOGIC_CHANGES;
+	packet.payload = &cp;
+	cp.unitsize = (NUM_CHANNELS + 7) / 8;
+	from = 0;
+	for (i = 0; i < num_changes; i += n) {
+		n = MIN(per_packet, num_changes - i);
+		cp.num_changes = n;
+		cp.index = index + i;
+		cp.data = changes + i * cp.unitsize;
+		/* the changes of the last packet hold up to its last one */
+		cp.num_samples = (i + n < num_changes) ? index[i + n] : index[i + n - 1] + 1;
+		from = cp.num_samples;
+		out = NULL;
+		fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+			    "Failed to send changes %u.", i);
+		g_string_append_len(csv, out->str, out->len);
+		g_string_free(out, TRUE);
+	}
+
+	if (samples && from < NUM_SAMPLES) {
+		memset(&logic, 0, sizeof(logic));
+		logic.unitsize = (NUM_CHANNELS + 7) / 8;
+		logic.length = (NUM_SAMPLES - from) * logic.unitsize;
+		logic.data = (uint8_t *)samples + from * logic.unitsize;
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		out = NULL;
+		fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+			    "Failed to send the samples.");
+		g_string_append_len(csv, out->str, out->len);
+		g_string_free(out, TRUE);
+	}
+
+	mod->cleanup(&o);
+	g_slist_free(meta.config);
+	g_variant_unref(samplerate.data);
+	g_hash_table_destroy(options);
+	g_slist_free(sdi.channels);
+
+	/* the comments and the column names come first */
+	rows = strstr(csv->str, "Time(s),");
+	fail_unless(rows != NULL && strchr(rows, '\n') != NULL, "No column names.");
+	g_string_erase(csv, 0, strchr(rows, '\n') + 1 - csv->str);
+
+	return csv;
+}
+
+/*
+ * Rows of changes are the rows of the samples they stand for, and
+ * samples may follow them.
+ */
+START_TEST(test_changes)
+{
+	static const unsigned int per_packet[] = {1, 7, NUM_SAMPLES};
+	const uint16_t unitsize = (NUM_CHANNELS + 7) / 8;
+	const uint8_t last_mask = (1 << (NUM_CHANNELS - 8 * (unitsize - 1))) - 1;
+	uint32_t seed = 2463534242U;
+	uint8_t *samples, *changes, *sample;
+	uint64_t *index;
+	unsigned int num_changes, i, cut;
+	GString *expected, *csv;
+	uint64_t s;
+
+	/* a word of slack: the module reads samples as words */
+	samples = g_malloc0(NUM_SAMPLES * unitsize + 8);
+	changes = g_malloc(NUM_SAMPLES * unitsize);
+	index = g_new(uint64_t, NUM_SAMPLES);
+	num_changes = 0;
+	for (s = 0; s < NUM_SAMPLES; s++) {
+		sample = samples + s * unitsize;
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		if (s > 0)
+			memcpy(sample, sample - unitsize, unitsize);
+		if (s == 0 || seed % 8 == 0)
+			sample[(seed >> 8) % unitsize] ^= seed >> 16;
+		/* only the enabled channels */
+		sample[unitsize - 1] &= last_mask;
+		if (s > 0 && !memcmp(sample, sample - unitsize, unitsize))
+			continue;
+		index[num_changes] = s;
+		memcpy(changes + num_changes * unitsize, sample, unitsize);
+		num_changes++;
+	}
+	fail_unless(num_changes > 100, "Only %u changes.", num_changes);
+
+	expected = export_logic(SR_MHZ(3), samples, index, changes, 0, 1);
+	for (i = 0; i < G_N_ELEMENTS(per_packet); i++) {
+		csv = export_logic(SR_MHZ(3), samples, index, changes, num_changes, per_packet[i]);
+		fail_unless(!strcmp(csv->str, expected->str),
+			    "Changes sent %u a packet differ from the samples.",
+			    per_packet[i]);
+		g_string_free(csv, TRUE);
+	}
+	for (cut = 1; cut < num_changes; cut += num_changes / 5) {
+		csv = export_logic(SR_MHZ(3), samples, index, changes, cut, 3);
+		fail_unless(!strcmp(csv->str, expected->str),
+			    "Samples after %u changes differ.", cut);
+		g_string_free(csv, TRUE);
+	}
+
+	g_string_free(expected, TRUE);
+	g_free(samples);
+	g_free(changes);
+	g_free(index);
+}
+END_TEST
+
+/* The time of each change must be what printf("%0.10g") makes of it. */
+static void check_times(uint64_t rate, const uint64_t *index, unsigned int n)
+{
+	uint8_t *changes;
+	char expected[64];
+	char **lines;
+	unsigned int i;
+	size_t len;
+	GString *csv;
+
+	changes = g_malloc0(n * 2);
+	for (i = 0; i < n; i++)
+		changes[i * 2] = i % 2;
+	csv = export_logic(rate, NULL, index, changes, n, 100);
+	lines = g_strsplit(csv->str, "\n", -1);
+	for (i = 0; i < n; i++) {
+		len = snprintf(expected, sizeof(expected), "%0.10g,%d",
+			       index[i] * 1.0 / rate, i % 2);
+		fail_unless(lines[i] != NULL, "Missing row %u at %" PRIu64 "Hz.",
+			    i, rate);
+		fail_unless(!strncmp(lines[i], expected, len) &&
+			    lines[i][len] == ',',
+			    "Invalid row at %" PRIu64 "Hz: %s, expected %s.",
+			    rate, lines[i], expected);
+	}
+
+	g_strfreev(lines);
+	g_string_free(csv, TRUE);
+	g_free(changes);
+}
+
+/*
+ * Times of changes from 0 to 2^50 samples, at rates from 1Hz on, and
+ * at each power of ten seconds and a sample before. At 2Hz and 1024Hz,
+ * some have an eleventh digit of 5 and no more.
+ */
+START_TEST(test_times)
+{
+	static const uint64_t rates[] = {
+		1, 2, 3, 7, 10, 1024, 12345, SR_KHZ(10), SR_MHZ(1), SR_MHZ(3),
+		SR_MHZ(100), SR_MHZ(400), SR_GHZ(1), SR_GHZ(10),
+	};
+	uint32_t seed = 88172645U;
+	uint64_t index[2000], second;
+	unsigned int r, n;
+
+	for (r = 0; r < G_N_ELEMENTS(rates); r++) {
+		index[0] = 0;
+		for (n = 1; n < G_N_ELEMENTS(index) && index[n - 1] < (1ULL << 50); n++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			index[n] = index[n - 1] + 1 + seed % (index[n - 1] / 64 + 1);
+			if (n % 7 == 0)
+				/* a round time, or one sample off */
+				index[n] = (index[n] / rates[r] + 1) * rates[r] - (n % 2);
+		}
+		check_times(rates[r], index, n);
+
+		n = 0;
+		for (second = 1; second <= 100000000000ULL; second *= 10) {
+			if (second * rates[r] > 1)
+				index[n++] = second * rates[r] - 1;
+			index[n++] = second * rates[r];
+		}
+		check_times(rates[r], index, n);
+	}
+}
+END_TEST
+
+Suite *suite_output_csv(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("output_csv");
+
+	tc = tcase_create("values");
+	tcase_add_test(tc, test_values);
+	tcase_add_test(tc, test_ties);
+	tcase_add_test(tc, test_large);
+	tcase_add_test(tc, test_random);
+	suite_add_tcase(s, tc);
+
+	tc = tcase_create("logic");
+	tcase_add_test(tc, test_changes);
+	tcase_add_test(tc, test_times);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -0,0 +1,325 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+#include "lib.h"
+
+#define NUM_SAMPLES 5000
+#define SAMPLERATE SR_MHZ(1)
+
+/* A logic stream, as samples and as its changes. */
+struct stream {
+	int num_channels;
+	uint16_t unitsize;
+	/* NUM_SAMPLES samples, and a word of slack */
+	uint8_t *samples;
+	/* the index of each change, and the sample there */
+	GArray *index;
+	GByteArray *changes;
+};
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed ^= *seed << 13;
+	*seed ^= *seed >> 17;
+	*seed ^= *seed << 5;
+
+	return *seed;
+}
+
+/*
+ * Random levels at first, then a change on one to three channels every
+ * eight samples or so. Half of the changes are on the channels past the
+ * first 94, which have identifiers of two characters.
+ */
+static void make_stream(struct stream *st, int num_channels, uint32_t seed)
+{
+	uint8_t *sample;
+	uint64_t s;
+	int k, n;
+
+	st->num_channels = num_channels;
+	st->unitsize = (num_channels + 7) / 8;
+	st->samples = g_malloc0((gsize)NUM_SAMPLES * st->unitsize + 8);
+	st->index = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+	st->changes = g_byte_array_new();
+
+	for (k = 0; k < num_channels; k++)
+		if (next_random(&seed) & 1)
+			st->samples[k / 8] |= 1 << (k % 8);
+	s = 0;
+	g_array_append_val(st->index, s);
+	g_byte_array_append(st->changes, st->samples, st->unitsize);
+
+	for (s = 1; s < NUM_SAMPLES; s++) {
+		sample = st->samples + s * st->unitsize;
+		memcpy(sample, sample - st->unitsize, st->unitsize);
+		if (next_random(&seed) % 8)
+			continue;
+		for (n = next_random(&seed) % 3; n >= 0; n--) {
+			k = next_random(&seed) % num_channels;
+			if (num_channels > 94 && (next_random(&seed) & 1))
+				k = 94 + k % (num_channels - 94);
+			sample[k / 8] ^= 1 << (k % 8);
+		}
+		if (!memcmp(sample, sample - st->unitsize, st->unitsize))
+			continue;
+		g_array_append_val(st->index, s);
+		g_byte_array_append(st->changes, sample, st->unitsize);
+	}
+}
+
+static void free_stream(struct stream *st)
+{
+	g_free(st->samples);
+	g_array_free(st->index, TRUE);
+	g_byte_array_free(st->changes, TRUE);
+}
+
+static const struct sr_output_module *vcd_module(void)
+{
+	const struct sr_output_module **m;
+
+	for (m = sr_output_list(); *m; m++)
+		if (!strcmp((*m)->id, "vcd"))
+			return *m;
+
+	return NULL;
+}
+
+static void append_out(GString *vcd, GString *out)
+{
+	if (out) {
+		g_string_append_len(vcd, out->str, out->len);
+		g_string_free(out, TRUE);
+	}
+}
+
+/*
+ * The VCD output of the stream, from SR_DF_LOGIC packets of per_packet
+ * samples, or from SR_DF_LOGIC_CHANGES packets of per_packet changes.
+ */
+static GString *export_stream(const struct stream *st, gboolean changes,
+			      unsigned int per_packet)
+{
+	const struct sr_output_module *mod;
+	struct sr_channel *channels;
+	struct sr_dev_inst sdi;
+	struct sr_output o;
+	struct sr_config samplerate;
+	struct sr_datafeed_meta meta;
+	struct sr_datafeed_logic logic;
+	struct sr_datafeed_changes cp;
+	struct sr_datafeed_packet packet;
+	GString *vcd, *out;
+	unsigned int i, n;
+	int k;
+
+	mod = vcd_module();
+	fail_unless(mod != NULL, "No VCD output module.");
+
+	channels = g_new0(struct sr_channel, st->num_channels);
+	memset(&sdi, 0, sizeof(sdi));
+	for (k = 0; k < st->num_channels; k++) {
+		channels[k].index = k;
+		channels[k].type = SR_CHANNEL_LOGIC;
+		channels[k].enabled = TRUE;
+		channels[k].name = g_strdup_printf("D%d", k);
+		sdi.channels = g_slist_append(sdi.channels, &channels[k]);
+	}
+
+	memset(&o, 0, sizeof(o));
+	o.module = mod;
+	o.sdi = &sdi;
+	fail_unless(mod->init(&o, NULL) == SR_OK,
+		    "Failed to init the VCD output for %d channels.",
+		    st->num_channels);
+
+	vcd = g_string_new(NULL);
+	samplerate.key = SR_CONF_SAMPLERATE;
+	samplerate.data = g_variant_new_uint64(SAMPLERATE);
+	meta.config = g_slist_append(NULL, &samplerate);
+	packet.type = SR_DF_META;
+	packet.status = SR_PKT_OK;
+	packet.payload = &meta;
+	fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+		    "Failed to send the samplerate.");
+	append_out(vcd, out);
+
+	if (changes) {
+		packet.type = SR_DF_LOGIC_CHANGES;
+		packet.payload = &cp;
+		cp.unitsize = st->unitsize;
+		for (i = 0; i < st->index->len; i += n) {
+			n = MIN(per_packet, st->index->len - i);
+			cp.num_changes = n;
+			cp.index = &g_array_index(st->index, uint64_t, i);
+			cp.data = st->changes->data + i * st->unitsize;
+			cp.num_samples = (i + n < st->index->len) ?
+				g_array_index(st->index, uint64_t, i + n) : NUM_SAMPLES;
+			fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+				    "Failed to send changes %u.", i);
+			append_out(vcd, out);
+		}
+	} else {
+		packet.type = SR_DF_LOGIC;
+		packet.payload = &logic;
+		memset(&logic, 0, sizeof(logic));
+		logic.unitsize = st->unitsize;
+		for (i = 0; i < NUM_SAMPLES; i += n) {
+			n = MIN(per_packet, NUM_SAMPLES - i);
+			logic.length = n * st->unitsize;
+			logic.data = st->samples + i * st->unitsize;
+			fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+				    "Failed to send samples %u.", i);
+			append_out(vcd, out);
+		}
+	}
+
+	packet.type = SR_DF_END;
+	packet.payload = NULL;
+	fail_unless(mod->receive(&o, &packet, &out) == SR_OK,
+		    "Failed to end the stream.");
+	append_out(vcd, out);
+
+	mod->cleanup(&o);
+	g_slist_free(meta.config);
+	g_variant_unref(samplerate.data);
+	for (k = 0; k < st->num_channels; k++)
+		g_free(channels[k].name);
+	g_slist_free(sdi.channels);
+	g_free(channels);
+
+	return vcd;
+}
+
+/* What follows the header, which has the date in it. */
+static const char *dump(const GString *vcd)
+{
+	const char *s;
+
+	s = strstr(vcd->str, "$enddefinitions $end\n");
+	fail_unless(s != NULL, "No end of definitions.");
+
+	return s;
+}
+
+/* The changes are written as the samples they stand for. */
+static void check_changes(int num_channels)
+{
+	static const unsigned int per_packet[] = {1, 7, 100000};
+	struct stream st;
+	GString *expected, *vcd;
+	unsigned int i;
+
+	make_stream(&st, num_channels, 2463534242U + num_channels);
+	expected = export_stream(&st, FALSE, 8192);
+	for (i = 0; i < G_N_ELEMENTS(per_packet); i++) {
+		vcd = export_stream(&st, TRUE, per_packet[i]);
+		fail_unless(!strcmp(dump(vcd), dump(expected)),
+			    "Changes of %d channels, %u a packet, differ from the samples.",
+			    num_channels, per_packet[i]);
+		g_string_free(vcd, TRUE);
+	}
+
+	g_string_free(expected, TRUE);
+	free_stream(&st);
+}
+
+START_TEST(test_changes)
+{
+	check_changes(1);
+	check_changes(12);
+	check_changes(64);
+	check_changes(200);
+}
+END_TEST
+
+/*
+ * Past 94 channels, identifiers have two characters: the header names
+ * each channel once, and the VCD importer reads every sample back.
+ */
+START_TEST(test_identifiers)
+{
+	struct srtest_capture cap;
+	struct stream st;
+	GString *vcd;
+	gchar *filename;
+	const uint8_t *sample;
+	uint64_t s;
+	int k, ret;
+
+	make_stream(&st, 200, 88172645U);
+	vcd = export_stream(&st, TRUE, 1000);
+	fail_unless(strstr(vcd->str, "$var wire 1 ~ D93 $end\n") != NULL,
+		    "Channel 93 is not identified by '~'.");
+	fail_unless(strstr(vcd->str, "$var wire 1 !! D94 $end\n") != NULL,
+		    "Channel 94 is not identified by '!!'.");
+	fail_unless(strstr(vcd->str, "$var wire 1 \"! D95 $end\n") != NULL,
+		    "Channel 95 is not identified by '\"!'.");
+
+	filename = g_build_filename(g_get_tmp_dir(), "check_output.vcd", NULL);
+	fail_unless(g_file_set_contents(filename, vcd->str, vcd->len, NULL),
+		    "Failed to write %s.", filename);
+	ret = srtest_input_load("vcd", filename, NULL, &cap);
+	fail_unless(ret == SR_OK, "Failed to load the VCD output: %d.", ret);
+	fail_unless(cap.num_probes == st.num_channels,
+		    "%d probes loaded, expected %d.", cap.num_probes, st.num_channels);
+	fail_unless(cap.samplerate == SAMPLERATE,
+		    "Samplerate %" PRIu64 ", expected %" PRIu64 ".",
+		    cap.samplerate, SAMPLERATE);
+	/* the importer keeps a sample at the timestamp of the end */
+	fail_unless(cap.total_samples == NUM_SAMPLES + 1,
+		    "%" PRIu64 " samples loaded, expected %d.",
+		    cap.total_samples, NUM_SAMPLES + 1);
+
+	for (s = 0; s < NUM_SAMPLES; s++) {
+		sample = st.samples + s * st.unitsize;
+		for (k = 0; k < st.num_channels; k++)
+			fail_unless(srtest_capture_level(&cap, k, s) ==
+				    ((sample[k / 8] >> (k % 8)) & 1),
+				    "Channel %d differs at sample %" PRIu64 ".", k, s);
+	}
+
+	srtest_capture_free(&cap);
+	g_unlink(filename);
+	g_free(filename);
+	g_string_free(vcd, TRUE);
+	free_stream(&st);
+}
+END_TEST
+
+Suite *suite_output_vcd(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("output_vcd");
+
+	tc = tcase_create("changes");
+	tcase_add_test(tc, test_changes);
+	tcase_add_test(tc, test_identifiers);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
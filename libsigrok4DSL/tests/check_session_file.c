@@ -0,0 +1,141 @@
+/*
+ * This file is part of the DSView project.
+ *
+ * Copyright (C) 2016 DreamSourceLab <support@dreamsourcelab.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+#include <check.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include "../libsigrok.h"
+
+#define CHUNK_SIZE 4096
+#define SYNCS 20
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t get64(const uint8_t *p)
+{
+	return get32(p) | ((uint64_t)get32(p + 4) << 32);
+}
+
+/* The times a zip record signature occurs in a file. */
+static int count_signature(const uint8_t *buf, gsize size, uint32_t sig)
+{
+	gsize i;
+	int n = 0;
+
+	for (i = 0; i + 4 <= size; i++)
+		if (get32(buf + i) == sig)
+			n++;
+
+	return n;
+}
+
+/*
+ * Record a header and two chunks per sync, SYNCS times. After each sync
+ * the file must end with a single central directory, right after the
+ * entries, and the file size must not grow with stale directories.
+ */
+START_TEST(test_recorder_sync)
+{
+	struct sr_session_recorder *rec;
+	unsigned char chunk[CHUNK_SIZE];
+	char header[64];
+	gchar *filename, *buf;
+	gsize size;
+	uint64_t payload, entries, cd_offset, cd_size, bound;
+	int i, n, ret;
+
+	/* no zip signatures in the data, all bytes are 0x80 and up */
+	for (i = 0; i < CHUNK_SIZE; i++)
+		chunk[i] = 0x80 | ((i * 7) & 0x3f);
+
+	filename = g_build_filename(g_get_tmp_dir(), "check_recorder.dsl", NULL);
+	rec = sr_session_recorder_new(filename);
+	fail_unless(rec != NULL, "Failed to create %s.", filename);
+
+	payload = 0;
+	for (n = 0; n < SYNCS; n++) {
+		i = snprintf(header, sizeof(header), "[header]\ntotal blocks = %d\n", n + 1);
+		ret = sr_session_recorder_add(rec, "header", (unsigned char *)header, i);
+		fail_unless(ret == SR_OK, "Failed to add the header: %d.", ret);
+		ret = sr_session_recorder_append(rec, chunk, CHUNK_SIZE, n, 0,
+						 SR_CHANNEL_LOGIC, 2);
+		fail_unless(ret == SR_OK, "Failed to append a chunk: %d.", ret);
+		ret = sr_session_recorder_append(rec, chunk, CHUNK_SIZE, n, 1,
+						 SR_CHANNEL_LOGIC, 2);
+		fail_unless(ret == SR_OK, "Failed to append a chunk: %d.", ret);
+		payload += i + 2 * CHUNK_SIZE;
+
+		ret = sr_session_recorder_sync(rec);
+		fail_unless(ret == SR_OK, "Sync %d failed: %d.", n, ret);
+		fail_unless(g_file_get_contents(filename, &buf, &size, NULL));
+		fail_unless(size > 98);
+
+		/* the zip64 end records point to the only directory */
+		entries = 1 + 2 * (n + 1);
+		fail_unless(get32((uint8_t *)buf + size - 22) == 0x06054b50);
+		fail_unless(get32((uint8_t *)buf + size - 98) == 0x06064b50);
+		fail_unless(get64((uint8_t *)buf + size - 98 + 32) == entries);
+		cd_size = get64((uint8_t *)buf + size - 98 + 40);
+		cd_offset = get64((uint8_t *)buf + size - 98 + 48);
+		fail_unless(cd_offset + cd_size + 98 == size,
+			    "Sync %d: directory at %" PRIu64 ", file size %" G_GSIZE_FORMAT ".",
+			    n, cd_offset, size);
+		fail_unless(count_signature((uint8_t *)buf, size, 0x02014b50) == (int)entries,
+			    "Sync %d: stale directory entries.", n);
+		fail_unless(count_signature((uint8_t *)buf, size, 0x06054b50) == 1,
+			    "Sync %d: stale end of directory records.", n);
+
+		/*
+		 * Each entry written costs its data, a local header of at
+		 * most 30 bytes, a 16 byte name, 20 bytes of zip64 sizes
+		 * and 12 of padding; the directory 46 + 16 + 28 bytes per
+		 * entry, and 98 for the end records.
+		 */
+		bound = payload + 3 * (n + 1) * (30 + 16 + 20 + 12) +
+			entries * (46 + 16 + 28) + 98;
+		fail_unless(size <= bound,
+			    "Sync %d: %" G_GSIZE_FORMAT " bytes, expected at most %" PRIu64 ".",
+			    n, size, bound);
+		g_free(buf);
+	}
+
+	ret = sr_session_recorder_close(rec);
+	fail_unless(ret == SR_OK, "Failed to close the recorder: %d.", ret);
+	g_unlink(filename);
+	g_free(filename);
+}
+END_TEST
+
+Suite *suite_session_file(void)
+{
+	Suite *s;
+	TCase *tc;
+
+	s = suite_create("session_file");
+
+	tc = tcase_create("recorder");
+	tcase_add_test(tc, test_recorder_sync);
+	suite_add_tcase(s, tc);
+
+	return s;
+}
@@ -22,6 +22,7 @@
 #include <string.h>
 #include <check.h>
 #include "../libsigrok.h"
+#include "lib.h"
 
 /* Get a libsigrok driver by name. */
 struct sr_dev_driver *srtest_driver_get(const char *drivername)
@@ -120,3 +121,152 @@ void srtest_check_samplerate(struct sr_context *sr_ctx, const char *drivername,
 	fail_unless(s == samplerate, "%s: Incorrect samplerate: %" PRIu64 ".",
 		    drivername, s);
 }
+
+static void capture_logic(struct srtest_capture *cap,
+			  const struct sr_datafeed_logic *logic)
+{
+	const struct sr_datafeed_leaf *leaf;
+	GByteArray *plane;
+	uint8_t *fill;
+
+	fail_unless(logic->order < SRTEST_MAX_PROBES,
+		    "Channel order %d out of range.", logic->order);
+	if (!(plane = cap->logic[logic->order]))
+		plane = cap->logic[logic->order] = g_byte_array_new();
+
+	switch (logic->format) {
+	case LA_SPLIT_DATA:
+		g_byte_array_append(plane, logic->data, logic->length);
+		break;
+	case LA_LEAF_DATA:
+		/* the samples lead a leaf, its mipmap follows */
+		leaf = logic->data;
+		if (leaf->leaf) {
+			g_byte_array_append(plane, leaf->leaf, logic->length);
+			break;
+		}
+		fill = g_malloc(logic->length);
+		memset(fill, leaf->value ? 0xff : 0x00, logic->length);
+		g_byte_array_append(plane, fill, logic->length);
+		g_free(fill);
+		cap->const_blocks[logic->order]++;
+		break;
+	default:
+		fail_unless(FALSE, "Unexpected logic format %d.", logic->format);
+	}
+}
+
+static void capture_packet(const struct sr_dev_inst *sdi,
+			   const struct sr_datafeed_packet *packet,
+			   void *cb_data)
+{
+	struct srtest_capture *cap = cb_data;
+	const struct sr_datafeed_analog *analog;
+
+	(void)sdi;
+
+	switch (packet->type) {
+	case SR_DF_LOGIC:
+		capture_logic(cap, packet->payload);
+		break;
+	case SR_DF_ANALOG:
+		analog = packet->payload;
+		if (!cap->analog)
+			cap->analog = g_byte_array_new();
+		g_byte_array_append(cap->analog, analog->data,
+				    analog->num_samples * g_slist_length(analog->probes) *
+				    analog->unit_bits / 8);
+		break;
+	case SR_DF_END:
+		cap->ends++;
+		cap->end_status = packet->status;
+		break;
+	}
+}
+
+/*
+ * Load a file with an input module, the way the frontend does, and keep
+ * what it sends in cap. The options are pairs of names and values,
+ * ended by NULL.
+ *
+ * Returns the result of the module's init(), nothing is loaded unless
+ * it is SR_OK.
+ */
+int srtest_input_load(const char *format_id, const char *filename,
+		      const char *const *options, struct srtest_capture *cap)
+{
+	struct sr_input_format **formats, *format = NULL;
+	struct sr_input in;
+	GVariant *gvar;
+	int i, ret;
+
+	memset(cap, 0, sizeof(*cap));
+
+	formats = sr_input_list();
+	for (i = 0; formats[i]; i++)
+		if (!strcmp(formats[i]->id, format_id))
+			format = formats[i];
+	fail_unless(format != NULL, "Input format '%s' not found.", format_id);
+
+	memset(&in, 0, sizeof(in));
+	in.format = format;
+	if (options) {
+		in.param = g_hash_table_new_full(g_str_hash, g_str_equal,
+						 g_free, g_free);
+		for (i = 0; options[i] && options[i + 1]; i += 2)
+			g_hash_table_insert(in.param, g_strdup(options[i]),
+					    g_strdup(options[i + 1]));
+	}
+
+	if ((ret = format->init(&in, filename)) == SR_OK) {
+		if (sr_config_get(in.sdi->driver, in.sdi, NULL, NULL,
+				  SR_CONF_SAMPLERATE, &gvar) == SR_OK) {
+			cap->samplerate = g_variant_get_uint64(gvar);
+			g_variant_unref(gvar);
+		}
+		if (sr_config_get(in.sdi->driver, in.sdi, NULL, NULL,
+				  SR_CONF_LIMIT_SAMPLES, &gvar) == SR_OK) {
+			cap->total_samples = g_variant_get_uint64(gvar);
+			g_variant_unref(gvar);
+		}
+		cap->num_probes = g_slist_length(in.sdi->channels);
+
+		sr_session_new();
+		sr_session_datafeed_callback_add(capture_packet, cap);
+		ret = format->loadfile(&in, filename);
+		sr_dev_close(in.sdi);
+		sr_dev_clear(in.sdi->driver);
+		sr_session_destroy();
+		fail_unless(cap->ends == 1, "%d end packets from '%s'.",
+			    cap->ends, format_id);
+	}
+
+	if (in.param)
+		g_hash_table_destroy(in.param);
+
+	return ret;
+}
+
+/* The level of a logic channel at a sample of a capture. */
+gboolean srtest_capture_level(const struct srtest_capture *cap, int order,
+			      uint64_t sample)
+{
+	const GByteArray *plane = cap->logic[order];
+
+	fail_unless(plane && sample / 8 < plane->len,
+		    "No sample %" PRIu64 " of channel %d.", sample, order);
+
+	return (plane->data[sample / 8] >> (sample % 8)) & 1;
+}
+
+void srtest_capture_free(struct srtest_capture *cap)
+{
+	int i;
+
+	for (i = 0; i < SRTEST_MAX_PROBES; i++)
+		if (cap->logic[i])
+			g_byte_array_free(cap->logic[i], TRUE);
+	if (cap->analog)
+		g_byte_array_free(cap->analog, TRUE);
+	memset(cap, 0, sizeof(*cap));
+}
@@ -31,4 +31,28 @@ uint64_t srtest_get_samplerate(struct sr_dev_driver *driver);
 void srtest_check_samplerate(struct sr_context *sr_ctx, const char *drivername,
 			     uint64_t samplerate);
 
+#define SRTEST_MAX_PROBES 256
+
+/* What an input module sent while loading a file. */
+struct srtest_capture {
+	uint64_t samplerate;
+	uint64_t total_samples;
+	int num_probes;
+	/* samples of the logic channels by order, 8 to a byte */
+	GByteArray *logic[SRTEST_MAX_PROBES];
+	/* blocks of the logic channels sent as a level, without data */
+	int const_blocks[SRTEST_MAX_PROBES];
+	/* analog samples as sent, interleaved */
+	GByteArray *analog;
+	/* SR_DF_END packets, and the status of the last one */
+	int ends;
+	int end_status;
+};
+
+int srtest_input_load(const char *format_id, const char *filename,
+		      const char *const *options, struct srtest_capture *cap);
+gboolean srtest_capture_level(const struct srtest_capture *cap, int order,
+			      uint64_t sample);
+void srtest_capture_free(struct srtest_capture *cap);
+
 #endif